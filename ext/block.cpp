@@ -53,6 +53,8 @@ void Block::Construct(Device* device, uint32_t block_id)
 	this->block_id = block_id;
 	this->dirty = false;
 	this->is_in_transit = false;
+	this->is_loading = false;
+	this->is_failed = false;
 }
 
 Block::~Block()
@@ -75,7 +77,9 @@ void Block::Refer()
 void Block::Unref()
 {
 	--reference_count;
-	if ( !device->block_limit )
+	// Blocks that failed to load are no longer found and are deleted once the
+	// threads that waited for them are done with them.
+	if ( !device->block_limit || (is_failed && !reference_count) )
 	{
 		device->block_count--;
 		delete this;
@@ -141,7 +145,7 @@ void Block::Unlink()
 {
 	(prev_block ? prev_block->next_block : device->mru_block) = next_block;
 	(next_block ? next_block->prev_block : device->lru_block) = prev_block;
-	size_t bin = block_id % DEVICE_HASH_LENGTH;
+	size_t bin = device->HashBlockId(block_id);
 	(prev_hashed ? prev_hashed->next_hashed : device->hash_blocks[bin]) = next_hashed;
 	if ( next_hashed ) next_hashed->prev_hashed = prev_hashed;
 }
@@ -155,7 +159,7 @@ void Block::Prelink()
 	device->mru_block = this;
 	if ( !device->lru_block )
 		device->lru_block = this;
-	size_t bin = block_id % DEVICE_HASH_LENGTH;
+	size_t bin = device->HashBlockId(block_id);
 	prev_hashed = NULL;
 	next_hashed = device->hash_blocks[bin];
 	device->hash_blocks[bin] = this;
@@ -88,7 +88,9 @@ uint32_t BlockGroup::AllocateBlock()
 		return errno = ENOSPC, 0;
 	size_t num_chunk_bits = filesystem->block_size * 8UL;
 	uint32_t begun_chunk = block_alloc_chunk;
-	for ( uint32_t i = 0; i < num_block_bitmap_chunks; i++ )
+	// Visit the chunk we began in twice, as the search might not have begun
+	// at the start of the chunk.
+	for ( uint32_t i = 0; i <= num_block_bitmap_chunks; i++ )
 	{
 		block_alloc_chunk = (begun_chunk + i) % num_block_bitmap_chunks;
 		bool last = block_alloc_chunk + 1 == num_block_bitmap_chunks;
@@ -135,6 +137,90 @@ uint32_t BlockGroup::AllocateBlock()
 	return errno = ENOSPC, 0;
 }
 
+// Allocate a block at the goal block if it is free, otherwise the next free
+// block, and count up to the wanted number of free blocks in a run from it.
+// Only the first block is allocated, the rest of the run is a window that the
+// caller only keeps in memory and claims a block at a time. The allocation
+// continues after the window, so other files rarely take blocks from it.
+uint32_t BlockGroup::AllocateBlocks(uint32_t goal, uint32_t wanted,
+                                    uint32_t* count)
+{
+	*count = 0;
+	size_t num_chunk_bits = filesystem->block_size * 8UL;
+	if ( goal && first_block_id <= goal && goal - first_block_id < num_blocks )
+	{
+		uint32_t goal_chunk = (goal - first_block_id) / num_chunk_bits;
+		if ( block_bitmap_chunk && block_alloc_chunk != goal_chunk )
+		{
+			block_bitmap_chunk->Unref();
+			block_bitmap_chunk = NULL;
+		}
+		block_alloc_chunk = goal_chunk;
+		if ( !block_bitmap_chunk )
+		{
+			uint32_t block_id = data->bg_block_bitmap + block_alloc_chunk;
+			if ( !(block_bitmap_chunk = filesystem->device->GetBlock(block_id)) )
+				return 0;
+		}
+		block_bitmap_chunk_i = (goal - first_block_id) % num_chunk_bits;
+	}
+	uint32_t block_id = AllocateBlock();
+	if ( !block_id )
+		return 0;
+	*count = 1;
+	// Extend the run with the following blocks in the chunk while free.
+	uint32_t chunk_offset = block_alloc_chunk * num_chunk_bits;
+	bool last = block_alloc_chunk + 1 == num_block_bitmap_chunks;
+	size_t num_bits = last ? num_blocks - chunk_offset : num_chunk_bits;
+	uint8_t* chunk_bits = block_bitmap_chunk->block_data;
+	uint32_t more = 0;
+	while ( *count + more < wanted &&
+	        more < data->bg_free_blocks_count &&
+	        block_bitmap_chunk_i + more < num_bits &&
+	        !checkbit(chunk_bits, block_bitmap_chunk_i + more) )
+		more++;
+	block_bitmap_chunk_i += more;
+	*count += more;
+	return block_id;
+}
+
+// Allocate the block if it is still free, for claiming a block in a window
+// returned by AllocateBlocks.
+bool BlockGroup::ClaimBlock(uint32_t block_id)
+{
+	if ( !filesystem->device->write )
+		return errno = EROFS, false;
+	block_id -= first_block_id;
+	size_t num_chunk_bits = filesystem->block_size * 8UL;
+	uint32_t chunk_id = block_id / num_chunk_bits;
+	uint32_t chunk_bit = block_id % num_chunk_bits;
+	if ( !block_bitmap_chunk || chunk_id != block_alloc_chunk )
+	{
+		if ( block_bitmap_chunk )
+			block_bitmap_chunk->Unref();
+		block_alloc_chunk = chunk_id;
+		uint32_t block_id = data->bg_block_bitmap + block_alloc_chunk;
+		block_bitmap_chunk = filesystem->device->GetBlock(block_id);
+		block_bitmap_chunk_i = chunk_bit + 1;
+		if ( !block_bitmap_chunk )
+			return false;
+	}
+	uint8_t* chunk_bits = block_bitmap_chunk->block_data;
+	if ( checkbit(chunk_bits, chunk_bit) )
+		return false;
+	block_bitmap_chunk->BeginWrite();
+	setbit(chunk_bits, chunk_bit);
+	block_bitmap_chunk->FinishWrite();
+	BeginWrite();
+	data->bg_free_blocks_count--;
+	FinishWrite();
+	filesystem->BeginWrite();
+	filesystem->sb->s_free_blocks_count--;
+	filesystem->FinishWrite();
+	UpdateFreeBlocks();
+	return true;
+}
+
 uint32_t BlockGroup::AllocateInode(bool is_directory)
 {
 	if ( !filesystem->device->write )
@@ -207,6 +293,9 @@ void BlockGroup::FreeBlock(uint32_t block_id)
 		uint32_t block_id = data->bg_block_bitmap + block_alloc_chunk;
 		block_bitmap_chunk = filesystem->device->GetBlock(block_id);
 		block_bitmap_chunk_i = 0;
+		// The block is leaked if its bitmap can't be read.
+		if ( !block_bitmap_chunk )
+			return;
 	}
 
 	block_bitmap_chunk->BeginWrite();
@@ -239,6 +328,9 @@ void BlockGroup::FreeInode(uint32_t inode_id, bool is_directory)
 		uint32_t block_id = data->bg_inode_bitmap + inode_alloc_chunk;
 		inode_bitmap_chunk = filesystem->device->GetBlock(block_id);
 		inode_bitmap_chunk_i = 0;
+		// The inode is leaked if its bitmap can't be read.
+		if ( !inode_bitmap_chunk )
+			return;
 	}
 
 	inode_bitmap_chunk->BeginWrite();
@@ -57,6 +57,8 @@ public:
 
 public:
 	uint32_t AllocateBlock();
+	uint32_t AllocateBlocks(uint32_t goal, uint32_t wanted, uint32_t* count);
+	bool ClaimBlock(uint32_t block_id);
 	uint32_t AllocateInode(bool is_directory);
 	void FreeBlock(uint32_t block_id);
 	void FreeInode(uint32_t inode_id, bool is_directory);
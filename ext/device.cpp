@@ -19,11 +19,15 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <assert.h>
+#include <err.h>
+#include <errno.h>
 #include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -44,10 +48,19 @@ Device::Device(int fd, const char* path, uint32_t block_size,
 	this->sync_thread_cond = PTHREAD_COND_INITIALIZER;
 	this->sync_thread_idle_cond = PTHREAD_COND_INITIALIZER;
 	this->sync_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+	this->lock = PTHREAD_MUTEX_INITIALIZER;
+	this->load_cond = PTHREAD_COND_INITIALIZER;
 	this->mru_block = NULL;
 	this->lru_block = NULL;
 	this->dirty_block = NULL;
-	for ( size_t i = 0; i < DEVICE_HASH_LENGTH; i++ )
+	// The hash table grows with the number of cached blocks up to the limit.
+	this->hash_length = DEVICE_HASH_LENGTH_MIN;
+	this->hash_length_max = DEVICE_HASH_LENGTH_MIN;
+	while ( hash_length_max < block_limit )
+		hash_length_max *= 2;
+	if ( !(this->hash_blocks = new Block*[hash_length]) )
+		err(1, "malloc");
+	for ( size_t i = 0; i < hash_length; i++ )
 		hash_blocks[i] = NULL;
 	struct stat st;
 	fstat(fd, &st);
@@ -61,6 +74,11 @@ Device::Device(int fd, const char* path, uint32_t block_size,
 	this->sync_in_transit = false;
 	this->block_count = 0;
 	this->block_limit = block_limit;
+	this->read_ahead_next = 0;
+	this->read_ahead_count = 1;
+	// The filesystem is used with the lock held, which the creating thread
+	// holds until it lets other threads use the filesystem.
+	pthread_mutex_lock(&lock);
 }
 
 Device::~Device()
@@ -77,6 +95,7 @@ Device::~Device()
 	Sync();
 	while ( mru_block )
 		delete mru_block;
+	delete[] hash_blocks;
 	close(fd);
 }
 
@@ -108,21 +127,125 @@ Block* Device::AllocateBlock()
 		return delete[] data, (Block*) NULL;
 	block->block_data = data;
 	block_count++;
+	if ( hash_length < block_count && hash_length < hash_length_max )
+		GrowHashTable();
 	return block;
 }
 
+void Device::GrowHashTable()
+{
+	size_t new_length = 2 * hash_length;
+	Block** new_hash_blocks = new Block*[new_length];
+	if ( !new_hash_blocks ) // TODO: Use operator new nothrow!
+		return;
+	for ( size_t i = 0; i < new_length; i++ )
+		new_hash_blocks[i] = NULL;
+	delete[] hash_blocks;
+	hash_blocks = new_hash_blocks;
+	hash_length = new_length;
+	// All the blocks in the hash table are also in the MRU list.
+	for ( Block* block = mru_block; block; block = block->next_block )
+	{
+		size_t bin = HashBlockId(block->block_id);
+		block->prev_hashed = NULL;
+		block->next_hashed = hash_blocks[bin];
+		if ( block->next_hashed )
+			block->next_hashed->prev_hashed = block;
+		hash_blocks[bin] = block;
+	}
+}
+
 Block* Device::GetBlock(uint32_t block_id)
 {
-	if ( Block* block = GetCachedBlock(block_id) )
-		return block;
-	Block* block = AllocateBlock();
-	if ( !block )
+	if ( FindBlock(block_id) )
+		return GetCachedBlock(block_id);
+
+	// Read more of the following blocks at once each time the blocks are
+	// read sequentially, but don't take too much of the cache.
+	size_t count = 1;
+	if ( block_limit && block_id == read_ahead_next )
+	{
+		count = 2 * read_ahead_count;
+		if ( DEVICE_READ_AHEAD_MAX < count )
+			count = DEVICE_READ_AHEAD_MAX;
+		if ( block_limit / 4 < count )
+			count = block_limit / 4 ? block_limit / 4 : 1;
+	}
+
+	Block* blocks[DEVICE_READ_AHEAD_MAX];
+	struct iovec iov[DEVICE_READ_AHEAD_MAX];
+	size_t got = 0;
+	while ( got < count )
+	{
+		uint32_t id = block_id + got;
+		if ( got )
+		{
+			// Stop at the end of the device or the first cached block.
+			if ( id < block_id ||
+			     device_size < (off_t) block_size * ((off_t) id + 1) )
+				break;
+			if ( FindBlock(id) )
+				break;
+		}
+		Block* block = AllocateBlock();
+		if ( !block )
+			break;
+		block->Construct(this, id);
+		block->is_loading = true;
+		block->Prelink();
+		blocks[got] = block;
+		iov[got].iov_base = block->block_data;
+		iov[got].iov_len = block_size;
+		got++;
+	}
+	if ( !got )
 		return NULL;
-	block->Construct(this, block_id);
+
+	// Let other threads use the cache while reading, where threads wanting
+	// these blocks wait for them to be loaded.
+	pthread_mutex_unlock(&lock);
+
 	off_t file_offset = (off_t) block_size * (off_t) block_id;
-	preadall(fd, block->block_data, block_size, file_offset);
-	block->Prelink();
-	return block;
+	size_t total = got * block_size;
+	size_t done = 0;
+	int iov_index = 0;
+	while ( done < total )
+	{
+		ssize_t amount = preadv(fd, iov + iov_index, got - iov_index,
+		                        file_offset + done);
+		if ( amount <= 0 )
+			break;
+		done += amount;
+		while ( (size_t) iov_index < got &&
+		        iov[iov_index].iov_len <= (size_t) amount )
+			amount -= iov[iov_index++].iov_len;
+		if ( (size_t) iov_index < got )
+		{
+			iov[iov_index].iov_base = (uint8_t*) iov[iov_index].iov_base + amount;
+			iov[iov_index].iov_len -= amount;
+		}
+	}
+
+	// Blocks that weren't read entirely fail for the threads waiting for them,
+	// and later lookups read them again.
+	pthread_mutex_lock(&lock);
+	size_t loaded = done / block_size;
+	for ( size_t i = 0; i < got; i++ )
+	{
+		blocks[i]->is_loading = false;
+		blocks[i]->is_failed = loaded <= i;
+	}
+	pthread_cond_broadcast(&load_cond);
+	for ( size_t i = 1; i < got; i++ )
+		blocks[i]->Unref();
+	if ( !loaded )
+	{
+		blocks[0]->Unref();
+		return errno = EIO, (Block*) NULL;
+	}
+	read_ahead_next = block_id + loaded;
+	read_ahead_count = loaded;
+	return blocks[0];
 }
 
 Block* Device::GetBlockZeroed(uint32_t block_id)
@@ -146,12 +269,43 @@ Block* Device::GetBlockZeroed(uint32_t block_id)
 	return block;
 }
 
+// Get a block filled with zeroes that doesn't belong to the device, for reading
+// the unallocated parts of files when the filesystem can't be written to.
+Block* Device::GetZeroBlock()
+{
+	if ( Block* block = GetCachedBlock(DEVICE_ZERO_BLOCK_ID) )
+		return block;
+	Block* block = AllocateBlock();
+	if ( !block )
+		return NULL;
+	block->Construct(this, DEVICE_ZERO_BLOCK_ID);
+	memset(block->block_data, 0, block_size);
+	block->Prelink();
+	return block;
+}
+
 Block* Device::GetCachedBlock(uint32_t block_id)
 {
-	size_t bin = block_id % DEVICE_HASH_LENGTH;
+	Block* block = FindBlock(block_id);
+	if ( !block )
+		return NULL;
+	block->Refer();
+	while ( block->is_loading )
+		pthread_cond_wait(&load_cond, &lock);
+	if ( block->is_failed )
+	{
+		block->Unref();
+		return errno = EIO, (Block*) NULL;
+	}
+	return block;
+}
+
+Block* Device::FindBlock(uint32_t block_id)
+{
+	size_t bin = HashBlockId(block_id);
 	for ( Block* iter = hash_blocks[bin]; iter; iter = iter->next_hashed )
-		if ( iter->block_id == block_id )
-			return iter->Refer(), iter;
+		if ( iter->block_id == block_id && !iter->is_failed )
+			return iter;
 	return NULL;
 }
 
@@ -172,9 +326,27 @@ void Device::Sync()
 	fsync(fd);
 }
 
+static int CompareBlockId(const void* a_ptr, const void* b_ptr)
+{
+	const Block* a = *(const Block* const*) a_ptr;
+	const Block* b = *(const Block* const*) b_ptr;
+	if ( a->block_id < b->block_id )
+		return -1;
+	if ( a->block_id > b->block_id )
+		return 1;
+	return 0;
+}
+
 void Device::SyncThread()
 {
-	uint8_t transit_block_data[block_size];
+	size_t batch_max = DEVICE_SYNC_BATCH_BYTES / block_size;
+	if ( !batch_max )
+		batch_max = 1;
+	Block** batch = new Block*[batch_max];
+	uint8_t* transit_data = new uint8_t[batch_max * block_size];
+	if ( !batch || !transit_data ) // TODO: Use operator new nothrow!
+		err(1, "malloc");
+
 	pthread_mutex_lock(&sync_thread_lock);
 	while ( true )
 	{
@@ -183,32 +355,57 @@ void Device::SyncThread()
 		if ( sync_thread_should_exit )
 			break;
 
-		Block* block = dirty_block;
-
-		if ( block->next_dirty )
-			block->next_dirty->prev_dirty = NULL;
-		dirty_block = block->next_dirty;
-		block->next_dirty = NULL;
-
-		block->dirty = false;
-		block->is_in_transit = true;
+		// Take a batch of the dirty blocks, which can't be destroyed while
+		// they are in transit.
+		size_t count = 0;
+		while ( dirty_block && count < batch_max )
+		{
+			Block* block = dirty_block;
+			if ( block->next_dirty )
+				block->next_dirty->prev_dirty = NULL;
+			dirty_block = block->next_dirty;
+			block->next_dirty = NULL;
+			block->dirty = false;
+			block->is_in_transit = true;
+			batch[count++] = block;
+		}
 		sync_in_transit = true;
 
 		pthread_mutex_unlock(&sync_thread_lock);
 
-		pthread_mutex_lock(&block->modify_lock);
-		memcpy(transit_block_data, block->block_data, block_size);
-		pthread_mutex_unlock(&block->modify_lock);
-
-		off_t offset = (off_t) block_size * (off_t) block->block_id;
-		pwriteall(fd, transit_block_data, block_size, offset);
+		// Write each run of adjacent blocks with a single write.
+		qsort(batch, count, sizeof(Block*), CompareBlockId);
+		for ( size_t i = 0; i < count; )
+		{
+			size_t run = 1;
+			while ( i + run < count &&
+			        batch[i + run]->block_id == batch[i]->block_id + run )
+				run++;
+			for ( size_t n = 0; n < run; n++ )
+			{
+				Block* block = batch[i + n];
+				pthread_mutex_lock(&block->modify_lock);
+				memcpy(transit_data + n * block_size, block->block_data,
+				       block_size);
+				pthread_mutex_unlock(&block->modify_lock);
+			}
+			off_t offset = (off_t) block_size * (off_t) batch[i]->block_id;
+			pwriteall(fd, transit_data, run * block_size, offset);
+			i += run;
+		}
 
 		pthread_mutex_lock(&sync_thread_lock);
-		block->is_in_transit = false;
+		for ( size_t i = 0; i < count; i++ )
+		{
+			batch[i]->is_in_transit = false;
+			pthread_cond_signal(&batch[i]->transit_done_cond);
+		}
 		sync_in_transit = false;
-		pthread_cond_signal(&block->transit_done_cond);
 		if ( !dirty_block )
 			pthread_cond_signal(&sync_thread_idle_cond);
 	}
 	pthread_mutex_unlock(&sync_thread_lock);
+
+	delete[] transit_data;
+	delete[] batch;
 }
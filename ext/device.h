@@ -22,7 +22,12 @@
 
 class Block;
 
-static const size_t DEVICE_HASH_LENGTH = 1 << 16;
+static const size_t DEVICE_HASH_LENGTH_MIN = 1 << 10;
+static const size_t DEVICE_READ_AHEAD_MAX = 32;
+static const size_t DEVICE_SYNC_BATCH_BYTES = 1 << 20;
+// Block numbers are less than the number of blocks, so the last block number is
+// never used and the cache uses it for the zero block.
+static const uint32_t DEVICE_ZERO_BLOCK_ID = UINT32_MAX;
 
 class Device
 {
@@ -36,10 +41,14 @@ public:
 	pthread_cond_t sync_thread_cond;
 	pthread_cond_t sync_thread_idle_cond;
 	pthread_mutex_t sync_thread_lock;
+	pthread_mutex_t lock;
+	pthread_cond_t load_cond;
 	Block* mru_block;
 	Block* lru_block;
 	Block* dirty_block;
-	Block* hash_blocks[DEVICE_HASH_LENGTH];
+	Block** hash_blocks;
+	size_t hash_length;
+	size_t hash_length_max;
 	off_t device_size;
 	const char* path;
 	uint32_t block_size;
@@ -50,13 +59,19 @@ public:
 	bool sync_in_transit;
 	size_t block_count;
 	size_t block_limit;
+	uint32_t read_ahead_next;
+	size_t read_ahead_count;
 
 public:
 	void SpawnSyncThread();
 	Block* AllocateBlock();
 	Block* GetBlock(uint32_t block_id);
 	Block* GetBlockZeroed(uint32_t block_id);
+	Block* GetZeroBlock();
 	Block* GetCachedBlock(uint32_t block_id);
+	Block* FindBlock(uint32_t block_id);
+	size_t HashBlockId(uint32_t block_id) { return block_id & (hash_length - 1); }
+	void GrowHashTable();
 	void Sync();
 	void SyncThread();
 
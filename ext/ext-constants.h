@@ -48,6 +48,7 @@ static const uint32_t EXT2_FEATURE_INCOMPAT_FILETYPE = 1U << 1U;
 static const uint32_t EXT2_FEATURE_INCOMPAT_RECOVER = 1U << 2U;
 static const uint32_t EXT2_FEATURE_INCOMPAT_JOURNAL_DEV = 1U << 3U;
 static const uint32_t EXT2_FEATURE_INCOMPAT_META_BG = 1U << 4U;
+static const uint32_t EXT4_FEATURE_INCOMPAT_EXTENTS = 1U << 6U;
 static const uint32_t EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER = 1U << 0U;
 static const uint32_t EXT2_FEATURE_RO_COMPAT_LARGE_FILE = 1U << 1U;
 static const uint32_t EXT2_FEATURE_RO_COMPAT_BTREE_DIR = 1U << 2U;
@@ -99,8 +100,12 @@ static const uint32_t EXT2_BTREE_FL = 0x00001000U;
 static const uint32_t EXT2_INDEX_FL = 0x00001000U;
 static const uint32_t EXT2_IMAGIC_FL = 0x00002000U;
 static const uint32_t EXT3_JOURNAL_DATA_FL = 0x00004000U;
+static const uint32_t EXT4_EXTENTS_FL = 0x00080000U;
 static const uint32_t EXT2_RESERVED_FL = 0x80000000U;
 static const uint32_t EXT2_ROOT_INO = 2;
+static const uint16_t EXT4_EXT_MAGIC = 0xF30A;
+static const uint16_t EXT4_EXT_INIT_MAX_LEN = 32768;
+static const uint16_t EXT4_EXT_MAX_DEPTH = 5;
 static const uint8_t EXT2_FT_UNKNOWN = 0;
 static const uint8_t EXT2_FT_REG_FILE = 1;
 static const uint8_t EXT2_FT_DIR = 2;
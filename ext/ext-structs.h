@@ -116,6 +116,31 @@ struct ext_inode
 	uint32_t i_osd2_alignment0;
 };
 
+struct ext_extent_header
+{
+	uint16_t eh_magic;
+	uint16_t eh_entries;
+	uint16_t eh_max;
+	uint16_t eh_depth;
+	uint32_t eh_generation;
+};
+
+struct ext_extent_idx
+{
+	uint32_t ei_block;
+	uint32_t ei_leaf_lo;
+	uint16_t ei_leaf_hi;
+	uint16_t ei_unused;
+};
+
+struct ext_extent
+{
+	uint32_t ee_block;
+	uint16_t ee_len;
+	uint16_t ee_start_hi;
+	uint32_t ee_start_lo;
+};
+
 struct ext_dirent
 {
 	uint32_t inode;
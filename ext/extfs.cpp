@@ -54,12 +54,13 @@
 // These must be kept up to date with libmount/ext2.c.
 static const uint32_t EXT2_FEATURE_COMPAT_SUPPORTED = 0;
 static const uint32_t EXT2_FEATURE_INCOMPAT_SUPPORTED = \
-                      EXT2_FEATURE_INCOMPAT_FILETYPE;
+                      EXT2_FEATURE_INCOMPAT_FILETYPE | \
+                      EXT4_FEATURE_INCOMPAT_EXTENTS;
 static const uint32_t EXT2_FEATURE_RO_COMPAT_SUPPORTED = \
                       EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
 
-uid_t request_uid;
-uid_t request_gid;
+__thread uid_t request_uid;
+__thread uid_t request_gid;
 
 mode_t HostModeFromExtMode(uint32_t extmode)
 {
@@ -217,7 +218,8 @@ int main(int argc, char* argv[])
 	if ( !pretend_mount_path )
 		pretend_mount_path = mount_path;
 
-	int fd = open(device_path, write ? O_RDWR : O_RDONLY);
+	// The blocks are whole and aligned, so let the disk transfer them directly.
+	int fd = open(device_path, (write ? O_RDWR : O_RDONLY) | O_DIRECT);
 	if ( fd < 0 )
 		err(1, "%s", device_path);
 
@@ -244,7 +246,7 @@ int main(int argc, char* argv[])
 		     device_path, sb.s_rev_level);
 
 	// Verify that no incompatible features are in use.
-	if ( sb.s_feature_compat & ~EXT2_FEATURE_INCOMPAT_SUPPORTED )
+	if ( sb.s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPPORTED )
 		errx(1, "%s: Uses unsupported and incompatible features", device_path);
 
 	if ( write && sb.s_feature_ro_compat & ~EXT2_FEATURE_RO_COMPAT_SUPPORTED )
@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -39,6 +40,10 @@
 
 Filesystem::Filesystem(Device* device, const char* mount_path)
 {
+	this->tree_lock = PTHREAD_RWLOCK_INITIALIZER;
+	this->write_lock = PTHREAD_MUTEX_INITIALIZER;
+	for ( size_t i = 0; i < INODE_LOCK_COUNT; i++ )
+		this->inode_locks[i] = PTHREAD_RWLOCK_INITIALIZER;
 	uint64_t sb_offset = 1024;
 	uint32_t sb_block_id = sb_offset / device->block_size;
 	this->sb_block = device->GetBlock(sb_block_id);
@@ -187,6 +192,10 @@ BlockGroup* Filesystem::GetBlockGroup(uint32_t group_id)
 	Block* block = device->GetBlock(block_id);
 	if ( !block )
 		return (BlockGroup*) NULL;
+	// Another thread may have loaded the group while the block was read.
+	if ( block_groups[group_id] )
+		return block->Unref(), block_groups[group_id]->Refer(),
+		       block_groups[group_id];
 	BlockGroup* group = new BlockGroup(this, group_id);
 	if ( !group ) // TODO: Use operator new nothrow!
 		return block->Unref(), (BlockGroup*) NULL;
@@ -228,6 +237,10 @@ Inode* Filesystem::GetInode(uint32_t inode_id)
 	Block* block = device->GetBlock(block_id);
 	if ( !block )
 		return (Inode*) NULL;
+	// Another thread may have loaded the inode while the block was read.
+	for ( Inode* iter = hash_inodes[bin]; iter; iter = iter->next_hashed )
+		if ( iter->inode_id == inode_id )
+			return block->Unref(), iter->Refer(), iter->Use(), iter;
 	Inode* inode = new Inode(this, inode_id);
 	if ( !inode )
 		return block->Unref(), (Inode*) NULL;
@@ -241,23 +254,50 @@ Inode* Filesystem::GetInode(uint32_t inode_id)
 
 uint32_t Filesystem::AllocateBlock(BlockGroup* preferred)
 {
+	uint32_t count;
+	return AllocateBlocks(preferred, 0, 1, &count);
+}
+
+// Allocate a block, preferably at the goal block (if not zero), and count up to
+// the wanted number of free blocks in a run from it, so files can be laid out
+// contiguously on the disk. Only the first block is allocated and the rest of
+// the run can be claimed later with ClaimBlock if still free.
+uint32_t Filesystem::AllocateBlocks(BlockGroup* preferred, uint32_t goal,
+                                    uint32_t wanted, uint32_t* count)
+{
+	*count = 0;
 	if ( !device->write )
 		return errno = EROFS, 0;
 	// Fail if the filesystem is out of blocks.
 	if ( !sb->s_free_blocks_count )
 		return errno = ENOSPC, 0;
+	// Try to continue where the goal is.
+	if ( goal && sb->s_first_data_block <= goal && goal < num_blocks )
+	{
+		uint32_t group_id = (goal - sb->s_first_data_block) /
+		                    sb->s_blocks_per_group;
+		if ( BlockGroup* group = GetBlockGroup(group_id) )
+		{
+			uint32_t block_id = group->AllocateBlocks(goal, wanted, count);
+			group->Unref();
+			if ( block_id )
+				return block_id;
+		}
+	}
 	// Use the preferred block group if it has space.
 	if ( preferred )
-		if ( uint32_t block_id = preferred->AllocateBlock() )
+		if ( uint32_t block_id = preferred->AllocateBlocks(0, wanted, count) )
 			return block_id;
 	// Allocate in constant time using a block group that we know has space.
 	if ( first_free_blocks_bg )
-		if ( uint32_t block_id = first_free_blocks_bg->AllocateBlock() )
+		if ( uint32_t block_id =
+		         first_free_blocks_bg->AllocateBlocks(0, wanted, count) )
 			return block_id;
 	// No block groups in memory has space. Read some more.
 	for ( ; initialized_groups < num_groups; initialized_groups++ )
 		if ( uint32_t block_id =
-		         GetBlockGroup(initialized_groups)->AllocateBlock() )
+		         GetBlockGroup(initialized_groups)->AllocateBlocks(0, wanted,
+		                                                           count) )
 			return block_id;
 	// We unexpected ran out of blocks, even though the superblock said there
 	// were available blocks. This case means the filesystem was inconsistent.
@@ -302,6 +342,22 @@ uint32_t Filesystem::AllocateInode(bool is_directory, BlockGroup* preferred)
 	return errno = ENOSPC, 0;
 }
 
+bool Filesystem::ClaimBlock(uint32_t block_id)
+{
+	if ( !device->write )
+		return errno = EROFS, false;
+	assert(block_id);
+	assert(block_id < num_blocks);
+	uint32_t group_id = (block_id - sb->s_first_data_block) / sb->s_blocks_per_group;
+	assert(group_id < num_groups);
+	BlockGroup* group = GetBlockGroup(group_id);
+	if ( !group )
+		return false;
+	bool claimed = group->ClaimBlock(block_id);
+	group->Unref();
+	return claimed;
+}
+
 void Filesystem::FreeBlock(uint32_t block_id)
 {
 	assert(device->write);
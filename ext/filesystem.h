@@ -25,6 +25,7 @@ class Device;
 class Inode;
 
 static const size_t INODE_HASH_LENGTH = 1 << 16;
+static const size_t INODE_LOCK_COUNT = 64;
 
 class Filesystem
 {
@@ -33,6 +34,14 @@ public:
 	~Filesystem();
 
 public:
+	// Requests that change the directory tree hold the tree lock exclusively,
+	// while other requests share it. Requests that modify a single inode are
+	// serialized by the write lock and hold the lock of that inode exclusively,
+	// while requests that read an inode share its lock. These locks are taken
+	// before the device lock.
+	pthread_rwlock_t tree_lock;
+	pthread_mutex_t write_lock;
+	pthread_rwlock_t inode_locks[INODE_LOCK_COUNT];
 	Block* sb_block;
 	struct ext_superblock* sb;
 	Device* device;
@@ -65,8 +74,13 @@ public:
 	void Corrupted();
 	BlockGroup* GetBlockGroup(uint32_t group_id);
 	Inode* GetInode(uint32_t inode_id);
+	pthread_rwlock_t* InodeLock(uint32_t inode_id)
+	{ return &inode_locks[inode_id % INODE_LOCK_COUNT]; }
 	uint32_t AllocateBlock(BlockGroup* preferred = NULL);
+	uint32_t AllocateBlocks(BlockGroup* preferred, uint32_t goal,
+	                        uint32_t wanted, uint32_t* count);
 	uint32_t AllocateInode(bool is_directory, BlockGroup* preferred = NULL);
+	bool ClaimBlock(uint32_t block_id);
 	void FreeBlock(uint32_t block_id);
 	void FreeInode(uint32_t inode_id, bool is_directory);
 	void BeginWrite();
@@ -66,15 +66,19 @@ Inode::Inode(Filesystem* filesystem, uint32_t inode_id)
 	this->reference_count = 1;
 	this->remote_reference_count = 0;
 	this->inode_id = inode_id;
+	this->prealloc_block = 0;
+	this->prealloc_count = 0;
 	this->dirty = false;
 }
 
 Inode::~Inode()
 {
+	// Other threads can't find the inode once it's unlinked from the cache.
+	Unlink();
+	ReleasePreallocation();
 	Sync();
 	if ( data_block )
 		data_block->Unref();
-	Unlink();
 }
 
 uint32_t Inode::Mode()
@@ -162,7 +166,9 @@ void Inode::SetSize(uint64_t new_size)
 		actual_blocks += divup(logical_blocks - max_doubly, ENTRIES * ENTRIES * ENTRIES);
 
 	BeginWrite();
-	data->i_blocks = (actual_blocks * filesystem->block_size) / 512;
+	// The blocks of files with extents are counted as they are allocated.
+	if ( !(data->i_flags & EXT4_EXTENTS_FL) )
+		data->i_blocks = (actual_blocks * filesystem->block_size) / 512;
 	if ( EXT2_S_ISREG(data->i_mode) && largefile )
 		data->i_dir_acl = upper;
 	FinishWrite();
@@ -170,18 +176,83 @@ void Inode::SetSize(uint64_t new_size)
 	Modified();
 }
 
-Block* Inode::GetBlockFromTable(Block* table, uint32_t index)
+uint32_t Inode::AllocateBlock(uint32_t goal)
+{
+	// Take the next block in the preallocation window, otherwise allocate a
+	// new window continuing at the goal if possible, so the blocks of growing
+	// files are laid out contiguously even if several files grow at once. The
+	// window is only kept in memory and is dropped if another file took the
+	// next block in it.
+	uint32_t block_id = 0;
+	if ( prealloc_count )
+	{
+		if ( filesystem->ClaimBlock(prealloc_block) )
+		{
+			block_id = prealloc_block++;
+			prealloc_count--;
+		}
+		else
+			prealloc_count = 0;
+	}
+	if ( !block_id )
+	{
+		uint32_t group_id = (inode_id - 1) / filesystem->sb->s_inodes_per_group;
+		assert(group_id < filesystem->num_groups);
+		BlockGroup* block_group = filesystem->GetBlockGroup(group_id);
+		if ( !block_group )
+			return 0;
+		uint32_t wanted = EXT2_S_ISREG(Mode()) ? INODE_PREALLOC_BLOCKS : 1;
+		uint32_t count;
+		block_id = filesystem->AllocateBlocks(block_group, goal, wanted, &count);
+		block_group->Unref();
+		if ( !block_id )
+			return 0;
+		prealloc_block = block_id + 1;
+		prealloc_count = count - 1;
+	}
+	if ( data->i_flags & EXT4_EXTENTS_FL )
+	{
+		BeginWrite();
+		data->i_blocks += filesystem->block_size / 512;
+		FinishWrite();
+	}
+	return block_id;
+}
+
+void Inode::FreeBlocks(uint32_t block_id, uint32_t count)
 {
-	if ( uint32_t block_id = ((uint32_t*) table->block_data)[index] )
+	for ( uint32_t i = 0; i < count; i++ )
+		filesystem->FreeBlock(block_id + i);
+	if ( data->i_flags & EXT4_EXTENTS_FL )
+	{
+		BeginWrite();
+		data->i_blocks -= count * (filesystem->block_size / 512);
+		FinishWrite();
+	}
+}
+
+void Inode::ReleasePreallocation()
+{
+	// The blocks in the window aren't allocated until they're claimed.
+	prealloc_count = 0;
+}
+
+Block* Inode::GetBlockFromTable(Block* table, uint32_t index, bool allocate)
+{
+	uint32_t* entries = (uint32_t*) table->block_data;
+	if ( uint32_t block_id = entries[index] )
 		return filesystem->device->GetBlock(block_id);
-	// TODO: If in read only mode, then perhaps return a zero block here.
+	// Holes read as zeroes and are only allocated when written to, as readers
+	// don't hold the locks needed to change the file.
+	if ( !allocate )
+		return filesystem->device->GetZeroBlock();
 	if ( !filesystem->device->write )
-		return NULL;
-	uint32_t group_id = (inode_id - 1) / filesystem->sb->s_inodes_per_group;
-	assert(group_id < filesystem->num_groups);
-	BlockGroup* block_group = filesystem->GetBlockGroup(group_id);
-	uint32_t block_id = filesystem->AllocateBlock(block_group);
-	block_group->Unref();
+		return errno = EROFS, (Block*) NULL;
+	// Continue after the previous block in the table, if any.
+	uint32_t* first = table == data_block ? data->i_block : entries;
+	uint32_t goal = first < &entries[index] && entries[index - 1] ?
+	                entries[index - 1] + 1 : 0;
+	uint32_t block_id = AllocateBlock(goal);
 	if ( block_id )
 	{
 		Block* block = filesystem->device->GetBlockZeroed(block_id);
@@ -193,8 +264,434 @@ Block* Inode::GetBlockFromTable(Block* table, uint32_t index)
 	return NULL;
 }
 
-Block* Inode::GetBlock(uint64_t offset)
+// Both kinds of extent tree entries begin with the first logical block they
+// map, which is the key the entries are sorted by.
+static uint32_t ExtentKey(uint8_t* node, uint16_t i)
+{
+	uint8_t* entries = node + sizeof(struct ext_extent_header);
+	return ((struct ext_extent*) entries)[i].ee_block;
+}
+
+bool Inode::IsExtentNodeValid(uint8_t* node, uint16_t depth)
+{
+	bool is_root = node == (uint8_t*) data->i_block;
+	size_t node_size = is_root ? sizeof(data->i_block) : filesystem->block_size;
+	size_t capacity = (node_size - sizeof(struct ext_extent_header)) /
+	                  sizeof(struct ext_extent);
+	struct ext_extent_header* header = (struct ext_extent_header*) node;
+	return header->eh_magic == EXT4_EXT_MAGIC &&
+	       header->eh_entries <= header->eh_max &&
+	       header->eh_max <= capacity &&
+	       header->eh_depth == depth &&
+	       depth <= EXT4_EXT_MAX_DEPTH &&
+	       (is_root || header->eh_entries);
+}
+
+void Inode::InitializeExtents()
+{
+	if ( !(filesystem->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_EXTENTS) )
+		return;
+	BeginWrite();
+	data->i_flags |= EXT4_EXTENTS_FL;
+	struct ext_extent_header* header = (struct ext_extent_header*) data->i_block;
+	memset(data->i_block, 0, sizeof(data->i_block));
+	header->eh_magic = EXT4_EXT_MAGIC;
+	header->eh_entries = 0;
+	header->eh_max = (sizeof(data->i_block) - sizeof(*header)) /
+	                 sizeof(struct ext_extent);
+	header->eh_depth = 0;
+	FinishWrite();
+}
+
+Block* Inode::GetBlockFromExtents(uint32_t logical, bool allocate)
+{
+	Block* node_block = data_block;
+	node_block->Refer();
+	uint8_t* node = (uint8_t*) data->i_block;
+	struct ext_extent_header* header = (struct ext_extent_header*) node;
+	uint16_t depth = header->eh_depth;
+	// Count how many nodes on the path would need to be split by an insert.
+	uint32_t full_nodes = 0;
+	while ( true )
+	{
+		if ( !IsExtentNodeValid(node, depth) )
+			return node_block->Unref(), filesystem->Corrupted(),
+			       errno = EIO, (Block*) NULL;
+		header = (struct ext_extent_header*) node;
+		if ( header->eh_entries == header->eh_max )
+			full_nodes++;
+		else
+			full_nodes = 0;
+		if ( !depth )
+			break;
+		struct ext_extent_idx* indexes = (struct ext_extent_idx*) (header + 1);
+		uint16_t i = 0;
+		while ( i + 1 < header->eh_entries && indexes[i + 1].ei_block <= logical )
+			i++;
+		if ( indexes[i].ei_leaf_hi ||
+		     filesystem->num_blocks <= indexes[i].ei_leaf_lo )
+			return node_block->Unref(), filesystem->Corrupted(),
+			       errno = EIO, (Block*) NULL;
+		Block* child = filesystem->device->GetBlock(indexes[i].ei_leaf_lo);
+		node_block->Unref();
+		if ( !child )
+			return NULL;
+		node_block = child;
+		node = child->block_data;
+		depth--;
+	}
+
+	struct ext_extent* extents = (struct ext_extent*) (header + 1);
+	uint32_t goal = 0;
+	for ( uint16_t i = header->eh_entries; i; i-- )
+	{
+		struct ext_extent* extent = &extents[i - 1];
+		if ( logical < extent->ee_block )
+			continue;
+		bool uninit = EXT4_EXT_INIT_MAX_LEN < extent->ee_len;
+		uint32_t length = uninit ? extent->ee_len - EXT4_EXT_INIT_MAX_LEN :
+		                           extent->ee_len;
+		if ( !length || extent->ee_start_hi ||
+		     filesystem->num_blocks < extent->ee_start_lo ||
+		     filesystem->num_blocks - extent->ee_start_lo < length )
+			return node_block->Unref(), filesystem->Corrupted(),
+			       errno = EIO, (Block*) NULL;
+		uint32_t physical = extent->ee_start_lo + (logical - extent->ee_block);
+		// Continue the previous extent if the logical block isn't mapped.
+		if ( length <= logical - extent->ee_block )
+		{
+			goal = physical;
+			break;
+		}
+		if ( uninit )
+		{
+			// Unwritten blocks read as zeroes and are only zeroed on the disk
+			// when written to.
+			if ( !allocate )
+			{
+				node_block->Unref();
+				return filesystem->device->GetZeroBlock();
+			}
+			if ( !filesystem->device->write )
+			{
+				node_block->Unref();
+				return errno = EROFS, (Block*) NULL;
+			}
+			// Unwritten blocks aren't tracked individually, so zero the whole
+			// extent and mark it as written.
+			for ( uint32_t n = 0; n < length; n++ )
+			{
+				uint32_t block_id = extent->ee_start_lo + n;
+				Block* block = filesystem->device->GetBlockZeroed(block_id);
+				if ( !block )
+				{
+					node_block->Unref();
+					return NULL;
+				}
+				block->Unref();
+			}
+			node_block->BeginWrite();
+			extent->ee_len = length;
+			if ( node_block == data_block )
+				FinishWrite();
+			else
+				node_block->FinishWrite();
+		}
+		node_block->Unref();
+		return filesystem->device->GetBlock(physical);
+	}
+	node_block->Unref();
+
+	// Holes read as zeroes and are only allocated when written to.
+	if ( !allocate )
+		return filesystem->device->GetZeroBlock();
+	if ( !filesystem->device->write )
+		return errno = EROFS, (Block*) NULL;
+	uint32_t block_id = AllocateBlock(goal);
+	if ( !block_id )
+		return NULL;
+	// Fail before changing the tree if it can't grow to map the new block.
+	if ( filesystem->sb->s_free_blocks_count < full_nodes )
+		return FreeBlocks(block_id, 1), errno = ENOSPC, (Block*) NULL;
+	Block* block = filesystem->device->GetBlockZeroed(block_id);
+	if ( !block )
+		return FreeBlocks(block_id, 1), (Block*) NULL;
+	uint32_t split_key, split_block;
+	if ( !InsertExtent(data_block, (uint8_t*) data->i_block, logical, block_id,
+	                   &split_key, &split_block) )
+	{
+		block->Unref();
+		FreeBlocks(block_id, 1);
+		return NULL;
+	}
+	return block;
+}
+
+bool Inode::InsertExtent(Block* node_block, uint8_t* node, uint32_t logical,
+                         uint32_t physical, uint32_t* split_key,
+                         uint32_t* split_block)
 {
+	*split_block = 0;
+	struct ext_extent_header* header = (struct ext_extent_header*) node;
+	if ( header->eh_depth )
+	{
+		struct ext_extent_idx* indexes = (struct ext_extent_idx*) (header + 1);
+		uint16_t i = 0;
+		while ( i + 1 < header->eh_entries && indexes[i + 1].ei_block <= logical )
+			i++;
+		// The first subtree covers everything before the following subtree.
+		if ( logical < indexes[i].ei_block )
+		{
+			node_block->BeginWrite();
+			indexes[i].ei_block = logical;
+			if ( node_block == data_block )
+				FinishWrite();
+			else
+				node_block->FinishWrite();
+		}
+		Block* child = filesystem->device->GetBlock(indexes[i].ei_leaf_lo);
+		if ( !child )
+			return false;
+		if ( !IsExtentNodeValid(child->block_data, header->eh_depth - 1) )
+		{
+			child->Unref();
+			filesystem->Corrupted();
+			return errno = EIO, false;
+		}
+		uint32_t child_key, child_block;
+		bool success = InsertExtent(child, child->block_data, logical, physical,
+		                            &child_key, &child_block);
+		child->Unref();
+		if ( !success )
+			return false;
+		if ( !child_block )
+			return true;
+		struct ext_extent_idx index;
+		memset(&index, 0, sizeof(index));
+		index.ei_block = child_key;
+		index.ei_leaf_lo = child_block;
+		return AddExtentEntry(node_block, node, i + 1, &index, split_key,
+		                      split_block);
+	}
+
+	struct ext_extent* extents = (struct ext_extent*) (header + 1);
+	uint16_t position = 0;
+	while ( position < header->eh_entries &&
+	        extents[position].ee_block <= logical )
+		position++;
+	// Grow the neighboring extents if the new block is contiguous with them.
+	struct ext_extent* prev = position ? &extents[position - 1] : NULL;
+	struct ext_extent* next =
+		position < header->eh_entries ? &extents[position] : NULL;
+	if ( prev && prev->ee_len < EXT4_EXT_INIT_MAX_LEN &&
+	     prev->ee_block + prev->ee_len == logical &&
+	     prev->ee_start_lo + prev->ee_len == physical )
+	{
+		node_block->BeginWrite();
+		prev->ee_len++;
+	}
+	else if ( next && next->ee_len < EXT4_EXT_INIT_MAX_LEN &&
+	          logical + 1 == next->ee_block &&
+	          physical + 1 == next->ee_start_lo )
+	{
+		node_block->BeginWrite();
+		next->ee_block--;
+		next->ee_start_lo--;
+		next->ee_len++;
+	}
+	else
+	{
+		struct ext_extent extent;
+		memset(&extent, 0, sizeof(extent));
+		extent.ee_block = logical;
+		extent.ee_len = 1;
+		extent.ee_start_lo = physical;
+		return AddExtentEntry(node_block, node, position, &extent, split_key,
+		                      split_block);
+	}
+	if ( node_block == data_block )
+		FinishWrite();
+	else
+		node_block->FinishWrite();
+	return true;
+}
+
+bool Inode::AddExtentEntry(Block* node_block, uint8_t* node, uint16_t position,
+                           const void* entry, uint32_t* split_key,
+                           uint32_t* split_block)
+{
+	*split_block = 0;
+	bool is_root = node == (uint8_t*) data->i_block;
+	struct ext_extent_header* header = (struct ext_extent_header*) node;
+	uint8_t* entries = node + sizeof(struct ext_extent_header);
+	const size_t entry_size = sizeof(struct ext_extent);
+	if ( header->eh_entries < header->eh_max )
+	{
+		node_block->BeginWrite();
+		memmove(entries + (position + 1) * entry_size,
+		        entries + position * entry_size,
+		        (header->eh_entries - position) * entry_size);
+		memcpy(entries + position * entry_size, entry, entry_size);
+		header->eh_entries++;
+		if ( is_root )
+			FinishWrite();
+		else
+			node_block->FinishWrite();
+		return true;
+	}
+
+	// The node is full, so move entries to a new node.
+	if ( header->eh_depth == EXT4_EXT_MAX_DEPTH && is_root )
+		return errno = EFBIG, false;
+	uint32_t group_id = (inode_id - 1) / filesystem->sb->s_inodes_per_group;
+	assert(group_id < filesystem->num_groups);
+	BlockGroup* block_group = filesystem->GetBlockGroup(group_id);
+	if ( !block_group )
+		return false;
+	uint32_t new_block_id = filesystem->AllocateBlock(block_group);
+	block_group->Unref();
+	if ( !new_block_id )
+		return false;
+	Block* new_block = filesystem->device->GetBlockZeroed(new_block_id);
+	if ( !new_block )
+		return filesystem->FreeBlock(new_block_id), false;
+	BeginWrite();
+	data->i_blocks += filesystem->block_size / 512;
+	FinishWrite();
+	uint8_t* new_node = new_block->block_data;
+	struct ext_extent_header* new_header = (struct ext_extent_header*) new_node;
+	uint8_t* new_entries = new_node + sizeof(struct ext_extent_header);
+	new_block->BeginWrite();
+	new_header->eh_magic = EXT4_EXT_MAGIC;
+	new_header->eh_max = (filesystem->block_size - sizeof(*new_header)) /
+	                     entry_size;
+	new_header->eh_depth = header->eh_depth;
+
+	// The root is split by moving its entries into a new node below it.
+	if ( is_root )
+	{
+		memcpy(new_entries, entries, header->eh_entries * entry_size);
+		new_header->eh_entries = header->eh_entries;
+		new_block->FinishWrite();
+		uint32_t unused_key, unused_block;
+		if ( !AddExtentEntry(new_block, new_node, position, entry, &unused_key,
+		                     &unused_block) )
+			return new_block->Unref(), false;
+		BeginWrite();
+		header->eh_depth++;
+		header->eh_entries = 1;
+		struct ext_extent_idx* index = (struct ext_extent_idx*) entries;
+		memset(index, 0, sizeof(*index));
+		index->ei_block = ExtentKey(new_node, 0);
+		index->ei_leaf_lo = new_block_id;
+		FinishWrite();
+		new_block->Unref();
+		return true;
+	}
+
+	// Move the upper half to the new node, except when appending, where the
+	// entry is put alone in the new node so sequential files pack nodes full.
+	uint16_t keep = position == header->eh_entries ? position :
+	                header->eh_entries / 2;
+	uint16_t moved = header->eh_entries - keep;
+	memcpy(new_entries, entries + keep * entry_size, moved * entry_size);
+	new_header->eh_entries = moved;
+	new_block->FinishWrite();
+	node_block->BeginWrite();
+	header->eh_entries = keep;
+	node_block->FinishWrite();
+	uint32_t unused_key, unused_block;
+	if ( position < keep )
+		AddExtentEntry(node_block, node, position, entry, &unused_key,
+		               &unused_block);
+	else
+		AddExtentEntry(new_block, new_node, position - keep, entry, &unused_key,
+		               &unused_block);
+	*split_key = ExtentKey(new_node, 0);
+	*split_block = new_block_id;
+	new_block->Unref();
+	return true;
+}
+
+// Free the blocks from the logical block and onwards, and the nodes that
+// become empty, returning whether the node itself became empty.
+bool Inode::FreeExtents(Block* node_block, uint8_t* node, uint32_t from)
+{
+	bool is_root = node == (uint8_t*) data->i_block;
+	struct ext_extent_header* header = (struct ext_extent_header*) node;
+	if ( header->eh_depth )
+	{
+		struct ext_extent_idx* indexes = (struct ext_extent_idx*) (header + 1);
+		while ( header->eh_entries )
+		{
+			struct ext_extent_idx* index = &indexes[header->eh_entries - 1];
+			uint32_t key = index->ei_block;
+			uint32_t child_id = index->ei_leaf_lo;
+			if ( index->ei_leaf_hi || filesystem->num_blocks <= child_id )
+				return filesystem->Corrupted(), false;
+			Block* child = filesystem->device->GetBlock(child_id);
+			if ( !child )
+				return false;
+			if ( !IsExtentNodeValid(child->block_data, header->eh_depth - 1) )
+				return child->Unref(), filesystem->Corrupted(), false;
+			bool empty = FreeExtents(child, child->block_data, from);
+			child->Unref();
+			if ( empty )
+			{
+				FreeBlocks(child_id, 1);
+				node_block->BeginWrite();
+				header->eh_entries--;
+				if ( is_root )
+					FinishWrite();
+				else
+					node_block->FinishWrite();
+			}
+			// The subtrees before this one only map blocks before its key.
+			if ( !empty || key < from )
+				break;
+		}
+		return !header->eh_entries;
+	}
+
+	struct ext_extent* extents = (struct ext_extent*) (header + 1);
+	while ( header->eh_entries )
+	{
+		struct ext_extent* extent = &extents[header->eh_entries - 1];
+		bool uninit = EXT4_EXT_INIT_MAX_LEN < extent->ee_len;
+		uint32_t length = uninit ? extent->ee_len - EXT4_EXT_INIT_MAX_LEN :
+		                           extent->ee_len;
+		if ( extent->ee_block + length <= from )
+			break;
+		if ( extent->ee_start_hi ||
+		     filesystem->num_blocks < extent->ee_start_lo ||
+		     filesystem->num_blocks - extent->ee_start_lo < length )
+			return filesystem->Corrupted(), false;
+		uint32_t keep = from < extent->ee_block ? 0 : from - extent->ee_block;
+		FreeBlocks(extent->ee_start_lo + keep, length - keep);
+		node_block->BeginWrite();
+		if ( keep )
+			extent->ee_len = uninit ? EXT4_EXT_INIT_MAX_LEN + keep : keep;
+		else
+			header->eh_entries--;
+		if ( is_root )
+			FinishWrite();
+		else
+			node_block->FinishWrite();
+		if ( keep )
+			break;
+	}
+	return !header->eh_entries;
+}
+
+Block* Inode::GetBlock(uint64_t offset, bool allocate)
+{
+	if ( data->i_flags & EXT4_EXTENTS_FL )
+	{
+		if ( UINT32_MAX < offset )
+			return errno = EFBIG, (Block*) NULL;
+		return GetBlockFromExtents(offset, allocate);
+	}
+
 	const uint64_t ENTRIES = filesystem->block_size / sizeof(uint32_t);
 	uint64_t block_direct = sizeof(data->i_block) / sizeof(uint32_t) - 3;
 	uint64_t block_singly = ENTRIES;
@@ -221,7 +718,7 @@ Block* Inode::GetBlock(uint64_t offset)
 	read_direct:
 		index = offset;
 		offset %= 1;
-		block = GetBlockFromTable(table, index);
+		block = GetBlockFromTable(table, index, allocate);
 		table->Unref();
 		if ( !block )
 			return NULL;
@@ -234,7 +731,7 @@ Block* Inode::GetBlock(uint64_t offset)
 	read_singly:
 		index = offset / ENTRIES;
 		offset = offset % ENTRIES;
-		block = GetBlockFromTable(table, index);
+		block = GetBlockFromTable(table, index, allocate);
 		table->Unref();
 		if ( !block )
 			return NULL;
@@ -248,7 +745,7 @@ Block* Inode::GetBlock(uint64_t offset)
 	read_doubly:
 		index = offset / (ENTRIES * ENTRIES);
 		offset = offset % (ENTRIES * ENTRIES);
-		block = GetBlockFromTable(table, index);
+		block = GetBlockFromTable(table, index, allocate);
 		table->Unref();
 		if ( !block )
 			return NULL;
@@ -262,7 +759,7 @@ Block* Inode::GetBlock(uint64_t offset)
 	/*read_triply:*/
 		index = offset / (ENTRIES * ENTRIES * ENTRIES);
 		offset = offset % (ENTRIES * ENTRIES * ENTRIES);
-		block = GetBlockFromTable(table, index);
+		block = GetBlockFromTable(table, index, allocate);
 		table->Unref();
 		if ( !block )
 			return NULL;
@@ -313,8 +810,9 @@ void Inode::Truncate(uint64_t new_size)
 {
 	assert(filesystem->device->write);
 	uint64_t old_size = Size();
-	bool could_be_embedded = old_size == 0 && EXT2_S_ISLNK(Mode()) && !data->i_blocks;
-	bool is_embedded = 0 < old_size && old_size <= 60 && !data->i_blocks;
+	bool extents = data->i_flags & EXT4_EXTENTS_FL;
+	bool could_be_embedded = old_size == 0 && EXT2_S_ISLNK(Mode()) && !data->i_blocks && !extents;
+	bool is_embedded = 0 < old_size && old_size <= 60 && !data->i_blocks && !extents;
 	if ( could_be_embedded || is_embedded )
 	{
 		if ( new_size <= 60 )
@@ -344,6 +842,8 @@ void Inode::Truncate(uint64_t new_size)
 	if ( old_size <= new_size )
 		return;
 
+	ReleasePreallocation();
+
 	uint64_t old_num_blocks = divup(old_size, (uint64_t) filesystem->block_size);
 	uint64_t new_num_blocks = divup(new_size, (uint64_t) filesystem->block_size);
 
@@ -351,11 +851,30 @@ void Inode::Truncate(uint64_t new_size)
 	uint32_t partial = new_size % filesystem->block_size;
 	if ( partial )
 	{
-		Block* partial_block = GetBlock(new_num_blocks-1);
-		uint8_t* data = partial_block->block_data;
-		partial_block->BeginWrite();
-		memset(data + partial, 0, filesystem->block_size - partial);
-		partial_block->FinishWrite();
+		if ( Block* partial_block = GetBlock(new_num_blocks-1, true) )
+		{
+			uint8_t* data = partial_block->block_data;
+			partial_block->BeginWrite();
+			memset(data + partial, 0, filesystem->block_size - partial);
+			partial_block->FinishWrite();
+			partial_block->Unref();
+		}
+	}
+
+	if ( extents )
+	{
+		uint8_t* root = (uint8_t*) data->i_block;
+		if ( UINT32_MAX < new_num_blocks ||
+		     !FreeExtents(data_block, root, new_num_blocks) )
+			return;
+		// Make the root a leaf again when the tree is empty.
+		struct ext_extent_header* header = (struct ext_extent_header*) root;
+		BeginWrite();
+		header->eh_depth = 0;
+		header->eh_max = (sizeof(data->i_block) - sizeof(*header)) /
+		                 sizeof(struct ext_extent);
+		FinishWrite();
+		return;
 	}
 
 	const uint64_t ENTRIES = filesystem->block_size / sizeof(uint32_t);
@@ -418,7 +937,7 @@ bool Inode::ReadDirectory(uint64_t* offset_inout,
 		if ( *block_inout && *block_id_inout != entry_block_id )
 			(*block_inout)->Unref(), *block_inout = NULL;
 		if ( !*block_inout &&
-		     !(*block_inout = GetBlock(*block_id_inout = entry_block_id)) )
+		     !(*block_inout = GetBlock(*block_id_inout = entry_block_id, false)) )
 			return false;
 		const uint8_t* block_data =
 			(*block_inout)->block_data + entry_block_offset;
@@ -467,7 +986,7 @@ Inode* Inode::Open(const char* elem, int flags, mode_t mode)
 		if ( block && block_id != entry_block_id )
 			block->Unref(),
 			block = NULL;
-		if ( !block && !(block = GetBlock(block_id = entry_block_id)) )
+		if ( !block && !(block = GetBlock(block_id = entry_block_id, false)) )
 			return NULL;
 		const uint8_t* block_data = block->block_data + entry_block_offset;
 		const struct ext_dirent* entry = (const struct ext_dirent*) block_data;
@@ -537,6 +1056,7 @@ Inode* Inode::Open(const char* elem, int flags, mode_t mode)
 		result->data->i_mtime = now.tv_sec;
 		// TODO: Set all the other inode properties!
 		result->FinishWrite();
+		result->InitializeExtents();
 		result->SetMode((mode & S_SETABLE) | S_IFREG);
 		result->SetUserId(request_uid);
 		result->SetGroupId(request_gid);
@@ -582,7 +1102,7 @@ bool Inode::Link(const char* elem, Inode* dest, bool directories)
 		if ( block && block_id != entry_block_id )
 			block->Unref(),
 			block = NULL;
-		if ( !block && !(block = GetBlock(block_id = entry_block_id)) )
+		if ( !block && !(block = GetBlock(block_id = entry_block_id, true)) )
 			return NULL;
 		const uint8_t* block_data = block->block_data + entry_block_offset;
 		const struct ext_dirent* entry = (const struct ext_dirent*) block_data;
@@ -641,7 +1161,7 @@ bool Inode::Link(const char* elem, Inode* dest, bool directories)
 	if ( block && block_id != hole_block_id )
 		block->Unref(),
 		block = NULL;
-	if ( !block && !(block = GetBlock(block_id = hole_block_id)) )
+	if ( !block && !(block = GetBlock(block_id = hole_block_id, true)) )
 		return NULL;
 
 	Modified();
@@ -705,7 +1225,7 @@ Inode* Inode::UnlinkKeep(const char* elem, bool directories, bool force)
 			last_entry = NULL,
 			block->Unref(),
 			block = NULL;
-		if ( !block && !(block = GetBlock(block_id = entry_block_id)) )
+		if ( !block && !(block = GetBlock(block_id = entry_block_id, true)) )
 			return NULL;
 		uint8_t* block_data = block->block_data + entry_block_offset;
 		struct ext_dirent* entry = (struct ext_dirent*) block_data;
@@ -776,7 +1296,7 @@ Inode* Inode::UnlinkKeep(const char* elem, bool directories, bool force)
 				// regardless.
 				if ( entry_block_id + 1 != num_blocks )
 				{
-					Block* last_block = GetBlock(num_blocks-1);
+					Block* last_block = GetBlock(num_blocks-1, false);
 					if ( last_block )
 					{
 						memcpy(block->block_data, last_block->block_data, block_size);
@@ -831,7 +1351,8 @@ ssize_t Inode::ReadAt(uint8_t* buf, size_t s_count, off_t o_offset)
 		count = file_size - offset;
 	// TODO: This case also needs to be handled in SetSize, Truncate, WriteAt,
 	//       and so on.
-	if ( 0 < file_size && file_size <= 60 && !data->i_blocks )
+	if ( 0 < file_size && file_size <= 60 && !data->i_blocks &&
+	     !(data->i_flags & EXT4_EXTENTS_FL) )
 	{
 		assert(offset + count <= 60);
 		unsigned char* block_data = (unsigned char*) &data->i_block[0];
@@ -843,7 +1364,7 @@ ssize_t Inode::ReadAt(uint8_t* buf, size_t s_count, off_t o_offset)
 		uint64_t block_id = offset / filesystem->block_size;
 		uint32_t block_offset = offset % filesystem->block_size;
 		uint32_t block_left = filesystem->block_size - block_offset;
-		Block* block = GetBlock(block_id);
+		Block* block = GetBlock(block_id, false);
 		if ( !block )
 			return sofar ? sofar : -1;
 		size_t amount = count - sofar < block_left ? count - sofar : block_left;
@@ -875,7 +1396,8 @@ ssize_t Inode::WriteAt(const uint8_t* buf, size_t s_count, off_t o_offset)
 		/* TODO: Overflow! off_t overflow? */{};
 	if ( file_size < end_at )
 		Truncate(end_at);
-	if ( 0 < end_at && end_at <= 60 && !data->i_blocks )
+	if ( 0 < end_at && end_at <= 60 && !data->i_blocks &&
+	     !(data->i_flags & EXT4_EXTENTS_FL) )
 	{
 		data_block->BeginWrite();
 		unsigned char* block_data = (unsigned char*) &data->i_block[0];
@@ -890,7 +1412,7 @@ ssize_t Inode::WriteAt(const uint8_t* buf, size_t s_count, off_t o_offset)
 		uint64_t block_id = offset / filesystem->block_size;
 		uint32_t block_offset = offset % filesystem->block_size;
 		uint32_t block_left = filesystem->block_size - block_offset;
-		Block* block = GetBlock(block_id);
+		Block* block = GetBlock(block_id, true);
 		if ( !block )
 			return sofar ? (ssize_t) sofar : -1;
 		size_t amount = count - sofar < block_left ? count - sofar : block_left;
@@ -1032,6 +1554,7 @@ Inode* Inode::CreateDirectory(const char* path, mode_t mode)
 	result->data->i_mtime = now.tv_sec;
 	// TODO: Set all the other inode properties!
 	result->FinishWrite();
+	result->InitializeExtents();
 	result->SetMode((mode & S_SETABLE) | EXT2_S_IFDIR);
 	result->SetUserId(request_uid);
 	result->SetGroupId(request_gid);
@@ -1110,7 +1633,7 @@ bool Inode::IsEmptyDirectory()
 		if ( block && block_id != entry_block_id )
 			block->Unref(),
 			block = NULL;
-		if ( !block && !(block = GetBlock(block_id = entry_block_id)) )
+		if ( !block && !(block = GetBlock(block_id = entry_block_id, false)) )
 			return false;
 		uint8_t* block_data = block->block_data + entry_block_offset;
 		struct ext_dirent* entry = (struct ext_dirent*) block_data;
@@ -1177,6 +1700,9 @@ void Inode::RemoteUnref()
 {
 	assert(0 < remote_reference_count);
 	remote_reference_count--;
+	// Forget the preallocation window once the file is no longer open.
+	if ( !remote_reference_count )
+		ReleasePreallocation();
 	if ( !reference_count && !remote_reference_count )
 	{
 		if ( !data->i_links_count )
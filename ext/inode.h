@@ -23,6 +23,9 @@
 class Block;
 class Filesystem;
 
+// How many blocks to reserve ahead of a growing file so it stays contiguous.
+static const uint32_t INODE_PREALLOC_BLOCKS = 32;
+
 class Inode
 {
 public:
@@ -42,6 +45,8 @@ public:
 	size_t reference_count;
 	size_t remote_reference_count;
 	uint32_t inode_id;
+	uint32_t prealloc_block;
+	uint32_t prealloc_count;
 	bool dirty;
 
 public:
@@ -56,8 +61,21 @@ public:
 	void Truncate(uint64_t new_size);
 	bool FreeIndirect(uint64_t from, uint64_t offset, uint32_t block_id,
 	                  int indirection, uint64_t entry_span);
-	Block* GetBlock(uint64_t offset);
-	Block* GetBlockFromTable(Block* table, uint32_t index);
+	Block* GetBlock(uint64_t offset, bool allocate);
+	Block* GetBlockFromTable(Block* table, uint32_t index, bool allocate);
+	Block* GetBlockFromExtents(uint32_t logical, bool allocate);
+	bool InsertExtent(Block* node_block, uint8_t* node, uint32_t logical,
+	                  uint32_t physical, uint32_t* split_key,
+	                  uint32_t* split_block);
+	bool AddExtentEntry(Block* node_block, uint8_t* node, uint16_t position,
+	                    const void* entry, uint32_t* split_key,
+	                    uint32_t* split_block);
+	bool FreeExtents(Block* node_block, uint8_t* node, uint32_t from);
+	bool IsExtentNodeValid(uint8_t* node, uint16_t depth);
+	void InitializeExtents();
+	uint32_t AllocateBlock(uint32_t goal);
+	void FreeBlocks(uint32_t block_id, uint32_t count);
+	void ReleasePreallocation();
 	bool ReadDirectory(uint64_t* offset_inout, uint64_t* entry_offset_out,
 	                   Block** block_inout, uint64_t* block_id_inout,
 	                   char* name, uint8_t* file_type_out,
@@ -45,6 +45,8 @@ public:
 	uint32_t block_id;
 	bool dirty;
 	bool is_in_transit;
+	bool is_loading;
+	bool is_failed;
 	uint8_t* block_data;
 
 public:
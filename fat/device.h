@@ -36,6 +36,8 @@ public:
 	pthread_cond_t sync_thread_cond;
 	pthread_cond_t sync_thread_idle_cond;
 	pthread_mutex_t sync_thread_lock;
+	pthread_mutex_t lock;
+	pthread_cond_t load_cond;
 	Block* mru_block;
 	Block* lru_block;
 	Block* dirty_block;
@@ -57,6 +59,7 @@ public:
 	Block* GetBlock(uint32_t block_id);
 	Block* GetBlockZeroed(uint32_t block_id);
 	Block* GetCachedBlock(uint32_t block_id);
+	Block* FindBlock(uint32_t block_id);
 	void Sync();
 	void SyncThread();
 
@@ -52,8 +52,8 @@
 #include "ioleast.h"
 #include "util.h"
 
-uid_t request_uid;
-uid_t request_gid;
+__thread uid_t request_uid;
+__thread uid_t request_gid;
 
 int main(int argc, char* argv[])
 {
@@ -146,7 +146,8 @@ int main(int argc, char* argv[])
 	if ( !pretend_mount_path )
 		pretend_mount_path = mount_path;
 
-	int fd = open(device_path, write ? O_RDWR : O_RDONLY);
+	// The blocks are whole and aligned, so let the disk transfer them directly.
+	int fd = open(device_path, (write ? O_RDWR : O_RDONLY) | O_DIRECT);
 	if ( fd < 0 )
 		err(1, "%s", device_path);
 
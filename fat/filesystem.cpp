@@ -25,6 +25,7 @@
 #include <endian.h>
 #include <err.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -196,6 +197,10 @@ struct timespec fat_to_timespec(const uint16_t* date_ptr,
 
 Filesystem::Filesystem(Device* device, const char* mount_path, Block* bpb_block)
 {
+	this->tree_lock = PTHREAD_RWLOCK_INITIALIZER;
+	this->write_lock = PTHREAD_MUTEX_INITIALIZER;
+	for ( size_t i = 0; i < INODE_LOCK_COUNT; i++ )
+		this->inode_locks[i] = PTHREAD_RWLOCK_INITIALIZER;
 	this->bpb_block = bpb_block;
 	this->bpb = (struct fat_bpb*) bpb_block->block_data;
 	this->device = device;
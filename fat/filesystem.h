@@ -32,6 +32,7 @@ class Device;
 class Inode;
 
 static const size_t INODE_HASH_LENGTH = 1 << 16;
+static const size_t INODE_LOCK_COUNT = 64;
 
 class Filesystem
 {
@@ -40,6 +41,14 @@ public:
 	~Filesystem();
 
 public:
+	// Requests that change the directory tree hold the tree lock exclusively,
+	// while other requests share it. Requests that modify a single inode are
+	// serialized by the write lock and hold the lock of that inode exclusively,
+	// while requests that read an inode share its lock. These locks are taken
+	// before the device lock.
+	pthread_rwlock_t tree_lock;
+	pthread_mutex_t write_lock;
+	pthread_rwlock_t inode_locks[INODE_LOCK_COUNT];
 	Block* bpb_block;
 	struct fat_bpb* bpb;
 	Device* device;
@@ -81,6 +90,8 @@ public:
 	void RequestCheck();
 	void Corrupted();
 	Inode* GetInode(fat_ino_t inode_id);
+	pthread_rwlock_t* InodeLock(fat_ino_t inode_id)
+	{ return &inode_locks[inode_id % INODE_LOCK_COUNT]; }
 	Inode* CreateInode(fat_ino_t inode_id, Block* dirent_block,
 	                   struct fat_dirent* dirent, Inode* parent);
 	bool WriteInfo();
@@ -46,6 +46,8 @@ void Block::Construct(Device* device, uint32_t block_id)
 	this->device = device;
 	this->reference_count = 1;
 	this->block_id = block_id;
+	this->is_loading = false;
+	this->is_failed = false;
 }
 
 Block::~Block()
@@ -67,7 +69,9 @@ void Block::Refer()
 void Block::Unref()
 {
 	--reference_count;
-	if ( !device->block_limit )
+	// Blocks that failed to load are no longer found and are deleted once the
+	// threads that waited for them are done with them.
+	if ( !device->block_limit || (is_failed && !reference_count) )
 	{
 		device->block_count--;
 		delete this;
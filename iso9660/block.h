@@ -39,6 +39,8 @@ public:
 	Device* device;
 	size_t reference_count;
 	uint32_t block_id;
+	bool is_loading;
+	bool is_failed;
 	uint8_t* block_data;
 
 public:
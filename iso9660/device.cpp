@@ -21,6 +21,8 @@
 #include <sys/types.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -33,6 +35,8 @@
 Device::Device(int fd, const char* path, uint32_t block_size,
                size_t block_limit)
 {
+	this->lock = PTHREAD_MUTEX_INITIALIZER;
+	this->load_cond = PTHREAD_COND_INITIALIZER;
 	this->mru_block = NULL;
 	this->lru_block = NULL;
 	for ( size_t i = 0; i < DEVICE_HASH_LENGTH; i++ )
@@ -45,6 +49,9 @@ Device::Device(int fd, const char* path, uint32_t block_size,
 	this->fd = fd;
 	this->block_count = 0;
 	this->block_limit = block_limit;
+	// The filesystem is used with the lock held, which the creating thread
+	// holds until it lets other threads use the filesystem.
+	pthread_mutex_lock(&lock);
 }
 
 Device::~Device()
@@ -79,23 +86,54 @@ Block* Device::AllocateBlock()
 
 Block* Device::GetBlock(uint32_t block_id)
 {
-	if ( Block* block = GetCachedBlock(block_id) )
-		return block;
+	if ( FindBlock(block_id) )
+		return GetCachedBlock(block_id);
 	Block* block = AllocateBlock();
 	if ( !block )
 		return NULL;
 	block->Construct(this, block_id);
-	off_t file_offset = (off_t) block_size * (off_t) block_id;
-	preadall(fd, block->block_data, block_size, file_offset);
+	block->is_loading = true;
 	block->Prelink();
+	// Let other threads use the cache while reading, where threads wanting
+	// this block wait for it to be loaded.
+	pthread_mutex_unlock(&lock);
+	off_t file_offset = (off_t) block_size * (off_t) block_id;
+	size_t amount = preadall(fd, block->block_data, block_size, file_offset);
+	pthread_mutex_lock(&lock);
+	// A block that wasn't read entirely fails for the threads waiting for it,
+	// and later lookups read it again.
+	block->is_loading = false;
+	block->is_failed = amount < block_size;
+	pthread_cond_broadcast(&load_cond);
+	if ( block->is_failed )
+	{
+		block->Unref();
+		return errno = EIO, (Block*) NULL;
+	}
 	return block;
 }
 
 Block* Device::GetCachedBlock(uint32_t block_id)
+{
+	Block* block = FindBlock(block_id);
+	if ( !block )
+		return NULL;
+	block->Refer();
+	while ( block->is_loading )
+		pthread_cond_wait(&load_cond, &lock);
+	if ( block->is_failed )
+	{
+		block->Unref();
+		return errno = EIO, (Block*) NULL;
+	}
+	return block;
+}
+
+Block* Device::FindBlock(uint32_t block_id)
 {
 	size_t bin = block_id % DEVICE_HASH_LENGTH;
 	for ( Block* iter = hash_blocks[bin]; iter; iter = iter->next_hashed )
-		if ( iter->block_id == block_id )
-			return iter->Refer(), iter;
+		if ( iter->block_id == block_id && !iter->is_failed )
+			return iter;
 	return NULL;
 }
@@ -31,6 +31,8 @@ public:
 	~Device();
 
 public:
+	pthread_mutex_t lock;
+	pthread_cond_t load_cond;
 	Block* mru_block;
 	Block* lru_block;
 	Block* hash_blocks[DEVICE_HASH_LENGTH];
@@ -45,6 +47,7 @@ public:
 	Block* AllocateBlock();
 	Block* GetBlock(uint32_t block_id);
 	Block* GetCachedBlock(uint32_t block_id);
+	Block* FindBlock(uint32_t block_id);
 
 };
 
@@ -83,8 +83,13 @@ Inode* Filesystem::GetInode(iso9660_ino_t inode_id)
 	inode->data_block = block;
 	uint8_t* buf = inode->data_block->block_data + offset;
 	inode->data = (struct iso9660_dirent*) buf;
-	inode->Prelink();
 	inode->Parse();
+	// Another thread may have loaded the inode while the blocks were read, in
+	// which case this copy is discarded through the cache.
+	inode->Prelink();
+	for ( Inode* iter = inode->next_hashed; iter; iter = iter->next_hashed )
+		if ( iter->inode_id == inode_id )
+			return inode->Unref(), iter->Refer(), iter;
 
 	return inode;
 }
@@ -19,7 +19,6 @@
 
 #if defined(__sortix__)
 
-#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -29,6 +28,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <ioleast.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -50,23 +50,97 @@
 #include "inode.h"
 #include "iso9660fs.h"
 
-bool RespondData(int chl, const void* ptr, size_t count)
-{
-	return writeall(chl, ptr, count) == count;
-}
+// Requests are handled in parallel by a pool of worker threads.
+static const size_t WORKER_THREADS = 8;
 
-bool RespondHeader(int chl, size_t type, size_t size)
+struct request
+{
+	struct request* next;
+	struct fsm_msg_header hdr;
+	int chl;
+};
+
+static pthread_mutex_t request_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t request_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t request_idle_cond = PTHREAD_COND_INITIALIZER;
+static struct request* first_request;
+static struct request* last_request;
+static size_t requests_active;
+static bool workers_should_exit;
+static pthread_mutex_t respond_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread size_t request_msgid;
+
+// The response is built while the filesystem is locked and is sent once the
+// request has released its locks, so the device lock isn't held while waiting
+// for the channel.
+struct response
+{
+	uint8_t* data;
+	size_t used;
+	size_t size;
+	bool failed;
+};
+
+static __thread struct response response;
+
+bool RespondMessage(int chl, size_t type, const void* ptr, size_t count,
+                    const void* data = NULL, size_t data_size = 0)
 {
+	(void) chl;
 	struct fsm_msg_header hdr;
 	hdr.msgtype = type;
-	hdr.msgsize = size;
-	return RespondData(chl, &hdr, sizeof(hdr));
+	hdr.msgsize = count + data_size;
+	hdr.msgid = request_msgid;
+	size_t needed = sizeof(hdr) + count + data_size;
+	if ( response.size - response.used < needed )
+	{
+		size_t new_size = response.used + needed;
+		uint8_t* new_data = (uint8_t*) realloc(response.data, new_size);
+		if ( !new_data )
+			return response.failed = true, false;
+		response.data = new_data;
+		response.size = new_size;
+	}
+	memcpy(response.data + response.used, &hdr, sizeof(hdr));
+	memcpy(response.data + response.used + sizeof(hdr), ptr, count);
+	if ( data_size )
+		memcpy(response.data + response.used + sizeof(hdr) + count, data,
+		       data_size);
+	response.used += needed;
+	return true;
 }
 
-bool RespondMessage(int chl, size_t type, const void* ptr, size_t count)
+// The responses to concurrent requests are written whole, one at a time.
+bool SendResponse(int chl)
 {
-	return RespondHeader(chl, type, count) &&
-	       RespondData(chl, ptr, count);
+	bool result;
+	pthread_mutex_lock(&respond_lock);
+	if ( response.failed )
+	{
+		struct
+		{
+			struct fsm_msg_header hdr;
+			struct fsm_resp_error body;
+		} error;
+		error.hdr.msgtype = FSM_RESP_ERROR;
+		error.hdr.msgsize = sizeof(error.body);
+		error.hdr.msgid = request_msgid;
+		error.body.errnum = ENOMEM;
+		result = writeall(chl, &error, sizeof(error)) == sizeof(error);
+	}
+	else
+		result = writeall(chl, response.data, response.used) == response.used;
+	pthread_mutex_unlock(&respond_lock);
+	// Don't keep the buffer for a large read around.
+	if ( 65536 < response.size )
+	{
+		free(response.data);
+		response.data = NULL;
+		response.size = 0;
+	}
+	response.used = 0;
+	response.failed = false;
+	return result;
 }
 
 bool RespondError(int chl, int errnum)
@@ -107,16 +181,16 @@ bool RespondRead(int chl, const uint8_t* buf, size_t count)
 {
 	struct fsm_resp_read body;
 	body.count = count;
-	return RespondMessage(chl, FSM_RESP_READ, &body, sizeof(body)) &&
-	       RespondData(chl, buf, count);
+	return RespondMessage(chl, FSM_RESP_READ, &body, sizeof(body), buf,
+	                      count);
 }
 
 bool RespondReadlink(int chl, const uint8_t* buf, size_t count)
 {
 	struct fsm_resp_readlink body;
 	body.targetlen = count;
-	return RespondMessage(chl, FSM_RESP_READLINK, &body, sizeof(body)) &&
-	       RespondData(chl, buf, count);
+	return RespondMessage(chl, FSM_RESP_READLINK, &body, sizeof(body), buf,
+	                      count);
 }
 
 bool RespondWrite(int chl, size_t count)
@@ -146,16 +220,16 @@ bool RespondReadDir(int chl, const void* data, size_t data_size, off_t next_off)
 	struct fsm_resp_getdents body;
 	body.count = data_size;
 	body.next_off = next_off;
-	return RespondMessage(chl, FSM_RESP_GETDENTS, &body, sizeof(body)) &&
-	       RespondData(chl, data, data_size);
+	return RespondMessage(chl, FSM_RESP_GETDENTS, &body, sizeof(body), data,
+	                      data_size);
 }
 
 bool RespondTCGetBlob(int chl, const void* data, size_t data_size)
 {
 	struct fsm_resp_tcgetblob body;
 	body.count = data_size;
-	return RespondMessage(chl, FSM_RESP_TCGETBLOB, &body, sizeof(body)) &&
-	       RespondData(chl, data, data_size);
+	return RespondMessage(chl, FSM_RESP_TCGETBLOB, &body, sizeof(body), data,
+	                      data_size);
 }
 
 static size_t isostrnlen(const char* str, size_t size)
@@ -171,8 +245,8 @@ bool RespondTCGetBlobISO(int chl, const char* data, size_t data_size)
 	data_size = isostrnlen(data, data_size);
 	struct fsm_resp_tcgetblob body;
 	body.count = data_size;
-	return RespondMessage(chl, FSM_RESP_TCGETBLOB, &body, sizeof(body)) &&
-	       RespondData(chl, data, data_size);
+	return RespondMessage(chl, FSM_RESP_TCGETBLOB, &body, sizeof(body), data,
+	                      data_size);
 }
 
 bool RespondPathConf(int chl, long value)
@@ -632,8 +706,10 @@ void HandlePathConf(int chl, struct fsm_req_pathconf* msg, Filesystem* fs)
 	RespondPathConf(chl, value);
 }
 
-void HandleIncomingMessage(int chl, struct fsm_msg_header* hdr, Filesystem* fs)
+void HandleIncomingMessage(int chl, struct fsm_msg_header* hdr, void* body,
+                           Filesystem* fs)
 {
+	request_msgid = hdr->msgid;
 	request_uid = hdr->uid;
 	request_gid = hdr->gid;
 	typedef void (*handler_t)(int, void*, Filesystem*);
@@ -668,25 +744,81 @@ void HandleIncomingMessage(int chl, struct fsm_msg_header* hdr, Filesystem* fs)
 		RespondError(chl, ENOTSUP);
 		return;
 	}
-	uint8_t body_buffer[65536];
-	uint8_t* body = body_buffer;
-	if ( sizeof(body_buffer) < hdr->msgsize )
+	// The filesystem is read-only, so the requests only need the device lock,
+	// which is released while blocks are read from the disk.
+	pthread_mutex_lock(&fs->device->lock);
+	handlers[hdr->msgtype](chl, body, fs);
+	pthread_mutex_unlock(&fs->device->lock);
+}
+
+void* Worker(void* ctx)
+{
+	Filesystem* fs = (Filesystem*) ctx;
+	pthread_mutex_lock(&request_lock);
+	while ( true )
 	{
-		body = (uint8_t*) mmap(NULL, hdr->msgsize, PROT_READ | PROT_WRITE,
-		                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-		if ( (void*) body == MAP_FAILED )
-		{
-			RespondError(chl, errno);
-			return;
-		}
+		while ( !first_request && !workers_should_exit )
+			pthread_cond_wait(&request_cond, &request_lock);
+		struct request* request = first_request;
+		if ( !request )
+			break;
+		if ( !(first_request = request->next) )
+			last_request = NULL;
+		requests_active++;
+		pthread_mutex_unlock(&request_lock);
+		HandleIncomingMessage(request->chl, &request->hdr, &request[1], fs);
+		SendResponse(request->chl);
+		free(request);
+		pthread_mutex_lock(&request_lock);
+		if ( !--requests_active && !first_request )
+			pthread_cond_broadcast(&request_idle_cond);
 	}
-	if ( readall(chl, body, hdr->msgsize) == hdr->msgsize )
-		handlers[hdr->msgtype](chl, body, fs);
-	else
+	pthread_mutex_unlock(&request_lock);
+	return NULL;
+}
+
+bool ReceiveRequest(int chl, struct fsm_msg_header* hdr)
+{
+	request_msgid = hdr->msgid;
+	struct request* request =
+		(struct request*) malloc(sizeof(struct request) + hdr->msgsize);
+	if ( !request )
+	{
 		RespondError(chl, errno);
-	if ( sizeof(body_buffer) < hdr->msgsize )
-		munmap(body, hdr->msgsize);
+		SendResponse(chl);
+		return false;
+	}
+	request->next = NULL;
+	request->hdr = *hdr;
+	request->chl = chl;
+	// Read the whole message even if it can't be handled, as the next message
+	// follows it on the channel.
+	if ( readall(chl, &request[1], hdr->msgsize) != hdr->msgsize )
+	{
+		RespondError(chl, errno);
+		SendResponse(chl);
+		free(request);
+		return false;
+	}
+	pthread_mutex_lock(&request_lock);
+	if ( last_request )
+		last_request->next = request;
+	else
+		first_request = request;
+	last_request = request;
+	pthread_cond_signal(&request_cond);
+	pthread_mutex_unlock(&request_lock);
+	return true;
 }
+
+void FinishRequests()
+{
+	pthread_mutex_lock(&request_lock);
+	while ( first_request || requests_active )
+		pthread_cond_wait(&request_idle_cond, &request_lock);
+	pthread_mutex_unlock(&request_lock);
+}
+
 static volatile bool should_terminate = false;
 
 void TerminationHandler(int)
@@ -723,7 +855,8 @@ int fsmarshall_main(const char* argv0,
 	root_inode->Unref();
 
 	// Create a filesystem server connected to the kernel that we'll listen on.
-	int serverfd = fsm_mountat(AT_FDCWD, mount_path, &root_inode_st, 0);
+	int serverfd = fsm_mountat(AT_FDCWD, mount_path, &root_inode_st,
+	                           FSM_MOUNT_MULTIPLEX);
 	if ( serverfd < 0 )
 		err(1, "%s", mount_path);
 
@@ -753,24 +886,47 @@ int fsmarshall_main(const char* argv0,
 	else
 		ready();
 
+	// Start the workers with the termination signals blocked, so the signals
+	// interrupt this thread while it waits for requests.
+	sigset_t sigterm, oldset;
+	sigemptyset(&sigterm);
+	sigaddset(&sigterm, SIGINT);
+	sigaddset(&sigterm, SIGTERM);
+	sigaddset(&sigterm, SIGQUIT);
+	pthread_sigmask(SIG_BLOCK, &sigterm, &oldset);
+	pthread_t workers[WORKER_THREADS];
+	for ( size_t i = 0; i < WORKER_THREADS; i++ )
+		if ( (errno = pthread_create(&workers[i], NULL, Worker, fs)) )
+			err(1, "pthread_create");
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	pthread_mutex_unlock(&dev->lock);
+
 	// Listen for filesystem messages.
 	int channel;
 	while ( 0 <= (channel = accept(serverfd, NULL, NULL)) )
 	{
-		if ( should_terminate )
-			break;
+		// The kernel sends further requests on the channel until closing it.
 		struct fsm_msg_header hdr;
-		size_t amount;
-		if ( (amount = readall(channel, &hdr, sizeof(hdr))) != sizeof(hdr) )
-		{
-			//warn("incomplete header: got %zi of %zu bytes", amount, sizeof(hdr));
-			errno = 0;
+		while ( !should_terminate &&
+		        readall(channel, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+		        ReceiveRequest(channel, &hdr) )
 			continue;
-		}
-		HandleIncomingMessage(channel, &hdr, fs);
+		// The workers respond on the channel, so finish the requests first.
+		FinishRequests();
 		close(channel);
+		errno = 0;
+		if ( should_terminate )
+			break;
 	}
 
+	pthread_mutex_lock(&request_lock);
+	workers_should_exit = true;
+	pthread_cond_broadcast(&request_cond);
+	pthread_mutex_unlock(&request_lock);
+	for ( size_t i = 0; i < WORKER_THREADS; i++ )
+		pthread_join(workers[i], NULL);
+	pthread_mutex_lock(&dev->lock);
+
 	// Garbage collect all open inode references.
 	while ( fs->mru_inode )
 	{
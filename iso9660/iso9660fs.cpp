@@ -50,8 +50,8 @@
 #include "iso9660fs.h"
 #include "util.h"
 
-uid_t request_uid;
-uid_t request_gid;
+__thread uid_t request_uid;
+__thread uid_t request_gid;
 
 mode_t HostModeFromFsMode(uint32_t mode)
 {
@@ -205,7 +205,8 @@ int main(int argc, char* argv[])
 	if ( !pretend_mount_path )
 		pretend_mount_path = mount_path;
 
-	int fd = open(device_path, O_RDONLY);
+	// The blocks are whole and aligned, so let the disk transfer them directly.
+	int fd = open(device_path, O_RDONLY | O_DIRECT);
 	if ( fd < 0 )
 		err(1, "%s", device_path);
 
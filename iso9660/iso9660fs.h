@@ -20,8 +20,8 @@
 #ifndef ISO9660FS_H
 #define ISO9660FS_H
 
-extern uid_t request_uid;
-extern gid_t request_gid;
+extern __thread uid_t request_uid;
+extern __thread gid_t request_gid;
 
 class Inode;
 
@@ -27,6 +27,7 @@
 #include <sortix/kernel/copy.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/kthread.h>
+#include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/segment.h>
 #include <sortix/kernel/string.h>
@@ -41,6 +42,22 @@
 
 namespace Sortix {
 
+static void UnpinFrames(const addr_t* frames, size_t count)
+{
+	for ( size_t i = 0; i < count; i++ )
+		Page::Unpin(frames[i]);
+}
+
+static size_t PinnedPageCount(const void* userbuf_ptr, size_t count)
+{
+	uintptr_t userbuf = (uintptr_t) userbuf_ptr;
+	if ( !count )
+		return 0;
+	uintptr_t first = Page::AlignDown(userbuf);
+	uintptr_t last = Page::AlignDown(userbuf + count - 1);
+	return (last - first) / Page::Size() + 1;
+}
+
 static bool IsInProcessAddressSpace(Process* process)
 {
 	addr_t current_address_space;
@@ -90,6 +107,14 @@ bool CopyToUser(void* userdst_ptr, const void* ksrc_ptr, size_t count)
 		size_t segment_available = segment->addr + segment->size - userdst;
 		if ( segment_available < amount )
 			amount = segment_available;
+		size_t page_available = Page::Size() - (userdst & (Page::Size() - 1));
+		if ( page_available < amount )
+			amount = page_available;
+		if ( !Memory::PrepareUserPage(process, segment, userdst, true) )
+		{
+			result = false;
+			break;
+		}
 		memcpy((void*) userdst, (const void*) ksrc, amount);
 		userdst += amount;
 		ksrc += amount;
@@ -120,6 +145,14 @@ bool CopyFromUser(void* kdst_ptr, const void* usersrc_ptr, size_t count)
 		size_t segment_available = segment->addr + segment->size - usersrc;
 		if ( segment_available < amount )
 			amount = segment_available;
+		size_t page_available = Page::Size() - (usersrc & (Page::Size() - 1));
+		if ( page_available < amount )
+			amount = page_available;
+		if ( !Memory::PrepareUserPage(process, segment, usersrc, false) )
+		{
+			result = false;
+			break;
+		}
 		memcpy((void*) kdst, (const void*) usersrc, amount);
 		kdst += amount;
 		usersrc += amount;
@@ -143,6 +176,8 @@ bool ReadAtomicFromUser(int* kdst_ptr, const int* usersrc_ptr)
 	size_t segment_available = segment->addr + segment->size - usersrc;
 	if ( segment_available < sizeof(int) )
 		return errno = EFAULT, false;
+	if ( !Memory::PrepareUserPage(process, segment, usersrc, false) )
+		return false;
 	*kdst_ptr = __atomic_load_n(usersrc_ptr, __ATOMIC_SEQ_CST);
 	return true;
 }
@@ -186,6 +221,14 @@ bool ZeroUser(void* userdst_ptr, size_t count)
 		size_t segment_available = segment->addr + segment->size - userdst;
 		if ( segment_available < amount )
 			amount = segment_available;
+		size_t page_available = Page::Size() - (userdst & (Page::Size() - 1));
+		if ( page_available < amount )
+			amount = page_available;
+		if ( !Memory::PrepareUserPage(process, segment, userdst, true) )
+		{
+			result = false;
+			break;
+		}
 		memset((void*) userdst, 0, amount);
 		userdst += amount;
 		count -= amount;
@@ -216,6 +259,15 @@ char* GetStringFromUser(const char* usersrc_str)
 			return errno = EFAULT, (char*) NULL;
 		}
 		size_t segment_available = segment->addr + segment->size - current_at;
+		size_t page_available =
+			Page::Size() - (current_at & (Page::Size() - 1));
+		if ( page_available < segment_available )
+			segment_available = page_available;
+		if ( !Memory::PrepareUserPage(process, segment, current_at, false) )
+		{
+			kthread_mutex_unlock(&process->segment_lock);
+			return (char*) NULL;
+		}
 		volatile const char* str = (volatile const char*) current_at;
 		size_t length = 0;
 		for ( ; length < segment_available; length++ )
@@ -251,4 +303,56 @@ char* GetStringFromUser(const char* usersrc_str)
 	return result;
 }
 
+// Pins the user-space pages spanned by the buffer so devices can transfer
+// directly to and from them, storing their physical frames in the frames array,
+// which must have room for an entry per page. The pages are made present, and
+// private if written, and the pin keeps the frames allocated even if they are
+// unmapped meanwhile. Pinned frames are copied rather than shared when forking,
+// so the device's writes go to this process. No lock is held while pinned.
+bool PinUserMemory(const void* userbuf_ptr, size_t count, bool write,
+                   addr_t* frames)
+{
+	uintptr_t userbuf = (uintptr_t) userbuf_ptr;
+	int prot = write ? PROT_WRITE : PROT_READ;
+	Process* process = CurrentProcess();
+	assert(IsInProcessAddressSpace(process));
+	ScopedLock lock(&process->segment_lock);
+	size_t pinned = 0;
+	while ( count )
+	{
+		struct segment* segment = FindSegment(process, userbuf);
+		if ( !segment || !(segment->prot & prot) )
+		{
+			UnpinFrames(frames, pinned);
+			return errno = EFAULT, false;
+		}
+		size_t amount = count;
+		size_t page_available = Page::Size() - (userbuf & (Page::Size() - 1));
+		if ( page_available < amount )
+			amount = page_available;
+		if ( !Memory::PrepareUserPage(process, segment, userbuf, write) )
+		{
+			UnpinFrames(frames, pinned);
+			return false;
+		}
+		addr_t frame;
+		if ( !Memory::LookUp(Page::AlignDown(userbuf), &frame, NULL) ||
+		     !Page::Pin(frame) )
+		{
+			UnpinFrames(frames, pinned);
+			return errno = EFAULT, false;
+		}
+		frames[pinned++] = frame;
+		userbuf += amount;
+		count -= amount;
+	}
+	return true;
+}
+
+void UnpinUserMemory(const void* userbuf_ptr, size_t count,
+                     const addr_t* frames)
+{
+	UnpinFrames(frames, PinnedPageCount(userbuf_ptr, count));
+}
+
 } // namespace Sortix
@@ -46,6 +46,7 @@
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/kthread.h>
+#include <sortix/kernel/pagecache.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/refcount.h>
 #include <sortix/kernel/string.h>
@@ -62,7 +63,7 @@ static const int OPEN_FLAGS = O_CREATE | O_DIRECTORY | O_EXCL | O_TRUNC |
                               O_TTY_INIT;
 
 // Flags that only make sense for descriptors.
-static const int DESCRIPTOR_FLAGS = O_APPEND | O_NONBLOCK;
+static const int DESCRIPTOR_FLAGS = O_APPEND | O_NONBLOCK | O_DIRECT;
 
 // Let the ioctx_t force bits like O_NONBLOCK and otherwise use the dflags of
 // the current file descriptor. This allows the caller to do non-blocking reads
@@ -159,6 +160,7 @@ Descriptor::Descriptor()
 	this->dflags = 0;
 	checked_seekable = false;
 	seekable = false /* unused */;
+	is_writer = false;
 	current_offset = 0;
 }
 
@@ -172,6 +174,7 @@ Descriptor::Descriptor(Ref<Vnode> vnode, int dflags)
 	this->dflags = 0;
 	checked_seekable = false;
 	seekable = false /* unused */;
+	is_writer = false;
 	current_offset = 0;
 	LateConstruct(vnode, dflags);
 }
@@ -187,6 +190,8 @@ void Descriptor::LateConstruct(Ref<Vnode> vnode, int dflags)
 
 Descriptor::~Descriptor()
 {
+	if ( is_writer )
+		PageCache::RemoveWriter(dev, ino);
 }
 
 bool Descriptor::SetFlags(int new_dflags)
@@ -212,6 +217,12 @@ Ref<Descriptor> Descriptor::Fork()
 	Ref<Descriptor> ret(new Descriptor(vnode, dflags));
 	if ( !ret )
 		return Ref<Descriptor>();
+	if ( is_writer )
+	{
+		if ( !PageCache::AddWriter(dev, ino) )
+			return Ref<Descriptor>();
+		ret->is_writer = true;
+	}
 	ret->current_offset = current_offset;
 	ret->checked_seekable = checked_seekable;
 	ret->seekable = seekable;
@@ -931,6 +942,16 @@ Ref<Descriptor> Descriptor::open(ioctx_t* ctx, const char* filename, int flags,
 			return errno = EISDIR, Ref<Descriptor>();
 	}
 
+	// Refuse writing to a running program, as its pages are loaded from the
+	// file as they're accessed, and count the writers so the file can't be
+	// executed while it's open for writing.
+	if ( (flags & O_WRITE) && S_ISREG(desc->type) && !desc->is_writer )
+	{
+		if ( !PageCache::AddWriter(desc->dev, desc->ino) )
+			return Ref<Descriptor>();
+		desc->is_writer = true;
+	}
+
 	// Truncate the file if requested.
 	if ( (flags & O_TRUNC) && S_ISREG(desc->type) )
 	{
@@ -955,8 +976,9 @@ Ref<Descriptor> Descriptor::open_elem(ioctx_t* ctx, const char* filename,
 	if ( !(flags & ACCESS_FLAGS) )
 		return errno = EINVAL, Ref<Descriptor>();
 
-	// Filter away flags that only make sense for descriptors.
-	int retvnode_flags = flags & ~DESCRIPTOR_FLAGS;
+	// Filter away flags that only make sense for descriptors. The file is
+	// truncated by open once it's known the file can be written to.
+	int retvnode_flags = flags & ~(DESCRIPTOR_FLAGS | O_TRUNC);
 	Ref<Vnode> retvnode = vnode->open(ctx, filename, retvnode_flags, mode);
 	if ( !retvnode )
 		return Ref<Descriptor>();
@@ -1244,7 +1266,8 @@ Ref<Descriptor> Descriptor::fsm_mount(ioctx_t* ctx,
                                       const struct stat* rootst,
                                       int flags)
 {
-	if ( flags & ~(FSM_MOUNT_NOFOLLOW | FSM_MOUNT_NONBLOCK) )
+	if ( flags & ~(FSM_MOUNT_NOFOLLOW | FSM_MOUNT_NONBLOCK |
+	               FSM_MOUNT_MULTIPLEX) )
 		return errno = EINVAL, Ref<Descriptor>(NULL);
 	int result_dflags = O_READ | O_WRITE;
 	if ( flags & FSM_MOUNT_NOFOLLOW ) result_dflags |= O_NONBLOCK;
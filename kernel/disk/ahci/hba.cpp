@@ -252,9 +252,13 @@ bool HBA::Initialize(Ref<Descriptor> dev, const char* devpath)
 			//ports[i]->Destroy();
 			// TODO: WARNING: FIXME: Shut down the port here, see the function
 			//                       ahci_port_destroy in the OS `kiwi'!
-			// TODO: Unsafe with respect to interrupt handler.
-			delete ports[i];
+			// The interrupt handler must not find the port once it's being
+			// destroyed.
+			Port* port = ports[i];
+			Interrupt::Disable();
 			ports[i] = NULL;
+			Interrupt::Enable();
+			delete port;
 			continue;
 		}
 	}
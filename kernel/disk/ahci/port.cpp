@@ -27,17 +27,21 @@
 #include <timespec.h>
 
 #include <sortix/clock.h>
+#include <sortix/fcntl.h>
 #include <sortix/mman.h>
 
 #include <sortix/kernel/addralloc.h>
 #include <sortix/kernel/clock.h>
+#include <sortix/kernel/copy.h>
+#include <sortix/kernel/interrupt.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kthread.h>
 #include <sortix/kernel/log.h>
 #include <sortix/kernel/memorymanagement.h>
+#include <sortix/kernel/pci-mmio.h>
 #include <sortix/kernel/random.h>
-#include <sortix/kernel/signal.h>
 #include <sortix/kernel/time.h>
+#include <sortix/kernel/timer.h>
 
 #include "ahci.h"
 #include "hba.h"
@@ -74,36 +78,82 @@ static void copy_ata_string(char* dest, const char* src, size_t length)
 	dest[length] = '\0';
 }
 
+
+// The errors that abort the commands in progress, as opposed to the port
+// changes that are merely acknowledged.
+static const uint32_t PORT_INTR_FATAL =
+	PXIE_OFE | PXIE_IFE | PXIE_HBDE | PXIE_HBFE | PXIE_TFEE;
+
+// The number of transfers to queue for devices without native command queuing.
+static const size_t NONQUEUED_SLOTS = 8;
+
+static void Port__InterruptWork(void* context)
+{
+	((Port*) context)->InterruptWork();
+}
+
+static void Port__OnTimer(Clock* /*clock*/, Timer* /*timer*/, void* user)
+{
+	((Port*) user)->OnTimer();
+}
+
 Port::Port(HBA* hba, uint32_t port_index)
 {
 	port_lock = KTHREAD_MUTEX_INITIALIZER;
+	slot_cond = KTHREAD_COND_INITIALIZER;
+	write_range_cond = KTHREAD_COND_INITIALIZER;
+	interrupt_work.handler = Port__InterruptWork;
+	interrupt_work.context = this;
+	timer.Attach(Time::GetClock(CLOCK_MONOTONIC));
 	memset(&control_alloc, 0, sizeof(control_alloc));
-	memset(&dma_alloc, 0, sizeof(dma_alloc));
+	memset(table_alloc, 0, sizeof(table_alloc));
+	memset(slots, 0, sizeof(slots));
+	first_write_range = NULL;
 	this->hba = hba;
 	regs = &hba->regs->ports[port_index];
-	control_physical_frame = 0;
-	dma_physical_frame = 0;
+	clist = NULL;
+	fis = NULL;
 	this->port_index = port_index;
-	is_control_page_mapped = false;
-	is_dma_page_mapped = false;
-	interrupt_signaled = false;
-	transfer_in_progress = false;
+	slot_count = 0;
+	depth = 1;
+	issued_count = 0;
+	exclusive_waiting = 0;
+	busy_slots = 0;
+	issued_slots = 0;
+	interrupt_status = 0;
+	interrupt_work_scheduled = false;
+	exclusive = false;
+	timer_armed = false;
+	is_lba48 = false;
+	is_ncq = false;
 }
 
 Port::~Port()
 {
-	if ( transfer_in_progress )
-		FinishTransferDMA();
-	if ( is_control_page_mapped )
-		Memory::Unmap(control_alloc.from);
-	FreeKernelAddress(&control_alloc);
-	if ( is_dma_page_mapped )
-		Memory::Unmap(dma_alloc.from);
-	FreeKernelAddress(&dma_alloc);
-	if ( control_physical_frame )
-		Page::Put(control_physical_frame, PAGE_USAGE_DRIVER);
-	if ( dma_physical_frame )
-		Page::Put(dma_physical_frame, PAGE_USAGE_DRIVER);
+	// The HBA no longer delivers interrupts to the port, but the interrupt
+	// work and the timer might still be scheduled. Both run with the port
+	// lock held and broadcast the slot condition when done. The timer isn't
+	// armed again once no commands are in progress.
+	regs->pxie = 0;
+	regs->pxis = regs->pxis;
+	kthread_mutex_lock(&port_lock);
+	while ( true )
+	{
+		if ( timer_armed && timer.TryCancel() )
+			timer_armed = false;
+		Interrupt::Disable();
+		bool work_scheduled = interrupt_work_scheduled;
+		Interrupt::Enable();
+		if ( !timer_armed && !work_scheduled )
+			break;
+		kthread_cond_wait(&slot_cond, &port_lock);
+	}
+	kthread_mutex_unlock(&port_lock);
+	for ( size_t i = 0; i < AHCI_COMMAND_HEADER_COUNT; i++ )
+		FreeSlot(i);
+	for ( size_t i = 0; i < AHCI_COMMAND_HEADER_COUNT; i++ )
+		FreeAllocatedAndMappedPage(&table_alloc[i]);
+	FreeAllocatedAndMappedPage(&control_alloc);
 }
 
 void Port::LogF(const char* format, ...)
@@ -117,6 +167,11 @@ void Port::LogF(const char* format, ...)
 	Log::PrintF("\n");
 }
 
+static size_t TableSize()
+{
+	return sizeof(struct command_table) + COMMAND_PRDS * sizeof(struct prd);
+}
+
 bool Port::Initialize()
 {
 	// TODO: Potentially move the wait-for-device-to-be-idle code here from hba.
@@ -127,51 +182,33 @@ bool Port::Initialize()
 	// Clear error bits.
 	regs->pxserr = regs->pxserr;
 
-	if ( !(control_physical_frame = Page::Get(PAGE_USAGE_DRIVER)) )
+	if ( !AllocateAndMapPage(&control_alloc, PAGE_USAGE_DRIVER) )
 	{
 		LogF("error: control page allocation failure");
 		return false;
 	}
 
-	if ( !(dma_physical_frame = Page::Get(PAGE_USAGE_DRIVER)) )
-	{
-		LogF("error: dma page allocation failure");
-		return false;
-	}
-
-	if ( !AllocateKernelAddress(&control_alloc, Page::Size()) )
-	{
-		LogF("error: control page virtual address allocation failure");
-		return false;
-	}
-
-	if ( !AllocateKernelAddress(&dma_alloc, Page::Size()) )
+	// The command tables are physically contiguous and must not cross pages.
+	size_t tables_per_page = Page::Size() / TableSize();
+	size_t table_pages =
+		(AHCI_COMMAND_HEADER_COUNT + tables_per_page - 1) / tables_per_page;
+	for ( size_t i = 0; i < table_pages; i++ )
 	{
-		LogF("error: dma page virtual address allocation failure");
-		return false;
+		if ( !AllocateAndMapPage(&table_alloc[i], PAGE_USAGE_DRIVER) )
+		{
+			LogF("error: command table page allocation failure");
+			return false;
+		}
+		memset((void*) table_alloc[i].from, 0, Page::Size());
 	}
 
-	int prot = PROT_KREAD | PROT_KWRITE;
-	is_control_page_mapped =
-		Memory::Map(control_physical_frame, control_alloc.from, prot);
-	if ( !is_control_page_mapped )
+	// The other slots are allocated once the device has been identified.
+	if ( !AllocateSlot(0) )
 	{
-		LogF("error: control page virtual address allocation failure");
+		LogF("error: dma buffer allocation failure");
 		return false;
 	}
 
-	Memory::Flush();
-
-	is_dma_page_mapped = Memory::Map(dma_physical_frame, dma_alloc.from, prot);
-	if ( !is_dma_page_mapped )
-	{
-
-		LogF("dma page virtual address allocation failure");
-		return false;
-	}
-
-	Memory::Flush();
-
 	return true;
 }
 
@@ -202,8 +239,9 @@ bool Port::FinishInitialize()
 	// Clear error bits.
 	regs->pxserr = regs->pxserr;
 
+
 	uintptr_t virt = control_alloc.from;
-	uintptr_t phys = control_physical_frame;
+	uintptr_t phys = control_alloc.phys;
 
 	memset((void*) virt, 0, Page::Size());
 
@@ -221,22 +259,26 @@ bool Port::FinishInitialize()
 	regs->pxfbu = pxf_addr >> 32;
 	offset += sizeof(struct fis);
 
-	ctbl = (volatile struct command_table*) (virt + offset);
-	uint64_t ctba_addr = phys + offset;
-	clist[0].ctba = ctba_addr >> 0;
-	clist[0].ctbau = ctba_addr >> 32;
-	offset += sizeof(struct command_table);
+	assert(offset <= Page::Size());
 
-	prdt = (volatile struct prd*) (virt + offset);
-	offset += sizeof(struct prd);
-	// TODO: There can be more of these, fill until end of page!
+	size_t tables_per_page = Page::Size() / TableSize();
+	for ( size_t i = 0; i < AHCI_COMMAND_HEADER_COUNT; i++ )
+	{
+		paddrmapped_t* table_page = &table_alloc[i / tables_per_page];
+		size_t table_offset = (i % tables_per_page) * TableSize();
+		uintptr_t table_virt = table_page->from + table_offset;
+		slots[i].ctbl = (volatile struct command_table*) table_virt;
+		slots[i].prdt = (volatile struct prd*)
+			(table_virt + sizeof(struct command_table));
+		uint64_t ctba_addr = table_page->phys + table_offset;
+		clist[i].ctba = ctba_addr >> 0;
+		clist[i].ctbau = ctba_addr >> 32;
+	}
 
 	// Enable FIS receive.
 	regs->pxcmd = regs->pxcmd | PXCMD_FRE;
 	ahci_port_flush(regs);
 
-	assert(offset <= Page::Size());
-
 	uint32_t ssts = regs->pxssts;
 	uint32_t pxtfd = regs->pxtfd;
 
@@ -268,19 +310,25 @@ bool Port::FinishInitialize()
 	             PXIE_DSE | PXIE_SDBE | PXIE_DPE;
 	ahci_port_flush(regs);
 
-	CommandDMA(ATA_CMD_IDENTIFY, 512, false);
-	if ( !AwaitInterrupt(500 /*ms*/) )
+	slot_count = 1;
+	kthread_mutex_lock(&port_lock);
+	size_t index = AcquireSlot(false);
+	Command(index, ATA_CMD_IDENTIFY, PrepareBounce(index, 512), false, false,
+	        500 /*ms*/);
+	bool identified = WaitSlot(index);
+	ReleaseSlot(index);
+	kthread_mutex_unlock(&port_lock);
+	if ( !identified )
 	{
-		LogF("error: IDENTIFY timed out");
-		transfer_in_progress = false;
+		LogF("error: IDENTIFY failed");
 		return false;
 	}
-	transfer_in_progress = false;
 
-	memcpy(identify_data, (void*) dma_alloc.from, sizeof(identify_data));
+	memcpy(identify_data, (void*) slots[index].buffer_alloc.from,
+	       sizeof(identify_data));
 	Random::Mix(Random::SOURCE_WEAK, identify_data, sizeof(identify_data));
 
-	little_uint16_t* words = (little_uint16_t*) dma_alloc.from;
+	little_uint16_t* words = (little_uint16_t*) slots[index].buffer_alloc.from;
 
 	if ( words[0] & (1 << 15) )
 		return errno = EINVAL, false; // Skipping non-ATA device.
@@ -329,6 +377,25 @@ bool Port::FinishInitialize()
 		return errno = EOVERFLOW, false;
 	}
 
+	// Queue commands natively if both the controller and the device support
+	// it, with as many commands in flight as both of them allow. Otherwise
+	// keep a few transfers queued so they can be merged and sorted while the
+	// device is busy.
+	size_t wanted = CAP_NCS(hba->regs->cap);
+	if ( is_lba48 && (hba->regs->cap & CAP_SNCQ) && (words[76] & (1 << 8)) )
+	{
+		size_t queue_depth = (words[75] & 0x1F) + 1;
+		if ( queue_depth < wanted )
+			wanted = queue_depth;
+		is_ncq = true;
+	}
+	else if ( NONQUEUED_SLOTS < wanted )
+		wanted = NONQUEUED_SLOTS;
+	while ( slot_count < wanted && AllocateSlot(slot_count) )
+		slot_count++;
+	depth = is_ncq ? slot_count : 1;
+	queue.SetLimits(is_lba48 ? 65535 : 255, COMMAND_PRDS);
+
 	this->block_count = (blkcnt_t) block_count;
 	this->block_size = (blkcnt_t) block_size;
 
@@ -405,14 +472,176 @@ bool Port::Reset()
 	return true;
 }
 
-void Port::Seek(blkcnt_t block_index, size_t count)
+bool Port::AllocateSlot(size_t index)
+{
+	struct slot* slot = &slots[index];
+	if ( !AllocateKernelAddress(&slot->buffer_alloc, SLOT_PAGES * Page::Size()) )
+		return false;
+	int prot = PROT_KREAD | PROT_KWRITE;
+	for ( size_t i = 0; i < SLOT_PAGES; i++ )
+	{
+		addr_t virt = slot->buffer_alloc.from + i * Page::Size();
+		if ( !(slot->buffer_pages[i] = Page::Get(PAGE_USAGE_DRIVER)) )
+			return FreeSlot(index), false;
+		if ( !Memory::Map(slot->buffer_pages[i], virt, prot) )
+		{
+			Page::Put(slot->buffer_pages[i], PAGE_USAGE_DRIVER);
+			slot->buffer_pages[i] = 0;
+			return FreeSlot(index), false;
+		}
+	}
+	Memory::Flush();
+	return true;
+}
+
+void Port::FreeSlot(size_t index)
+{
+	struct slot* slot = &slots[index];
+	for ( size_t i = 0; i < SLOT_PAGES; i++ )
+	{
+		if ( !slot->buffer_pages[i] )
+			continue;
+		Memory::Unmap(slot->buffer_alloc.from + i * Page::Size());
+		Page::Put(slot->buffer_pages[i], PAGE_USAGE_DRIVER);
+		slot->buffer_pages[i] = 0;
+	}
+	Memory::Flush();
+	FreeKernelAddress(&slot->buffer_alloc);
+}
+
+// Transfers share the port and use any free slot, while the other commands
+// must run alone on an idle port, and go first so they aren't starved.
+bool Port::HasFreeSlot(bool shared) // port_lock locked
+{
+	if ( exclusive )
+		return false;
+	if ( !shared )
+		return !busy_slots;
+	if ( exclusive_waiting )
+		return false;
+	for ( size_t i = 0; i < slot_count; i++ )
+		if ( !(busy_slots & 1U << i) )
+			return true;
+	return false;
+}
+
+size_t Port::AcquireSlot(bool shared) // port_lock locked
+{
+	if ( !shared )
+		exclusive_waiting++;
+	while ( !HasFreeSlot(shared) )
+		kthread_cond_wait(&slot_cond, &port_lock);
+	if ( !shared )
+	{
+		exclusive_waiting--;
+		exclusive = true;
+	}
+	size_t index = 0;
+	while ( busy_slots & 1U << index )
+		index++;
+	busy_slots |= 1U << index;
+	slots[index].pinned = false;
+	slots[index].request.merged = NULL;
+	slots[index].request.tag = index;
+	return index;
+}
+
+void Port::ReleaseSlot(size_t index) // port_lock locked
+{
+	assert(!slots[index].issued);
+	busy_slots &= ~(1U << index);
+	exclusive = false;
+	kthread_cond_broadcast(&slot_cond);
+}
+
+// Queues a transfer for the elevator, which might merge it with the transfers
+// next to it, and issues the transfers that the device has room for.
+void Port::Submit(size_t index, blkcnt_t block_index, size_t num_blocks,
+                  uint16_t prdtl, bool write) // port_lock locked
 {
+	struct slot* slot = &slots[index];
+	struct block_request* request = &slot->request;
+	request->block = block_index;
+	request->blocks = num_blocks;
+	request->segments = prdtl;
+	request->tag = index;
+	request->write = write;
+	slot->issued = true;
+	slot->failed = false;
+	queue.Insert(request, true);
+	Dispatch();
+}
+
+void Port::Dispatch() // port_lock locked
+{
+	struct block_request* request;
+	while ( issued_count < depth && (request = queue.Next()) )
+	{
+		// The first transfer's command also describes the merged transfers.
+		struct slot* slot = &slots[request->tag];
+		uint16_t prdtl = request->segments;
+		for ( struct block_request* merged = request->merged;
+		      merged;
+		      merged = merged->merged )
+		{
+			volatile struct prd* prdt = slots[merged->tag].prdt;
+			for ( size_t i = 0; i < merged->segments; i++ )
+			{
+				slot->prdt[prdtl].dba = prdt[i].dba;
+				slot->prdt[prdtl].dbau = prdt[i].dbau;
+				slot->prdt[prdtl].reserved1 = 0;
+				slot->prdt[prdtl].dw3 = prdt[i].dw3;
+				prdtl++;
+			}
+		}
+		bool queued = is_ncq;
+		uint8_t cmd;
+		if ( request->write )
+			cmd = queued ? ATA_CMD_WRITE_FPDMA_QUEUED :
+			      is_lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+		else
+			cmd = queued ? ATA_CMD_READ_FPDMA_QUEUED :
+			      is_lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+		Seek(request->tag, request->block, request->total_blocks, queued);
+		Command(request->tag, cmd, prdtl, request->write, queued,
+		        10000 /*ms*/);
+	}
+}
+
+void Port::Complete(size_t index, bool success) // port_lock locked
+{
+	issued_slots &= ~(1U << index);
+	issued_count--;
+	for ( struct block_request* request = &slots[index].request;
+	      request;
+	      request = request->merged )
+	{
+		slots[request->tag].issued = false;
+		slots[request->tag].failed = !success;
+	}
+}
+
+void Port::Seek(size_t index, blkcnt_t block_index, size_t count, bool queued)
+{
+	volatile struct command_table* ctbl = slots[index].ctbl;
 	uintmax_t lba = (uintmax_t) block_index;
-	if ( is_lba48 )
+	memset((void *)&ctbl->cfis, 0, sizeof(ctbl->cfis));
+	if ( queued )
+	{
+		// Queued commands have the count in the features and the tag in the
+		// count.
+		ctbl->cfis.features_0_7 = (count >> 0) & 0xff;
+		ctbl->cfis.features_8_15 = (count >> 8) & 0xff;
+		ctbl->cfis.count_0_7  = index << 3;
+	}
+	else
 	{
-		memset((void *)&ctbl->cfis, 0, sizeof(ctbl->cfis));
 		ctbl->cfis.count_0_7  = (count >> 0) & 0xff;
-		ctbl->cfis.count_8_15 = (count >> 8) & 0xff;
+		if ( is_lba48 )
+			ctbl->cfis.count_8_15 = (count >> 8) & 0xff;
+	}
+	if ( queued || is_lba48 )
+	{
 		ctbl->cfis.lba_0_7    = (lba >> 0) & 0xff;
 		ctbl->cfis.lba_8_15   = (lba >> 8) & 0xff;
 		ctbl->cfis.lba_16_23  = (lba >> 16) & 0xff;
@@ -423,7 +652,6 @@ void Port::Seek(blkcnt_t block_index, size_t count)
 	}
 	else
 	{
-		ctbl->cfis.count_0_7  = (count >> 0) & 0xff;
 		ctbl->cfis.lba_0_7    = (lba >> 0) & 0xff;
 		ctbl->cfis.lba_8_15   = (lba >> 8) & 0xff;
 		ctbl->cfis.lba_16_23  = (lba >> 16) & 0xff;
@@ -431,70 +659,169 @@ void Port::Seek(blkcnt_t block_index, size_t count)
 	}
 }
 
-void Port::CommandDMA(uint8_t cmd, size_t size, bool write)
+// Describes the slot's bounce buffer with a physical region descriptor per page.
+uint16_t Port::PrepareBounce(size_t index, size_t size) // port_lock locked
 {
+	struct slot* slot = &slots[index];
 	if ( 0 < size )
 	{
-		assert(size <= Page::Size());
+		assert(size <= SLOT_PAGES * Page::Size());
 		assert((size & 1) == 0); /* sizes & addresses must be 2-byte aligned */
 	}
+	uint16_t prdtl = 0;
+	for ( size_t done = 0; done < size; done += Page::Size() )
+	{
+		size_t amount = size - done;
+		if ( Page::Size() < amount )
+			amount = Page::Size();
+		uint64_t address = slot->buffer_pages[prdtl];
+		slot->prdt[prdtl].dba  = address >>  0 & 0xFFFFFFFF;
+		slot->prdt[prdtl].dbau = address >> 32 & 0xFFFFFFFF;
+		slot->prdt[prdtl].reserved1 = 0;
+		slot->prdt[prdtl].dw3 = amount - 1;
+		prdtl++;
+	}
+	return prdtl;
+}
+
+// Describes the caller's memory directly with a physical region descriptor per
+// page, using the physical frames of the pinned pages if given and otherwise
+// looking up the kernel memory, or returns zero if the controller can't reach
+// the memory.
+uint16_t Port::PrepareDirect(size_t index, uintptr_t addr, size_t size,
+                             const addr_t* frames) // port_lock locked
+{
+	struct slot* slot = &slots[index];
+	assert(0 < size);
+	assert(((addr | size) & 1) == 0); /* sizes & addresses must be 2-byte aligned */
+	uint16_t prdtl = 0;
+	while ( size )
+	{
+		assert(prdtl < SLOT_PAGES);
+		size_t amount = Page::Size() - (addr & (Page::Size() - 1));
+		if ( size < amount )
+			amount = size;
+		addr_t page;
+		if ( frames )
+			page = frames[prdtl];
+		else if ( !Memory::LookUp(Page::AlignDown(addr), &page, NULL) )
+			return 0;
+		uint64_t address = page + (addr & (Page::Size() - 1));
+		if ( (address >> 32) && !(hba->regs->cap & CAP_S64A) )
+			return 0;
+		slot->prdt[prdtl].dba  = address >>  0 & 0xFFFFFFFF;
+		slot->prdt[prdtl].dbau = address >> 32 & 0xFFFFFFFF;
+		slot->prdt[prdtl].reserved1 = 0;
+		slot->prdt[prdtl].dw3 = amount - 1;
+		prdtl++;
+		addr += amount;
+		size -= amount;
+	}
+	return prdtl;
+}
+
+void Port::Command(size_t index, uint8_t cmd, uint16_t prdtl, bool write,
+                   bool queued, unsigned int msecs) // port_lock locked
+{
+	struct slot* slot = &slots[index];
 
 	// Set up the command header.
 	uint16_t fis_length = 5 /* dwords */;
-	uint16_t prdtl = size ? 1 : 0;
-	uint16_t clist_0_dw0l = fis_length;
+	uint16_t dw0l = fis_length;
 	if ( write )
-		clist_0_dw0l |= COMMAND_HEADER_DW0_WRITE;
-	clist[0].dw0l = clist_0_dw0l;
-	clist[0].prdtl = prdtl;
-	clist[0].prdbc = 0;
-
-	// Set up the physical region descriptor.
-	if ( prdtl )
-	{
-		uint32_t prdt_0_dbc = size - 1;
-		uint32_t prdt_0_dw3 = prdt_0_dbc;
-		prdt[0].dba  = (uint64_t) dma_physical_frame >>  0 & 0xFFFFFFFF;
-		prdt[0].dbau = (uint64_t) dma_physical_frame >> 32 & 0xFFFFFFFF;
-		prdt[0].reserved1 = 0;
-		prdt[0].dw3 = prdt_0_dw3;
-	}
+		dw0l |= COMMAND_HEADER_DW0_WRITE;
+	clist[index].dw0l = dw0l;
+	clist[index].prdtl = prdtl;
+	clist[index].prdbc = 0;
 
 	// Set up the command table.
-	ctbl->cfis.type = 0x27;
-	ctbl->cfis.pm_port = 0;
-	ctbl->cfis.c_bit = 1;
-	ctbl->cfis.command = cmd;
-
-	// Anticipate we will be delivered an IRQ.
-	PrepareAwaitInterrupt();
-	transfer_in_progress = true;
-	transfer_size = size;
-	transfer_is_write = write;
+	slot->ctbl->cfis.type = 0x27;
+	slot->ctbl->cfis.pm_port = 0;
+	slot->ctbl->cfis.c_bit = 1;
+	slot->ctbl->cfis.command = cmd;
+
+	struct timespec timeout =
+		timespec_make(msecs / 1000, (msecs % 1000) * 1000000L);
+	slot->deadline = timespec_add(Time::Get(CLOCK_MONOTONIC), timeout);
+	slot->issued = true;
+	slot->failed = false;
+	issued_slots |= 1U << index;
+	issued_count++;
+	SetTimer();
 
 	// Execute the command.
-	regs->pxci = 1;
+	if ( queued )
+		regs->pxsact = 1U << index;
+	regs->pxci = 1U << index;
 	ahci_port_flush(regs);
 }
 
-bool Port::FinishTransferDMA()
+bool Port::WaitSlot(size_t index) // port_lock locked
 {
-	assert(transfer_in_progress);
+	// TODO: Can't safely back out here unless the pending operation is
+	//       is properly cancelled.
+	while ( slots[index].issued )
+		kthread_cond_wait(&slot_cond, &port_lock);
+	if ( slots[index].failed )
+		return errno = EIO, false;
+	return true;
+}
 
-	// Wait for an interrupt to arrive.
-	if ( !AwaitInterrupt(10000 /*ms*/) )
+// The device aborts every queued command on an error, so stop the port to
+// discard the commands, restart it, and fail all the commands in progress.
+void Port::Recover() // port_lock locked
+{
+	regs->pxcmd = regs->pxcmd & ~PXCMD_ST;
+	if ( !WaitClear(&regs->pxcmd, PXCMD_CR, false, 500) )
+		LogF("error: timeout waiting for PXCMD_CR to clear");
+	regs->pxserr = regs->pxserr;
+	regs->pxis = regs->pxis;
+	if ( (regs->pxtfd & (ATA_STATUS_BSY | ATA_STATUS_DRQ)) &&
+	     (hba->regs->cap & CAP_SCLO) )
 	{
-		const char* op = transfer_is_write ? "write" : "read";
-		LogF("error: %s timed out", op);
-		transfer_in_progress = false;
-		return errno = EIO, false;
+		regs->pxcmd = regs->pxcmd | PXCMD_CLO;
+		if ( !WaitClear(&regs->pxcmd, PXCMD_CLO, false, 500) )
+			LogF("error: timeout waiting for PXCMD_CLO to clear");
 	}
+	regs->pxcmd = regs->pxcmd | PXCMD_ST;
+	ahci_port_flush(regs);
+	for ( size_t i = 0; i < slot_count; i++ )
+		if ( issued_slots & 1U << i )
+			Complete(i, false);
+	kthread_cond_broadcast(&slot_cond);
+	Dispatch();
+}
 
-	while ( transfer_is_write && regs->pxtfd & ATA_STATUS_BSY )
-		kthread_yield();
+void Port::SetTimer() // port_lock locked
+{
+	if ( timer_armed || !issued_slots )
+		return;
+	struct itimerspec timeout;
+	memset(&timeout, 0, sizeof(timeout));
+	timeout.it_value = timespec_make(1, 0);
+	int flags = TIMER_FUNC_MAY_DEALLOCATE_TIMER;
+	timer.Set(&timeout, NULL, flags, Port__OnTimer, this);
+	timer_armed = true;
+}
 
-	transfer_in_progress = false;
-	return true;
+void Port::OnTimer()
+{
+	ScopedLock lock(&port_lock);
+	timer_armed = false;
+	struct timespec now = Time::Get(CLOCK_MONOTONIC);
+	for ( size_t i = 0; i < slot_count; i++ )
+	{
+		if ( (issued_slots & 1U << i) &&
+		     timespec_le(slots[i].deadline, now) )
+		{
+			LogF("error: command timed out");
+			Recover();
+			break;
+		}
+	}
+	SetTimer();
+	if ( !timer_armed )
+		kthread_cond_broadcast(&slot_cond);
 }
 
 off_t Port::GetSize()
@@ -561,20 +888,18 @@ int Port::sync(ioctx_t* ctx)
 {
 	(void) ctx;
 	ScopedLock lock(&port_lock);
-	if ( transfer_in_progress && !FinishTransferDMA() )
-		return -1;
-	PrepareAwaitInterrupt();
+	size_t index = AcquireSlot(false);
 	uint8_t cmd = is_lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE;
-	CommandDMA(cmd, 0, false);
 	// TODO: This might take longer than 30 seconds according to the spec. But
 	//       how long? Let's say twice that?
-	if ( !AwaitInterrupt(2 * 30000 /*ms*/) )
+	Command(index, cmd, 0, false, false, 2 * 30000 /*ms*/);
+	bool success = WaitSlot(index);
+	ReleaseSlot(index);
+	if ( !success )
 	{
-		LogF("error: cache flush timed out");
-		transfer_in_progress = false;
-		return errno = EIO, -1;
+		LogF("error: cache flush failed");
+		return -1;
 	}
-	transfer_in_progress = false;
 	if ( regs->pxtfd & (ATA_STATUS_ERR | ATA_STATUS_DF) )
 	{
 		LogF("error: IO error");
@@ -583,116 +908,246 @@ int Port::sync(ioctx_t* ctx)
 	return 0;
 }
 
-ssize_t Port::pread(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off)
+// Waits until no other write covers the blocks and then covers them, as the
+// partial blocks at the ends of a write are read, modified, and written back
+// with the port lock released while copying, and a concurrent write to the
+// same blocks would otherwise be lost.
+void Port::LockWriteRange(struct write_range* range, uintmax_t first_block,
+                          uintmax_t last_block) // port_lock locked
 {
-	ScopedLock lock(&port_lock);
-	ssize_t result = 0;
-	while ( count )
+	while ( true )
 	{
-		if ( device_size <= off )
+		bool overlaps = false;
+		for ( struct write_range* iter = first_write_range;
+		      !overlaps && iter;
+		      iter = iter->next )
+			overlaps = iter->first_block <= last_block &&
+			           first_block <= iter->last_block;
+		if ( !overlaps )
 			break;
-		if ( (uintmax_t) device_size - off < (uintmax_t) count )
-			count = (size_t) device_size - off;
-		uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
-		uintmax_t block_offset = (uintmax_t) off % (uintmax_t) block_size;
-		uintmax_t amount = block_offset + count;
-		if ( Page::Size() < amount )
-			amount = Page::Size();
-		size_t num_blocks = (amount + block_size - 1) / block_size;
-		uintmax_t full_amount = num_blocks * block_size;
-		// If an asynchronous operation is in progress, let it finish.
-		if ( transfer_in_progress && !FinishTransferDMA() )
-			return result ? result : -1;
-		unsigned char* dma_data = (unsigned char*) dma_alloc.from;
-		unsigned char* data = dma_data + block_offset;
-		size_t data_size = amount - block_offset;
-		Seek(block_index, num_blocks);
-		uint8_t cmd = is_lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
-		CommandDMA(cmd, (size_t) full_amount, false);
-		if ( !FinishTransferDMA() )
-			return result ? result : -1;
-		if ( !ctx->copy_to_dest(buf, data, data_size) )
-			return result ? result : -1;
-		buf += data_size;
-		count -= data_size;
-		result += data_size;
-		off += data_size;
-	}
-	return result;
+		kthread_cond_wait(&write_range_cond, &port_lock);
+	}
+	range->first_block = first_block;
+	range->last_block = last_block;
+	range->prev = NULL;
+	range->next = first_write_range;
+	if ( first_write_range )
+		first_write_range->prev = range;
+	first_write_range = range;
 }
 
-ssize_t Port::pwrite(ioctx_t* ctx, const unsigned char* buf, size_t count, off_t off)
+void Port::UnlockWriteRange(struct write_range* range) // port_lock locked
+{
+	if ( range->prev )
+		range->prev->next = range->next;
+	else
+		first_write_range = range->next;
+	if ( range->next )
+		range->next->prev = range->prev;
+	kthread_cond_broadcast(&write_range_cond);
+}
+
+// Transfers in chunks of up to a slot's buffer, issuing the next chunks while
+// the earlier ones are in flight, and finishing them in order so the result is
+// the amount transferred before the first failure. The block aligned chunks go
+// directly to and from the caller's memory for the kernel and for O_DIRECT,
+// with the bounce buffers only used for the misaligned parts.
+ssize_t Port::Transfer(ioctx_t* ctx, unsigned char* buf, size_t count,
+                       off_t off, bool write)
 {
 	ScopedLock lock(&port_lock);
-	ssize_t result = 0;
-	while ( count )
+	if ( device_size <= off )
+		return 0;
+	if ( (uintmax_t) device_size - off < (uintmax_t) count )
+		count = (size_t) device_size - off;
+	if ( !count )
+		return 0;
+	struct write_range range;
+	if ( write )
+		LockWriteRange(&range, (uintmax_t) off / (uintmax_t) block_size,
+		               ((uintmax_t) off + count - 1) / (uintmax_t) block_size);
+	// User memory is pinned a chunk at a time right before the chunk is
+	// submitted directly, and unpinned when the chunk is done, and no lock is
+	// held while pinning, as it might read a file on this very device. The
+	// transfers through the bounce buffers copy the memory with the port lock
+	// released instead.
+	bool is_kernel = ctx->copy_to_dest == CopyToKernel;
+	bool direct = is_kernel || (ctx->dflags & O_DIRECT);
+	addr_t chunk_frames[SLOT_PAGES];
+	size_t chunk_size = 0;
+	bool chunk_pinned = false;
+	size_t pending_slot[AHCI_COMMAND_HEADER_COUNT];
+	size_t pending_offset[AHCI_COMMAND_HEADER_COUNT];
+	size_t pending_size[AHCI_COMMAND_HEADER_COUNT];
+	bool pending_direct[AHCI_COMMAND_HEADER_COUNT];
+	size_t pending_first = 0;
+	size_t pending_count = 0;
+	size_t issued = 0;
+	size_t done = 0;
+	bool failed = false;
+	while ( pending_count || (!failed && issued < count) )
 	{
-		if ( device_size <= off )
-			break;
-		if ( (uintmax_t) device_size - off < (uintmax_t) count )
-			count = (size_t) device_size - off;
-		uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
-		uintmax_t block_offset = (uintmax_t) off % (uintmax_t) block_size;
-		uintmax_t amount = block_offset + count;
-		if ( Page::Size() < amount )
-			amount = Page::Size();
-		size_t num_blocks = (amount + block_size - 1) / block_size;
-		uintmax_t full_amount =  num_blocks * block_size;
-		// If an asynchronous operation is in progress, let it finish.
-		if ( transfer_in_progress && !FinishTransferDMA() )
-			return result ? result : -1;
-		unsigned char* dma_data = (unsigned char*) dma_alloc.from;
-		unsigned char* data = dma_data + block_offset;
-		size_t data_size = amount - block_offset;
-		if ( block_offset || amount < full_amount )
+		// Issue another command if a slot is free, but only wait for a slot if
+		// there's nothing in flight, as the slots might all be ours.
+		if ( !failed && issued < count && (!pending_count || HasFreeSlot(true)) )
 		{
-			Seek(block_index, num_blocks);
-			uint8_t cmd = is_lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
-			CommandDMA(cmd, (size_t) full_amount, false);
-			if ( !FinishTransferDMA() )
-				return result ? result : -1;
+			off_t position = off + issued;
+			uintmax_t block_index = (uintmax_t) position / (uintmax_t) block_size;
+			uintmax_t block_offset = (uintmax_t) position % (uintmax_t) block_size;
+			uintptr_t addr = (uintptr_t) (buf + issued);
+			// Transfer as many whole blocks directly as the descriptors allow.
+			size_t direct_amount = 0;
+			if ( direct && !block_offset && !(addr & 1) &&
+			     (size_t) block_size <= count - issued )
+			{
+				direct_amount = count - issued;
+				size_t max_amount = SLOT_PAGES * Page::Size() -
+				                    (addr & (Page::Size() - 1));
+				if ( max_amount < direct_amount )
+					direct_amount = max_amount;
+				direct_amount -= direct_amount % block_size;
+			}
+			if ( direct_amount && !is_kernel && !chunk_pinned )
+			{
+				kthread_mutex_unlock(&port_lock);
+				chunk_pinned = PinUserMemory((void*) addr, direct_amount, !write,
+				                             chunk_frames);
+				chunk_size = direct_amount;
+				kthread_mutex_lock(&port_lock);
+				if ( !chunk_pinned )
+					failed = true;
+				// Another thread might have taken the last free slot meanwhile.
+				continue;
+			}
+			size_t index = AcquireSlot(true);
+			uint16_t prdtl;
+			if ( direct_amount &&
+			     (prdtl = PrepareDirect(index, addr, direct_amount,
+			                            is_kernel ? NULL : chunk_frames)) )
+			{
+				size_t num_blocks = direct_amount / block_size;
+				struct slot* slot = &slots[index];
+				if ( chunk_pinned )
+				{
+					slot->pinned = true;
+					slot->pinned_addr = addr;
+					slot->pinned_size = chunk_size;
+					memcpy(slot->pinned_frames, chunk_frames,
+					       sizeof(chunk_frames));
+					chunk_pinned = false;
+				}
+				Submit(index, block_index, num_blocks, prdtl, write);
+				size_t pending = (pending_first + pending_count++) %
+				                 AHCI_COMMAND_HEADER_COUNT;
+				pending_slot[pending] = index;
+				pending_offset[pending] = 0;
+				pending_size[pending] = direct_amount;
+				pending_direct[pending] = true;
+				issued += direct_amount;
+				continue;
+			}
+			// The controller can't reach the memory, so use the bounce buffer.
+			if ( chunk_pinned )
+			{
+				UnpinUserMemory((void*) addr, chunk_size, chunk_frames);
+				chunk_pinned = false;
+			}
+			uintmax_t amount = block_offset + (count - issued);
+			if ( SLOT_PAGES * Page::Size() < amount )
+				amount = SLOT_PAGES * Page::Size();
+			size_t num_blocks = (amount + block_size - 1) / block_size;
+			uintmax_t full_amount = num_blocks * block_size;
+			unsigned char* dma_data = (unsigned char*) slots[index].buffer_alloc.from;
+			unsigned char* data = dma_data + block_offset;
+			size_t data_size = amount - block_offset;
+			if ( write )
+			{
+				if ( block_offset || amount < full_amount )
+				{
+					Submit(index, block_index, num_blocks,
+					       PrepareBounce(index, (size_t) full_amount), false);
+					if ( !WaitSlot(index) )
+					{
+						ReleaseSlot(index);
+						failed = true;
+						continue;
+					}
+				}
+				kthread_mutex_unlock(&port_lock);
+				bool copied = ctx->copy_from_src(data, buf + issued, data_size);
+				kthread_mutex_lock(&port_lock);
+				if ( !copied )
+				{
+					ReleaseSlot(index);
+					failed = true;
+					continue;
+				}
+			}
+			Submit(index, block_index, num_blocks,
+			       PrepareBounce(index, (size_t) full_amount), write);
+			size_t pending = (pending_first + pending_count++) %
+			                 AHCI_COMMAND_HEADER_COUNT;
+			pending_slot[pending] = index;
+			pending_offset[pending] = block_offset;
+			pending_size[pending] = data_size;
+			pending_direct[pending] = false;
+			issued += data_size;
+			continue;
 		}
-		if ( !ctx->copy_from_src(data, buf, data_size) )
-			return result ? result : -1;
-		Seek(block_index, num_blocks);
-		uint8_t cmd = is_lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
-		CommandDMA(cmd, (size_t) full_amount, true);
-		// Let the transfer finish asynchronously so the caller can prepare the
-		// next write operation to keep the write pipeline busy.
-		buf += data_size;
-		count -= data_size;
-		result += data_size;
-		off += data_size;
+		// Finish the oldest command in flight.
+		size_t index = pending_slot[pending_first];
+		size_t block_offset = pending_offset[pending_first];
+		size_t data_size = pending_size[pending_first];
+		bool was_direct = pending_direct[pending_first];
+		pending_first = (pending_first + 1) % AHCI_COMMAND_HEADER_COUNT;
+		pending_count--;
+		if ( !WaitSlot(index) )
+		{
+			if ( !failed )
+			{
+				const char* op = write ? "write" : "read";
+				LogF("error: %s failed", op);
+			}
+			failed = true;
+		}
+		if ( !failed && !write && !was_direct )
+		{
+			unsigned char* dma_data = (unsigned char*) slots[index].buffer_alloc.from;
+			unsigned char* data = dma_data + block_offset;
+			kthread_mutex_unlock(&port_lock);
+			bool copied = ctx->copy_to_dest(buf + done, data, data_size);
+			kthread_mutex_lock(&port_lock);
+			if ( !copied )
+				failed = true;
+		}
+		if ( slots[index].pinned )
+		{
+			struct slot* slot = &slots[index];
+			UnpinUserMemory((void*) slot->pinned_addr, slot->pinned_size,
+			                slot->pinned_frames);
+			slot->pinned = false;
+		}
+		if ( !failed )
+			done += data_size;
+		ReleaseSlot(index);
 	}
-	return result;
+	if ( chunk_pinned )
+		UnpinUserMemory(buf + issued, chunk_size, chunk_frames);
+	if ( write )
+		UnlockWriteRange(&range);
+	if ( failed && !done )
+		return -1;
+	return (ssize_t) done;
 }
 
-void Port::PrepareAwaitInterrupt()
+ssize_t Port::pread(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off)
 {
-	interrupt_signaled = false;
+	return Transfer(ctx, buf, count, off, false);
 }
 
-bool Port::AwaitInterrupt(unsigned int msecs)
+ssize_t Port::pwrite(ioctx_t* ctx, const unsigned char* buf, size_t count, off_t off)
 {
-	struct timespec timeout = timespec_make(msecs / 1000, (msecs % 1000) * 1000000L);
-	Clock* clock = Time::GetClock(CLOCK_BOOTTIME);
-	struct timespec begun;
-	clock->Get(&begun, NULL);
-	while ( true )
-	{
-		struct timespec now;
-		clock->Get(&now, NULL);
-		if ( interrupt_signaled )
-			return true;
-		struct timespec elapsed = timespec_sub(now, begun);
-		if ( timespec_le(timeout, elapsed) )
-			return errno = ETIMEDOUT, false;
-		// TODO: Can't safely back out here unless the pending operation is
-		//       is properly cancelled.
-		//if ( Signal::IsPending() )
-		//	return errno = EINTR, false;
-		kthread_yield();
-	}
+	return Transfer(ctx, (unsigned char*) buf, count, off, true);
 }
 
 void Port::OnInterrupt()
@@ -707,16 +1162,45 @@ void Port::OnInterrupt()
 
 	// Handle error interrupts.
 	if ( is & PORT_INTR_ERROR )
-	{
 		regs->pxserr = regs->pxserr;
-		// TODO: How exactly should this be handled?
+
+	// Complete the commands in the interrupt worker thread.
+	interrupt_status |= is;
+	if ( !interrupt_work_scheduled )
+	{
+		interrupt_work_scheduled = true;
+		Interrupt::ScheduleWork(&interrupt_work);
+	}
+}
+
+void Port::InterruptWork()
+{
+	// The work remains scheduled until the port lock is held, so the port
+	// isn't destroyed while the work is about to run.
+	ScopedLock lock(&port_lock);
+	Interrupt::Disable();
+	uint32_t is = interrupt_status;
+	interrupt_status = 0;
+	interrupt_work_scheduled = false;
+	Interrupt::Enable();
+
+	if ( is & PORT_INTR_FATAL )
+	{
+		LogF("error: IO error");
+		Recover();
+		return;
 	}
 
-	if ( !interrupt_signaled )
+	// The commands are complete once the device no longer reports them.
+	uint32_t running = regs->pxci | regs->pxsact;
+	for ( size_t i = 0; i < slot_count; i++ )
 	{
-		interrupt_signaled = true;
-		// TODO: Priority schedule the blocking thread now.
+		if ( !(issued_slots & 1U << i) || (running & 1U << i) )
+			continue;
+		Complete(i, true);
 	}
+	kthread_cond_broadcast(&slot_cond);
+	Dispatch();
 }
 
 } // namespace AHCI
@@ -27,8 +27,14 @@
 
 #include <sortix/kernel/addralloc.h>
 #include <sortix/kernel/harddisk.h>
+#include <sortix/kernel/interrupt.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kthread.h>
+#include <sortix/kernel/pci-mmio.h>
+#include <sortix/kernel/timer.h>
+
+#include "../queue.h"
+#include "registers.h"
 
 namespace Sortix {
 namespace AHCI {
@@ -41,6 +47,38 @@ struct prd;
 
 class HBA;
 
+// Each slot transfers up to this many pages at once through its own bounce
+// buffer, with a physical region descriptor per page.
+static const size_t SLOT_PAGES = 16;
+
+// Commands have room for the descriptors of several merged transfers.
+static const size_t COMMAND_PRDS = 4 * SLOT_PAGES;
+
+struct slot
+{
+	volatile struct command_table* ctbl;
+	volatile struct prd* prdt;
+	struct block_request request;
+	addralloc_t buffer_alloc;
+	addr_t buffer_pages[SLOT_PAGES];
+	addr_t pinned_frames[SLOT_PAGES];
+	uintptr_t pinned_addr;
+	size_t pinned_size;
+	struct timespec deadline;
+	bool issued;
+	bool failed;
+	bool pinned;
+};
+
+// The blocks covered by a write in progress.
+struct write_range
+{
+	struct write_range* prev;
+	struct write_range* next;
+	uintmax_t first_block;
+	uintmax_t last_block;
+};
+
 class Port : public Harddisk
 {
 public:
@@ -68,47 +106,75 @@ public:
 	bool Initialize();
 	bool FinishInitialize();
 	void OnInterrupt();
+	void InterruptWork();
+	void OnTimer();
 
 private:
 	__attribute__((format(printf, 2, 3)))
 	void LogF(const char* format, ...);
 	bool Reset();
-	void Seek(blkcnt_t block_index, size_t count);
-	void CommandDMA(uint8_t cmd, size_t size, bool write);
-	bool FinishTransferDMA();
-	void PrepareAwaitInterrupt();
-	bool AwaitInterrupt(unsigned int msescs);
+	bool AllocateSlot(size_t index);
+	void FreeSlot(size_t index);
+	bool HasFreeSlot(bool shared);
+	size_t AcquireSlot(bool shared);
+	void ReleaseSlot(size_t index);
+	void Submit(size_t index, blkcnt_t block_index, size_t num_blocks,
+	            uint16_t prdtl, bool write);
+	void Dispatch();
+	void Complete(size_t index, bool success);
+	void Seek(size_t index, blkcnt_t block_index, size_t count, bool queued);
+	uint16_t PrepareBounce(size_t index, size_t size);
+	uint16_t PrepareDirect(size_t index, uintptr_t addr, size_t size,
+	                       const addr_t* frames);
+	void Command(size_t index, uint8_t cmd, uint16_t prdtl, bool write,
+	             bool queued, unsigned int msecs);
+	bool WaitSlot(size_t index);
+	void Recover();
+	void SetTimer();
+	void LockWriteRange(struct write_range* range, uintmax_t first_block,
+	                    uintmax_t last_block);
+	void UnlockWriteRange(struct write_range* range);
+	ssize_t Transfer(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off,
+	                 bool write);
 
 private:
 	kthread_mutex_t port_lock;
+	kthread_cond_t slot_cond;
+	kthread_cond_t write_range_cond;
+	struct interrupt_work interrupt_work;
+	Timer timer;
+	BlockQueue queue;
 	unsigned char identify_data[512];
 	char serial[20 + 1];
 	char revision[8 + 1];
 	char model[40 + 1];
-	addralloc_t control_alloc;
-	addralloc_t dma_alloc;
+	paddrmapped_t control_alloc;
+	paddrmapped_t table_alloc[AHCI_COMMAND_HEADER_COUNT];
+	struct slot slots[AHCI_COMMAND_HEADER_COUNT];
+	struct write_range* first_write_range;
 	HBA* hba;
 	volatile struct port_regs* regs;
 	volatile struct command_header* clist;
 	volatile struct fis* fis;
-	volatile struct command_table* ctbl;
-	volatile struct prd* prdt;
-	addr_t control_physical_frame;
-	addr_t dma_physical_frame;
 	uint32_t port_index;
-	bool is_control_page_mapped;
-	bool is_dma_page_mapped;
+	size_t slot_count;
+	size_t depth;
+	size_t issued_count;
+	size_t exclusive_waiting;
+	uint32_t busy_slots;
+	uint32_t issued_slots;
+	uint32_t interrupt_status;
+	bool interrupt_work_scheduled;
+	bool exclusive;
+	bool timer_armed;
 	bool is_lba48;
+	bool is_ncq;
 	off_t device_size;
 	blksize_t block_count;
 	blkcnt_t block_size;
 	uint16_t cylinder_count;
 	uint16_t head_count;
 	uint16_t sector_count;
-	volatile bool interrupt_signaled;
-	bool transfer_in_progress;
-	size_t transfer_size;
-	bool transfer_is_write;
 
 };
 
@@ -25,10 +25,12 @@
 #include <timespec.h>
 
 #include <sortix/clock.h>
+#include <sortix/fcntl.h>
 #include <sortix/mman.h>
 
 #include <sortix/kernel/addralloc.h>
 #include <sortix/kernel/clock.h>
+#include <sortix/kernel/copy.h>
 #include <sortix/kernel/ioport.h>
 #include <sortix/kernel/kthread.h>
 #include <sortix/kernel/log.h>
@@ -389,7 +391,7 @@ bool Port::CommandATAPI(size_t response_size, bool no_error)
 	outport8(channel->port_base + REG_LBA_LOW, 0x08);
 	outport8(channel->port_base + REG_LBA_MID, 0x08);
 	if ( is_using_dma )
-		CommandDMA(CMD_PACKET, response_size, false);
+		CommandDMA(CMD_PACKET, response_size, false, dma_physical_frame);
 	else
 		CommandPIO(CMD_PACKET, response_size, false);
 	if ( !TransferPIO(sizeof(struct atapi_packet), true, no_error) )
@@ -439,7 +441,7 @@ void Port::Seek(blkcnt_t block_index, size_t count)
 	outport8(channel->port_base + REG_LBA_HIGH, lba >> 16 & 0xFF);
 }
 
-void Port::CommandDMA(uint8_t cmd, size_t size, bool write)
+void Port::CommandDMA(uint8_t cmd, size_t size, bool write, addr_t physical)
 {
 	assert(size);
 	assert(size <= Page::Size());
@@ -447,7 +449,7 @@ void Port::CommandDMA(uint8_t cmd, size_t size, bool write)
 	assert((size & 1) == 0); /* sizes and addresses must be 2-byte aligned */
 
 	// Store the DMA region in the first PRD.
-	prdt->physical = dma_physical_frame >> 0 & 0xFFFFFFFF;
+	prdt->physical = physical >> 0 & 0xFFFFFFFF;
 	prdt->count = size;
 	prdt->flags = PRD_FLAG_EOT;
 
@@ -719,71 +721,261 @@ int Port::sync(ioctx_t* ctx)
 	return 0;
 }
 
+// Returns how much of the transfer can go directly to or from the caller's
+// memory, which is the whole blocks within the first page for the kernel and
+// for O_DIRECT, or zero if the bounce page must be used instead.
+size_t Port::DirectAmount(ioctx_t* ctx, const unsigned char* buf, size_t count,
+                          off_t off)
+{
+	bool is_kernel = ctx->copy_to_dest == CopyToKernel;
+	if ( !is_kernel && !(ctx->dflags & O_DIRECT) )
+		return 0;
+	if ( !is_using_dma || is_packet_interface )
+		return 0;
+	if ( (uintmax_t) off % (uintmax_t) block_size )
+		return 0;
+	uintptr_t addr = (uintptr_t) buf;
+	if ( addr & 1 ) /* sizes and addresses must be 2-byte aligned */
+		return 0;
+	size_t amount = Page::Size() - (addr & (Page::Size() - 1));
+	if ( count < amount )
+		amount = count;
+	amount -= amount % block_size;
+	return amount;
+}
+
+// Transfers whole blocks within a page directly to or from the caller's memory,
+// returning the amount transferred, or zero at the end of the device or if the
+// controller can't reach the memory. User memory is pinned only for this
+// transfer, before taking the locks, as pinning might read a file on this very
+// device.
+ssize_t Port::TransferDirect(ioctx_t* ctx, unsigned char* buf, size_t count,
+                             off_t off, bool write)
+{
+	bool is_kernel = ctx->copy_to_dest == CopyToKernel;
+	uintptr_t addr = (uintptr_t) buf;
+	addr_t frame;
+	if ( is_kernel )
+	{
+		if ( !Memory::LookUp(Page::AlignDown(addr), &frame, NULL) )
+			return errno = EFAULT, -1;
+	}
+	else if ( !PinUserMemory(buf, count, !write, &frame) )
+		return -1;
+	ssize_t result = TransferPhysical(frame + (addr & (Page::Size() - 1)),
+	                                  count, off, write);
+	if ( !is_kernel )
+		UnpinUserMemory(buf, count, &frame);
+	return result;
+}
+
+ssize_t Port::TransferPhysical(addr_t physical, size_t count, off_t off,
+                               bool write)
+{
+	ScopedLock lock(&channel->hw_lock);
+	if ( device_size <= off )
+		return 0;
+	if ( (uintmax_t) device_size - off < (uintmax_t) count )
+		count = (size_t) device_size - off;
+	count -= count % block_size;
+	// The physical region descriptors only have 32-bit addresses.
+	if ( !count || ((uint64_t) physical >> 32) )
+		return 0;
+	uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
+	size_t num_blocks = count / block_size;
+	// Take turns with the other transfers in the elevator order.
+	struct block_request request;
+	request.block = (blkcnt_t) block_index;
+	request.blocks = num_blocks;
+	request.segments = 0;
+	request.write = write;
+	ScopedBlockTurn turn(&queue, &request, &channel->hw_lock);
+	channel->SelectDrive(port_index);
+	// If an asynchronous operation is in progress, let it finish.
+	if ( transfer_in_progress && !FinishTransferDMA() )
+		return -1;
+	Seek(block_index, num_blocks);
+	uint8_t cmd = write ? (is_lba48 ? CMD_WRITE_DMA_EXT : CMD_WRITE_DMA)
+	                    : (is_lba48 ? CMD_READ_DMA_EXT : CMD_READ_DMA);
+	CommandDMA(cmd, count, write, physical);
+	if ( !FinishTransferDMA() )
+		return -1;
+	return (ssize_t) count;
+}
+
+// Reads up to a page from the device into the kernel buffer, returning the
+// amount read, or zero at the end of the device. The caller copies the data to
+// its destination after the locks are released, as faulting in user memory
+// might read a file on this very device.
+ssize_t Port::ReadChunk(unsigned char* dest, size_t count, off_t off)
+{
+	ScopedLock lock(&channel->hw_lock);
+	if ( device_size <= off )
+		return 0;
+	if ( (uintmax_t) device_size - off < (uintmax_t) count )
+		count = (size_t) device_size - off;
+	uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
+	uintmax_t block_offset = (uintmax_t) off % (uintmax_t) block_size;
+	uintmax_t amount = block_offset + count;
+	if ( Page::Size() < amount )
+		amount = Page::Size();
+	size_t num_blocks = (amount + block_size - 1) / block_size;
+	uintmax_t full_amount = num_blocks * block_size;
+	// Take turns with the other transfers in the elevator order.
+	struct block_request request;
+	request.block = (blkcnt_t) block_index;
+	request.blocks = num_blocks;
+	request.segments = 0;
+	request.write = false;
+	ScopedBlockTurn turn(&queue, &request, &channel->hw_lock);
+	channel->SelectDrive(port_index);
+	// If an asynchronous operation is in progress, let it finish.
+	if ( transfer_in_progress && !FinishTransferDMA() )
+		return -1;
+	unsigned char* dma_data = (unsigned char*) dma_alloc.from;
+	unsigned char* data = dma_data + block_offset;
+	size_t data_size = amount - block_offset;
+	if ( is_packet_interface )
+	{
+		struct atapi_packet* packet = (struct atapi_packet*) dma_alloc.from;
+		memset(packet, 0, sizeof(*packet));
+		packet->operation = ATAPI_CMD_READ;
+		packet->lba[0] = block_index >> 24 & 0xFF;
+		packet->lba[1] = block_index >> 16 & 0xFF;
+		packet->lba[2] = block_index >>  8 & 0xFF;
+		packet->lba[3] = block_index >>  0 & 0xFF;
+		packet->control = num_blocks;
+		if ( !CommandATAPI((size_t) full_amount) )
+			return -1;
+	}
+	else
+	{
+		Seek(block_index, num_blocks);
+		if ( is_using_dma )
+		{
+			uint8_t cmd = is_lba48 ? CMD_READ_DMA_EXT : CMD_READ_DMA;
+			CommandDMA(cmd, (size_t) full_amount, false, dma_physical_frame);
+			if ( !FinishTransferDMA() )
+				return -1;
+		}
+		else
+		{
+			uint8_t cmd = is_lba48 ? CMD_READ_EXT : CMD_READ;
+			CommandPIO(cmd, (size_t) full_amount, false);
+			if ( !TransferPIO((size_t) full_amount, false) )
+				return -1;
+		}
+	}
+	memcpy(dest, data, data_size);
+	return (ssize_t) data_size;
+}
+
 ssize_t Port::pread(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off)
 {
 	if ( !block_size )
 		return errno = ENOMEDIUM, -1;
+	unsigned char* staging = NULL;
 	ssize_t result = 0;
 	while ( count )
 	{
-		ScopedLock lock(&channel->hw_lock);
-		channel->SelectDrive(port_index);
-		if ( device_size <= off )
-			break;
-		if ( (uintmax_t) device_size - off < (uintmax_t) count )
-			count = (size_t) device_size - off;
-		uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
-		uintmax_t block_offset = (uintmax_t) off % (uintmax_t) block_size;
-		uintmax_t amount = block_offset + count;
-		if ( Page::Size() < amount )
-			amount = Page::Size();
-		size_t num_blocks = (amount + block_size - 1) / block_size;
-		uintmax_t full_amount = num_blocks * block_size;
-		// If an asynchronous operation is in progress, let it finish.
-		if ( transfer_in_progress && !FinishTransferDMA() )
+		size_t chunk = count < Page::Size() ? count : Page::Size();
+		size_t direct = DirectAmount(ctx, buf, chunk, off);
+		ssize_t amount = 0;
+		if ( direct )
+			amount = TransferDirect(ctx, buf, direct, off, false);
+		if ( !amount )
+		{
+			if ( !staging && !(staging = new unsigned char[Page::Size()]) )
+				amount = -1;
+			else if ( 0 < (amount = ReadChunk(staging, chunk, off)) &&
+			          !ctx->copy_to_dest(buf, staging, amount) )
+				amount = -1;
+		}
+		if ( amount < 0 )
+		{
+			delete[] staging;
 			return result ? result : -1;
-		unsigned char* dma_data = (unsigned char*) dma_alloc.from;
-		unsigned char* data = dma_data + block_offset;
-		size_t data_size = amount - block_offset;
-		if ( is_packet_interface )
+		}
+		if ( !amount )
+			break;
+		buf += amount;
+		count -= amount;
+		result += amount;
+		off += amount;
+	}
+	delete[] staging;
+	return result;
+}
+
+// Writes up to a page from the kernel buffer to the device, returning the
+// amount written, or zero at the end of the device. The caller copies the data
+// from its source before taking the locks, as faulting in user memory might
+// read a file on this very device.
+ssize_t Port::WriteChunk(const unsigned char* src, size_t count, off_t off)
+{
+	ScopedLock lock(&channel->hw_lock);
+	if ( device_size <= off )
+		return 0;
+	if ( (uintmax_t) device_size - off < (uintmax_t) count )
+		count = (size_t) device_size - off;
+	uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
+	uintmax_t block_offset = (uintmax_t) off % (uintmax_t) block_size;
+	uintmax_t amount = block_offset + count;
+	if ( Page::Size() < amount )
+		amount = Page::Size();
+	size_t num_blocks = (amount + block_size - 1) / block_size;
+	uintmax_t full_amount = num_blocks * block_size;
+	// Take turns with the other transfers in the elevator order.
+	struct block_request request;
+	request.block = (blkcnt_t) block_index;
+	request.blocks = num_blocks;
+	request.segments = 0;
+	request.write = true;
+	ScopedBlockTurn turn(&queue, &request, &channel->hw_lock);
+	channel->SelectDrive(port_index);
+	// If an asynchronous operation is in progress, let it finish.
+	if ( transfer_in_progress && !FinishTransferDMA() )
+		return -1;
+	unsigned char* dma_data = (unsigned char*) dma_alloc.from;
+	unsigned char* data = dma_data + block_offset;
+	size_t data_size = amount - block_offset;
+	if ( block_offset || amount < full_amount )
+	{
+		if ( is_using_dma )
 		{
-			struct atapi_packet* packet = (struct atapi_packet*) dma_alloc.from;
-			memset(packet, 0, sizeof(*packet));
-			packet->operation = ATAPI_CMD_READ;
-			packet->lba[0] = block_index >> 24 & 0xFF;
-			packet->lba[1] = block_index >> 16 & 0xFF;
-			packet->lba[2] = block_index >>  8 & 0xFF;
-			packet->lba[3] = block_index >>  0 & 0xFF;
-			packet->control = num_blocks;
-			if ( !CommandATAPI((size_t) full_amount) )
-				return result ? result : -1;
+			uint8_t cmd = is_lba48 ? CMD_READ_DMA_EXT : CMD_READ_DMA;
+			Seek(block_index, num_blocks);
+			CommandDMA(cmd, (size_t) full_amount, false, dma_physical_frame);
+			if ( !FinishTransferDMA() )
+				return -1;
 		}
 		else
 		{
+			uint8_t cmd = is_lba48 ? CMD_READ_EXT : CMD_READ;
 			Seek(block_index, num_blocks);
-			if ( is_using_dma )
-			{
-				uint8_t cmd = is_lba48 ? CMD_READ_DMA_EXT : CMD_READ_DMA;
-				CommandDMA(cmd, (size_t) full_amount, false);
-				if ( !FinishTransferDMA() )
-					return result ? result : -1;
-			}
-			else
-			{
-				uint8_t cmd = is_lba48 ? CMD_READ_EXT : CMD_READ;
-				CommandPIO(cmd, (size_t) full_amount, false);
-				if ( !TransferPIO((size_t) full_amount, false) )
-					return result ? result : -1;
-			}
+			CommandPIO(cmd, (size_t) full_amount, false);
+			if ( !TransferPIO((size_t) full_amount, false) )
+				return -1;
 		}
-		if ( !ctx->copy_to_dest(buf, data, data_size) )
-			return result ? result : -1;
-		buf += data_size;
-		count -= data_size;
-		result += data_size;
-		off += data_size;
 	}
-	return result;
+	memcpy(data, src, data_size);
+	if ( is_using_dma )
+	{
+		Seek(block_index, num_blocks);
+		uint8_t cmd = is_lba48 ? CMD_WRITE_DMA_EXT : CMD_WRITE_DMA;
+		CommandDMA(cmd, (size_t) full_amount, true, dma_physical_frame);
+		// Let the transfer finish asynchronously so the caller can prepare
+		// the next write operation to keep the write pipeline busy.
+	}
+	else
+	{
+		Seek(block_index, num_blocks);
+		uint8_t cmd = is_lba48 ? CMD_WRITE_EXT : CMD_WRITE;
+		CommandPIO(cmd, (size_t) full_amount, true);
+		if ( !TransferPIO((size_t) full_amount, true) )
+			return -1;
+	}
+	return (ssize_t) data_size;
 }
 
 ssize_t Port::pwrite(ioctx_t* ctx, const unsigned char* buf, size_t count, off_t off)
@@ -792,70 +984,38 @@ ssize_t Port::pwrite(ioctx_t* ctx, const unsigned char* buf, size_t count, off_t
 		return errno = EPERM, -1;
 	if ( !block_size )
 		return errno = ENOMEDIUM, -1;
+	unsigned char* staging = NULL;
 	ssize_t result = 0;
 	while ( count )
 	{
-		ScopedLock lock(&channel->hw_lock);
-		channel->SelectDrive(port_index);
-		if ( device_size <= off )
-			break;
-		if ( (uintmax_t) device_size - off < (uintmax_t) count )
-			count = (size_t) device_size - off;
-		uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
-		uintmax_t block_offset = (uintmax_t) off % (uintmax_t) block_size;
-		uintmax_t amount = block_offset + count;
-		if ( Page::Size() < amount )
-			amount = Page::Size();
-		size_t num_blocks = (amount + block_size - 1) / block_size;
-		uintmax_t full_amount = num_blocks * block_size;
-		// If an asynchronous operation is in progress, let it finish.
-		if ( transfer_in_progress && !FinishTransferDMA() )
-			return result ? result : -1;
-		unsigned char* dma_data = (unsigned char*) dma_alloc.from;
-		unsigned char* data = dma_data + block_offset;
-		size_t data_size = amount - block_offset;
-		if ( block_offset || amount < full_amount )
+		size_t chunk = count < Page::Size() ? count : Page::Size();
+		size_t direct = DirectAmount(ctx, buf, chunk, off);
+		ssize_t amount = 0;
+		if ( direct )
+			amount = TransferDirect(ctx, (unsigned char*) buf, direct, off,
+			                        true);
+		if ( !amount )
 		{
-			if ( is_using_dma )
-			{
-				uint8_t cmd = is_lba48 ? CMD_READ_DMA_EXT : CMD_READ_DMA;
-				Seek(block_index, num_blocks);
-				CommandDMA(cmd, (size_t) full_amount, false);
-				if ( !FinishTransferDMA() )
-					return result ? result : -1;
-			}
+			if ( !staging && !(staging = new unsigned char[Page::Size()]) )
+				amount = -1;
+			else if ( !ctx->copy_from_src(staging, buf, chunk) )
+				amount = -1;
 			else
-			{
-				uint8_t cmd = is_lba48 ? CMD_READ_EXT : CMD_READ;
-				Seek(block_index, num_blocks);
-				CommandPIO(cmd, (size_t) full_amount, false);
-				if ( !TransferPIO((size_t) full_amount, false) )
-					return result ? result : -1;
-			}
-		}
-		if ( !ctx->copy_from_src(data, buf, data_size) )
-			return result ? result : -1;
-		if ( is_using_dma )
-		{
-			Seek(block_index, num_blocks);
-			uint8_t cmd = is_lba48 ? CMD_WRITE_DMA_EXT : CMD_WRITE_DMA;
-			CommandDMA(cmd, (size_t) full_amount, true);
-			// Let the transfer finish asynchronously so the caller can prepare
-			// the next write operation to keep the write pipeline busy.
+				amount = WriteChunk(staging, chunk, off);
 		}
-		else
+		if ( amount < 0 )
 		{
-			Seek(block_index, num_blocks);
-			uint8_t cmd = is_lba48 ? CMD_WRITE_EXT : CMD_WRITE;
-			CommandPIO(cmd, (size_t) full_amount, true);
-			if ( !TransferPIO((size_t) full_amount, true) )
-				return result ? result : -1;
+			delete[] staging;
+			return result ? result : -1;
 		}
-		buf += data_size;
-		count -= data_size;
-		result += data_size;
-		off += data_size;
+		if ( !amount )
+			break;
+		buf += amount;
+		count -= amount;
+		result += amount;
+		off += amount;
 	}
+	delete[] staging;
 	return result;
 }
 
@@ -29,6 +29,8 @@
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kthread.h>
 
+#include "../queue.h"
+
 namespace Sortix {
 namespace ATA {
 
@@ -69,10 +71,18 @@ private:
 	bool ReadCapacityATAPI(bool no_error = false);
 	void Seek(blkcnt_t block_index, size_t count);
 	bool CommandATAPI(size_t response_size, bool no_error = false);
-	void CommandDMA(uint8_t cmd, size_t size, bool write);
+	void CommandDMA(uint8_t cmd, size_t size, bool write, addr_t physical);
 	void CommandPIO(uint8_t cmd, size_t size, bool write);
 	bool FinishTransferDMA();
 	bool TransferPIO(size_t size, bool write, bool no_error = false);
+	size_t DirectAmount(ioctx_t* ctx, const unsigned char* buf, size_t count,
+	                    off_t off);
+	ssize_t TransferDirect(ioctx_t* ctx, unsigned char* buf, size_t count,
+	                       off_t off, bool write);
+	ssize_t TransferPhysical(addr_t physical, size_t count, off_t off,
+	                         bool write);
+	ssize_t ReadChunk(unsigned char* dest, size_t count, off_t off);
+	ssize_t WriteChunk(const unsigned char* src, size_t count, off_t off);
 	void PrepareAwaitInterrupt();
 	bool AwaitInterrupt(unsigned int msescs);
 	void OnInterrupt();
@@ -82,6 +92,7 @@ private:
 	char serial[20 + 1];
 	char revision[8 + 1];
 	char model[40 + 1];
+	BlockQueue queue;
 	addralloc_t control_alloc;
 	addralloc_t dma_alloc;
 	Channel* channel;
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * disk/queue.cpp
+ * Block request queue with an elevator scheduler.
+ */
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <time.h>
+#include <timespec.h>
+
+#include <sortix/clock.h>
+
+#include <sortix/kernel/kthread.h>
+#include <sortix/kernel/time.h>
+
+#include "queue.h"
+
+namespace Sortix {
+
+// Reads usually have a waiting caller, while writes are often written back in
+// the background, so reads are preferred when requests have waited too long.
+static const unsigned int READ_EXPIRE_MS = 500;
+static const unsigned int WRITE_EXPIRE_MS = 5000;
+
+BlockQueue::BlockQueue()
+{
+	turn_cond = KTHREAD_COND_INITIALIZER;
+	first = NULL;
+	last = NULL;
+	position = 0;
+	max_blocks = 0;
+	max_segments = 0;
+	turn_taken = false;
+}
+
+void BlockQueue::SetLimits(size_t max_blocks, size_t max_segments)
+{
+	this->max_blocks = max_blocks;
+	this->max_segments = max_segments;
+}
+
+bool BlockQueue::CanMerge(struct block_request* front,
+                          struct block_request* back)
+{
+	return front->write == back->write &&
+	       front->block + (blkcnt_t) front->total_blocks == back->block &&
+	       front->total_blocks + back->total_blocks <= max_blocks &&
+	       front->total_segments + back->total_segments <= max_segments;
+}
+
+void BlockQueue::Link(struct block_request* request)
+{
+	struct block_request* after = last;
+	while ( after && request->block < after->block )
+		after = after->prev;
+	request->prev = after;
+	request->next = after ? after->next : first;
+	if ( request->next )
+		request->next->prev = request;
+	else
+		last = request;
+	if ( after )
+		after->next = request;
+	else
+		first = request;
+}
+
+void BlockQueue::Unlink(struct block_request* request)
+{
+	if ( request->prev )
+		request->prev->next = request->next;
+	else
+		first = request->next;
+	if ( request->next )
+		request->next->prev = request->prev;
+	else
+		last = request->prev;
+	request->prev = NULL;
+	request->next = NULL;
+}
+
+void BlockQueue::Insert(struct block_request* request, bool merge)
+{
+	unsigned int msecs = request->write ? WRITE_EXPIRE_MS : READ_EXPIRE_MS;
+	struct timespec delay =
+		timespec_make(msecs / 1000, (msecs % 1000) * 1000000L);
+	request->expire = timespec_add(Time::Get(CLOCK_MONOTONIC), delay);
+	request->merged = NULL;
+	request->merged_last = request;
+	request->total_blocks = request->blocks;
+	request->total_segments = request->segments;
+	request->dispatched = false;
+	for ( struct block_request* queued = first;
+	      merge && queued;
+	      queued = queued->next )
+	{
+		// Continue a queued request that ends where this request begins.
+		if ( CanMerge(queued, request) )
+		{
+			queued->merged_last->merged = request;
+			queued->merged_last = request;
+			queued->total_blocks += request->blocks;
+			queued->total_segments += request->segments;
+			return;
+		}
+		// Take the place of a queued request that begins where this one ends,
+		// keeping the earlier deadline.
+		if ( CanMerge(request, queued) )
+		{
+			Unlink(queued);
+			request->merged = queued;
+			request->merged_last = queued->merged_last;
+			request->total_blocks += queued->total_blocks;
+			request->total_segments += queued->total_segments;
+			request->expire = queued->expire;
+			break;
+		}
+	}
+	Link(request);
+}
+
+struct block_request* BlockQueue::Next()
+{
+	if ( !first )
+		return NULL;
+	// Serve the request that has waited the longest if past its deadline, and
+	// otherwise continue upwards from the last request, wrapping around.
+	struct block_request* chosen = first;
+	for ( struct block_request* request = first; request; request = request->next )
+		if ( timespec_lt(request->expire, chosen->expire) )
+			chosen = request;
+	if ( timespec_lt(Time::Get(CLOCK_MONOTONIC), chosen->expire) )
+	{
+		chosen = first;
+		for ( struct block_request* request = first; request; request = request->next )
+		{
+			if ( position <= request->block )
+			{
+				chosen = request;
+				break;
+			}
+		}
+	}
+	Unlink(chosen);
+	position = chosen->block + (blkcnt_t) chosen->total_blocks;
+	for ( struct block_request* request = chosen; request; request = request->merged )
+		request->dispatched = true;
+	return chosen;
+}
+
+void BlockQueue::Enter(struct block_request* request, kthread_mutex_t* lock)
+{
+	Insert(request, false);
+	if ( !turn_taken )
+	{
+		Next();
+		turn_taken = true;
+		kthread_cond_broadcast(&turn_cond);
+	}
+	while ( !request->dispatched )
+		kthread_cond_wait(&turn_cond, lock);
+}
+
+void BlockQueue::Leave()
+{
+	turn_taken = Next() != NULL;
+	kthread_cond_broadcast(&turn_cond);
+}
+
+} // namespace Sortix
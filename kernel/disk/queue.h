@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * disk/queue.h
+ * Block request queue with an elevator scheduler.
+ */
+
+#ifndef SORTIX_DISK_QUEUE_H
+#define SORTIX_DISK_QUEUE_H
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <time.h>
+
+#include <sortix/kernel/kthread.h>
+
+namespace Sortix {
+
+struct block_request
+{
+	struct block_request* prev;
+	struct block_request* next;
+	struct block_request* merged;
+	struct block_request* merged_last;
+	struct timespec expire;
+	blkcnt_t block;
+	size_t blocks;
+	size_t segments;
+	size_t total_blocks;
+	size_t total_segments;
+	size_t tag;
+	bool write;
+	bool dispatched;
+};
+
+// The requests are dispatched in ascending block order, wrapping around at the
+// end, unless a request has waited past its deadline. Adjacent requests in the
+// same direction are merged into the request in front of them, so the driver
+// can transfer them with a single command. The device lock is held.
+class BlockQueue
+{
+public:
+	BlockQueue();
+	void SetLimits(size_t max_blocks, size_t max_segments);
+	bool IsEmpty() { return !first; }
+	void Insert(struct block_request* request, bool merge);
+	struct block_request* Next();
+	void Enter(struct block_request* request, kthread_mutex_t* lock);
+	void Leave();
+
+private:
+	bool CanMerge(struct block_request* front, struct block_request* back);
+	void Link(struct block_request* request);
+	void Unlink(struct block_request* request);
+
+private:
+	kthread_cond_t turn_cond;
+	struct block_request* first;
+	struct block_request* last;
+	blkcnt_t position;
+	size_t max_blocks;
+	size_t max_segments;
+	bool turn_taken;
+
+};
+
+// Synchronous drivers take turns doing their transfers in the elevator order.
+class ScopedBlockTurn
+{
+public:
+	ScopedBlockTurn(BlockQueue* queue, struct block_request* request,
+	                kthread_mutex_t* lock) : queue(queue)
+	{
+		queue->Enter(request, lock);
+	}
+	~ScopedBlockTurn()
+	{
+		queue->Leave();
+	}
+
+private:
+	BlockQueue* queue;
+
+};
+
+} // namespace Sortix
+
+#endif
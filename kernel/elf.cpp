@@ -32,12 +32,14 @@
 #include <__/wordsize.h>
 
 #include <sortix/mman.h>
+#include <sortix/stat.h>
 
 #include <sortix/kernel/descriptor.h>
 #include <sortix/kernel/elf.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/memorymanagement.h>
+#include <sortix/kernel/pagecache.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/segment.h>
 
@@ -49,7 +51,7 @@ static bool is_power_of_two(uintptr_t value)
 	return value && !(value & (value - 1));
 }
 
-uintptr_t Load(Ref<Descriptor> program, Auxiliary* aux)
+static uintptr_t LoadProgram(Ref<Descriptor> program, Auxiliary* aux)
 {
 	static const uintmax_t off_max = OFF_MAX; // Silence false -Wtype-limits
 
@@ -59,6 +61,12 @@ uintptr_t Load(Ref<Descriptor> program, Auxiliary* aux)
 
 	memset(aux, 0, sizeof(*aux));
 
+	uintmax_t program_generation =
+		PageCache::Generation(program->dev, program->ino);
+	struct stat program_st;
+	if ( program->stat(&ctx, &program_st) < 0 )
+		return 0;
+
 	Process* process = CurrentProcess();
 
 	uintptr_t userspace_addr;
@@ -306,14 +314,33 @@ uintptr_t Load(Ref<Descriptor> program, Auxiliary* aux)
 			if ( userspace_end - phdr.p_vaddr < phdr.p_memsz )
 				return errno = EINVAL, 0;
 
+			if ( (uintmax_t) off_max < (uintmax_t) phdr.p_offset ||
+			     OFF_MAX - phdr.p_offset < phdr.p_filesz )
+				return errno = EINVAL, 0;
+
+			// The file contents must actually be in the file, as the pages are
+			// loaded on demand and can't be faulted in past the end of file.
+			if ( (uintmax_t) program_st.st_size <
+			     (uintmax_t) (phdr.p_offset + phdr.p_filesz) )
+				return errno = EINVAL, 0;
+
 			uintptr_t map_start = Page::AlignDown(phdr.p_vaddr);
 			uintptr_t map_end = Page::AlignUp(phdr.p_vaddr + phdr.p_memsz);
 			size_t map_size = map_end - map_start;
+			size_t map_lead = phdr.p_vaddr - map_start;
 
 			struct segment segment;
 			segment.addr =  map_start;
 			segment.size = map_size;
 			segment.prot = kprot;
+			segment.backing = NULL;
+			segment.backing_offset = 0;
+			segment.backing_size = 0;
+			segment.backing_mtime = timespec_nul();
+			segment.backing_file_size = 0;
+			segment.backing_generation = 0;
+			segment.backing_shared = false;
+			segment.backing_deny_write = false;
 
 			assert(IsUserspaceSegment(&segment));
 
@@ -323,6 +350,28 @@ uintptr_t Load(Ref<Descriptor> program, Auxiliary* aux)
 			if ( IsSegmentOverlapping(process, &segment) )
 				return errno = EINVAL, 0;
 
+			// Load the segment from the program file on demand as the pages
+			// are accessed, sharing the unmodified pages with other processes
+			// running the same program.
+			if ( phdr.p_filesz && map_lead <= (uintmax_t) phdr.p_offset )
+			{
+				segment.prot = prot;
+				segment.backing = program.Get();
+				segment.backing_offset = phdr.p_offset - map_lead;
+				segment.backing_size = map_lead + phdr.p_filesz;
+				segment.backing_mtime = program_st.st_mtim;
+				segment.backing_file_size = program_st.st_size;
+				segment.backing_generation = program_generation;
+				segment.backing_deny_write = true;
+				ReferSegmentBacking(&segment);
+				if ( !AddSegment(process, &segment) )
+				{
+					UnrefSegmentBacking(&segment);
+					return errno = EINVAL, 0;
+				}
+				continue;
+			}
+
 			if ( !Memory::MapRange(segment.addr, segment.size, kprot, PAGE_USAGE_USER_SPACE) )
 				return errno = EINVAL, 0;
 
@@ -336,10 +385,6 @@ uintptr_t Load(Ref<Descriptor> program, Auxiliary* aux)
 
 			ioctx_t user_ctx; SetupUserIOCtx(&user_ctx);
 
-
-			if ( (uintmax_t) off_max < (uintmax_t) phdr.p_offset ||
-			     OFF_MAX - phdr.p_offset < phdr.p_filesz )
-				return errno = EINVAL, 0;
 			for ( size_t done = 0; done < phdr.p_filesz; )
 			{
 				kthread_mutex_unlock(&process->segment_lock);
@@ -362,5 +407,16 @@ uintptr_t Load(Ref<Descriptor> program, Auxiliary* aux)
 	return ehdr.e_entry;
 }
 
+uintptr_t Load(Ref<Descriptor> program, Auxiliary* aux)
+{
+	// Refuse running a program that is open for writing before the process is
+	// reset, and keep denying writes while its segments are mapped from it.
+	if ( !PageCache::DenyWrite(program->dev, program->ino) )
+		return 0;
+	uintptr_t entry = LoadProgram(program, aux);
+	PageCache::AllowWrite(program->dev, program->ino);
+	return entry;
+}
+
 } // namespace ELF
 } // namespace Sortix
@@ -30,6 +30,7 @@
 #include <sortix/seek.h>
 
 #include <sortix/kernel/addralloc.h>
+#include <sortix/kernel/copy.h>
 #include <sortix/kernel/fcache.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
@@ -86,6 +87,7 @@ BlockCache::BlockCache()
 	mru_block = NULL;
 	lru_block = NULL;
 	unused_block = NULL;
+	absent_block = NULL;
 	bcache_mutex = KTHREAD_MUTEX_INITIALIZER;
 }
 
@@ -97,6 +99,28 @@ BlockCache::~BlockCache()
 BlockCacheBlock* BlockCache::AcquireBlock()
 {
 	ScopedLock lock(&bcache_mutex);
+	// Reuse a block whose memory was given back before making a new area.
+	if ( !unused_block && absent_block )
+	{
+		BlockCacheBlock* block = absent_block;
+		addr_t page = Page::Get(PAGE_USAGE_FILESYSTEM_CACHE);
+		if ( !page )
+			return errno = ENOMEM, (BlockCacheBlock*) NULL;
+		addr_t block_data = (addr_t) BlockDataUnlocked(block);
+		if ( !Memory::Map(page, block_data, PROT_KREAD | PROT_KWRITE) )
+		{
+			Page::Put(page, PAGE_USAGE_FILESYSTEM_CACHE);
+			return errno = ENOMEM, (BlockCacheBlock*) NULL;
+		}
+		Memory::InvalidatePage(block_data);
+		absent_block = block->next_block;
+		blocks_allocated++;
+		block->information |= BCACHE_PRESENT;
+		block->next_block = unused_block;
+		block->prev_block = NULL;
+		unused_block = block;
+		unused_block_count++;
+	}
 	if ( !unused_block && !AddArea() )
 		return NULL;
 	BlockCacheBlock* ret = unused_block;
@@ -123,12 +147,15 @@ void BlockCache::ReleaseBlock(BlockCacheBlock* block)
 		blocks_allocated--;
 		uint8_t* block_data = BlockDataUnlocked(block);
 		addr_t block_data_addr = Memory::Unmap((addr_t) block_data);
+		Memory::InvalidatePage((addr_t) block_data);
 		Page::Put(block_data_addr, PAGE_USAGE_FILESYSTEM_CACHE);
-		// TODO: We leak this block's meta information here. Rather, we should
-		// put this block into a list of non-present blocks so we can reuse it
-		// later and reallocate a physical frame for it - then we will just
-		// reuse the block's meta information.
-		block->information &= ~(BCACHE_USED | BCACHE_PRESENT);
+		// Keep the block's meta information and address around for when more
+		// blocks are needed again.
+		UnlinkBlock(block);
+		block->information &= ~(BCACHE_USED | BCACHE_PRESENT | BCACHE_MODIFIED);
+		block->next_block = absent_block;
+		block->prev_block = NULL;
+		absent_block = block;
 		return;
 	}
 	UnlinkBlock(block);
@@ -253,14 +280,72 @@ static BlockCache* kernel_block_cache = NULL;
 		Panic("Unable to allocate kernel block cache");
 }
 
+// The blocks of a file are kept in a radix tree indexed by the block number,
+// such that large and sparse files don't need a large array of blocks. Nodes
+// at height 1 point to blocks and nodes further up point to nodes. Blocks not
+// in the tree are holes in the file that read as zero.
+static const size_t FCACHE_NODE_BITS = 6;
+static const size_t FCACHE_NODE_SLOTS = 1 << FCACHE_NODE_BITS;
+
+struct FileCacheNode
+{
+	void* slots[FCACHE_NODE_SLOTS];
+};
+
+// Returns whether a tree of the given height has room for the block.
+static bool TreeCoversBlock(size_t height, size_t block_num)
+{
+	if ( sizeof(size_t) * 8 <= height * FCACHE_NODE_BITS )
+		return true;
+	return block_num < (size_t) 1 << (height * FCACHE_NODE_BITS);
+}
+
+static size_t NodeSlot(size_t height, size_t block_num)
+{
+	size_t shift = (height - 1) * FCACHE_NODE_BITS;
+	return (block_num >> shift) & (FCACHE_NODE_SLOTS - 1);
+}
+
+// Releases the blocks in the subtree from the given block number onwards,
+// returning whether the subtree is now empty.
+static bool ReleaseSubtree(FileCacheNode* node, size_t height, size_t first,
+                           size_t from)
+{
+	size_t span = (size_t) 1 << ((height - 1) * FCACHE_NODE_BITS);
+	bool empty = true;
+	for ( size_t i = 0; i < FCACHE_NODE_SLOTS; i++ )
+	{
+		if ( !node->slots[i] )
+			continue;
+		size_t slot_first = first + i * span;
+		if ( slot_first < from && span <= from - slot_first )
+		{
+			empty = false;
+			continue;
+		}
+		if ( height == 1 )
+			kernel_block_cache->ReleaseBlock((BlockCacheBlock*) node->slots[i]);
+		else
+		{
+			FileCacheNode* child = (FileCacheNode*) node->slots[i];
+			if ( !ReleaseSubtree(child, height - 1, slot_first, from) )
+			{
+				empty = false;
+				continue;
+			}
+			delete child;
+		}
+		node->slots[i] = NULL;
+	}
+	return empty;
+}
+
 FileCache::FileCache(/*FileCacheBackend* backend*/)
 {
 	assert(kernel_block_cache);
 	file_size = 0;
-	file_written = 0;
-	blocks = NULL;
-	blocks_used = 0;
-	blocks_length = 0;
+	root = NULL;
+	root_height = 0;
 	fcache_mutex = KTHREAD_MUTEX_INITIALIZER;
 	modified = false;
 	modified_size = false;
@@ -268,9 +353,7 @@ FileCache::FileCache(/*FileCacheBackend* backend*/)
 
 FileCache::~FileCache()
 {
-	for ( size_t i = 0; i < blocks_used; i++ )
-		kernel_block_cache->ReleaseBlock(blocks[i]);
-	free(blocks);
+	ReleaseBlocks(0);
 }
 
 int FileCache::sync(ioctx_t* /*ctx*/)
@@ -281,6 +364,8 @@ int FileCache::sync(ioctx_t* /*ctx*/)
 
 bool FileCache::Synchronize()
 {
+	// There is no backing store to write the modified blocks to, the cache is
+	// the only copy of the file.
 	//if ( !backend )
 	if ( true )
 		return true;
@@ -290,29 +375,71 @@ bool FileCache::Synchronize()
 	return true;
 }
 
-void FileCache::InitializeFileData(off_t to_where)
+BlockCacheBlock* FileCache::LookupBlock(size_t block_num)
+{
+	if ( !root || !TreeCoversBlock(root_height, block_num) )
+		return NULL;
+	void* node = root;
+	for ( size_t height = root_height; node && height; height-- )
+		node = ((FileCacheNode*) node)->slots[NodeSlot(height, block_num)];
+	return (BlockCacheBlock*) node;
+}
+
+BlockCacheBlock* FileCache::ObtainBlock(size_t block_num)
 {
-	while ( file_written < to_where )
+	if ( BlockCacheBlock* block = LookupBlock(block_num) )
+		return block;
+	// Make the tree taller until it has room for the block.
+	while ( !root || !TreeCoversBlock(root_height, block_num) )
 	{
-		off_t left = to_where - file_written;
-		size_t block_off = (size_t) (file_written % Page::Size());
-		size_t block_num = (size_t) (file_written / Page::Size());
-		size_t block_left = Page::Size() - block_off;
-		size_t amount_to_set = (uintmax_t) left < (uintmax_t) block_left ?
-		                       (size_t) left : block_left;
-		assert(block_num < blocks_used);
-		BlockCacheBlock* block = blocks[block_num];
-		uint8_t* block_data = kernel_block_cache->BlockData(block);
-		uint8_t* data = block_data + block_off;
-		memset(data, 0, amount_to_set);
-		file_written += (off_t) amount_to_set;
-		kernel_block_cache->MarkModified(block);
+		FileCacheNode* node = new FileCacheNode;
+		if ( !node )
+			return NULL;
+		memset(node, 0, sizeof(*node));
+		node->slots[0] = root;
+		root = node;
+		root_height++;
 	}
+	FileCacheNode* node = root;
+	for ( size_t height = root_height; 1 < height; height-- )
+	{
+		void** slot = &node->slots[NodeSlot(height, block_num)];
+		if ( !*slot )
+		{
+			FileCacheNode* child = new FileCacheNode;
+			if ( !child )
+				return NULL;
+			memset(child, 0, sizeof(*child));
+			*slot = child;
+		}
+		node = (FileCacheNode*) *slot;
+	}
+	BlockCacheBlock* block = kernel_block_cache->AcquireBlock();
+	if ( !block )
+		return NULL;
+	memset(kernel_block_cache->BlockData(block), 0, Page::Size());
+	node->slots[NodeSlot(1, block_num)] = block;
+	return block;
+}
+
+void FileCache::ReleaseBlocks(size_t from_block_num)
+{
+	if ( !root || !ReleaseSubtree(root, root_height, 0, from_block_num) )
+		return;
+	delete root;
+	root = NULL;
+	root_height = 0;
 }
 
 ssize_t FileCache::preadv(ioctx_t* ctx, const struct iovec* iovs, int iovcnt,
                           off_t off)
 {
+	// User memory is written through a staging page with the lock released, as
+	// faulting it in might read this very file.
+	bool staged = ctx->copy_to_dest != CopyToKernel;
+	uint8_t* staging = NULL;
+	if ( staged && !(staging = new uint8_t[Page::Size()]) )
+		return -1;
 	ScopedLock lock(&fcache_mutex);
 	ssize_t so_far = 0;
 	int iov_i = 0;
@@ -342,16 +469,32 @@ ssize_t FileCache::preadv(ioctx_t* ctx, const struct iovec* iovs, int iovcnt,
 		size_t block_num = (size_t) (current_off / Page::Size());
 		size_t block_left = Page::Size() - block_off;
 		size_t amount = count < block_left ? count : block_left;
-		assert(block_num < blocks_used);
-		BlockCacheBlock* block = blocks[block_num];
-		const uint8_t* block_data = kernel_block_cache->BlockData(block);
-		const uint8_t* src_data = block_data + block_off;
-		if ( file_written < current_off + (off_t) amount )
-			InitializeFileData(current_off + (off_t) amount);
-		if ( !ctx->copy_to_dest(buf, src_data, amount) )
-			return so_far ? (ssize_t) so_far : -1;
+		BlockCacheBlock* block = LookupBlock(block_num);
+		const uint8_t* src_data = NULL;
+		if ( block )
+		{
+			const uint8_t* block_data = kernel_block_cache->BlockData(block);
+			src_data = block_data + block_off;
+			if ( staged )
+			{
+				memcpy(staging, src_data, amount);
+				src_data = staging;
+			}
+			kernel_block_cache->MarkUsed(block);
+		}
+		if ( staged )
+			kthread_mutex_unlock(&fcache_mutex);
+		bool copied = src_data ? ctx->copy_to_dest(buf, src_data, amount)
+		                       : ctx->zero_dest(buf, amount);
+		if ( staged )
+			kthread_mutex_lock(&fcache_mutex);
+		if ( !copied )
+		{
+			if ( !so_far )
+				so_far = -1;
+			break;
+		}
 		so_far += amount;
-		kernel_block_cache->MarkUsed(block);
 		iov_offset += amount;
 		if ( iov_offset == iov->iov_len )
 		{
@@ -359,13 +502,19 @@ ssize_t FileCache::preadv(ioctx_t* ctx, const struct iovec* iovs, int iovcnt,
 			iov_offset = 0;
 		}
 	}
+	delete[] staging;
 	return so_far;
 }
 
 ssize_t FileCache::pwritev(ioctx_t* ctx, const struct iovec* iovs, int iovcnt,
                            off_t off)
 {
-	ScopedLock lock(&fcache_mutex);
+	// User memory is read into a staging page before taking the lock, as
+	// faulting it in might read this very file.
+	bool staged = ctx->copy_from_src != CopyFromKernel;
+	uint8_t* staging = NULL;
+	if ( staged && !(staging = new uint8_t[Page::Size()]) )
+		return -1;
 	ssize_t so_far = 0;
 	int iov_i = 0;
 	size_t iov_offset = 0;
@@ -383,35 +532,59 @@ ssize_t FileCache::pwritev(ioctx_t* ctx, const struct iovec* iovs, int iovcnt,
 		if ( count == 0 )
 		{
 			if ( so_far == 0 && maxcount == 0 && iov->iov_len != 0 )
-				return errno = ENOSPC, -1;
+			{
+				so_far = -1;
+				errno = ENOSPC;
+				break;
+			}
 			iov_i++;
 			iov_offset = 0;
 			continue;
 		}
-		off_t write_end = current_off + count;
-		if ( file_size < write_end && !ChangeSize(write_end, false) )
+		if ( (uintmax_t) SIZE_MAX < (uintmax_t) (current_off / Page::Size()) )
 		{
-			if ( file_size <= current_off )
-				return -1;
-			if ( (uintmax_t) (file_size - current_off) < count )
-				count = file_size - current_off;
+			if ( !so_far )
+			{
+				so_far = -1;
+				errno = EFBIG;
+			}
+			break;
 		}
 		size_t block_off = (size_t) (current_off % Page::Size());
 		size_t block_num = (size_t) (current_off / Page::Size());
 		size_t block_left = Page::Size() - block_off;
 		size_t amount = count < block_left ? count : block_left;
-		assert(block_num < blocks_used);
-		BlockCacheBlock* block = blocks[block_num];
+		assert(amount);
+		if ( staged && !ctx->copy_from_src(staging, buf, amount) )
+		{
+			if ( !so_far )
+				so_far = -1;
+			break;
+		}
+		ScopedLock lock(&fcache_mutex);
+		BlockCacheBlock* block = ObtainBlock(block_num);
+		if ( !block )
+		{
+			if ( !so_far )
+				so_far = -1;
+			break;
+		}
 		uint8_t* block_data = kernel_block_cache->BlockData(block);
 		uint8_t* data = block_data + block_off;
-		if ( file_written < current_off )
-			InitializeFileData(current_off);
-		assert(amount);
 		modified = true; /* Unconditionally - copy_from_src can fail midway. */
-		if ( !ctx->copy_from_src(data, buf, amount) )
-			return so_far ? (ssize_t) so_far : -1;
-		if ( file_written < current_off + (off_t) amount )
-			file_written = current_off + (off_t) amount;
+		if ( staged )
+			memcpy(data, staging, amount);
+		else if ( !ctx->copy_from_src(data, buf, amount) )
+		{
+			if ( !so_far )
+				so_far = -1;
+			break;
+		}
+		if ( file_size < current_off + (off_t) amount )
+		{
+			file_size = current_off + (off_t) amount;
+			modified_size = true;
+		}
 		so_far += amount;
 		kernel_block_cache->MarkModified(block);
 		iov_offset += amount;
@@ -421,13 +594,14 @@ ssize_t FileCache::pwritev(ioctx_t* ctx, const struct iovec* iovs, int iovcnt,
 			iov_offset = 0;
 		}
 	}
+	delete[] staging;
 	return so_far;
 }
 
 int FileCache::truncate(ioctx_t* /*ctx*/, off_t length)
 {
 	ScopedLock lock(&fcache_mutex);
-	return ChangeSize(length, true) ? 0 : -1;
+	return ChangeSize(length) ? 0 : -1;
 }
 
 off_t FileCache::GetFileSize()
@@ -448,74 +622,33 @@ off_t FileCache::lseek(ioctx_t* /*ctx*/, off_t offset, int whence)
 //{
 //}
 
-bool FileCache::ChangeSize(off_t new_size, bool exact)
+bool FileCache::ChangeSize(off_t new_size)
 {
-	if ( file_size == new_size && !exact )
+	if ( file_size == new_size )
 		return true;
 
 	off_t numblocks_off_t = (new_size + Page::Size() - 1) / Page::Size();
-	// TODO: An alternative datastructure (perhaps tree like) will decrease the
-	// memory consumption of this pointer list as well as avoid this filesize
-	// restriction on 32-bit platforms.
 	if ( (uintmax_t) SIZE_MAX < (uintmax_t) numblocks_off_t )
 		return errno = EFBIG, false;
-	size_t numblocks = (size_t) numblocks_off_t;
-	if ( !ChangeNumBlocks(numblocks, exact) )
-		return false;
-	if ( new_size < file_written )
-		file_written = new_size;
-	file_size = new_size;
-	modified_size = true;
-	return true;
-}
-
-bool FileCache::ChangeNumBlocks(size_t new_numblocks, bool exact)
-{
-	if ( new_numblocks == blocks_used && !exact )
-		return true;
-
-	// Release blocks if the file has decreased in size.
-	if ( new_numblocks < blocks_used )
-	{
-		for ( size_t i = new_numblocks; i < blocks_used; i++ )
-			kernel_block_cache->ReleaseBlock(blocks[i]);
-		blocks_used = new_numblocks;
-	}
 
-	// If needed, adapt the length of the array containing block pointers.
-	if ( new_numblocks < blocks_length )
-		exact = true;
-	size_t new_blocks_length = 2 * blocks_length;
-	if ( exact || new_blocks_length < new_numblocks )
-		new_blocks_length = new_numblocks;
-	size_t size = sizeof(BlockCacheBlock*) * new_blocks_length;
-	BlockCacheBlock** new_blocks = (BlockCacheBlock**) realloc(blocks, size);
-	if ( !new_blocks )
+	// Growing the file just adds a hole at the end, while shrinking the file
+	// releases the blocks past the end and zeroes the rest of the last block
+	// in case the file grows again.
+	if ( new_size < file_size )
 	{
-		if ( blocks_length < new_blocks_length )
-			return false;
-	}
-	else
-	{
-		blocks = new_blocks;
-		blocks_length = new_blocks_length;
-	}
-
-	assert(new_numblocks <= blocks_length);
-	assert(!blocks_length || blocks);
-
-	// Acquire more blocks if the file has increased in size.
-	for ( size_t i = blocks_used; i < new_numblocks; i++ )
-	{
-		if ( !(blocks[i] = kernel_block_cache->AcquireBlock()) )
+		ReleaseBlocks((size_t) numblocks_off_t);
+		size_t block_off = (size_t) (new_size % Page::Size());
+		BlockCacheBlock* block;
+		if ( block_off &&
+		     (block = LookupBlock((size_t) (new_size / Page::Size()))) )
 		{
-			for ( size_t n = blocks_used; n < i; n++ )
-				kernel_block_cache->ReleaseBlock(blocks[n]);
-			return false;
+			uint8_t* block_data = kernel_block_cache->BlockData(block);
+			memset(block_data + block_off, 0, Page::Size() - block_off);
+			kernel_block_cache->MarkModified(block);
 		}
-		blocks_used++;
 	}
-
+	file_size = new_size;
+	modified_size = true;
 	return true;
 }
 
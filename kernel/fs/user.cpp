@@ -38,6 +38,7 @@
 
 #include <fsmarshall-msg.h>
 
+#include <sortix/kernel/copy.h>
 #include <sortix/kernel/descriptor.h>
 #include <sortix/kernel/inode.h>
 #include <sortix/kernel/ioctx.h>
@@ -58,6 +59,8 @@ namespace UserFS {
 class ChannelDirection;
 class Channel;
 class ChannelNode;
+class Multiplexer;
+class Request;
 class Server;
 class ServerNode;
 class Unode;
@@ -125,8 +128,10 @@ public:
 	void UserClose();
 
 private:
-	kthread_mutex_t kernel_lock;
-	kthread_mutex_t user_lock;
+	kthread_mutex_t kernel_send_lock;
+	kthread_mutex_t kernel_recv_lock;
+	kthread_mutex_t user_send_lock;
+	kthread_mutex_t user_recv_lock;
 	kthread_mutex_t destruction_lock;
 	ChannelDirection from_kernel;
 	ChannelDirection from_user;
@@ -154,27 +159,104 @@ private:
 
 };
 
+// A persistent channel carrying the messages of many requests, where each
+// message is sent whole and the responses are matched with their requests by
+// the message id, so the server may answer them in any order.
+class Multiplexer
+{
+public:
+	Multiplexer(Channel* channel);
+	~Multiplexer();
+	bool ReceiveHeader();
+
+public:
+	Channel* channel;
+	Request* first_pending;
+	Request* last_pending;
+	Request* receiving;
+	struct fsm_msg_header hdr;
+	size_t hdr_got;
+	size_t discard;
+	size_t next_msgid;
+	size_t refcount;
+	bool sending;
+	bool reading;
+	bool broken;
+	bool retired;
+
+};
+
+class Request
+{
+public:
+	Request(Server* server, ioctx_t* ctx);
+	~Request();
+
+public:
+	bool KernelSend(ioctx_t* ctx, const void* ptr, size_t count)
+	{
+		return KernelSend(ctx, ptr, count, count) == count;
+	}
+	size_t KernelSend(ioctx_t* ctx, const void* ptr, size_t least, size_t max);
+	bool KernelRecv(ioctx_t* ctx, void* ptr, size_t count)
+	{
+		return KernelRecv(ctx, ptr, count, count) == count;
+	}
+	size_t KernelRecv(ioctx_t* ctx, void* ptr, size_t least, size_t max);
+	void KernelClose();
+
+public:
+	Request* prev_pending;
+	Request* next_pending;
+	Server* server;
+	Channel* channel;
+	Multiplexer* mux;
+	struct fsm_msg_header hdr;
+	size_t hdr_offset;
+	size_t body_offset;
+	size_t msgid;
+	uid_t uid;
+	gid_t gid;
+	bool sending;
+	bool pending;
+	bool awaiting;
+	bool answered;
+	bool failed;
+
+};
+
 class Server : public Refcountable
 {
 public:
-	Server();
+	Server(bool multiplex);
 	virtual ~Server();
 	void Disconnect();
 	void Unmount();
 	Channel* Connect(ioctx_t* ctx);
 	Channel* Accept(ioctx_t* ctx);
+	Request* Begin(ioctx_t* ctx);
+	bool AwaitResponse(Request* request);
+	void Finish(Request* request);
 	Ref<Inode> BootstrapNode(ino_t ino, mode_t type);
 	Ref<Inode> OpenNode(ino_t ino, mode_t type);
 
+private:
+	void Retire(Multiplexer* mux);
+
 private:
 	kthread_mutex_t connect_lock;
 	kthread_cond_t connecting_cond;
 	kthread_cond_t connectable_cond;
+	kthread_mutex_t mux_lock;
+	kthread_cond_t mux_cond;
 	uintptr_t listener_system_tid;
 	uintptr_t connecter_system_tid;
 	Channel* connecting;
+	Multiplexer* multiplexer;
 	bool disconnected;
 	bool unmounted;
+	bool multiplex;
+	bool creating_multiplexer;
 
 };
 
@@ -275,12 +357,19 @@ public:
 	virtual int sockatmark(ioctx_t* ctx);
 
 private:
-	bool SendMessage(Channel* channel, size_t type, void* ptr, size_t size,
+	ssize_t Read(ioctx_t* ctx, uint8_t* buf, size_t count, const off_t* off);
+	ssize_t ReadRequest(ioctx_t* ctx, uint8_t* buf, size_t count,
+	                    const off_t* off);
+	ssize_t Write(ioctx_t* ctx, const uint8_t* buf, size_t count,
+	              const off_t* off);
+	ssize_t WriteRequest(ioctx_t* ctx, const uint8_t* buf, size_t count,
+	                     const off_t* off);
+	bool SendMessage(Request* request, size_t type, void* ptr, size_t size,
 	                 size_t extra = 0);
-	bool RecvMessage(Channel* channel, size_t type, void* ptr, size_t size);
-	void RecvError(Channel* channel);
-	bool RecvBoolean(Channel* channel);
-	void UnexpectedResponse(Channel* channel, struct fsm_msg_header* hdr);
+	bool RecvMessage(Request* request, size_t type, void* ptr, size_t size);
+	void RecvError(Request* request);
+	bool RecvBoolean(Request* request);
+	void UnexpectedResponse(Request* request, struct fsm_msg_header* hdr);
 
 private:
 	ioctx_t kctx;
@@ -410,8 +499,10 @@ void ChannelDirection::RecvClose()
 
 Channel::Channel(ioctx_t* ctx)
 {
-	kernel_lock = KTHREAD_MUTEX_INITIALIZER;
-	user_lock = KTHREAD_MUTEX_INITIALIZER;
+	kernel_send_lock = KTHREAD_MUTEX_INITIALIZER;
+	kernel_recv_lock = KTHREAD_MUTEX_INITIALIZER;
+	user_send_lock = KTHREAD_MUTEX_INITIALIZER;
+	user_recv_lock = KTHREAD_MUTEX_INITIALIZER;
 	destruction_lock = KTHREAD_MUTEX_INITIALIZER;
 	user_closed = false;
 	kernel_closed = false;
@@ -434,7 +525,7 @@ void Channel::InformSystemTids(uintptr_t client_tid, uintptr_t server_tid)
 size_t Channel::KernelSend(ioctx_t* ctx, const void* ptr, size_t least,
                             size_t max)
 {
-	ScopedLockSignal outer_lock(&kernel_lock);
+	ScopedLockSignal outer_lock(&kernel_send_lock);
 	if ( !outer_lock.IsAcquired() )
 		return errno = EINTR, 0;
 	size_t ret = from_kernel.Send(ctx, ptr, least, max);
@@ -445,7 +536,7 @@ size_t Channel::KernelSend(ioctx_t* ctx, const void* ptr, size_t least,
 
 size_t Channel::KernelRecv(ioctx_t* ctx, void* ptr, size_t least, size_t max)
 {
-	ScopedLockSignal outer_lock(&kernel_lock);
+	ScopedLockSignal outer_lock(&kernel_recv_lock);
 	if ( !outer_lock.IsAcquired() )
 		return errno = EINTR, 0;
 	CurrentThread()->yield_to_tid = 0;
@@ -470,7 +561,7 @@ void Channel::KernelClose()
 size_t Channel::UserSend(ioctx_t* ctx, const void* ptr, size_t least,
                          size_t max)
 {
-	ScopedLockSignal outer_lock(&user_lock);
+	ScopedLockSignal outer_lock(&user_send_lock);
 	if ( !outer_lock.IsAcquired() )
 		return errno = EINTR, 0;
 	size_t ret = from_user.Send(ctx, ptr, least, max);
@@ -481,7 +572,7 @@ size_t Channel::UserSend(ioctx_t* ctx, const void* ptr, size_t least,
 
 size_t Channel::UserRecv(ioctx_t* ctx, void* ptr, size_t least, size_t max)
 {
-	ScopedLockSignal outer_lock(&user_lock);
+	ScopedLockSignal outer_lock(&user_recv_lock);
 	if ( !outer_lock.IsAcquired() )
 		return errno = EINTR, 0;
 	size_t ret = from_kernel.Recv(ctx, ptr, least, max);
@@ -543,23 +634,168 @@ ssize_t ChannelNode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
 	return channel->UserSend(ctx, buf, /*1*/ count, count);
 }
 
+//
+// Implementation of Multiplexer.
+//
+
+Multiplexer::Multiplexer(Channel* channel)
+{
+	this->channel = channel;
+	first_pending = NULL;
+	last_pending = NULL;
+	receiving = NULL;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr_got = 0;
+	discard = 0;
+	next_msgid = 0;
+	refcount = 0;
+	sending = false;
+	reading = false;
+	broken = false;
+	retired = false;
+}
+
+Multiplexer::~Multiplexer()
+{
+	channel->KernelClose();
+}
+
+bool Multiplexer::ReceiveHeader()
+{
+	ioctx_t kctx; SetupKernelIOCtx(&kctx);
+	// Skip the rest of the previous response if its request didn't want it.
+	while ( discard )
+	{
+		uint8_t buffer[256];
+		size_t count = discard < sizeof(buffer) ? discard : sizeof(buffer);
+		size_t amount = channel->KernelRecv(&kctx, buffer, 1, count);
+		if ( !amount )
+			return false;
+		discard -= amount;
+	}
+	while ( hdr_got < sizeof(hdr) )
+	{
+		size_t amount = channel->KernelRecv(&kctx, (uint8_t*) &hdr + hdr_got,
+		                                    1, sizeof(hdr) - hdr_got);
+		if ( !amount )
+			return false;
+		hdr_got += amount;
+	}
+	return true;
+}
+
+//
+// Implementation of Request.
+//
+
+Request::Request(Server* server, ioctx_t* ctx)
+{
+	prev_pending = NULL;
+	next_pending = NULL;
+	this->server = server;
+	channel = NULL;
+	mux = NULL;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr_offset = 0;
+	body_offset = 0;
+	msgid = 0;
+	uid = ctx ? ctx->uid : 0;
+	gid = ctx ? ctx->gid : 0;
+	sending = false;
+	pending = false;
+	awaiting = false;
+	answered = false;
+	failed = false;
+}
+
+Request::~Request()
+{
+}
+
+size_t Request::KernelSend(ioctx_t* ctx, const void* ptr, size_t least,
+                           size_t max)
+{
+	if ( !mux )
+		return channel->KernelSend(ctx, ptr, least, max);
+	assert(sending);
+	size_t amount = mux->channel->KernelSend(ctx, ptr, least, max);
+	if ( amount < least )
+		failed = true;
+	return amount;
+}
+
+size_t Request::KernelRecv(ioctx_t* ctx, void* ptr, size_t least, size_t max)
+{
+	if ( !mux )
+		return channel->KernelRecv(ctx, ptr, least, max);
+	if ( !answered && !server->AwaitResponse(this) )
+		return failed = true, 0;
+	// The header was received on behalf of this request, followed by the body
+	// which must not be read past as the next response follows it.
+	uint8_t* dst = (uint8_t*) ptr;
+	size_t sofar = 0;
+	if ( hdr_offset < sizeof(hdr) )
+	{
+		size_t count = sizeof(hdr) - hdr_offset;
+		if ( max < count )
+			count = max;
+		if ( !ctx->copy_to_dest(dst, (uint8_t*) &hdr + hdr_offset, count) )
+			return failed = true, 0;
+		hdr_offset += count;
+		sofar += count;
+	}
+	size_t available = hdr.msgsize - body_offset;
+	size_t count = max - sofar;
+	if ( available < count )
+		count = available;
+	if ( count )
+	{
+		size_t needed = sofar < least ? least - sofar : 0;
+		if ( count < needed )
+			needed = count;
+		size_t amount =
+			mux->channel->KernelRecv(ctx, dst + sofar, needed, count);
+		body_offset += amount;
+		sofar += amount;
+	}
+	if ( sofar < least )
+	{
+		if ( body_offset == hdr.msgsize )
+			errno = EIO;
+		failed = true;
+	}
+	return sofar;
+}
+
+void Request::KernelClose()
+{
+	server->Finish(this);
+}
+
 //
 // Implementation of Server.
 //
 
-Server::Server()
+Server::Server(bool multiplex)
 {
 	connect_lock = KTHREAD_MUTEX_INITIALIZER;
 	connecting_cond = KTHREAD_COND_INITIALIZER;
 	connectable_cond = KTHREAD_COND_INITIALIZER;
+	mux_lock = KTHREAD_MUTEX_INITIALIZER;
+	mux_cond = KTHREAD_COND_INITIALIZER;
 	listener_system_tid = 0;
 	connecting = NULL;
+	multiplexer = NULL;
 	disconnected = false;
 	unmounted = false;
+	this->multiplex = multiplex;
+	creating_multiplexer = false;
 }
 
 Server::~Server()
 {
+	if ( multiplexer )
+		Retire(multiplexer);
 }
 
 void Server::Disconnect()
@@ -571,9 +807,15 @@ void Server::Disconnect()
 
 void Server::Unmount()
 {
-	ScopedLock lock(&connect_lock);
-	unmounted = true;
-	kthread_cond_signal(&connecting_cond);
+	{
+		ScopedLock lock(&connect_lock);
+		unmounted = true;
+		kthread_cond_signal(&connecting_cond);
+	}
+	// Close the persistent channel once idle so the server stops reading it.
+	ScopedLock lock(&mux_lock);
+	if ( multiplexer )
+		Retire(multiplexer);
 }
 
 Channel* Server::Connect(ioctx_t* ctx)
@@ -620,6 +862,192 @@ Channel* Server::Accept(ioctx_t* ctx)
 	return result;
 }
 
+Request* Server::Begin(ioctx_t* ctx)
+{
+	Request* request = new Request(this, ctx);
+	if ( !request )
+		return NULL;
+	if ( !multiplex )
+	{
+		if ( !(request->channel = Connect(ctx)) )
+			return delete request, (Request*) NULL;
+		return request;
+	}
+	kthread_mutex_lock(&mux_lock);
+	while ( !multiplexer || multiplexer->sending )
+	{
+		if ( multiplexer || creating_multiplexer )
+		{
+			if ( !kthread_cond_wait_signal(&mux_cond, &mux_lock) )
+			{
+				kthread_mutex_unlock(&mux_lock);
+				delete request;
+				return errno = EINTR, (Request*) NULL;
+			}
+			continue;
+		}
+		// Open a new persistent channel, which the server accepts once done
+		// with any previous channel.
+		creating_multiplexer = true;
+		kthread_mutex_unlock(&mux_lock);
+		Multiplexer* mux = NULL;
+		if ( Channel* channel = Connect(NULL) )
+		{
+			if ( !(mux = new Multiplexer(channel)) )
+				channel->KernelClose();
+		}
+		kthread_mutex_lock(&mux_lock);
+		creating_multiplexer = false;
+		kthread_cond_broadcast(&mux_cond);
+		if ( !mux )
+		{
+			kthread_mutex_unlock(&mux_lock);
+			delete request;
+			return NULL;
+		}
+		multiplexer = mux;
+	}
+	// The request has the channel to itself until its message has been sent.
+	Multiplexer* mux = multiplexer;
+	mux->sending = true;
+	mux->refcount++;
+	request->mux = mux;
+	request->msgid = mux->next_msgid++;
+	request->sending = true;
+	request->pending = true;
+	request->prev_pending = mux->last_pending;
+	request->next_pending = NULL;
+	if ( mux->last_pending )
+		mux->last_pending->next_pending = request;
+	else
+		mux->first_pending = request;
+	mux->last_pending = request;
+	kthread_mutex_unlock(&mux_lock);
+	return request;
+}
+
+bool Server::AwaitResponse(Request* request)
+{
+	Multiplexer* mux = request->mux;
+	ScopedLock lock(&mux_lock);
+	if ( request->sending )
+	{
+		request->sending = false;
+		mux->sending = false;
+		kthread_cond_broadcast(&mux_cond);
+	}
+	request->awaiting = true;
+	while ( !request->answered )
+	{
+		if ( mux->broken )
+			return errno = ECONNRESET, false;
+		if ( mux->reading || mux->receiving )
+		{
+			if ( !kthread_cond_wait_signal(&mux_cond, &mux_lock) )
+				return errno = EINTR, false;
+			continue;
+		}
+		// Read the next header on behalf of whichever request it answers.
+		mux->reading = true;
+		kthread_mutex_unlock(&mux_lock);
+		bool success = mux->ReceiveHeader();
+		kthread_mutex_lock(&mux_lock);
+		mux->reading = false;
+		kthread_cond_broadcast(&mux_cond);
+		if ( !success )
+		{
+			if ( errno != EINTR )
+			{
+				mux->broken = true;
+				Retire(mux);
+			}
+			return false;
+		}
+		mux->hdr_got = 0;
+		Request* owner = mux->first_pending;
+		while ( owner && owner->msgid != mux->hdr.msgid )
+			owner = owner->next_pending;
+		if ( !owner )
+		{
+			mux->discard = mux->hdr.msgsize;
+			continue;
+		}
+		if ( owner->prev_pending )
+			owner->prev_pending->next_pending = owner->next_pending;
+		else
+			mux->first_pending = owner->next_pending;
+		if ( owner->next_pending )
+			owner->next_pending->prev_pending = owner->prev_pending;
+		else
+			mux->last_pending = owner->prev_pending;
+		owner->prev_pending = NULL;
+		owner->next_pending = NULL;
+		owner->pending = false;
+		owner->hdr = mux->hdr;
+		owner->answered = true;
+		mux->receiving = owner;
+	}
+	return true;
+}
+
+void Server::Finish(Request* request)
+{
+	if ( !request->mux )
+	{
+		request->channel->KernelClose();
+		delete request;
+		return;
+	}
+	Multiplexer* mux = request->mux;
+	ScopedLock lock(&mux_lock);
+	// A partially sent message can't be taken back and unread responses could
+	// block the server, so later requests use a new channel in those cases.
+	bool retire = false;
+	if ( request->sending )
+	{
+		mux->sending = false;
+		if ( request->failed )
+			retire = true;
+	}
+	if ( request->pending )
+	{
+		if ( request->prev_pending )
+			request->prev_pending->next_pending = request->next_pending;
+		else
+			mux->first_pending = request->next_pending;
+		if ( request->next_pending )
+			request->next_pending->prev_pending = request->prev_pending;
+		else
+			mux->last_pending = request->prev_pending;
+		// Requests that never waited for a response don't get one.
+		if ( request->awaiting )
+			retire = true;
+	}
+	if ( mux->receiving == request )
+	{
+		mux->discard = request->hdr.msgsize - request->body_offset;
+		mux->receiving = NULL;
+		if ( mux->discard )
+			retire = true;
+	}
+	kthread_cond_broadcast(&mux_cond);
+	mux->refcount--;
+	if ( retire )
+		Retire(mux);
+	else if ( mux->retired && !mux->refcount )
+		delete mux;
+	delete request;
+}
+
+void Server::Retire(Multiplexer* mux)
+{
+	if ( multiplexer == mux )
+		multiplexer = NULL;
+	mux->retired = true;
+	if ( !mux->refcount )
+		delete mux;
+}
+
 Ref<Inode> Server::BootstrapNode(ino_t ino, mode_t type)
 {
 	return Ref<Inode>(new Unode(Ref<Server>(this), ino, type));
@@ -672,6 +1100,16 @@ Ref<Inode> ServerNode::accept4(ioctx_t* ctx, uint8_t* addr, size_t* addrlen,
 // Implementation of Unode.
 //
 
+// User memory is only copied while the request doesn't hold the channel, as
+// copying might fault in a page of a file on this very filesystem, which needs
+// the channel. The data is staged in kernel buffers of at most this size.
+static const size_t STAGING_SIZE = 65536;
+
+static bool IsKernelIOCtx(ioctx_t* ctx)
+{
+	return ctx->copy_to_dest == CopyToKernel;
+}
+
 Unode::Unode(Ref<Server> server, ino_t ino, mode_t type)
 {
 	SetupKernelIOCtx(&kctx);
@@ -685,12 +1123,12 @@ Unode::Unode(Ref<Server> server, ino_t ino, mode_t type)
 	bool saved = thread->force_no_signals;
 	thread->force_no_signals = true;
 	thread->DoUpdatePendingSignal();
-	if ( Channel* channel = server->Connect(NULL) )
+	if ( Request* request = server->Begin(NULL) )
 	{
 		struct fsm_req_refer msg;
 		msg.ino = ino;
-		SendMessage(channel, FSM_REQ_REFER, &msg, sizeof(msg));
-		channel->KernelClose();
+		SendMessage(request, FSM_REQ_REFER, &msg, sizeof(msg));
+		request->KernelClose();
 	}
 	thread->force_no_signals = saved;
 	thread->DoUpdatePendingSignal();
@@ -703,69 +1141,70 @@ Unode::~Unode()
 	bool saved = thread->force_no_signals;
 	thread->force_no_signals = true;
 	thread->DoUpdatePendingSignal();
-	if ( Channel* channel = server->Connect(NULL) )
+	if ( Request* request = server->Begin(NULL) )
 	{
 		struct fsm_req_unref msg;
 		msg.ino = ino;
-		SendMessage(channel, FSM_REQ_UNREF, &msg, sizeof(msg));
-		channel->KernelClose();
+		SendMessage(request, FSM_REQ_UNREF, &msg, sizeof(msg));
+		request->KernelClose();
 	}
 	thread->force_no_signals = saved;
 	thread->DoUpdatePendingSignal();
 }
 
-bool Unode::SendMessage(Channel* channel, size_t type, void* ptr, size_t size,
+bool Unode::SendMessage(Request* request, size_t type, void* ptr, size_t size,
                         size_t extra)
 {
 	struct fsm_msg_header hdr;
 	hdr.msgtype = type;
 	hdr.msgsize = size + extra;
-	hdr.uid = channel->uid;
-	hdr.gid = channel->gid;
-	if ( !channel->KernelSend(&kctx, &hdr, sizeof(hdr)) )
+	hdr.msgid = request->msgid;
+	hdr.uid = request->uid;
+	hdr.gid = request->gid;
+	if ( !request->KernelSend(&kctx, &hdr, sizeof(hdr)) )
 		return false;
-	if ( !channel->KernelSend(&kctx, ptr, size) )
+	if ( !request->KernelSend(&kctx, ptr, size) )
 		return false;
 	return true;
 }
 
-bool Unode::RecvMessage(Channel* channel, size_t type, void* ptr, size_t size)
+bool Unode::RecvMessage(Request* request, size_t type, void* ptr, size_t size)
 {
 	struct fsm_msg_header resp_hdr;
-	if ( !channel->KernelRecv(&kctx, &resp_hdr, sizeof(resp_hdr)) )
+	if ( !request->KernelRecv(&kctx, &resp_hdr, sizeof(resp_hdr)) )
 		return false;
 	if ( resp_hdr.msgtype != type )
 	{
-		UnexpectedResponse(channel, &resp_hdr);
+		UnexpectedResponse(request, &resp_hdr);
 		return false;
 	}
-	return  !ptr || !size || channel->KernelRecv(&kctx, ptr, size);
+	return  !ptr || !size || request->KernelRecv(&kctx, ptr, size);
 }
 
-void Unode::RecvError(Channel* channel)
+void Unode::RecvError(Request* request)
 {
 	SetupKernelIOCtx(&kctx);
 	struct fsm_resp_error resp;
-	if ( channel->KernelRecv(&kctx, &resp, sizeof(resp)) )
+	if ( request->KernelRecv(&kctx, &resp, sizeof(resp)) )
 		errno = resp.errnum;
 	// In case of error, errno is set to that error.
 }
 
-bool Unode::RecvBoolean(Channel* channel)
+bool Unode::RecvBoolean(Request* request)
 {
 	struct fsm_msg_header resp_hdr;
-	if ( !channel->KernelRecv(&kctx, &resp_hdr, sizeof(resp_hdr)) )
+	if ( !request->KernelRecv(&kctx, &resp_hdr, sizeof(resp_hdr)) )
 		return false;
 	if ( resp_hdr.msgtype == FSM_RESP_SUCCESS )
 		return true;
-	UnexpectedResponse(channel, &resp_hdr);
+	UnexpectedResponse(request, &resp_hdr);
 	return false;
 }
 
-void Unode::UnexpectedResponse(Channel* channel, struct fsm_msg_header* hdr)
+void Unode::UnexpectedResponse(Request* request, struct fsm_msg_header* hdr)
 {
 	if ( hdr->msgtype == FSM_RESP_ERROR )
-		RecvError(channel);
+		RecvError(request);
 	else
 		errno = EIO;
 }
@@ -789,16 +1228,16 @@ void Unode::unlinked()
 
 int Unode::sync(ioctx_t* ctx)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_sync msg;
 	msg.ino = ino;
-	if ( SendMessage(channel, FSM_REQ_SYNC, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_SYNC, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -809,18 +1248,19 @@ int Unode::stat(ioctx_t* ctx, struct stat* st)
 	sigfillset(&set);
 	Signal::UpdateMask(SIG_SETMASK, &set, &oldset);
 	int ret = -1;
-	Channel* channel = server->Connect(ctx);
-	if ( channel )
+	Request* request = server->Begin(ctx);
+	if ( request )
 	{
 		struct fsm_req_stat msg;
 		struct fsm_resp_stat resp;
 		msg.ino = ino;
-		if ( SendMessage(channel, FSM_REQ_STAT, &msg, sizeof(msg)) &&
-			 RecvMessage(channel, FSM_RESP_STAT, &resp, sizeof(resp)) &&
-			 (resp.st.st_dev = (dev_t) server.Get(), true) &&
-			 ctx->copy_to_dest(st, &resp.st, sizeof(*st)) )
+		bool received =
+			SendMessage(request, FSM_REQ_STAT, &msg, sizeof(msg)) &&
+			RecvMessage(request, FSM_RESP_STAT, &resp, sizeof(resp));
+		request->KernelClose();
+		resp.st.st_dev = (dev_t) server.Get();
+		if ( received && ctx->copy_to_dest(st, &resp.st, sizeof(*st)) )
 			ret = 0;
-		channel->KernelClose();
 	}
 	Signal::UpdateMask(SIG_SETMASK, &oldset, NULL);
 	return ret;
@@ -828,53 +1268,54 @@ int Unode::stat(ioctx_t* ctx, struct stat* st)
 
 int Unode::statvfs(ioctx_t* ctx, struct statvfs* stvfs)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_statvfs msg;
 	struct fsm_resp_statvfs resp;
 	msg.ino = ino;
-	if ( SendMessage(channel, FSM_REQ_STATVFS, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_STATVFS, &resp, sizeof(resp)) &&
-	     (resp.stvfs.f_fsid = (dev_t) server.Get(), true) &&
-	     (resp.stvfs.f_flag |= ST_NOSUID, true) &&
-	     ctx->copy_to_dest(stvfs, &resp.stvfs, sizeof(*stvfs)) )
+	bool received =
+		SendMessage(request, FSM_REQ_STATVFS, &msg, sizeof(msg)) &&
+		RecvMessage(request, FSM_RESP_STATVFS, &resp, sizeof(resp));
+	request->KernelClose();
+	resp.stvfs.f_fsid = (dev_t) server.Get();
+	resp.stvfs.f_flag |= ST_NOSUID;
+	if ( received && ctx->copy_to_dest(stvfs, &resp.stvfs, sizeof(*stvfs)) )
 		ret = 0;
-	channel->KernelClose();
 	return ret;
 }
 
 int Unode::chmod(ioctx_t* ctx, mode_t mode)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_chmod msg;
 	msg.ino = ino;
 	msg.mode = mode;
-	if ( SendMessage(channel, FSM_REQ_CHMOD, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_CHMOD, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
 int Unode::chown(ioctx_t* ctx, uid_t owner, gid_t group)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_chown msg;
 	msg.ino = ino;
 	msg.uid = owner;
 	msg.gid = group;
-	if ( SendMessage(channel, FSM_REQ_CHOWN, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_CHOWN, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -886,16 +1327,16 @@ int Unode::truncate(ioctx_t* ctx, off_t length)
 	sigfillset(&set);
 	Signal::UpdateMask(SIG_SETMASK, &set, &oldset);
 	int ret = -1;
-	Channel* channel = server->Connect(ctx);
-	if ( channel )
+	Request* request = server->Begin(ctx);
+	if ( request )
 	{
 		struct fsm_req_truncate msg;
 		msg.ino = ino;
 		msg.size = length;
-		if ( SendMessage(channel, FSM_REQ_TRUNCATE, &msg, sizeof(msg)) &&
-			 RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+		if ( SendMessage(request, FSM_REQ_TRUNCATE, &msg, sizeof(msg)) &&
+			 RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 			ret = 0;
-		channel->KernelClose();
+		request->KernelClose();
 	}
 	Signal::UpdateMask(SIG_SETMASK, &oldset, NULL);
 	return ret;
@@ -908,17 +1349,17 @@ long Unode::pathconf(ioctx_t* ctx, int name)
 	sigfillset(&set);
 	Signal::UpdateMask(SIG_SETMASK, &set, &oldset);
 	long ret = -1;
-	Channel* channel = server->Connect(ctx);
-	if ( channel )
+	Request* request = server->Begin(ctx);
+	if ( request )
 	{
 		struct fsm_req_pathconf msg;
 		struct fsm_resp_pathconf resp;
 		msg.ino = ino;
 		msg.name = name;
-		if ( SendMessage(channel, FSM_REQ_PATHCONF, &msg, sizeof(msg)) &&
-			 RecvMessage(channel, FSM_RESP_PATHCONF, &resp, sizeof(resp))  )
+		if ( SendMessage(request, FSM_REQ_PATHCONF, &msg, sizeof(msg)) &&
+			 RecvMessage(request, FSM_RESP_PATHCONF, &resp, sizeof(resp))  )
 			ret = resp.value;
-		channel->KernelClose();
+		request->KernelClose();
 	}
 	Signal::UpdateMask(SIG_SETMASK, &oldset, NULL);
 	return ret;
@@ -928,8 +1369,8 @@ off_t Unode::lseek(ioctx_t* ctx, off_t offset, int whence)
 {
 	if ( whence != SEEK_END && offset != 0 )
 		return errno = EINVAL, -1;
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	off_t ret = -1;
 	struct fsm_req_lseek msg;
@@ -937,35 +1378,92 @@ off_t Unode::lseek(ioctx_t* ctx, off_t offset, int whence)
 	msg.ino = ino;
 	msg.offset = offset;
 	msg.whence = whence;
-	if ( SendMessage(channel, FSM_REQ_LSEEK, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_LSEEK, &resp, sizeof(resp)) )
+	if ( SendMessage(request, FSM_REQ_LSEEK, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_LSEEK, &resp, sizeof(resp)) )
 		ret = resp.offset;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
-ssize_t Unode::read(ioctx_t* ctx, uint8_t* buf, size_t count)
+// Reads into kernel memory with a single request.
+ssize_t Unode::ReadRequest(ioctx_t* ctx, uint8_t* buf, size_t count,
+                           const off_t* off)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	ssize_t ret = -1;
-	struct fsm_req_read msg;
 	struct fsm_resp_read resp;
-	msg.ino = ino;
-	msg.count = count;
-	if ( SendMessage(channel, FSM_REQ_READ, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_READ, &resp, sizeof(resp)) )
+	bool sent;
+	if ( off )
+	{
+		struct fsm_req_pread msg;
+		msg.ino = ino;
+		msg.count = count;
+		msg.offset = *off;
+		sent = SendMessage(request, FSM_REQ_PREAD, &msg, sizeof(msg));
+	}
+	else
+	{
+		struct fsm_req_read msg;
+		msg.ino = ino;
+		msg.count = count;
+		sent = SendMessage(request, FSM_REQ_READ, &msg, sizeof(msg));
+	}
+	if ( sent && RecvMessage(request, FSM_RESP_READ, &resp, sizeof(resp)) )
 	{
 		if ( resp.count < count )
 			count = resp.count;
-		if ( channel->KernelRecv(ctx, buf, count) )
+		if ( request->KernelRecv(&kctx, buf, count) )
 			ret = (ssize_t) count;
 	}
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
+ssize_t Unode::Read(ioctx_t* ctx, uint8_t* buf, size_t count, const off_t* off)
+{
+	if ( IsKernelIOCtx(ctx) )
+		return ReadRequest(ctx, buf, count, off);
+	size_t staging_size = count < STAGING_SIZE ? count : STAGING_SIZE;
+	uint8_t* staging = new uint8_t[staging_size ? staging_size : 1];
+	if ( !staging )
+		return -1;
+	size_t sofar = 0;
+	bool failed = false;
+	do
+	{
+		size_t amount = count - sofar;
+		if ( staging_size < amount )
+			amount = staging_size;
+		off_t offset = 0;
+		if ( off && __builtin_add_overflow(*off, sofar, &offset) )
+		{
+			errno = EOVERFLOW;
+			failed = true;
+			break;
+		}
+		ssize_t done = ReadRequest(ctx, staging, amount, off ? &offset : NULL);
+		if ( done < 0 || !ctx->copy_to_dest(buf + sofar, staging, done) )
+		{
+			failed = true;
+			break;
+		}
+		sofar += done;
+		if ( (size_t) done < amount )
+			break;
+	} while ( sofar < count );
+	delete[] staging;
+	if ( failed && !sofar )
+		return -1;
+	return (ssize_t) sofar;
+}
+
+ssize_t Unode::read(ioctx_t* ctx, uint8_t* buf, size_t count)
+{
+	return Read(ctx, buf, count, NULL);
+}
+
 ssize_t Unode::readv(ioctx_t* ctx, const struct iovec* iov, int iovcnt)
 {
 	ssize_t sofar = 0;
@@ -994,25 +1492,7 @@ ssize_t Unode::readv(ioctx_t* ctx, const struct iovec* iov, int iovcnt)
 
 ssize_t Unode::pread(ioctx_t* ctx, uint8_t* buf, size_t count, off_t off)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
-		return -1;
-	ssize_t ret = -1;
-	struct fsm_req_pread msg;
-	struct fsm_resp_read resp;
-	msg.ino = ino;
-	msg.count = count;
-	msg.offset = off;
-	if ( SendMessage(channel, FSM_REQ_PREAD, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_READ, &resp, sizeof(resp)) )
-	{
-		if ( resp.count < count )
-			count = resp.count;
-		if ( channel->KernelRecv(ctx, buf, count) )
-			ret = (ssize_t) count;
-	}
-	channel->KernelClose();
-	return ret;
+	return Read(ctx, buf, count, &off);
 }
 
 ssize_t Unode::preadv(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
@@ -1045,30 +1525,98 @@ ssize_t Unode::preadv(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 	return sofar;
 }
 
-ssize_t Unode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
+// Writes from kernel memory with a single request.
+ssize_t Unode::WriteRequest(ioctx_t* ctx, const uint8_t* buf, size_t count,
+                            const off_t* off)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
-	int ret = -1;
-	struct fsm_req_write msg;
-	msg.ino = ino;
-	msg.count = count;
+	ssize_t ret = -1;
 	struct fsm_msg_header hdr;
-	hdr.msgtype = FSM_REQ_WRITE;
-	hdr.msgsize = sizeof(msg) + count;
+	hdr.msgid = request->msgid;
 	hdr.uid = ctx->uid;
 	hdr.gid = ctx->gid;
+	bool sent;
+	if ( off )
+	{
+		struct fsm_req_pwrite msg;
+		msg.ino = ino;
+		msg.count = count;
+		msg.offset = *off;
+		hdr.msgtype = FSM_REQ_PWRITE;
+		hdr.msgsize = sizeof(msg) + count;
+		sent = request->KernelSend(&kctx, &hdr, sizeof(hdr)) &&
+		       request->KernelSend(&kctx, &msg, sizeof(msg));
+	}
+	else
+	{
+		struct fsm_req_write msg;
+		msg.ino = ino;
+		msg.count = count;
+		hdr.msgtype = FSM_REQ_WRITE;
+		hdr.msgsize = sizeof(msg) + count;
+		sent = request->KernelSend(&kctx, &hdr, sizeof(hdr)) &&
+		       request->KernelSend(&kctx, &msg, sizeof(msg));
+	}
 	struct fsm_resp_write resp;
-	if ( channel->KernelSend(&kctx, &hdr, sizeof(hdr)) &&
-	     channel->KernelSend(&kctx, &msg, sizeof(msg)) &&
-	     channel->KernelSend(ctx, buf, count) &&
-	     RecvMessage(channel, FSM_RESP_WRITE, &resp, sizeof(resp)) )
+	if ( sent &&
+	     request->KernelSend(&kctx, buf, count) &&
+	     RecvMessage(request, FSM_RESP_WRITE, &resp, sizeof(resp)) )
 		ret = (ssize_t) resp.count;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
+ssize_t Unode::Write(ioctx_t* ctx, const uint8_t* buf, size_t count,
+                     const off_t* off)
+{
+	if ( IsKernelIOCtx(ctx) )
+		return WriteRequest(ctx, buf, count, off);
+	size_t staging_size = count < STAGING_SIZE ? count : STAGING_SIZE;
+	uint8_t* staging = new uint8_t[staging_size ? staging_size : 1];
+	if ( !staging )
+		return -1;
+	size_t sofar = 0;
+	bool failed = false;
+	do
+	{
+		size_t amount = count - sofar;
+		if ( staging_size < amount )
+			amount = staging_size;
+		off_t offset = 0;
+		if ( off && __builtin_add_overflow(*off, sofar, &offset) )
+		{
+			errno = EOVERFLOW;
+			failed = true;
+			break;
+		}
+		if ( !ctx->copy_from_src(staging, buf + sofar, amount) )
+		{
+			failed = true;
+			break;
+		}
+		ssize_t done = WriteRequest(ctx, staging, amount, off ? &offset : NULL);
+		if ( done < 0 )
+		{
+			failed = true;
+			break;
+		}
+		sofar += done;
+		if ( (size_t) done < amount )
+			break;
+	} while ( sofar < count );
+	delete[] staging;
+	if ( failed && !sofar )
+		return -1;
+	return (ssize_t) sofar;
+}
+
+ssize_t Unode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
+{
+	return Write(ctx, buf, count, NULL);
+}
+
 ssize_t Unode::writev(ioctx_t* ctx, const struct iovec* iov, int iovcnt)
 {
 	ssize_t sofar = 0;
@@ -1097,27 +1645,7 @@ ssize_t Unode::writev(ioctx_t* ctx, const struct iovec* iov, int iovcnt)
 
 ssize_t Unode::pwrite(ioctx_t* ctx, const uint8_t* buf, size_t count, off_t off)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
-		return -1;
-	ssize_t ret = -1;
-	struct fsm_req_pwrite msg;
-	msg.ino = ino;
-	msg.count = count;
-	msg.offset = off;
-	struct fsm_msg_header hdr;
-	hdr.msgtype = FSM_REQ_PWRITE;
-	hdr.msgsize = sizeof(msg) + count;
-	hdr.uid = ctx->uid;
-	hdr.gid = ctx->gid;
-	struct fsm_resp_write resp;
-	if ( channel->KernelSend(&kctx, &hdr, sizeof(hdr)) &&
-	     channel->KernelSend(&kctx, &msg, sizeof(msg)) &&
-	     channel->KernelSend(ctx, buf, count) &&
-	     RecvMessage(channel, FSM_RESP_WRITE, &resp, sizeof(resp)) )
-		ret = (ssize_t) resp.count;
-	channel->KernelClose();
-	return ret;
+	return Write(ctx, buf, count, &off);
 }
 
 ssize_t Unode::pwritev(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
@@ -1152,33 +1680,33 @@ ssize_t Unode::pwritev(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 
 int Unode::utimens(ioctx_t* ctx, const struct timespec* times)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_utimens msg;
 	msg.ino = ino;
 	msg.times[0] = times[0];
 	msg.times[1] = times[1];
-	if ( SendMessage(channel, FSM_REQ_UTIMENS, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_UTIMENS, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
 int Unode::isatty(ioctx_t* ctx)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return 0;
 	int ret = 0;
 	struct fsm_req_isatty msg;
 	msg.ino = ino;
-	if ( SendMessage(channel, FSM_REQ_ISATTY, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_ISATTY, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 1;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1187,11 +1715,14 @@ ssize_t Unode::getdents(ioctx_t* ctx, void* buf, size_t size, int flags,
 {
 	// Limit the buffer size to avoid overwhelming the filesystem with too
 	// large buffer allocations.
-	if ( 65536 < size )
-		size = 65536;
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	if ( STAGING_SIZE < size )
+		size = STAGING_SIZE;
+	uint8_t* entries = new uint8_t[size ? size : 1];
+	if ( !entries )
 		return -1;
+	Request* request = server->Begin(ctx);
+	if ( !request )
+		return delete[] entries, -1;
 	ssize_t ret = -1;
 	struct fsm_req_getdents msg;
 	struct fsm_resp_getdents resp;
@@ -1200,8 +1731,8 @@ ssize_t Unode::getdents(ioctx_t* ctx, void* buf, size_t size, int flags,
 	msg.flags = flags;
 	msg.offset = *offset;
 	errno = 0;
-	if ( SendMessage(channel, FSM_REQ_GETDENTS, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_GETDENTS, &resp, sizeof(resp)) )
+	if ( SendMessage(request, FSM_REQ_GETDENTS, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_GETDENTS, &resp, sizeof(resp)) )
 	{
 		if ( size < resp.count || resp.next_off < 0 )
 			errno = EIO, ret = -1;
@@ -1220,7 +1751,7 @@ ssize_t Unode::getdents(ioctx_t* ctx, void* buf, size_t size, int flags,
 				errno = EIO, ret = -1;
 				break;
 			}
-			if ( !channel->KernelRecv(&kctx, &dent.entry, entry_size) )
+			if ( !request->KernelRecv(&kctx, &dent.entry, entry_size) )
 			{
 				ret = -1;
 				break;
@@ -1234,13 +1765,13 @@ ssize_t Unode::getdents(ioctx_t* ctx, void* buf, size_t size, int flags,
 			}
 			reclen_t reclen = entry_size + dent.entry.d_namlen + 1;
 			reclen = -(-reclen & ~(alignof(struct dirent) - 1));
-			if ( dent.entry.d_reclen != reclen )
+			if ( dent.entry.d_reclen != reclen || size - ret < reclen )
 			{
 				errno = EIO, ret = -1;
 				break;
 			}
 			size_t remaining = reclen - entry_size;
-			if ( !channel->KernelRecv(&kctx, dent.entry.d_name, remaining) )
+			if ( !request->KernelRecv(&kctx, dent.entry.d_name, remaining) )
 			{
 				ret = -1;
 				break;
@@ -1251,18 +1782,16 @@ ssize_t Unode::getdents(ioctx_t* ctx, void* buf, size_t size, int flags,
 				errno = EIO, ret = -1;
 				break;
 			}
-			struct dirent* out = (struct dirent*) ((char*) buf + ret);
-			if ( !ctx->copy_to_dest(out, &dent, reclen)  )
-			{
-				ret = -1;
-				break;
-			}
+			memcpy(entries + ret, &dent, reclen);
 			ret += reclen;
 		}
-		if ( 0 <= ret )
-			*offset = resp.next_off;
 	}
-	channel->KernelClose();
+	request->KernelClose();
+	if ( 0 <= ret && !ctx->copy_to_dest(buf, entries, ret) )
+		ret = -1;
+	if ( 0 <= ret )
+		*offset = resp.next_off;
+	delete[] entries;
 	return ret;
 }
 
@@ -1275,8 +1804,8 @@ Ref<Inode> Unode::open(ioctx_t* ctx, const char* filename, int flags,
 	sigfillset(&set);
 	Signal::UpdateMask(SIG_SETMASK, &set, &oldset);
 	Ref<Inode> ret;
-	Channel* channel = server->Connect(ctx);
-	if ( channel )
+	Request* request = server->Begin(ctx);
+	if ( request )
 	{
 		size_t filenamelen = strlen(filename);
 		struct fsm_req_open msg;
@@ -1285,11 +1814,14 @@ Ref<Inode> Unode::open(ioctx_t* ctx, const char* filename, int flags,
 		msg.mode = mode;
 		msg.namelen = filenamelen;
 		struct fsm_resp_open resp;
-		if ( SendMessage(channel, FSM_REQ_OPEN, &msg, sizeof(msg), filenamelen) &&
-			 channel->KernelSend(&kctx, filename, filenamelen) &&
-			 RecvMessage(channel, FSM_RESP_OPEN, &resp, sizeof(resp)) )
+		bool success =
+			SendMessage(request, FSM_REQ_OPEN, &msg, sizeof(msg), filenamelen) &&
+			request->KernelSend(&kctx, filename, filenamelen) &&
+			RecvMessage(request, FSM_RESP_OPEN, &resp, sizeof(resp));
+		// Finish the request first as the new inode sends its own message.
+		request->KernelClose();
+		if ( success )
 			ret = server->OpenNode(resp.ino, resp.type);
-		channel->KernelClose();
 	}
 	Signal::UpdateMask(SIG_SETMASK, &oldset, NULL);
 	return ret;
@@ -1303,8 +1835,8 @@ Ref<Inode> Unode::factory(ioctx_t* /*ctx*/, const char* /*filename*/,
 
 int Unode::mkdir(ioctx_t* ctx, const char* filename, mode_t mode)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	size_t filenamelen = strlen(filename);
 	int ret = -1;
@@ -1313,11 +1845,11 @@ int Unode::mkdir(ioctx_t* ctx, const char* filename, mode_t mode)
 	msg.mode = mode;
 	msg.namelen = filenamelen;
 	struct fsm_resp_mkdir resp;
-	if ( SendMessage(channel, FSM_REQ_MKDIR, &msg, sizeof(msg), filenamelen) &&
-	     channel->KernelSend(&kctx, filename, filenamelen) &&
-	     RecvMessage(channel, FSM_RESP_MKDIR, &resp, sizeof(resp)) )
+	if ( SendMessage(request, FSM_REQ_MKDIR, &msg, sizeof(msg), filenamelen) &&
+	     request->KernelSend(&kctx, filename, filenamelen) &&
+	     RecvMessage(request, FSM_RESP_MKDIR, &resp, sizeof(resp)) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1325,8 +1857,8 @@ int Unode::link(ioctx_t* ctx, const char* filename, Ref<Inode> node)
 {
 	if ( node->dev != this->dev )
 		return errno = EXDEV, -1;
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	size_t filenamelen = strlen(filename);
 	int ret = -1;
@@ -1334,11 +1866,11 @@ int Unode::link(ioctx_t* ctx, const char* filename, Ref<Inode> node)
 	msg.dirino = ino;
 	msg.linkino = node->ino;
 	msg.namelen = filenamelen;
-	if ( SendMessage(channel, FSM_REQ_LINK, &msg, sizeof(msg), filenamelen) &&
-	     channel->KernelSend(&kctx, filename, filenamelen) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_LINK, &msg, sizeof(msg), filenamelen) &&
+	     request->KernelSend(&kctx, filename, filenamelen) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1350,19 +1882,19 @@ int Unode::link_raw(ioctx_t* /*ctx*/, const char* /*filename*/, Ref<Inode> /*nod
 int Unode::unlink(ioctx_t* ctx, const char* filename)
 {
 	// TODO: Make sure the target is no longer used!
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	size_t filenamelen = strlen(filename);
 	int ret = -1;
 	struct fsm_req_unlink msg;
 	msg.dirino = ino;
 	msg.namelen = filenamelen;
-	if ( SendMessage(channel, FSM_REQ_UNLINK, &msg, sizeof(msg), filenamelen) &&
-	     channel->KernelSend(&kctx, filename, filenamelen) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_UNLINK, &msg, sizeof(msg), filenamelen) &&
+	     request->KernelSend(&kctx, filename, filenamelen) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1374,19 +1906,19 @@ int Unode::unlink_raw(ioctx_t* /*ctx*/, const char* /*filename*/)
 int Unode::rmdir(ioctx_t* ctx, const char* filename)
 {
 	// TODO: Make sure the target is no longer used!
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	size_t filenamelen = strlen(filename);
 	int ret = -1;
 	struct fsm_req_rmdir msg;
 	msg.dirino = ino;
 	msg.namelen = filenamelen;
-	if ( SendMessage(channel, FSM_REQ_RMDIR, &msg, sizeof(msg), filenamelen) &&
-	     channel->KernelSend(&kctx, filename, filenamelen) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_RMDIR, &msg, sizeof(msg), filenamelen) &&
+	     request->KernelSend(&kctx, filename, filenamelen) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1397,8 +1929,8 @@ int Unode::rmdir_me(ioctx_t* /*ctx*/)
 
 int Unode::symlink(ioctx_t* ctx, const char* oldname, const char* filename)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	size_t oldnamelen = strlen(oldname);
 	size_t filenamelen = strlen(filename);
@@ -1408,12 +1940,12 @@ int Unode::symlink(ioctx_t* ctx, const char* oldname, const char* filename)
 	msg.targetlen = oldnamelen;
 	msg.namelen = filenamelen;
 	size_t extra = msg.targetlen + msg.namelen;
-	if ( SendMessage(channel, FSM_REQ_SYMLINK, &msg, sizeof(msg), extra) &&
-	     channel->KernelSend(&kctx, oldname, oldnamelen) &&
-	     channel->KernelSend(&kctx, filename, filenamelen) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_SYMLINK, &msg, sizeof(msg), extra) &&
+	     request->KernelSend(&kctx, oldname, oldnamelen) &&
+	     request->KernelSend(&kctx, filename, filenamelen) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1424,21 +1956,26 @@ ssize_t Unode::readlink(ioctx_t* ctx, char* buf, size_t bufsiz)
 	sigfillset(&set);
 	Signal::UpdateMask(SIG_SETMASK, &set, &oldset);
 	ssize_t ret = -1;
-	Channel* channel = server->Connect(ctx);
-	if ( channel )
+	Request* request = server->Begin(ctx);
+	if ( request )
 	{
 		struct fsm_req_readlink msg;
 		struct fsm_resp_readlink resp;
 		msg.ino = ino;
-		if ( SendMessage(channel, FSM_REQ_READLINK, &msg, sizeof(msg)) &&
-			 RecvMessage(channel, FSM_RESP_READLINK, &resp, sizeof(resp)) )
+		char* target = NULL;
+		if ( SendMessage(request, FSM_REQ_READLINK, &msg, sizeof(msg)) &&
+			 RecvMessage(request, FSM_RESP_READLINK, &resp, sizeof(resp)) )
 		{
 			if ( resp.targetlen < bufsiz )
 				bufsiz = resp.targetlen;
-			if ( channel->KernelRecv(ctx, buf, bufsiz) )
+			if ( (target = new char[bufsiz ? bufsiz : 1]) &&
+			     request->KernelRecv(&kctx, target, bufsiz) )
 				ret = (ssize_t) bufsiz;
 		}
-		channel->KernelClose();
+		request->KernelClose();
+		if ( 0 <= ret && !ctx->copy_to_dest(buf, target, bufsiz) )
+			ret = -1;
+		delete[] target;
 	}
 	Signal::UpdateMask(SIG_SETMASK, &oldset, NULL);
 	return ret;
@@ -1446,18 +1983,19 @@ ssize_t Unode::readlink(ioctx_t* ctx, char* buf, size_t bufsiz)
 
 int Unode::tcgetwincurpos(ioctx_t* ctx, struct wincurpos* wcp)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_tcgetwincurpos msg;
 	struct fsm_resp_tcgetwincurpos resp;
 	msg.ino = ino;
-	if ( SendMessage(channel, FSM_REQ_TCGETWINCURPOS, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_TCGETWINCURPOS, &resp, sizeof(resp)) &&
-	     ctx->copy_to_dest(wcp, &resp.pos, sizeof(*wcp)) )
+	bool received =
+		SendMessage(request, FSM_REQ_TCGETWINCURPOS, &msg, sizeof(msg)) &&
+		RecvMessage(request, FSM_RESP_TCGETWINCURPOS, &resp, sizeof(resp));
+	request->KernelClose();
+	if ( received && ctx->copy_to_dest(wcp, &resp.pos, sizeof(*wcp)) )
 		ret = 0;
-	channel->KernelClose();
 	return ret;
 }
 
@@ -1466,51 +2004,52 @@ int Unode::ioctl(ioctx_t* ctx, int cmd, uintptr_t arg)
 	if ( cmd == TIOCGWINSZ )
 	{
 		struct winsize* ws = (struct winsize*) arg;
-		Channel* channel = server->Connect(ctx);
-		if ( !channel )
+		Request* request = server->Begin(ctx);
+		if ( !request )
 			return -1;
 		int ret = -1;
 		struct fsm_req_tcgetwinsize msg;
 		struct fsm_resp_tcgetwinsize resp;
 		msg.ino = ino;
-		if ( SendMessage(channel, FSM_REQ_TCGETWINSIZE, &msg, sizeof(msg)) &&
-		     RecvMessage(channel, FSM_RESP_TCGETWINSIZE, &resp, sizeof(resp)) &&
-		     ctx->copy_to_dest(ws, &resp.size, sizeof(*ws)) )
+		bool received =
+			SendMessage(request, FSM_REQ_TCGETWINSIZE, &msg, sizeof(msg)) &&
+			RecvMessage(request, FSM_RESP_TCGETWINSIZE, &resp, sizeof(resp));
+		request->KernelClose();
+		if ( received && ctx->copy_to_dest(ws, &resp.size, sizeof(*ws)) )
 			ret = 0;
-		channel->KernelClose();
 		return ret;
 	}
 	return errno = ENOTTY, -1;
 }
 int Unode::tcsetpgrp(ioctx_t* ctx, pid_t pgid)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_tcsetpgrp msg;
 	msg.ino = ino;
 	msg.pgid = pgid;
-	if ( SendMessage(channel, FSM_REQ_TCSETPGRP, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_TCSETPGRP, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
 pid_t Unode::tcgetpgrp(ioctx_t* ctx)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	pid_t ret = -1;
 	struct fsm_req_tcgetpgrp msg;
 	struct fsm_resp_tcgetpgrp resp;
 	msg.ino = ino;
-	if ( SendMessage(channel, FSM_REQ_TCGETPGRP, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_TCGETPGRP, &resp, sizeof(resp)) )
+	if ( SendMessage(request, FSM_REQ_TCGETPGRP, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_TCGETPGRP, &resp, sizeof(resp)) )
 		ret = resp.pgid;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1526,8 +2065,8 @@ int Unode::poll(ioctx_t* /*ctx*/, PollNode* node)
 int Unode::rename_here(ioctx_t* ctx, Ref<Inode> from, const char* oldname,
                        const char* newname)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_rename msg;
@@ -1536,12 +2075,12 @@ int Unode::rename_here(ioctx_t* ctx, Ref<Inode> from, const char* oldname,
 	msg.oldnamelen = strlen(oldname);
 	msg.newnamelen = strlen(newname);
 	size_t extra = msg.oldnamelen + msg.newnamelen;
-	if ( SendMessage(channel, FSM_REQ_RENAME, &msg, sizeof(msg), extra) &&
-	     channel->KernelSend(&kctx, oldname, msg.oldnamelen) &&
-	     channel->KernelSend(&kctx, newname, msg.newnamelen) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_RENAME, &msg, sizeof(msg), extra) &&
+	     request->KernelSend(&kctx, oldname, msg.oldnamelen) &&
+	     request->KernelSend(&kctx, newname, msg.newnamelen) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1595,8 +2134,8 @@ int Unode::getsockopt(ioctx_t* ctx, int level, int option_name,
 	size_t option_size;
 	if ( !ctx->copy_from_src(&option_size, option_size_ptr, sizeof(option_size)) )
 		return -1;
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_getsockopt msg;
@@ -1605,44 +2144,57 @@ int Unode::getsockopt(ioctx_t* ctx, int level, int option_name,
 	msg.level = level;
 	msg.option_name = option_name;
 	msg.max_option_size = option_size;
-	if ( SendMessage(channel, FSM_REQ_GETSOCKOPT, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_GETSOCKOPT, &resp, sizeof(resp)) )
+	uint8_t* value = NULL;
+	if ( SendMessage(request, FSM_REQ_GETSOCKOPT, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_GETSOCKOPT, &resp, sizeof(resp)) )
 	{
 		if ( resp.option_size < option_size )
 			option_size = resp.option_size;
-		if ( channel->KernelRecv(ctx, option_value, option_size) )
+		if ( (value = new uint8_t[option_size ? option_size : 1]) &&
+		     request->KernelRecv(&kctx, value, option_size) )
 			ret = 0;
-		if ( !ctx->copy_to_dest(option_size_ptr, &option_size, sizeof(option_size)) )
-			ret = -1;
 	}
-	channel->KernelClose();
+	request->KernelClose();
+	if ( ret == 0 &&
+	     (!ctx->copy_to_dest(option_value, value, option_size) ||
+	      !ctx->copy_to_dest(option_size_ptr, &option_size,
+	                         sizeof(option_size))) )
+		ret = -1;
+	delete[] value;
 	return ret;
 }
 
 int Unode::setsockopt(ioctx_t* ctx, int level, int option_name,
                       const void* option_value, size_t option_size)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	uint8_t* value = new uint8_t[option_size ? option_size : 1];
+	if ( !value )
 		return -1;
+	if ( !ctx->copy_from_src(value, option_value, option_size) )
+		return delete[] value, -1;
+	Request* request = server->Begin(ctx);
+	if ( !request )
+		return delete[] value, -1;
 	int ret = -1;
 	struct fsm_req_setsockopt msg;
 	msg.ino = ino;
 	msg.level = level;
 	msg.option_name = option_name;
 	msg.option_size = option_size;
-	if ( SendMessage(channel, FSM_REQ_SETSOCKOPT, &msg, sizeof(msg)) &&
-	     channel->KernelSend(ctx, option_value, option_size) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_SETSOCKOPT, &msg, sizeof(msg),
+	                 option_size) &&
+	     request->KernelSend(&kctx, value, option_size) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
+	delete[] value;
 	return ret;
 }
 
 ssize_t Unode::tcgetblob(ioctx_t* ctx, const char* name, void* buffer, size_t count)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	if ( !buffer )
 		count = SSIZE_MAX;
@@ -1650,43 +2202,56 @@ ssize_t Unode::tcgetblob(ioctx_t* ctx, const char* name, void* buffer, size_t co
 	size_t namelen = name ? strlen(name) : 0;
 	struct fsm_req_tcgetblob msg;
 	struct fsm_resp_tcgetblob resp;
+	uint8_t* blob = NULL;
 	msg.ino = ino;
 	msg.namelen = namelen;
-	if ( SendMessage(channel, FSM_REQ_TCGETBLOB, &msg, sizeof(msg), namelen) &&
-	     channel->KernelSend(&kctx, name, namelen) &&
-	     RecvMessage(channel, FSM_RESP_TCGETBLOB, &resp, sizeof(resp)) )
+	if ( SendMessage(request, FSM_REQ_TCGETBLOB, &msg, sizeof(msg), namelen) &&
+	     request->KernelSend(&kctx, name, namelen) &&
+	     RecvMessage(request, FSM_RESP_TCGETBLOB, &resp, sizeof(resp)) )
 	{
 		if ( resp.count < count )
 			count = resp.count;
 		if ( count < resp.count )
 			errno = ERANGE;
-		else if ( !buffer || channel->KernelRecv(ctx, buffer, count) )
+		else if ( !buffer )
+			ret = (ssize_t) count;
+		else if ( (blob = new uint8_t[count ? count : 1]) &&
+		          request->KernelRecv(&kctx, blob, count) )
 			ret = (ssize_t) count;
 	}
-	channel->KernelClose();
+	request->KernelClose();
+	if ( 0 <= ret && buffer && !ctx->copy_to_dest(buffer, blob, count) )
+		ret = -1;
+	delete[] blob;
 	return ret;
 }
 
 ssize_t Unode::tcsetblob(ioctx_t* ctx, const char* name, const void* buffer, size_t count)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
-		return -1;
-	ssize_t ret = -1;
 	size_t namelen = name ? strlen(name) : 0;
 	if ( SIZE_MAX - count < namelen )
 		return errno = EOVERFLOW, -1;
+	uint8_t* blob = new uint8_t[count ? count : 1];
+	if ( !blob )
+		return -1;
+	if ( !ctx->copy_from_src(blob, buffer, count) )
+		return delete[] blob, -1;
+	Request* request = server->Begin(ctx);
+	if ( !request )
+		return delete[] blob, -1;
+	ssize_t ret = -1;
 	struct fsm_req_tcsetblob msg;
 	struct fsm_resp_tcsetblob resp;
 	msg.ino = ino;
 	msg.namelen = namelen;
 	msg.count = count;
-	if ( SendMessage(channel, FSM_REQ_TCSETBLOB, &msg, sizeof(msg), namelen + count) &&
-	     channel->KernelSend(&kctx, name, namelen) &&
-	     channel->KernelSend(ctx, buffer, count) &&
-	     RecvMessage(channel, FSM_RESP_TCSETBLOB, &resp, sizeof(resp)) )
+	if ( SendMessage(request, FSM_REQ_TCSETBLOB, &msg, sizeof(msg), namelen + count) &&
+	     request->KernelSend(&kctx, name, namelen) &&
+	     request->KernelSend(&kctx, blob, count) &&
+	     RecvMessage(request, FSM_RESP_TCSETBLOB, &resp, sizeof(resp)) )
 		ret = (ssize_t) resp.count;
-	channel->KernelClose();
+	request->KernelClose();
+	delete[] blob;
 	return ret;
 }
 
@@ -1698,97 +2263,98 @@ int Unode::unmounted(ioctx_t* /*ctx*/)
 
 int Unode::tcdrain(ioctx_t* ctx)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_tcdrain msg;
 	msg.ino = ino;
-	if ( SendMessage(channel, FSM_REQ_TCDRAIN, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_TCDRAIN, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
 int Unode::tcflow(ioctx_t* ctx, int action)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_tcflow msg;
 	msg.ino = ino;
 	msg.action = action;
-	if ( SendMessage(channel, FSM_REQ_TCFLOW, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_TCFLOW, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
 int Unode::tcflush(ioctx_t* ctx, int queue_selector)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_tcflush msg;
 	msg.ino = ino;
 	msg.queue_selector = queue_selector;
-	if ( SendMessage(channel, FSM_REQ_TCFLUSH, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_TCFLUSH, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
 int Unode::tcgetattr(ioctx_t* ctx, struct termios* io_tio)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_tcgetattr msg;
 	struct fsm_resp_tcgetattr resp;
 	msg.ino = ino;
-	if ( SendMessage(channel, FSM_REQ_TCGETATTR, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_TCGETATTR, &resp, sizeof(resp)) &&
-	     ctx->copy_to_dest(io_tio, &resp.tio, sizeof(resp.tio)) )
+	bool received =
+		SendMessage(request, FSM_REQ_TCGETATTR, &msg, sizeof(msg)) &&
+		RecvMessage(request, FSM_RESP_TCGETATTR, &resp, sizeof(resp));
+	request->KernelClose();
+	if ( received && ctx->copy_to_dest(io_tio, &resp.tio, sizeof(resp.tio)) )
 		ret = 0;
-	channel->KernelClose();
 	return ret;
 }
 
 pid_t Unode::tcgetsid(ioctx_t* ctx)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	pid_t ret = -1;
 	struct fsm_req_tcgetsid msg;
 	struct fsm_resp_tcgetsid resp;
 	msg.ino = ino;
-	if ( SendMessage(channel, FSM_REQ_TCGETSID, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_TCGETSID, &resp, sizeof(resp)) )
+	if ( SendMessage(request, FSM_REQ_TCGETSID, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_TCGETSID, &resp, sizeof(resp)) )
 		ret = resp.sid;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
 int Unode::tcsendbreak(ioctx_t* ctx, int duration)
 {
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	struct fsm_req_tcsendbreak msg;
 	msg.ino = ino;
 	msg.duration = duration;
-	if ( SendMessage(channel, FSM_REQ_TCSENDBREAK, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_TCSENDBREAK, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1797,32 +2363,32 @@ int Unode::tcsetattr(ioctx_t* ctx, int actions, const struct termios* user_tio)
 	struct fsm_req_tcsetattr msg;
 	if ( !ctx->copy_from_src(&msg.tio, user_tio, sizeof(msg.tio)) )
 		return -1;
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	msg.ino = ino;
 	msg.actions = actions;
-	if ( SendMessage(channel, FSM_REQ_TCSETATTR, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_TCSETATTR, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
 int Unode::shutdown(ioctx_t* ctx, int how)
 {
 	struct fsm_req_shutdown msg;
-	Channel* channel = server->Connect(ctx);
-	if ( !channel )
+	Request* request = server->Begin(ctx);
+	if ( !request )
 		return -1;
 	int ret = -1;
 	msg.ino = ino;
 	msg.how = how;
-	if ( SendMessage(channel, FSM_REQ_SHUTDOWN, &msg, sizeof(msg)) &&
-	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
+	if ( SendMessage(request, FSM_REQ_SHUTDOWN, &msg, sizeof(msg)) &&
+	     RecvMessage(request, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
-	channel->KernelClose();
+	request->KernelClose();
 	return ret;
 }
 
@@ -1845,9 +2411,10 @@ int Unode::sockatmark(ioctx_t* /*ctx*/)
 
 bool Bootstrap(Ref<Inode>* out_root,
                Ref<Inode>* out_server,
-               const struct stat* rootst)
+               const struct stat* rootst,
+               int flags)
 {
-	Ref<Server> server(new Server());
+	Ref<Server> server(new Server(flags & FSM_MOUNT_MULTIPLEX));
 	if ( !server )
 		return false;
 
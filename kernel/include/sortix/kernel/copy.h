@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2012, 2014, 2021 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sortix/kernel/copy.h
+ * The context for io operations: who made it, how should data be copied, etc.
+ */
+
+#ifndef _INCLUDE_SORTIX_KERNEL_COPY_H
+#define _INCLUDE_SORTIX_KERNEL_COPY_H
+
+#include <stddef.h>
+
+#include <sortix/kernel/decl.h>
+
+namespace Sortix {
+
+bool CopyToUser(void* userdst, const void* ksrc, size_t count);
+bool CopyFromUser(void* kdst, const void* usersrc, size_t count);
+bool CopyToKernel(void* kdst, const void* ksrc, size_t count);
+bool CopyFromKernel(void* kdst, const void* ksrc, size_t count);
+bool ReadAtomicFromUser(int* kdst, const int* usersrc);
+bool ZeroKernel(void* kdst, size_t count);
+bool ZeroUser(void* userdst, size_t count);
+char* GetStringFromUser(const char* str);
+bool PinUserMemory(const void* userbuf, size_t count, bool write,
+                   addr_t* frames);
+void UnpinUserMemory(const void* userbuf, size_t count, const addr_t* frames);
+
+} // namespace Sortix
+
+#endif
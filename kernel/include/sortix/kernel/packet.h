@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2016 Meisaka Yukara.
+ * Copyright (c) 2016, 2017 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sortix/kernel/packet.h
+ * Reference counted network packets.
+ */
+
+#ifndef _INCLUDE_SORTIX_KERNEL_PACKET_H
+#define _INCLUDE_SORTIX_KERNEL_PACKET_H
+
+#include <endian.h>
+#include <stdint.h>
+
+#include <sortix/kernel/addralloc.h>
+#include <sortix/kernel/pci-mmio.h>
+#include <sortix/kernel/refcount.h>
+
+namespace Sortix {
+
+class NetworkInterface;
+
+// Packets reserved for a network interface, so it can always refill its receive
+// ring even if the packets of the system are exhausted. Packets from the pool
+// are returned to it when freed, until it's full again. The pool must outlive
+// its packets.
+struct packet_pool
+{
+	paddrmapped_t* pages;
+	size_t used;
+	size_t allocated;
+};
+
+// The transport checksum is stored at checksum_start + checksum_offset and
+// must be completed over the data from checksum_start by the network interface
+// (or in software if not supported). The checksum field is initialized to the
+// pseudo-header checksum without taking the complement.
+#define PACKET_CHECKSUM_PARTIAL (1 << 0)
+// The IP header checksum of the incoming packet was verified by the hardware.
+#define PACKET_CHECKSUM_IP_VERIFIED (1 << 1)
+// The transport checksum of the incoming packet was verified by the hardware,
+// or the packet never left this machine.
+#define PACKET_CHECKSUM_VERIFIED (1 << 2)
+
+class Packet : public Refcountable
+{
+public:
+	Packet(paddrmapped_t pmap);
+	virtual ~Packet();
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr);
+
+public:
+	paddrmapped_t pmap;
+	unsigned char* from;
+	size_t length;
+	size_t offset;
+	NetworkInterface* netif;
+	struct packet_pool* pool;
+	Ref<Packet> next;
+	// The packet continues in this packet on network interfaces with the
+	// IF_FEATURE_SCATTER_GATHER feature, or if consecutive TCP segments were
+	// merged when received.
+	Ref<Packet> fragment;
+	size_t checksum_start;
+	size_t checksum_offset;
+	int checksum_flags;
+	// The TCP segment is cut into segments with this much data each, by the
+	// network interface with the IF_FEATURE_TCP_SEGMENTATION_OFFLOAD feature
+	// or otherwise in software, if not zero. The pseudo-header sum in the
+	// checksum field doesn't include the length in that case.
+	size_t segment_size;
+
+};
+
+Ref<Packet> GetPacket(struct packet_pool* pool = NULL);
+bool ReservePackets(struct packet_pool* pool, size_t count);
+size_t GetPacketLength(const Packet* pkt);
+void CopyPacketData(void* dst, const Packet* pkt, size_t position,
+                    size_t length);
+
+} // namespace Sortix
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sortix/kernel/pagecache.h
+ * Cache of file pages shared between file mappings.
+ */
+
+#ifndef _INCLUDE_SORTIX_KERNEL_PAGECACHE_H
+#define _INCLUDE_SORTIX_KERNEL_PAGECACHE_H
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <timespec.h>
+
+#include <sortix/kernel/decl.h>
+
+struct iovec;
+
+namespace Sortix {
+
+struct ioctx_struct;
+typedef struct ioctx_struct ioctx_t;
+
+// A page worth of file contents is identified by the file, its modification
+// time when mapped, the generation of the file when the page was read, the
+// position in the file, and how many bytes of the file are in the page (the
+// rest of the page is zero).
+struct page_cache_key
+{
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	uintmax_t generation;
+	off_t offset;
+	size_t size;
+};
+
+namespace PageCache {
+
+// Returns the current generation of the file, which must be stored in the key
+// before the file contents are read.
+uintmax_t Generation(dev_t dev, ino_t ino);
+// Advances the generation of the file after its contents have been changed, so
+// pages read before the change are no longer found or inserted.
+void Invalidate(dev_t dev, ino_t ino);
+// Returns a new reference to the physical page if it's cached.
+bool Lookup(const struct page_cache_key* key, addr_t* page);
+// Lets the cache keep a reference to the physical page, which must not be
+// written to afterwards, unless the file has changed since the key's
+// generation.
+bool Insert(const struct page_cache_key* key, addr_t page);
+// Refuses opening the file for writing until the matching AllowWrite, as the
+// file is a running program whose pages are loaded as they're accessed. Fails
+// with ETXTBSY if the file is open for writing.
+bool DenyWrite(dev_t dev, ino_t ino);
+void AllowWrite(dev_t dev, ino_t ino);
+// Counts a descriptor open for writing to the file until the matching
+// RemoveWriter. Fails with ETXTBSY if the file is a running program.
+bool AddWriter(dev_t dev, ino_t ino);
+void RemoveWriter(dev_t dev, ino_t ino);
+// Counts a shared mapping of the file until the matching RemoveSharedMapping,
+// which releases the pages of the file once it's no longer mapped shared.
+bool AddSharedMapping(dev_t dev, ino_t ino);
+void RemoveSharedMapping(dev_t dev, ino_t ino);
+// Returns a new reference to the page of the file at the offset that is shared
+// by its shared mappings, if it has been loaded.
+bool LookupShared(dev_t dev, ino_t ino, off_t offset, addr_t* page);
+// Lets the page be the one shared by the shared mappings of the file at the
+// offset. Fails with EEXIST if another page was inserted first, or with EAGAIN
+// if the file has changed since the generation and the page must be read again.
+bool InsertShared(dev_t dev, ino_t ino, off_t offset, uintmax_t generation,
+                  addr_t page);
+// Copies the data just written to the file into its shared pages.
+void WriteShared(dev_t dev, ino_t ino, ioctx_t* ctx, const struct iovec* iov,
+                 int iovcnt, off_t offset, size_t amount);
+// Zeroes the shared pages of the file past its new end.
+void TruncateShared(dev_t dev, ino_t ino, off_t length);
+
+} // namespace PageCache
+} // namespace Sortix
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2013 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sortix/kernel/segment.h
+ * Structure representing a segment in a process.
+ */
+
+#ifndef _INCLUDE_SORTIX_KERNEL_SEGMENT_H
+#define _INCLUDE_SORTIX_KERNEL_SEGMENT_H
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <timespec.h>
+
+namespace Sortix {
+
+class Descriptor;
+class Process;
+
+struct segment
+{
+	uintptr_t addr;
+	size_t size;
+	int prot;
+	// Pages of a segment with a backing file are mapped on first access. The
+	// first backing_size bytes are read from the file at backing_offset and the
+	// rest of the segment is zero. The segment owns a reference to the file.
+	// Pages are loaded with the current file contents, and pages past the end
+	// of the file can't be loaded. The file's modification time and size are
+	// remembered along with the file's page cache generation, and are only
+	// looked up again once the generation has changed. Shared segments map the
+	// same pages as every other shared mapping of the file, and the pages
+	// written to are written back to the file when unmapped. Opening the file
+	// for writing is refused while a program is mapped from it, so the program
+	// can keep loading its pages.
+	Descriptor* backing;
+	off_t backing_offset;
+	size_t backing_size;
+	struct timespec backing_mtime;
+	off_t backing_file_size;
+	uintmax_t backing_generation;
+	bool backing_shared;
+	bool backing_deny_write;
+};
+
+static inline int segmentcmp(const void* a_ptr, const void* b_ptr)
+{
+	const struct segment* a = (const struct segment*) a_ptr;
+	const struct segment* b = (const struct segment*) b_ptr;
+	return a->addr < b->addr ? -1 :
+	       b->addr < a->addr ?  1 :
+	       a->size < b->size ? -1 :
+	       b->size < a->size ?  1 :
+	                            0 ;
+}
+
+bool AreSegmentsOverlapping(const struct segment* a, const struct segment* b);
+bool IsUserspaceSegment(const struct segment* segment);
+struct segment* FindOverlappingSegment(Process* process, const struct segment* new_segment);
+bool IsSegmentOverlapping(Process* process, const struct segment* new_segment);
+bool AddSegment(Process* process, const struct segment* new_segment);
+bool PlaceSegment(struct segment* solution, Process* process, void* addr_ptr,
+                  size_t size, int flags);
+void ReferSegmentBacking(struct segment* segment);
+void UnrefSegmentBacking(struct segment* segment);
+void TrimSegment(struct segment* segment, uintptr_t addr, size_t size);
+
+} // namespace Sortix
+
+#endif
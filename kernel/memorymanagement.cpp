@@ -25,18 +25,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sortix/fcntl.h>
 #include <sortix/memusage.h>
 #include <sortix/mman.h>
 #include <sortix/seek.h>
+#include <sortix/stat.h>
 
 #include <sortix/kernel/copy.h>
 #include <sortix/kernel/descriptor.h>
+#include <sortix/kernel/inode.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/memorymanagement.h>
+#include <sortix/kernel/pagecache.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/segment.h>
 #include <sortix/kernel/syscall.h>
+#include <sortix/kernel/vnode.h>
 
 namespace Sortix {
 
@@ -125,8 +130,10 @@ void UnmapMemory(Process* process, uintptr_t addr, size_t size)
 		{
 			uintptr_t conflict_offset = (uintptr_t) conflict - (uintptr_t) process->segments;
 			size_t conflict_index = conflict_offset / sizeof(struct segment);
+			WriteBackMemory(conflict, conflict->addr, conflict->size);
 			Memory::UnmapRange(conflict->addr, conflict->size, PAGE_USAGE_USER_SPACE);
 			Memory::Flush();
+			UnrefSegmentBacking(conflict);
 			process->segments_used--;
 			for ( size_t i = conflict_index; i < process->segments_used; i++ )
 				process->segments[i] = process->segments[i + 1];
@@ -136,13 +143,14 @@ void UnmapMemory(Process* process, uintptr_t addr, size_t size)
 		// Delete the middle of the segment if our request splits it in two.
 		if ( conflict->addr < addr && addr + size < conflict->size + conflict->addr )
 		{
+			WriteBackMemory(conflict, addr, size);
 			Memory::UnmapRange(addr, size, PAGE_USAGE_USER_SPACE);
 			Memory::Flush();
-			struct segment right_segment;
-			right_segment.addr = addr + size;
-			right_segment.size = conflict->addr + conflict->size - (addr + size);
-			right_segment.prot = conflict->prot;
-			conflict->size = addr - conflict->addr;
+			struct segment right_segment = *conflict;
+			TrimSegment(&right_segment, addr + size,
+			            conflict->addr + conflict->size - (addr + size));
+			ReferSegmentBacking(&right_segment);
+			TrimSegment(conflict, conflict->addr, addr - conflict->addr);
 			// TODO: This shouldn't really fail as we free memory above, but
 			//       this code isn't really provably reliable.
 			if ( !AddSegment(process, &right_segment) )
@@ -153,19 +161,21 @@ void UnmapMemory(Process* process, uintptr_t addr, size_t size)
 		// Delete the part of the segment covered partially from the left.
 		if ( addr <= conflict->addr )
 		{
+			WriteBackMemory(conflict, conflict->addr, addr + size - conflict->addr);
 			Memory::UnmapRange(conflict->addr, addr + size - conflict->addr, PAGE_USAGE_USER_SPACE);
 			Memory::Flush();
-			conflict->size = conflict->addr + conflict->size - (addr + size);
-			conflict->addr = addr + size;
+			TrimSegment(conflict, addr + size,
+			            conflict->addr + conflict->size - (addr + size));
 			continue;
 		}
 
 		// Delete the part of the segment covered partially from the right.
 		if ( conflict->addr <= addr + size )
 		{
+			WriteBackMemory(conflict, addr, conflict->addr + conflict->size - addr);
 			Memory::UnmapRange(addr, conflict->addr + conflict->size - addr, PAGE_USAGE_USER_SPACE);
 			Memory::Flush();
-			conflict->size -= conflict->addr + conflict->size - addr;
+			TrimSegment(conflict, conflict->addr, addr - conflict->addr);
 			continue;
 		}
 	}
@@ -195,20 +205,28 @@ bool ProtectMemory(Process* process, uintptr_t addr, size_t size, int prot)
 		if ( !segment )
 			return errno = EINVAL, false;
 
+		// Shared file mappings can only be made writable if the file is open
+		// for writing, as the pages are written back to the file.
+		if ( segment->backing_shared && (prot & PROT_WRITE) &&
+		     !(segment->backing->GetFlags() & O_WRITE) )
+			return errno = EACCES, false;
+
 		// Split the segment into two if it begins before our search region.
 		if ( segment->addr < search_region.addr )
 		{
-			struct segment new_segment;
-			new_segment.addr = search_region.addr;
-			new_segment.size = segment->addr + segment->size - new_segment.addr;
-			new_segment.prot = segment->prot;
-			segment->size = search_region.addr - segment->addr;
+			struct segment old_segment = *segment;
+			struct segment new_segment = *segment;
+			TrimSegment(&new_segment, search_region.addr,
+			            segment->addr + segment->size - search_region.addr);
+			TrimSegment(segment, segment->addr,
+			            search_region.addr - segment->addr);
 
 			if ( !AddSegment(process, &new_segment) )
 			{
-				segment->size += new_segment.size;
+				*segment = old_segment;
 				return false;
 			}
+			ReferSegmentBacking(&new_segment);
 
 			continue;
 		}
@@ -216,17 +234,18 @@ bool ProtectMemory(Process* process, uintptr_t addr, size_t size, int prot)
 		// Split the segment into two if it ends after addr + size.
 		if ( size < segment->addr + segment->size - addr )
 		{
-			struct segment new_segment;
-			new_segment.addr = addr + size;
-			new_segment.size = segment->addr + segment->size - new_segment.addr;
-			new_segment.prot = segment->prot;
-			segment->size = addr + size - segment->addr;
+			struct segment old_segment = *segment;
+			struct segment new_segment = *segment;
+			TrimSegment(&new_segment, addr + size,
+			            segment->addr + segment->size - (addr + size));
+			TrimSegment(segment, segment->addr, addr + size - segment->addr);
 
 			if ( !AddSegment(process, &new_segment) )
 			{
-				segment->size += new_segment.size;
+				*segment = old_segment;
 				return false;
 			}
+			ReferSegmentBacking(&new_segment);
 
 			continue;
 		}
@@ -263,6 +282,271 @@ bool ProtectMemory(Process* process, uintptr_t addr, size_t size, int prot)
 	return true;
 }
 
+// Describe the file contents backing the page in the key, whose size is zero
+// if the page is zero filled. Fails with EIO if the page is past the end of the
+// file. The file's modification time and size are only looked up again once
+// the file has changed since they were last looked up.
+static bool GetPageKey(struct segment* segment, uintptr_t page,
+                       struct page_cache_key* key)
+{
+	// process->segment_lock is held.
+	memset(key, 0, sizeof(*key));
+	size_t offset = page - segment->addr;
+	if ( !segment->backing || segment->backing_size <= offset )
+		return true;
+	key->dev = segment->backing->dev;
+	key->ino = segment->backing->ino;
+	key->generation = PageCache::Generation(key->dev, key->ino);
+	if ( key->generation != segment->backing_generation )
+	{
+		ioctx_t ctx; SetupKernelIOCtx(&ctx);
+		struct stat st;
+		if ( segment->backing->stat(&ctx, &st) < 0 )
+			return false;
+		segment->backing_mtime = st.st_mtim;
+		segment->backing_file_size = st.st_size;
+		segment->backing_generation = key->generation;
+	}
+	key->mtime = segment->backing_mtime;
+	key->offset = segment->backing_offset + (off_t) offset;
+	if ( segment->backing_file_size <= key->offset )
+		return errno = EIO, false;
+	size_t amount = segment->backing_size - offset;
+	if ( Page::Size() < amount )
+		amount = Page::Size();
+	if ( (uintmax_t) (segment->backing_file_size - key->offset) < amount )
+		amount = segment->backing_file_size - key->offset;
+	key->size = amount;
+	return true;
+}
+
+// Read the file contents described by the key into a new page mapped at the
+// address, where the rest of the page is zero. Other threads can't access the
+// page while it's being read, as they must wait for the segment lock to handle
+// the page fault.
+static bool ReadPage(struct segment* segment, uintptr_t page,
+                     const struct page_cache_key* key, addr_t* phys_ptr,
+                     size_t* so_far_ptr)
+{
+	// process->segment_lock is held.
+	addr_t phys = Page::Get(PAGE_USAGE_USER_SPACE);
+	if ( !phys )
+		return errno = ENOMEM, false;
+	if ( !Map(phys, page, PROT_KREAD | PROT_KWRITE) )
+	{
+		Page::Put(phys, PAGE_USAGE_USER_SPACE);
+		return errno = ENOMEM, false;
+	}
+	InvalidatePage(page);
+	uint8_t* buffer = (uint8_t*) page;
+	memset(buffer, 0, Page::Size());
+	ioctx_t ctx; SetupKernelIOCtx(&ctx);
+	size_t so_far = 0;
+	while ( so_far < key->size )
+	{
+		ssize_t num_bytes = segment->backing->pread(&ctx, buffer + so_far,
+		                                            key->size - so_far,
+		                                            key->offset + so_far);
+		if ( num_bytes < 0 )
+		{
+			Unmap(page);
+			InvalidatePage(page);
+			Page::Put(phys, PAGE_USAGE_USER_SPACE);
+			return false;
+		}
+		// The remainder is zero if the file has been truncated.
+		if ( !num_bytes )
+			break;
+		so_far += num_bytes;
+	}
+	*phys_ptr = phys;
+	*so_far_ptr = so_far;
+	return true;
+}
+
+// Map the page of a shared file mapping, which is the same page in every shared
+// mapping of the file, reading it from the file if it isn't mapped anywhere.
+static bool FaultInSharedPage(struct segment* segment, uintptr_t page,
+                              struct page_cache_key* key)
+{
+	// process->segment_lock is held.
+	while ( true )
+	{
+		addr_t phys;
+		if ( PageCache::LookupShared(key->dev, key->ino, key->offset, &phys) )
+		{
+			if ( !MapShared(phys, page, segment->prot) )
+			{
+				Page::Put(phys, PAGE_USAGE_USER_SPACE);
+				return errno = ENOMEM, false;
+			}
+			InvalidatePage(page);
+			return true;
+		}
+		size_t so_far;
+		if ( !ReadPage(segment, page, key, &phys, &so_far) )
+			return false;
+		if ( PageCache::InsertShared(key->dev, key->ino, key->offset,
+		                             key->generation, phys) )
+		{
+			MapShared(phys, page, segment->prot);
+			InvalidatePage(page);
+			return true;
+		}
+		Unmap(page);
+		InvalidatePage(page);
+		Page::Put(phys, PAGE_USAGE_USER_SPACE);
+		// Another process loaded the page first, or the file was changed while
+		// the page was read, so look for the page again.
+		if ( errno != EEXIST && errno != EAGAIN )
+			return false;
+		if ( !GetPageKey(segment, page, key) )
+			return false;
+	}
+}
+
+// Map a page of a file backed segment. Pages of private mappings are shared
+// copy-on-write with other mappings of the same file contents if possible, and
+// are otherwise read from the file.
+static bool FaultInPage(struct segment* segment, uintptr_t page)
+{
+	// process->segment_lock is held.
+	// Anonymous memory whose pages have been discarded is zero filled.
+	struct page_cache_key key;
+	if ( !GetPageKey(segment, page, &key) )
+		return false;
+	if ( key.size && segment->backing_shared )
+		return FaultInSharedPage(segment, page, &key);
+	addr_t phys;
+	if ( key.size && PageCache::Lookup(&key, &phys) )
+	{
+		if ( !MapCopyOnWrite(phys, page, segment->prot) )
+		{
+			Page::Put(phys, PAGE_USAGE_USER_SPACE);
+			return errno = ENOMEM, false;
+		}
+		InvalidatePage(page);
+		return true;
+	}
+	size_t so_far;
+	if ( !ReadPage(segment, page, &key, &phys, &so_far) )
+		return false;
+	// Share the page with later mappings of the file unless it was truncated
+	// or written to in the meanwhile.
+	if ( key.size && so_far == key.size && PageCache::Insert(&key, phys) )
+		MapCopyOnWrite(phys, page, segment->prot);
+	else
+		Map(phys, page, segment->prot);
+	InvalidatePage(page);
+	return true;
+}
+
+// Write the pages of a shared file mapping that have been written to since they
+// were last written back to the file, without extending the file. The pages are
+// written to the file's inode directly, as its shared pages already have the
+// data, and copying the data into them again would lose concurrent writes.
+bool WriteBackMemory(struct segment* segment, uintptr_t addr, size_t size)
+{
+	// process->segment_lock is held.
+	if ( !segment->backing || !segment->backing_shared )
+		return true;
+	Ref<Vnode> vnode = segment->backing->vnode;
+	ioctx_t ctx; SetupKernelIOCtx(&ctx);
+	bool success = true;
+	bool changed = false;
+	off_t file_size = -1;
+	for ( uintptr_t page = addr; page < addr + size; page += Page::Size() )
+	{
+		size_t offset = page - segment->addr;
+		if ( segment->backing_size <= offset )
+			break;
+		if ( !ClearDirty(page) )
+			continue;
+		if ( file_size < 0 )
+		{
+			struct stat st;
+			if ( vnode->stat(&ctx, &st) < 0 )
+				return false;
+			file_size = st.st_size;
+		}
+		off_t file_offset = segment->backing_offset + (off_t) offset;
+		if ( file_size <= file_offset )
+			continue;
+		size_t amount = segment->backing_size - offset;
+		if ( Page::Size() < amount )
+			amount = Page::Size();
+		if ( (uintmax_t) (file_size - file_offset) < amount )
+			amount = file_size - file_offset;
+		const uint8_t* buffer = (const uint8_t*) page;
+		for ( size_t so_far = 0; so_far < amount; )
+		{
+			ssize_t num_bytes = vnode->inode->pwrite(&ctx, buffer + so_far,
+			                                         amount - so_far,
+			                                         file_offset + so_far);
+			if ( num_bytes <= 0 )
+			{
+				success = false;
+				break;
+			}
+			so_far += num_bytes;
+			changed = true;
+		}
+	}
+	if ( changed )
+		PageCache::Invalidate(segment->backing->dev, segment->backing->ino);
+	if ( !success )
+		return errno = EIO, false;
+	return true;
+}
+
+// Make the page containing the address accessible to the kernel, reading it
+// from the backing file (or zeroing it if the segment is anonymous) if it isn't
+// present, and giving the process
+// its own copy of the page if it's about to be written and is shared.
+bool PrepareUserPage(Process* process, struct segment* segment, uintptr_t addr,
+                     bool write)
+{
+	// process->segment_lock is held.
+	(void) process;
+	uintptr_t page = Page::AlignDown(addr);
+	if ( !LookUp(page, NULL, NULL) && !FaultInPage(segment, page) )
+		return false;
+	if ( write && !BreakCopyOnWrite(page) )
+		return errno = ENOMEM, false;
+	return true;
+}
+
+// Resolve a page fault in user-space, which is legitimate if the page is meant
+// to be loaded on demand from a file, or if the page is shared copy-on-write
+// and the segment is writable. Fails with EIO if the page couldn't be loaded
+// from the file, which isn't an invalid access.
+bool HandlePageFault(Process* process, uintptr_t addr, int access)
+{
+	assert(process == CurrentProcess());
+	ScopedLock lock(&process->segment_lock);
+	struct segment search_region;
+	search_region.addr = Page::AlignDown(addr);
+	search_region.size = Page::Size();
+	search_region.prot = 0;
+	struct segment* segment = FindOverlappingSegment(process, &search_region);
+	if ( !segment || (segment->prot & access) != access )
+		return errno = EFAULT, false;
+	if ( !PrepareUserPage(process, segment, addr, access & PROT_WRITE) )
+	{
+		if ( errno != EIO )
+			errno = EFAULT;
+		return false;
+	}
+	// Only retry the access if the page now permits it, otherwise it would
+	// just fault again.
+	int prot;
+	if ( !LookUp(search_region.addr, NULL, &prot) )
+		return errno = EFAULT, false;
+	if ( (prot & access) != access )
+		return errno = EFAULT, false;
+	return true;
+}
+
 bool MapMemory(Process* process, uintptr_t addr, size_t size, int prot)
 {
 	// process->segment_write_lock is held.
@@ -277,6 +561,14 @@ bool MapMemory(Process* process, uintptr_t addr, size_t size, int prot)
 	new_segment.addr = addr;
 	new_segment.size = size;
 	new_segment.prot = prot;
+	new_segment.backing = NULL;
+	new_segment.backing_offset = 0;
+	new_segment.backing_size = 0;
+	new_segment.backing_mtime = timespec_nul();
+	new_segment.backing_file_size = 0;
+	new_segment.backing_generation = 0;
+	new_segment.backing_shared = false;
+	new_segment.backing_deny_write = false;
 
 	if ( !MapRange(new_segment.addr, new_segment.size, new_segment.prot, PAGE_USAGE_USER_SPACE) )
 		return false;
@@ -299,6 +591,30 @@ bool MapMemory(Process* process, uintptr_t addr, size_t size, int prot)
 	return true;
 }
 
+// Add a segment backed by a file, whose pages are read from the file on the
+// first access rather than right away.
+bool MapBackedMemory(Process* process, struct segment* segment)
+{
+	// process->segment_write_lock is held.
+	// process->segment_lock is held.
+	assert(Page::IsAligned(segment->addr));
+	assert(Page::IsAligned(segment->size));
+	assert(segment->backing);
+	assert(process == CurrentProcess());
+
+	UnmapMemory(process, segment->addr, segment->size);
+
+	struct segment new_segment = *segment;
+	ReferSegmentBacking(&new_segment);
+	if ( !AddSegment(process, &new_segment) )
+	{
+		UnrefSegmentBacking(&new_segment);
+		return false;
+	}
+
+	return true;
+}
+
 } // namespace Memory
 } // namespace Sortix
 
@@ -330,8 +646,8 @@ void* sys_mmap(void* addr_ptr, size_t size, int prot, int flags, int fd,
 	// Verify that MAP_PRIVATE and MAP_SHARED are not both set.
 	if ( bool(flags & MAP_PRIVATE) == bool(flags & MAP_SHARED) )
 		return errno = EINVAL, MAP_FAILED;
-	// TODO: MAP_SHARED is not currently supported.
-	if ( flags & MAP_SHARED )
+	// TODO: Shared anonymous memory is not currently supported.
+	if ( (flags & MAP_SHARED) && (flags & MAP_ANONYMOUS) )
 		return errno = EINVAL, MAP_FAILED;
 	// Verify the fíle descriptor and the offset is suitable set if needed.
 	if ( !(flags & MAP_ANONYMOUS) &&
@@ -361,6 +677,8 @@ void* sys_mmap(void* addr_ptr, size_t size, int prot, int flags, int fd,
 	// Verify whether the backing file is usable for memory mapping.
 	ioctx_t ctx; SetupUserIOCtx(&ctx);
 	Ref<Descriptor> desc;
+	struct stat st;
+	uintmax_t generation = 0;
 	if ( !(flags & MAP_ANONYMOUS) )
 	{
 		if ( !(desc = process->GetDescriptor(fd)) )
@@ -375,6 +693,10 @@ void* sys_mmap(void* addr_ptr, size_t size, int prot, int flags, int fd,
 		if ( (prot & PROT_WRITE) && !(flags & MAP_PRIVATE) &&
 		     desc->write(&ctx, NULL, 0) != 0 )
 			return errno = EACCES, MAP_FAILED;
+		generation = PageCache::Generation(desc->dev, desc->ino);
+		ioctx_t kctx; SetupKernelIOCtx(&kctx);
+		if ( desc->stat(&kctx, &st) < 0 )
+			return MAP_FAILED;
 	}
 
 	ScopedLock lock1(&process->segment_write_lock);
@@ -387,54 +709,47 @@ void* sys_mmap(void* addr_ptr, size_t size, int prot, int flags, int fd,
 		new_segment.size = aligned_size;
 	else if ( !PlaceSegment(&new_segment, process, (void*) addr, aligned_size, flags) )
 		return errno = ENOMEM, MAP_FAILED;
-	new_segment.prot = PROT_KWRITE | PROT_FORK;
-
-	// Allocate a memory segment with the desired properties.
-	if ( !Memory::MapMemory(process, new_segment.addr, new_segment.size, new_segment.prot) )
-		return MAP_FAILED;
-
-	// The pread will copy to user-space right requires this lock to be free.
-	lock2.Reset();
+	if ( prot & PROT_READ )
+		prot |= PROT_KREAD;
+	if ( prot & PROT_WRITE )
+		prot |= PROT_KWRITE;
+	// The pages of shared mappings are written back through the mapping.
+	if ( flags & MAP_SHARED )
+		prot |= PROT_KREAD;
+	prot |= PROT_FORK;
 
-	// Read the file contents into the newly allocated memory.
+	// Map the file contents on demand as the pages are first accessed.
 	if ( !(flags & MAP_ANONYMOUS) )
 	{
-		ioctx_t kctx; SetupKernelIOCtx(&kctx);
-		for ( size_t so_far = 0; so_far < aligned_size; )
-		{
-			uint8_t* ptr = (uint8_t*) (new_segment.addr + so_far);
-			size_t left = aligned_size - so_far;
-			off_t pos = offset + so_far;
-			ssize_t num_bytes = desc->pread(&kctx, ptr, left, pos);
-			if ( num_bytes < 0 )
-			{
-				// TODO: How should this situation be handled? For now we'll
-				//       just ignore the error condition.
-				errno = 0;
-				break;
-			}
-			if ( !num_bytes )
-			{
-				// We got an unexpected early end-of-file condition, but that's
-				// alright as the MapMemory call zero'd the new memory and we
-				// are expected to zero the remainder.
-				break;
-			}
-			so_far += num_bytes;
-		}
+		new_segment.prot = prot;
+		new_segment.backing = desc.Get();
+		new_segment.backing_offset = offset;
+		new_segment.backing_size = aligned_size;
+		new_segment.backing_mtime = st.st_mtim;
+		new_segment.backing_file_size = st.st_size;
+		new_segment.backing_generation = generation;
+		new_segment.backing_shared = flags & MAP_SHARED;
+		new_segment.backing_deny_write = false;
+		// Count the mapping while it's being made, so unmapping another shared
+		// mapping of the file in its place doesn't release the shared pages.
+		if ( new_segment.backing_shared &&
+		     !PageCache::AddSharedMapping(desc->dev, desc->ino) )
+			return MAP_FAILED;
+		bool success = Memory::MapBackedMemory(process, &new_segment);
+		if ( new_segment.backing_shared )
+			PageCache::RemoveSharedMapping(desc->dev, desc->ino);
+		if ( !success )
+			return MAP_FAILED;
+		return (void*) new_segment.addr;
 	}
 
+	// Allocate a memory segment with the desired properties.
+	new_segment.prot = PROT_KWRITE | PROT_FORK;
+	if ( !Memory::MapMemory(process, new_segment.addr, new_segment.size, new_segment.prot) )
+		return MAP_FAILED;
+
 	// Finally switch to the desired page protections.
-	kthread_mutex_lock(&process->segment_lock);
-	if ( prot & PROT_READ )
-		prot |= PROT_KREAD;
-	if ( prot & PROT_WRITE )
-		prot |= PROT_KWRITE;
-	prot |= PROT_FORK;
 	Memory::ProtectMemory(CurrentProcess(), new_segment.addr, new_segment.size, prot);
-	kthread_mutex_unlock(&process->segment_lock);
-
-	lock1.Reset();
 
 	return (void*) new_segment.addr;
 }
@@ -483,6 +798,116 @@ int sys_munmap(void* addr_ptr, size_t size)
 	return 0;
 }
 
+int sys_madvise(void* addr_ptr, size_t size, int advice)
+{
+	// Verify that that the address is suitable aligned.
+	uintptr_t addr = (uintptr_t) addr_ptr;
+	if ( !Page::IsAligned(addr) )
+		return errno = EINVAL, -1;
+	if ( advice != MADV_NORMAL && advice != MADV_RANDOM &&
+	     advice != MADV_SEQUENTIAL && advice != MADV_WILLNEED &&
+	     advice != MADV_DONTNEED )
+		return errno = EINVAL, -1;
+
+	size = Page::AlignUp(size);
+	if ( addr + size < addr )
+		return errno = ENOMEM, -1;
+
+	Process* process = CurrentProcess();
+	ScopedLock lock1(&process->segment_write_lock);
+	ScopedLock lock2(&process->segment_lock);
+
+	// The whole range must be mapped.
+	for ( uintptr_t at = addr; at < addr + size; )
+	{
+		struct segment search_region;
+		search_region.addr = at;
+		search_region.size = Page::Size();
+		search_region.prot = 0;
+		struct segment* segment = FindOverlappingSegment(process, &search_region);
+		if ( !segment )
+			return errno = ENOMEM, -1;
+		at = segment->addr + segment->size;
+	}
+
+	if ( advice != MADV_DONTNEED )
+		return 0;
+
+	// Drop the pages, which are faulted back in when accessed again, either
+	// from the backing file or as zero filled pages.
+	for ( uintptr_t at = addr; at < addr + size; )
+	{
+		struct segment search_region;
+		search_region.addr = at;
+		search_region.size = Page::Size();
+		search_region.prot = 0;
+		struct segment* segment = FindOverlappingSegment(process, &search_region);
+		uintptr_t end = segment->addr + segment->size;
+		if ( addr + size < end )
+			end = addr + size;
+		Memory::WriteBackMemory(segment, at, end - at);
+		Memory::UnmapRange(at, end - at, PAGE_USAGE_USER_SPACE);
+		at = end;
+	}
+	Memory::Flush();
+
+	return 0;
+}
+
+int sys_msync(void* addr_ptr, size_t size, int flags)
+{
+	// Verify that that the address is suitable aligned.
+	uintptr_t addr = (uintptr_t) addr_ptr;
+	if ( !Page::IsAligned(addr) )
+		return errno = EINVAL, -1;
+	if ( flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC) )
+		return errno = EINVAL, -1;
+	if ( (flags & MS_ASYNC) && (flags & MS_SYNC) )
+		return errno = EINVAL, -1;
+
+	size = Page::AlignUp(size);
+	if ( addr + size < addr )
+		return errno = ENOMEM, -1;
+
+	Process* process = CurrentProcess();
+	ScopedLock lock1(&process->segment_write_lock);
+	ScopedLock lock2(&process->segment_lock);
+
+	// The whole range must be mapped.
+	for ( uintptr_t at = addr; at < addr + size; )
+	{
+		struct segment search_region;
+		search_region.addr = at;
+		search_region.size = Page::Size();
+		search_region.prot = 0;
+		struct segment* segment = FindOverlappingSegment(process, &search_region);
+		if ( !segment )
+			return errno = ENOMEM, -1;
+		at = segment->addr + segment->size;
+	}
+
+	// The pages are written back right away even if MS_ASYNC, and the shared
+	// pages always have the current file contents, so MS_INVALIDATE has
+	// nothing to do.
+	bool success = true;
+	for ( uintptr_t at = addr; at < addr + size; )
+	{
+		struct segment search_region;
+		search_region.addr = at;
+		search_region.size = Page::Size();
+		search_region.prot = 0;
+		struct segment* segment = FindOverlappingSegment(process, &search_region);
+		uintptr_t end = segment->addr + segment->size;
+		if ( addr + size < end )
+			end = addr + size;
+		if ( !Memory::WriteBackMemory(segment, at, end - at) )
+			success = false;
+		at = end;
+	}
+
+	return success ? 0 : -1;
+}
+
 // TODO: We use a wrapper system call here because there are too many parameters
 //       to mmap for some platforms. We should extend the system call ABI so we
 //       can do system calls with huge parameter lists and huge return values
@@ -55,6 +55,17 @@ namespace Sortix {
 namespace EM {
 
 static const int RECEIVE_PACKET_COUNT = 32;
+static const size_t RECEIVE_POOL_SIZE = 128;
+
+// Receive at most this many packets before letting other work run, and keep
+// interrupts masked while polling the receive ring if there are more.
+static const size_t RECEIVE_POLL_BUDGET = 64;
+
+// The interrupt rate is throttled depending on the traffic, favoring latency
+// when there are few packets and throughput when there are many.
+static const unsigned int INTERRUPT_RATE_LOWEST_LATENCY = 70000;
+static const unsigned int INTERRUPT_RATE_LOW_LATENCY = 20000;
+static const unsigned int INTERRUPT_RATE_BULK = 4000;
 
 static const int FEATURE_EEPROM = 1 << 0; // EEPROM access present
 static const int FEATURE_SERDES = 1 << 1; // SerDes/TBI supported
@@ -271,6 +282,20 @@ struct tx_desc_tcpdata
 	little_uint16_t special;
 };
 
+struct tx_desc_context
+{
+	little_uint8_t ipcss;
+	little_uint8_t ipcso;
+	little_uint16_t ipcse;
+	little_uint8_t tucss;
+	little_uint8_t tucso;
+	little_uint16_t tucse;
+	little_uint32_t lencmd;
+	little_uint8_t status;
+	little_uint8_t hdrlen;
+	little_uint16_t mss;
+};
+
 class EM : public NetworkInterface
 {
 public:
@@ -294,17 +319,21 @@ private:
 	void RegisterInterrupts();
 	bool AddReceiveDescriptor(Ref<Packet> pkt);
 	bool AddTransmitDescriptor(Ref<Packet> pkt);
-	bool CanAddTransmit();
+	bool CanAddTransmit(Packet* pkt);
 	static void InterruptHandler(struct interrupt_context*, void*);
 	static void InterruptWorkHandler(void* context);
 	void OnInterrupt();
 	void InterruptWork();
+	void UpdateInterruptRate(size_t packets, size_t bytes);
 
 private:
 	uint32_t devaddr;
 	struct interrupt_handler interrupt_registration;
 	struct interrupt_work interrupt_work;
 	uint32_t interrupt_work_icr;
+	unsigned int interrupt_rate;
+	bool polling;
+	uint64_t tx_packets;
 	uint8_t interrupt;
 	addralloc_t mmio_alloc;
 	volatile uint8_t* mmio_base;
@@ -315,6 +344,7 @@ private:
 	struct tx_desc_tcpdata* tdesc;
 	Ref<Packet>* rpackets;
 	Ref<Packet>* tpackets;
+	struct packet_pool rx_pool;
 	Ref<Packet> tx_queue_first;
 	Ref<Packet> tx_queue_last;
 	kthread_mutex_t tx_lock;
@@ -326,6 +356,8 @@ private:
 	uint32_t rx_prochead;
 	uint32_t tx_tail;
 	uint32_t tx_prochead;
+	size_t tx_context_start;
+	size_t tx_context_offset;
 
 };
 
@@ -343,7 +375,10 @@ EM::EM(uint32_t devaddr, size_t number, int features)
 {
 	snprintf(ifinfo.name, sizeof(ifinfo.name), "em%zu", number);
 	ifinfo.type = IF_TYPE_ETHERNET;
-	ifinfo.features = IF_FEATURE_ETHERNET_CRC_OFFLOAD;
+	ifinfo.features = IF_FEATURE_ETHERNET_CRC_OFFLOAD |
+	                  IF_FEATURE_CHECKSUM_OFFLOAD |
+	                  IF_FEATURE_SCATTER_GATHER |
+	                  IF_FEATURE_TCP_SEGMENTATION_OFFLOAD;
 	ifinfo.addrlen = ETHER_ADDR_LEN;
 	ifstatus.mtu = ETHERMTU;
 	this->devaddr = devaddr;
@@ -361,6 +396,7 @@ EM::EM(uint32_t devaddr, size_t number, int features)
 	tdesc = NULL;
 	rpackets = NULL;
 	tpackets = NULL;
+	memset(&rx_pool, 0, sizeof(rx_pool));
 	// tx_queue_first has constructor.
 	// tx_queue_last has constructor.
 	tx_lock = KTHREAD_MUTEX_INITIALIZER;
@@ -372,6 +408,11 @@ EM::EM(uint32_t devaddr, size_t number, int features)
 	rx_prochead = 0;
 	tx_tail = 0;
 	tx_prochead = 0;
+	tx_context_start = SIZE_MAX;
+	tx_context_offset = 0;
+	interrupt_rate = 0;
+	polling = false;
+	tx_packets = 0;
 }
 
 EM::~EM()
@@ -510,20 +551,90 @@ bool EM::AddReceiveDescriptor(Ref<Packet> pkt) // ordered via interrupt worker
 
 bool EM::AddTransmitDescriptor(Ref<Packet> pkt) // tx_lock must be locked.
 {
-	uint32_t next_desc = tx_tail + 1;
-	if ( tx_count <= next_desc )
-		next_desc = 0;
-	if ( next_desc == tx_prochead )
+	if ( !CanAddTransmit(pkt.Get()) )
 		return false;
-	struct tx_desc_tcpdata* desc = &tdesc[tx_tail];
-	desc->address = pkt->pmap.phys;
-	desc->lencmd = EM_TDESC_LENGTH(pkt->length) | EM_TDESC_TYPE_TCPDATA |
-	               EM_TDESC_CMD_RS | EM_TDESC_CMD_EOP | EM_TDESC_CMD_IFCS;
-	desc->status = 0;
-	desc->opts = 0;
-	desc->special = 0;
-	tpackets[tx_tail] = pkt;
-	tx_tail = next_desc;
+	uint8_t opts = 0;
+	uint32_t tse = 0;
+	if ( pkt->segment_size )
+	{
+		// Let the controller cut the large TCP segment into segments of the
+		// maximum segment size and checksum each. The context describes the
+		// length of this particular packet, so it can't be reused.
+		assert(pkt->checksum_flags & PACKET_CHECKSUM_PARTIAL);
+		opts = EM_TDESC_POPTS_TXSM | EM_TDESC_POPTS_IXSM;
+		tse = EM_TDESC_CMD_TSE;
+		size_t ip_start = ETHER_HDR_LEN;
+		size_t tcp_start = pkt->checksum_start;
+		uint8_t tcp_offset;
+		CopyPacketData(&tcp_offset, pkt.Get(), tcp_start + 12, 1);
+		size_t header_length = tcp_start + 4 * (tcp_offset >> 4);
+		size_t length = GetPacketLength(pkt.Get());
+		assert(header_length <= UINT8_MAX);
+		struct tx_desc_context* ctx =
+			(struct tx_desc_context*) &tdesc[tx_tail];
+		*ctx = tx_desc_context{0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+		ctx->ipcss = ip_start;
+		ctx->ipcso = ip_start + 10; // The IPv4 header checksum.
+		ctx->ipcse = tcp_start - 1;
+		ctx->tucss = tcp_start;
+		ctx->tucso = tcp_start + pkt->checksum_offset;
+		ctx->tucse = 0; // Checksum until the end of the packet.
+		ctx->lencmd = EM_TDESC_LENGTH(length - header_length) |
+		              EM_TDESC_TYPE_CONTEXT | EM_TDESC_TUCMD_TCP |
+		              EM_TDESC_TUCMD_IP | EM_TDESC_CMD_TSE |
+		              EM_TDESC_CMD_RS;
+		ctx->hdrlen = header_length;
+		ctx->mss = pkt->segment_size;
+		tpackets[tx_tail].Reset();
+		if ( tx_count <= ++tx_tail )
+			tx_tail = 0;
+		// The next checksum offload needs a new context.
+		tx_context_start = SIZE_MAX;
+	}
+	else if ( pkt->checksum_flags & PACKET_CHECKSUM_PARTIAL )
+	{
+		opts = EM_TDESC_POPTS_TXSM;
+		size_t start = pkt->checksum_start;
+		size_t offset = pkt->checksum_offset;
+		// The checksum context is remembered by the controller and only needs
+		// to be changed when the headers change, which is rarely.
+		if ( start != tx_context_start || offset != tx_context_offset )
+		{
+			assert(start + offset <= UINT8_MAX);
+			struct tx_desc_context* ctx =
+				(struct tx_desc_context*) &tdesc[tx_tail];
+			*ctx = tx_desc_context{0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+			ctx->tucss = start;
+			ctx->tucso = start + offset;
+			ctx->tucse = 0; // Checksum until the end of the packet.
+			ctx->lencmd = EM_TDESC_TYPE_CONTEXT | EM_TDESC_CMD_RS;
+			tpackets[tx_tail].Reset();
+			if ( tx_count <= ++tx_tail )
+				tx_tail = 0;
+			tx_context_start = start;
+			tx_context_offset = offset;
+		}
+	}
+	// Transmit the fragments of the packet from their own buffers.
+	for ( Ref<Packet> frag = pkt; frag; frag = frag->fragment )
+	{
+		uint32_t cmd = EM_TDESC_TYPE_TCPDATA | EM_TDESC_CMD_RS |
+		               EM_TDESC_CMD_IFCS | tse;
+		if ( !frag->fragment )
+			cmd |= EM_TDESC_CMD_EOP;
+		struct tx_desc_tcpdata* desc = &tdesc[tx_tail];
+		size_t offset = frag->from + frag->offset -
+		                (unsigned char*) frag->pmap.from;
+		desc->address = frag->pmap.phys + offset;
+		desc->lencmd = EM_TDESC_LENGTH(frag->length - frag->offset) | cmd;
+		desc->status = 0;
+		desc->opts = opts;
+		desc->special = 0;
+		tpackets[tx_tail] = frag;
+		if ( tx_count <= ++tx_tail )
+			tx_tail = 0;
+	}
+	tx_packets++;
 	// TODO: Research whether this is needed, or whether the paging bits do
 	//       the right thing. Do those bits work on all systems?
 	//asm volatile ("wbinvd");
@@ -531,21 +642,23 @@ bool EM::AddTransmitDescriptor(Ref<Packet> pkt) // tx_lock must be locked.
 	return true;
 }
 
-bool EM::CanAddTransmit() // tx_lock must be locked.
+bool EM::CanAddTransmit(Packet* pkt) // tx_lock must be locked.
 {
-	uint32_t next_desc = tx_tail + 1;
-	if ( tx_count <= next_desc )
-		next_desc = 0;
-	if ( next_desc == tx_prochead )
-		return false;
-	return true;
+	// One descriptor per fragment and possibly a checksum context descriptor.
+	uint32_t needed = pkt->checksum_flags & PACKET_CHECKSUM_PARTIAL ? 1 : 0;
+	for ( Packet* frag = pkt; frag; frag = frag->fragment.Get() )
+		needed++;
+	// One descriptor is always kept unused to tell a full ring from an empty.
+	uint32_t used = tx_tail - tx_prochead;
+	if ( tx_tail < tx_prochead )
+		used += tx_count;
+	return needed < tx_count - used;
 }
 
 bool EM::Send(Ref<Packet> pkt)
 {
 	ScopedLock lock(&tx_lock);
 	if ( !tx_queue_first &&
-	     CanAddTransmit() &&
 	     AddTransmitDescriptor(pkt) )
 		return true;
 	if ( tx_queue_last )
@@ -577,8 +690,8 @@ void EM::RegisterInterrupts()
 
 void EM::OnInterrupt()
 {
-	// TODO: Use "Interrupt Acknowledge Auto Mask Register - IAM (000E0h)" to
-	//       automatically mask set interrupts.
+	// Interrupts are masked by hand rather than with the Interrupt Acknowledge
+	// Auto Mask register, which only the newer controllers have.
 	uint32_t icr = Read32(EM_MAIN_REG_ICR);
 	if ( !icr )
 		return;
@@ -630,7 +743,7 @@ void EM::InterruptWork()
 		// process the incoming packets.
 		for ( size_t i = 0; i < RECEIVE_PACKET_COUNT; i++ )
 		{
-			Ref<Packet> buf = GetPacket();
+			Ref<Packet> buf = GetPacket(&rx_pool);
 			if ( buf )
 			{
 				if ( !AddReceiveDescriptor(buf) )
@@ -643,17 +756,39 @@ void EM::InterruptWork()
 	{
 		// MDI/O Access Complete
 	}
+	size_t rx_packets = 0;
+	size_t rx_bytes = 0;
+	bool more = false;
 	if ( icr & EM_INTERRUPT_RXT0 )
 	{
 		// Receive timer expired, check descriptors.
 		while ( rx_prochead != rx_tail && rdesc[rx_prochead].status )
 		{
+			if ( rx_packets == RECEIVE_POLL_BUDGET )
+			{
+				more = true;
+				break;
+			}
+			rx_packets++;
+			rx_bytes += rdesc[rx_prochead].length;
 			Ref<Packet> rxpacket = rpackets[rx_prochead];
 			rpackets[rx_prochead].Reset();
 			assert(rxpacket.IsUnique());
 			rxpacket->length = rdesc[rx_prochead].length;
 			assert(rxpacket->pmap.phys == rdesc[rx_prochead].address);
 			rxpacket->netif = this;
+			uint8_t status = rdesc[rx_prochead].status;
+			uint8_t errors = rdesc[rx_prochead].errors;
+			if ( !(status & EM_RDESC_STATUS_IXSM) )
+			{
+				if ( (status & EM_RDESC_STATUS_IPCS) &&
+				     !(errors & EM_RDESC_ERRORS_IPE) )
+					rxpacket->checksum_flags |= PACKET_CHECKSUM_IP_VERIFIED;
+				if ( (status & (EM_RDESC_STATUS_TDPCS |
+				                EM_RDESC_STATUS_UDPCS)) &&
+				     !(errors & EM_RDESC_ERRORS_TCPE) )
+					rxpacket->checksum_flags |= PACKET_CHECKSUM_VERIFIED;
+			}
 			Ether::Handle(rxpacket, true);
 			rxpacket.Reset();
 			rx_prochead++;
@@ -661,7 +796,7 @@ void EM::InterruptWork()
 				rx_prochead = 0;
 			if ( rx_prochead != rx_tail )
 			{
-				Ref<Packet> buf = GetPacket();
+				Ref<Packet> buf = GetPacket(&rx_pool);
 				// TODO: Design a solution that handles when there's no more
 				//       packets available, but later adds packets when they
 				//       become available, otherwise the receive queue might
@@ -670,6 +805,7 @@ void EM::InterruptWork()
 					AddReceiveDescriptor(buf);
 			}
 		}
+		Ether::Flush();
 		unhandled &= ~EM_INTERRUPT_RXT0;
 	}
 	if ( icr & EM_INTERRUPT_RXO )
@@ -705,7 +841,7 @@ void EM::InterruptWork()
 		}
 		unhandled &= ~EM_INTERRUPT_TXQE;
 	}
-	while ( tx_queue_first && CanAddTransmit() )
+	while ( tx_queue_first && CanAddTransmit(tx_queue_first.Get()) )
 	{
 		Ref<Packet> pkt = tx_queue_first;
 		tx_queue_first = pkt->next;
@@ -714,12 +850,63 @@ void EM::InterruptWork()
 	}
 	if ( !tx_queue_first )
 		tx_queue_last.Reset();
+	uint64_t tx_sent = tx_packets;
+	tx_packets = 0;
 	kthread_mutex_unlock(&tx_lock);
+	kthread_mutex_lock(&cfg_lock);
+	if ( !polling )
+		ifstats.interrupts++;
+	ifstats.polls++;
+	if ( more )
+		ifstats.polls_exhausted++;
+	ifstats.rx_packets += rx_packets;
+	ifstats.tx_packets += tx_sent;
+	kthread_mutex_unlock(&cfg_lock);
+	// Keep interrupts masked and poll the receive ring again after any other
+	// pending work if the budget ran out, rather than taking an interrupt per
+	// packet while the traffic keeps coming.
+	polling = more;
+	if ( more )
+	{
+		interrupt_work_icr = EM_INTERRUPT_RXT0 | EM_INTERRUPT_TXDW;
+		Interrupt::Disable();
+		Interrupt::ScheduleWork(&interrupt_work);
+		Interrupt::Enable();
+		return;
+	}
+	UpdateInterruptRate(rx_packets, rx_bytes);
 	interrupt_work_icr = 0;
 	// Unmask interrupts so they can be delivered again.
 	Write32(EM_MAIN_REG_IMS, understood_interrupts);
 }
 
+void EM::UpdateInterruptRate(size_t packets, size_t bytes)
+{
+	unsigned int rate;
+	if ( 32 < packets || 32 * 1024 < bytes )
+		rate = INTERRUPT_RATE_BULK;
+	else if ( 4 < packets || 4 * 1024 < bytes )
+		rate = INTERRUPT_RATE_LOW_LATENCY;
+	else
+		rate = INTERRUPT_RATE_LOWEST_LATENCY;
+	// Throttle immediately when the traffic increases but only gradually stop
+	// throttling when it decreases, so short pauses don't cause bursts of
+	// interrupts.
+	if ( interrupt_rate && interrupt_rate < rate )
+	{
+		unsigned int step = interrupt_rate + rate / 4;
+		if ( step < rate )
+			rate = step;
+	}
+	if ( rate == interrupt_rate )
+		return;
+	interrupt_rate = rate;
+	// The interval is in units of 256 nanoseconds.
+	Write32(EM_MAIN_REG_ITR, 1000000000 / (rate * 256));
+	ScopedLock lock(&cfg_lock);
+	ifstats.interrupt_rate = rate;
+}
+
 bool EM::Reset()
 {
 	uint32_t ctrl;
@@ -887,6 +1074,8 @@ bool EM::Reset()
 	rx_prochead = 0;
 	tx_tail = 0;
 	tx_prochead = 0;
+	tx_context_start = SIZE_MAX;
+	tx_context_offset = 0;
 	rx_count = rdesc_alloc.size / sizeof(struct rx_desc);
 	tx_count = tdesc_alloc.size / sizeof(struct tx_desc_tcpdata);
 	rdesc = (struct rx_desc*) rdesc_alloc.from;
@@ -902,8 +1091,16 @@ bool EM::Reset()
 	Write32(EM_MAIN_REG_RDT, 0);
 	Write32(EM_MAIN_REG_RDBAL, (uint64_t) rdesc_alloc.phys & 0xffffffff);
 	Write32(EM_MAIN_REG_RDBAH, (uint64_t) rdesc_alloc.phys >> 32);
+	Write32(EM_MAIN_REG_RDTR, 0);
 	Write32(EM_MAIN_REG_RADV, 0);
 	Write32(EM_MAIN_REG_RSRPD, 0);
+	// Interrupts are moderated using the throttling rate instead of the delay
+	// timers, starting out favoring latency.
+	interrupt_rate = 0;
+	UpdateInterruptRate(0, 0);
+	// Verify the IP, TCP, and UDP checksums of incoming packets.
+	Write32(EM_MAIN_REG_RXCSUM, EM_MAIN_REG_RXCSUM_IPOFL |
+	                            EM_MAIN_REG_RXCSUM_TUOFL);
 
 	Write32(EM_MAIN_REG_TXDCTL,
 	        EM_MAIN_REG_TXDCTL_WTHRESH(1) | EM_MAIN_REG_TXDCTL_GRAN);
@@ -924,7 +1121,7 @@ bool EM::Reset()
 
 	for ( size_t i = 0; i < RECEIVE_PACKET_COUNT; i++ )
 	{
-		Ref<Packet> buf = GetPacket();
+		Ref<Packet> buf = GetPacket(&rx_pool);
 		if ( !buf )
 		{
 			if ( !i )
@@ -991,6 +1188,13 @@ bool EM::Initialize()
 		Log("error: Failed to map descriptor page");
 		return false;
 	}
+	if ( !ReservePackets(&rx_pool, RECEIVE_POOL_SIZE) )
+	{
+		FreeAllocatedAndMappedPage(&tdesc_alloc);
+		FreeAllocatedAndMappedPage(&rdesc_alloc);
+		Log("error: Failed to reserve packets: %m");
+		return false;
+	}
 	return Reset();
 }
 
@@ -519,6 +519,15 @@
 /* Receive Small Packet Detect Interrupt (size in bytes) */
 #define EM_MAIN_REG_RSRPD               0x2c00U
 
+/* Receive Checksum Control */
+#define EM_MAIN_REG_RXCSUM              0x5000U
+/* Packet Checksum Start */
+#define EM_MAIN_REG_RXCSUM_PCSS(v)                (((v) & 0xffU) << 0)
+/* IP Checksum Offload Enable */
+#define EM_MAIN_REG_RXCSUM_IPOFL                  (1U << 8)
+/* TCP/UDP Checksum Offload Enable */
+#define EM_MAIN_REG_RXCSUM_TUOFL                  (1U << 9)
+
 /* Transmit Control */
 #define EM_MAIN_REG_TCTL                0x0400U
 #define EM_MAIN_REG_TCTL_EN                       (1U << 1)
@@ -635,19 +644,33 @@
 
 #define EM_RDESC_STATUS_DD      (1U << 0)
 #define EM_RDESC_STATUS_EOP     (1U << 1)
+#define EM_RDESC_STATUS_IXSM    (1U << 2)
 #define EM_RDESC_STATUS_VP      (1U << 3)
 #define EM_RDESC_STATUS_UDPCS   (1U << 4)
 #define EM_RDESC_STATUS_TDPCS   (1U << 5)
 #define EM_RDESC_STATUS_IPCS    (1U << 6)
 #define EM_RDESC_STATUS_PIF     (1U << 7)
 
+#define EM_RDESC_ERRORS_CE      (1U << 0)
+#define EM_RDESC_ERRORS_SE      (1U << 1)
+#define EM_RDESC_ERRORS_SEQ     (1U << 2)
+#define EM_RDESC_ERRORS_CXE     (1U << 4)
+#define EM_RDESC_ERRORS_TCPE    (1U << 5)
+#define EM_RDESC_ERRORS_IPE     (1U << 6)
+#define EM_RDESC_ERRORS_RXE     (1U << 7)
+
 #define EM_TDESC_TYPE_TCPDATA   ((1U << 20) | (1U << 29))
+#define EM_TDESC_TYPE_CONTEXT   (1U << 29)
 #define EM_TDESC_CMD_EOP        (1U << 24)
 #define EM_TDESC_CMD_IFCS       (1U << 25)
 #define EM_TDESC_CMD_TSE        (1U << 26)
 #define EM_TDESC_CMD_RS         (1U << 27)
 #define EM_TDESC_CMD_VLE        (1U << 30)
 #define EM_TDESC_CMD_IDE        (1U << 31)
+#define EM_TDESC_TUCMD_TCP      (1U << 24)
+#define EM_TDESC_TUCMD_IP       (1U << 25)
 #define EM_TDESC_LENGTH(l)      ((l) & 0xfffff)
+#define EM_TDESC_POPTS_IXSM     (1U << 0)
+#define EM_TDESC_POPTS_TXSM     (1U << 1)
 
 #endif
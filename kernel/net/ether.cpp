@@ -102,6 +102,21 @@ void Handle(Ref<Packet> pkt, bool checksum_offloaded)
 	}
 }
 
+// Network interfaces call this function after handling the packets received at
+// once, as the packets may be held until then to merge them.
+void Flush()
+{
+	IP::Flush();
+}
+
+bool CanGather(NetworkInterface* netif)
+{
+	// Checksums and CRCs can't be computed in software across fragments.
+	int needed = IF_FEATURE_SCATTER_GATHER | IF_FEATURE_CHECKSUM_OFFLOAD |
+	             IF_FEATURE_ETHERNET_CRC_OFFLOAD;
+	return (netif->ifinfo.features & needed) == needed;
+}
+
 bool Send(Ref<Packet> pktin,
           const struct ether_addr* src,
           const struct ether_addr* dst,
@@ -109,14 +124,19 @@ bool Send(Ref<Packet> pktin,
           NetworkInterface* netif)
 {
 	Random::MixNow(Random::SOURCE_NETWORK);
-	if ( ETHERMTU < pktin->length )
+	// The fragments are sent as is after the header and the first packet.
+	size_t total = GetPacketLength(pktin.Get());
+	// Segments larger than the MTU are cut by the network interface.
+	if ( !pktin->segment_size && ETHERMTU < total )
 		return errno = EMSGSIZE, false;
+	assert(!pktin->fragment || CanGather(netif));
+	assert(!pktin->fragment || ETHERMIN <= total);
 	Ref<Packet> pkt = GetPacket();
 	if ( !pkt )
 		return false;
 	const unsigned char* in = pktin->from;
 	size_t inlen = pktin->length;
-	size_t padding = inlen < ETHERMIN ? ETHERMIN - inlen : 0;
+	size_t padding = total < ETHERMIN ? ETHERMIN - total : 0;
 	unsigned char* out = pkt->from;
 	struct ether_header hdr;
 	struct ether_footer ftr;
@@ -132,6 +152,19 @@ bool Send(Ref<Packet> pktin,
 	memcpy(out, &hdr, sizeof(hdr));
 	memcpy(out + sizeof(hdr), in, inlen);
 	memset(out + sizeof(hdr) + inlen, 0, padding);
+	pkt->fragment = pktin->fragment;
+	pkt->checksum_flags = pktin->checksum_flags;
+	pkt->checksum_start = sizeof(hdr) + pktin->checksum_start;
+	pkt->checksum_offset = pktin->checksum_offset;
+	pkt->segment_size = pktin->segment_size;
+	if ( (pkt->checksum_flags & PACKET_CHECKSUM_PARTIAL) &&
+	     !(netif->ifinfo.features & IF_FEATURE_CHECKSUM_OFFLOAD) )
+	{
+		// The checksum covers the datagram but not the padding and footer.
+		pkt->length = sizeof(hdr) + inlen;
+		IP::CompleteChecksum(pkt);
+		pkt->length = outlen;
+	}
 	if ( !(netif->ifinfo.features & IF_FEATURE_ETHERNET_CRC_OFFLOAD) )
 	{
 		ftr.ether_crc = htole32(crc32(0, out, pkt->length));
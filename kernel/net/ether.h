@@ -33,7 +33,9 @@ namespace Sortix {
 namespace Ether {
 
 size_t GetMTU(NetworkInterface* netif);
+bool CanGather(NetworkInterface* netif);
 void Handle(Ref<Packet> pkt, bool checksum_offloaded);
+void Flush();
 bool Send(Ref<Packet> pkt,
           const struct ether_addr* src,
           const struct ether_addr* dst,
@@ -111,6 +111,7 @@ NetworkInterface::NetworkInterface()
 	cfg_cond = KTHREAD_COND_INITIALIZER;
 	memset(&ifinfo, 0, sizeof(ifinfo));
 	memset(&ifstatus, 0, sizeof(ifstatus));
+	memset(&ifstats, 0, sizeof(ifstats));
 	memset(&cfg, 0, sizeof(cfg));
 	arp_table = NULL;
 	// poll_channel is initialized by its constructor.
@@ -210,6 +211,11 @@ int NetworkInterfaceNode::ioctl(ioctx_t* ctx, int cmd, uintptr_t arg)
 		                        sizeof(netif->ifstatus)) )
 			return -1;
 		return 0;
+	case NIOC_GETSTATS:
+		if ( !ctx->copy_to_dest(ptr, &netif->ifstats,
+		                        sizeof(netif->ifstats)) )
+			return -1;
+		return 0;
 	case NIOC_GETCONFIG:
 		if ( !ctx->copy_to_dest(ptr, &netif->cfg, sizeof(netif->cfg)) )
 			return -1;
@@ -24,11 +24,13 @@
 #include <errno.h>
 #include <netinet/if_ether.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdint.h>
 #include <timespec.h>
 
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/if.h>
+#include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/packet.h>
 #include <sortix/kernel/random.h>
 #include <sortix/kernel/refcount.h>
@@ -36,6 +38,7 @@
 
 #include "arp.h"
 #include "ether.h"
+#include "ip.h"
 #include "ping.h"
 #include "tcp.h"
 #include "udp.h"
@@ -67,6 +70,10 @@ struct ipv4
 #define IPV4_FRAGMENT_DONT (1 << (13 + 1))
 #define IPV4_FRAGMENT_EVIL (1 << (13 + 2))
 
+// Payloads at least this large are transmitted without copying them if the
+// network interface supports scatter-gather.
+static const size_t GATHER_THRESHOLD = 256;
+
 static kthread_mutex_t worker_lock;
 static Ref<Packet> worker_first_packet;
 static Ref<Packet> worker_last_packet;
@@ -82,13 +89,43 @@ uint16_t ipsum_word(uint16_t sum, uint16_t word)
 
 uint16_t ipsum_buf(uint16_t sum, const void* bufptr, size_t size)
 {
+	// The one's complement sum doesn't depend on the byte order, so sum the
+	// buffer as native 32-bit words into a wide accumulator whose carries are
+	// folded back at the end, and then convert the sum to big endian.
 	const uint8_t* buf = (const uint8_t*) bufptr;
-	for ( size_t i = 0; i < (size & ~1UL); i += 2 )
-		sum = ipsum_word(sum, buf[i] << 8 | buf[i + 1]);
+	uint64_t wide = 0;
+	size_t i = 0;
+	while ( 16 <= size - i )
+	{
+		uint32_t words[4];
+		memcpy(words, buf + i, sizeof(words));
+		wide += (uint64_t) words[0] + words[1] + words[2] + words[3];
+		i += 16;
+	}
+	while ( 4 <= size - i )
+	{
+		uint32_t word;
+		memcpy(&word, buf + i, sizeof(word));
+		wide += word;
+		i += 4;
+	}
+	if ( 2 <= size - i )
+	{
+		uint16_t word;
+		memcpy(&word, buf + i, sizeof(word));
+		wide += word;
+		i += 2;
+	}
 	// Odd sizes only work correctly if this is the final byte being summed.
-	if ( size & 1 )
-		sum = ipsum_word(sum, buf[size - 1] << 8);
-	return sum;
+	if ( i < size )
+	{
+		uint16_t word = 0;
+		memcpy(&word, buf + i, 1);
+		wide += word;
+	}
+	while ( wide >> 16 )
+		wide = (wide & 0xFFFF) + (wide >> 16);
+	return ipsum_word(sum, be16toh((uint16_t) wide));
 }
 
 uint16_t ipsum_finish(uint16_t sum)
@@ -102,6 +139,23 @@ uint16_t ipsum(const void* bufptr, size_t size)
 	return ipsum_finish(sum);
 }
 
+void CompleteChecksum(Ref<Packet> pkt)
+{
+	assert(pkt->checksum_flags & PACKET_CHECKSUM_PARTIAL);
+	assert(!pkt->fragment);
+	assert(pkt->checksum_start + pkt->checksum_offset + 2 <= pkt->length);
+	unsigned char* data = pkt->from + pkt->checksum_start;
+	size_t size = pkt->length - pkt->checksum_start;
+	// The checksum field already contains the pseudo-header sum.
+	uint16_t checksum = ipsum_finish(ipsum_buf(0, data, size));
+	// Zero means no checksum in UDP and is equivalent to 0xFFFF in TCP.
+	if ( checksum == 0x0000 )
+		checksum = 0xFFFF;
+	checksum = htobe16(checksum);
+	memcpy(data + pkt->checksum_offset, &checksum, sizeof(checksum));
+	pkt->checksum_flags &= ~PACKET_CHECKSUM_PARTIAL;
+}
+
 static NetworkInterface* LocateInterface(const struct in_addr* src,
                                          const struct in_addr* dst,
                                          unsigned int ifindex)
@@ -283,13 +337,14 @@ void Handle(Ref<Packet> pkt,
             bool dst_broadcast)
 {
 	struct ipv4 hdr;
-	size_t pkt_remain = pkt->length - pkt->offset;
+	size_t pkt_remain = GetPacketLength(pkt.Get());
 	// The packet has to be large enough to contain a header.
-	if ( pkt_remain < sizeof(hdr) )
+	if ( pkt->length - pkt->offset < sizeof(hdr) )
 		return;
 	memcpy(&hdr, pkt->from + pkt->offset, sizeof(hdr));
 	// Verify the header's checksum is correct.
-	if ( ipsum(&hdr, sizeof(hdr)) != 0 )
+	if ( !(pkt->checksum_flags & PACKET_CHECKSUM_IP_VERIFIED) &&
+	     ipsum(&hdr, sizeof(hdr)) != 0 )
 		return;
 	hdr.length = be16toh(hdr.length);
 	hdr.identification = be16toh(hdr.identification);
@@ -308,6 +363,9 @@ void Handle(Ref<Packet> pkt,
 	// Verify total length isn't smaller than the header length.
 	if ( hdr.length < ihl )
 		return;
+	// Verify the header isn't split across fragments.
+	if ( pkt->length - pkt->offset < ihl )
+		return;
 	// Verify the packet length isn't smaller than the datagram.
 	if ( pkt_remain < hdr.length )
 		return;
@@ -327,11 +385,30 @@ void Handle(Ref<Packet> pkt,
 	// Trim the packet to the length according to the header, in case the packet
 	// was smaller than the link layer protocol's minimum transmission unit and
 	// the packet was padded by zeroes.
-	size_t truncated_length = pkt->offset + hdr.length;
-	if ( pkt->length < truncated_length )
-		return;
-	pkt->length = truncated_length;
+	// Datagrams in fragments are never padded.
+	if ( pkt->fragment )
+	{
+		if ( pkt_remain != hdr.length )
+			return;
+	}
+	else
+	{
+		size_t truncated_length = pkt->offset + hdr.length;
+		if ( pkt->length < truncated_length )
+			return;
+		pkt->length = truncated_length;
+	}
 	pkt->offset += ihl;
+	// Datagrams delivered locally continue after the header in the packet that
+	// was sent, which is received as is.
+	if ( pkt->offset == pkt->length && pkt->fragment )
+	{
+		Ref<Packet> datagram = pkt->fragment;
+		datagram->netif = pkt->netif;
+		datagram->checksum_flags = pkt->checksum_flags;
+		datagram->segment_size = 0;
+		pkt = datagram;
+	}
 	if ( hdr.protocol == IPPROTO_ICMP )
 		Ping::HandleIP(pkt, in_src, in_dst, in_dst_broadcast);
 	else if ( hdr.protocol == IPPROTO_TCP )
@@ -340,6 +417,94 @@ void Handle(Ref<Packet> pkt,
 		UDP::HandleIP(pkt, in_src, in_dst, in_dst_broadcast);
 }
 
+void Flush()
+{
+	TCP::Flush();
+}
+
+static Ref<Packet> Encapsulate(Ref<Packet> pktin,
+                               const struct ipv4* hdr,
+                               bool gather)
+{
+	Ref<Packet> pkt = GetPacket();
+	if ( !pkt )
+		return Ref<Packet>();
+	memcpy(pkt->from, hdr, sizeof(*hdr));
+	pkt->length = sizeof(*hdr);
+	if ( gather )
+		pkt->fragment = pktin;
+	else
+	{
+		assert(!pktin->fragment);
+		memcpy(pkt->from + pkt->length, pktin->from, pktin->length);
+		pkt->length += pktin->length;
+	}
+	pkt->checksum_flags = pktin->checksum_flags;
+	pkt->checksum_start = sizeof(*hdr) + pktin->checksum_start;
+	pkt->checksum_offset = pktin->checksum_offset;
+	pkt->segment_size = pktin->segment_size;
+	return pkt;
+}
+
+static bool CanSegment(NetworkInterface* netif)
+{
+	return (netif->ifinfo.features & IF_FEATURE_TCP_SEGMENTATION_OFFLOAD) &&
+	       Ether::CanGather(netif);
+}
+
+// Cuts a TCP segment into segments of at most the segment size each, which
+// are sent as usual.
+static bool SendSegments(Ref<Packet> pktin,
+                         const struct in_addr* src,
+                         const struct in_addr* dst,
+                         uint8_t protocol,
+                         unsigned int ifindex,
+                         bool broadcast)
+{
+	assert(protocol == IPPROTO_TCP);
+	assert(pktin->checksum_flags & PACKET_CHECKSUM_PARTIAL);
+	struct tcphdr hdr;
+	unsigned char options[TCP_MAXOLEN];
+	size_t length = GetPacketLength(pktin.Get());
+	CopyPacketData(&hdr, pktin.Get(), 0, sizeof(hdr));
+	size_t header_length = TCP_OFFSET_DECODE(hdr.th_offset) * 4;
+	assert(header_length <= sizeof(hdr) + sizeof(options));
+	size_t options_length = header_length - sizeof(hdr);
+	CopyPacketData(options, pktin.Get(), sizeof(hdr), options_length);
+	tcp_seq seq = be32toh(hdr.th_seq);
+	uint8_t flags = hdr.th_flags;
+	uint16_t checksum = be16toh(hdr.th_sum);
+	size_t data_length = length - header_length;
+	for ( size_t done = 0; done < data_length; )
+	{
+		size_t amount = data_length - done;
+		if ( pktin->segment_size < amount )
+			amount = pktin->segment_size;
+		Ref<Packet> pkt = GetPacket();
+		if ( !pkt )
+			return false;
+		pkt->length = header_length + amount;
+		hdr.th_seq = htobe32(seq + done);
+		// Only the final segment has the PSH and FIN flags.
+		hdr.th_flags = flags;
+		if ( done + amount < data_length )
+			hdr.th_flags &= ~(TH_PUSH | TH_FIN);
+		hdr.th_sum = htobe16(ipsum_word(checksum, pkt->length));
+		memcpy(pkt->from, &hdr, sizeof(hdr));
+		memcpy(pkt->from + sizeof(hdr), options, options_length);
+		CopyPacketData(pkt->from + header_length, pktin.Get(),
+		               header_length + done, amount);
+		pkt->checksum_flags = PACKET_CHECKSUM_PARTIAL;
+		pkt->checksum_start = 0;
+		pkt->checksum_offset = pktin->checksum_offset;
+		if ( !Send(pkt, src, dst, protocol, ifindex, broadcast) )
+			return false;
+		done += amount;
+	}
+	return true;
+}
+
+// Receives the packets delivered locally on the shared worker thread.
 static void ReceiveLoopback(void* ctx)
 {
 	(void) ctx;
@@ -355,6 +520,7 @@ static void ReceiveLoopback(void* ctx)
 		packet->next.Reset();
 		Handle(packet, NULL, NULL, false);
 	}
+	Flush();
 	kthread_mutex_lock(&worker_lock);
 	bool should_schedule = worker_first_packet;
 	if ( !should_schedule ||
@@ -379,6 +545,24 @@ static void SendLoopback(Ref<Packet> pkt)
 	kthread_mutex_unlock(&worker_lock);
 }
 
+// Delivers the datagram to ourselves without going through the link layer. The
+// header is gathered in front of the packet that was sent, so the data isn't
+// copied, and large TCP segments are received as is. The packet never leaves
+// this machine and can't be corrupted, so checksums aren't computed.
+static bool SendLocal(Ref<Packet> pktin,
+                      const struct ipv4* hdr,
+                      NetworkInterface* netif)
+{
+	Ref<Packet> pkt = Encapsulate(pktin, hdr, true);
+	if ( !pkt )
+		return false;
+	pkt->checksum_flags = PACKET_CHECKSUM_IP_VERIFIED | PACKET_CHECKSUM_VERIFIED;
+	pkt->segment_size = 0;
+	pkt->netif = netif;
+	SendLoopback(pkt);
+	return true;
+}
+
 bool Send(Ref<Packet> pktin,
           const struct in_addr* src,
           const struct in_addr* dst,
@@ -386,20 +570,20 @@ bool Send(Ref<Packet> pktin,
           unsigned int ifindex,
           bool broadcast)
 {
-	Ref<Packet> pkt = GetPacket();
-	if ( !pkt )
+	size_t length = GetPacketLength(pktin.Get());
+	size_t max_length = pktin->segment_size ? UINT16_MAX : Page::Size();
+	if ( max_length - sizeof(struct ipv4) < length )
+		return errno = EMSGSIZE, false;
+	NetworkInterface* netif = LocateInterface(src, dst, ifindex);
+	if ( !netif )
 		return false;
-	size_t mtu = pkt->pmap.size;
-	if ( mtu < sizeof(struct ipv4) ||
-	     mtu - sizeof(struct ipv4) < pktin->length )
-		return errno = EMSGSIZE, -1;
-	pkt->length = sizeof(struct ipv4) + pktin->length;
-	unsigned char* in = pktin->from;
-	unsigned char* out = pkt->from;
+	// Cut large TCP segments in software if the network interface can't.
+	if ( pktin->segment_size && !CanSegment(netif) )
+		return SendSegments(pktin, src, dst, protocol, ifindex, broadcast);
 	struct ipv4 hdr;
 	hdr.version_ihl = IPV4_VERSION_MAKE(4) | IPV4_IHL_MAKE(5);
 	hdr.dscp_ecn = 0;
-	hdr.length = htobe16(pkt->length);
+	hdr.length = htobe16(sizeof(struct ipv4) + length);
 	hdr.identification = htobe16(0); // TODO: Assign identification to packets.
 	hdr.fragment = htobe16(0);
 	hdr.ttl = 0x40; // TODO: This should be configurable.
@@ -408,21 +592,11 @@ bool Send(Ref<Packet> pktin,
 	memcpy(hdr.source, src, sizeof(struct in_addr));
 	memcpy(hdr.destination, dst, sizeof(struct in_addr));
 	hdr.checksum = htobe16(ipsum(&hdr, sizeof(hdr)));
-	memcpy(out, &hdr, sizeof(hdr));
-	memcpy(out + sizeof(struct ipv4), in, pktin->length);
 
 	Random::Mix(Random::SOURCE_NETWORK, &hdr.checksum, sizeof(hdr.checksum));
 
-	NetworkInterface* netif = LocateInterface(src, dst, ifindex);
-	if ( !netif )
-		return false;
-
 	if ( netif->ifinfo.type == IF_TYPE_LOOPBACK )
-	{
-		struct ether_addr localaddr;
-		memset(&localaddr, 0, sizeof(localaddr));
-		return Ether::Send(pkt, &localaddr, &localaddr, ETHERTYPE_IP, netif);
-	}
+		return SendLocal(pktin, &hdr, netif);
 
 	if ( netif->ifinfo.type != IF_TYPE_ETHERNET )
 		return errno = EAFNOSUPPORT, false;
@@ -440,11 +614,7 @@ bool Send(Ref<Packet> pktin,
 	struct in_addr route;
 	// Deliver deliver to ourselves if the address is our own.
 	if ( dst_ip == address_ip )
-	{
-		pkt->netif = netif;
-		SendLoopback(pkt);
-		return true;
-	}
+		return SendLocal(pktin, &hdr, netif);
 	// Route directly to the destination if the destination is broadcast.
 	else if ( dst_ip == htobe32(INADDR_BROADCAST) || dst_ip == broadcast_ip )
 		memcpy(&route, &dst_ip, sizeof(route));
@@ -458,6 +628,22 @@ bool Send(Ref<Packet> pktin,
 	else
 		return errno = ENETUNREACH, false;
 
+	// The network interface fills in the length and checksum of each segment
+	// it cuts from a large TCP segment, which must be zero beforehand.
+	if ( pktin->segment_size )
+	{
+		hdr.length = htobe16(0);
+		hdr.checksum = htobe16(0);
+	}
+
+	// Avoid copying large payloads if the headers can be transmitted from a
+	// separate buffer.
+	bool gather = pktin->segment_size ||
+	              (GATHER_THRESHOLD <= length && Ether::CanGather(netif));
+	Ref<Packet> pkt = Encapsulate(pktin, &hdr, gather);
+	if ( !pkt )
+		return false;
+
 	// If the destination is broadcast, send an ethernet broadcast.
 	if ( dst_ip == htobe32(INADDR_BROADCAST) || dst_ip == broadcast_ip )
 	{
@@ -473,11 +659,14 @@ bool GetSourceIP(const struct in_addr* src,
                  const struct in_addr* dst,
                  struct in_addr* sendfrom,
                  unsigned int ifindex,
-                 size_t* mtu)
+                 size_t* mtu,
+                 bool* segmentation)
 {
 	NetworkInterface* netif = LocateInterface(src, dst, ifindex);
 	if ( !netif )
 		return false;
+	if ( segmentation )
+		*segmentation = CanSegment(netif);
 	ScopedLock cfg_lock(&netif->cfg_lock);
 	if ( sendfrom )
 		memcpy(sendfrom, &netif->cfg.inet.address, sizeof(struct in_addr));
@@ -486,6 +675,20 @@ bool GetSourceIP(const struct in_addr* src,
 	return true;
 }
 
+// Returns whether packets from src to dst are delivered on this machine.
+bool IsLocal(const struct in_addr* src,
+             const struct in_addr* dst,
+             unsigned int ifindex)
+{
+	NetworkInterface* netif = LocateInterface(src, dst, ifindex);
+	if ( !netif )
+		return false;
+	if ( netif->ifinfo.type == IF_TYPE_LOOPBACK )
+		return true;
+	ScopedLock cfg_lock(&netif->cfg_lock);
+	return netif->cfg.inet.address.s_addr == dst->s_addr;
+}
+
 Ref<Inode> Socket(int type, int protocol)
 {
 	switch ( type )
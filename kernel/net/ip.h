@@ -32,10 +32,12 @@ uint16_t ipsum(const void* bufptr, size_t size);
 uint16_t ipsum_word(uint16_t sum, uint16_t word);
 uint16_t ipsum_buf(uint16_t sum, const void* bufptr, size_t size);
 uint16_t ipsum_finish(uint16_t sum);
+void CompleteChecksum(Ref<Packet> pkt);
 void Handle(Ref<Packet> pkt,
             const struct ether_addr* src,
             const struct ether_addr* dst,
             bool dst_broadcast);
+void Flush();
 bool Send(Ref<Packet> pkt,
           const struct in_addr* src,
           const struct in_addr* dst,
@@ -46,7 +48,11 @@ bool GetSourceIP(const struct in_addr* src,
                  const struct in_addr* dst,
                  struct in_addr* sendfrom,
                  unsigned int ifindex,
-                 size_t* mtu = NULL);
+                 size_t* mtu = NULL,
+                 bool* segmentation = NULL);
+bool IsLocal(const struct in_addr* src,
+             const struct in_addr* dst,
+             unsigned int ifindex);
 Ref<Inode> Socket(int type, int protocol);
 
 } // namespace IP
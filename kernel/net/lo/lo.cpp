@@ -33,7 +33,10 @@
 #include "lo.h"
 
 // The loopback device currently communicates through the Ethernet layer and
-// pretends to do offload Ethernet checksumming as an optimization.
+// pretends to do offload Ethernet checksumming as an optimization. The IP layer
+// delivers its datagrams on the loopback device directly without using the
+// device, and the offload features let TCP send large segments that are
+// received as is.
 
 // The shared worker thread is used for processing. Whenever a packet needs to
 // be sent, if the worker thread isn't scheduled, it is scheduled. The worker
@@ -70,7 +73,10 @@ private:
 Loopback::Loopback()
 {
 	ifinfo.type = IF_TYPE_LOOPBACK;
-	ifinfo.features = IF_FEATURE_ETHERNET_CRC_OFFLOAD;
+	ifinfo.features = IF_FEATURE_ETHERNET_CRC_OFFLOAD |
+	                  IF_FEATURE_CHECKSUM_OFFLOAD |
+	                  IF_FEATURE_SCATTER_GATHER |
+	                  IF_FEATURE_TCP_SEGMENTATION_OFFLOAD;
 	ifinfo.addrlen = 0;
 	ifstatus.flags = IF_STATUS_FLAGS_UP;
 	cfg.inet.address.s_addr = htobe32(INADDR_LOOPBACK);
@@ -112,8 +118,12 @@ void Loopback::Recv()
 		next_packet = next_packet->next;
 		packet->next.Reset();
 		packet->netif = this;
+		// The packet never left this machine and can't be corrupted.
+		if ( packet->checksum_flags & PACKET_CHECKSUM_PARTIAL )
+			packet->checksum_flags = PACKET_CHECKSUM_VERIFIED;
 		Ether::Handle(packet, true);
 	}
+	Ether::Flush();
 	kthread_mutex_lock(&socket_lock);
 	bool should_schedule = first_packet;
 	if ( !should_schedule ||
@@ -20,6 +20,8 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/kthread.h>
@@ -44,12 +46,57 @@ static size_t packet_cache_used = 0;
 static size_t packet_cache_allocated = 0;
 static size_t packet_count = 0;
 
+// The packet objects are carved out of slabs rather than allocated individually
+// from the heap, and freed objects are kept on a list for reuse. The slabs are
+// never freed, which is bounded by the limit on the number of packets.
+struct packet_object
+{
+	struct packet_object* next;
+};
+static kthread_mutex_t packet_object_lock = KTHREAD_MUTEX_INITIALIZER;
+static struct packet_object* packet_object_free = NULL;
+
+void* Packet::operator new(size_t size)
+{
+	assert(size == sizeof(Packet));
+	ScopedLock lock(&packet_object_lock);
+	if ( !packet_object_free )
+	{
+		size_t slab_size = Page::Size();
+		unsigned char* slab = (unsigned char*) malloc(slab_size);
+		if ( !slab )
+			return NULL;
+		for ( size_t i = 0; i + size <= slab_size; i += size )
+		{
+			struct packet_object* object = (struct packet_object*) (slab + i);
+			object->next = packet_object_free;
+			packet_object_free = object;
+		}
+	}
+	struct packet_object* object = packet_object_free;
+	packet_object_free = object->next;
+	return object;
+}
+
+void Packet::operator delete(void* ptr)
+{
+	ScopedLock lock(&packet_object_lock);
+	struct packet_object* object = (struct packet_object*) ptr;
+	object->next = packet_object_free;
+	packet_object_free = object;
+}
+
 Packet::Packet(paddrmapped_t _pmap) : pmap(_pmap)
 {
 	from = (unsigned char*) pmap.from;
 	length = 0;
 	offset = 0;
 	netif = NULL;
+	pool = NULL;
+	checksum_start = 0;
+	checksum_offset = 0;
+	checksum_flags = 0;
+	segment_size = 0;
 	packet_count++;
 }
 
@@ -58,14 +105,16 @@ Packet::~Packet()
 	// Refuse to do recursive destructor calls that could stack overflow.
 	assert(!next);
 	ScopedLock lock(&packet_cache_lock);
-	if ( packet_cache_used < packet_cache_allocated )
+	if ( pool && pool->used < pool->allocated )
+		pool->pages[pool->used++] = pmap;
+	else if ( packet_cache_used < packet_cache_allocated )
 		packet_cache[packet_cache_used++] = pmap;
 	else
 		FreeAllocatedAndMappedPage(&pmap);
 	packet_count--;
 }
 
-Ref<Packet> GetPacket()
+Ref<Packet> GetPacket(struct packet_pool* pool)
 {
 	ScopedLock lock(&packet_cache_lock);
 	if ( packet_cache == NULL )
@@ -77,8 +126,11 @@ Ref<Packet> GetPacket()
 		packet_cache_allocated = new_allocated;
 	}
 	paddrmapped_t pmap;
+	// Use the packets reserved for the network interface if any.
+	if ( pool && 0 < pool->used )
+		pmap = pool->pages[--pool->used];
 	// Fast reuse of an existing physical allocation if available.
-	if ( 0 < packet_cache_used )
+	else if ( 0 < packet_cache_used )
 		pmap = packet_cache[--packet_cache_used];
 	// Otherwise make a new physical allocation for the packet.
 	else
@@ -92,13 +144,77 @@ Ref<Packet> GetPacket()
 		if ( !AllocateAndMapPage(&pmap, PAGE_USAGE_NETWORK_PACKET) )
 			return errno = ENOBUFS, Ref<Packet>(NULL);
 	}
-	Ref<Packet> pkt = Ref<Packet>(new Packet(pmap));
+	Packet* pkt = new Packet(pmap);
 	if ( !pkt )
 	{
-		FreeAllocatedAndMappedPage(&pmap);
+		if ( pool && pool->used < pool->allocated )
+			pool->pages[pool->used++] = pmap;
+		else
+			FreeAllocatedAndMappedPage(&pmap);
 		return errno = ENOBUFS, Ref<Packet>(NULL);
 	}
-	return pkt;
+	// The packet is returned to the pool when freed, even if the pool was
+	// empty, such that the pool fills up again.
+	pkt->pool = pool;
+	return Ref<Packet>(pkt);
+}
+
+bool ReservePackets(struct packet_pool* pool, size_t count)
+{
+	paddrmapped_t* pages = new paddrmapped_t[count];
+	if ( !pages )
+		return false;
+	size_t used = 0;
+	while ( used < count )
+	{
+		if ( !AllocateAndMapPage(&pages[used], PAGE_USAGE_NETWORK_PACKET) )
+		{
+			while ( used )
+				FreeAllocatedAndMappedPage(&pages[--used]);
+			delete[] pages;
+			return false;
+		}
+		used++;
+	}
+	ScopedLock lock(&packet_cache_lock);
+	assert(!pool->pages);
+	pool->pages = pages;
+	pool->used = used;
+	pool->allocated = count;
+	return true;
+}
+
+// The data of a packet is from its offset until its length, which continues
+// with the data of each of its fragments.
+size_t GetPacketLength(const Packet* pkt)
+{
+	size_t length = 0;
+	for ( ; pkt; pkt = pkt->fragment.Get() )
+		length += pkt->length - pkt->offset;
+	return length;
+}
+
+void CopyPacketData(void* dst_ptr, const Packet* pkt, size_t position,
+                    size_t length)
+{
+	unsigned char* dst = (unsigned char*) dst_ptr;
+	for ( ; length; pkt = pkt->fragment.Get() )
+	{
+		assert(pkt);
+		size_t available = pkt->length - pkt->offset;
+		if ( available <= position )
+		{
+			position -= available;
+			continue;
+		}
+		size_t amount = available - position;
+		if ( length < amount )
+			amount = length;
+		memcpy(dst, pkt->from + pkt->offset + position, amount);
+		dst += amount;
+		length -= amount;
+		position = 0;
+	}
 }
 
 } // namespace Sortix
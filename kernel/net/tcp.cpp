@@ -20,15 +20,7 @@
 // TODO: Implement sending back RST and such.
 // TODO: PUSH.
 // TODO: URG.
-// TODO: Nagle's algorithm, MSG_MORE, TCP_CORK, TCP_NODELAY, etc.
-// TODO: TCP options.
-// TODO: Maximum Segment Size (respect TCP_MSS).
-// TODO: Efficient receieve queue when out of order.
-// TODO: Efficient backlog / half-open. Avoid denial of service attacks.
-// TODO: Measure average round trip time for efficient retransmission?
-// TODO: High speed extensions.
-// TODO: Anti-congestion extensions.
-// TODO: Selective acknowledgements.
+// TODO: Timestamps and protection against wrapped sequence numbers (RFC 7323).
 // TODO: Implement all RFC 1122 TCP requirements.
 // TODO: Probing Zero Windows per RFC 1122 4.2.2.17.
 // TODO: os-test all the things.
@@ -44,6 +36,7 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <poll.h>
+#include <sha2.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -76,9 +69,59 @@
 #include "tcp.h"
 
 #define BUFFER_SIZE 65536 // Documented in tcp(4).
+#define BUFFER_MIN 4096 // Documented in tcp(4).
+#define BUFFER_MAX (4 * 1024 * 1024) // Documented in tcp(4).
+
+// The delay in microseconds before sending data held back by TCP_CORK or
+// MSG_MORE. Documented in tcp(4).
+#define CORK_DELAY 200000
+
+// The time in microseconds an empty buffer is kept for more data before its
+// memory is released. Documented in tcp(4).
+#define BUFFER_IDLE_DELAY 1000000
+
+// The window scale advertised, enough for windows of BUFFER_MAX (RFC 7323).
+#define WINDOW_SHIFT 7
+
+// Refuse smaller segments than this as they would waste resources.
+#define MSS_MIN 64
+
+// The number of ranges of out of order data that can be received and that the
+// remote socket can report having selectively acknowledged.
+#define REASSEMBLY_MAX 32
+#define SCOREBOARD_MAX 32
+
+// The number of selective acknowledgement blocks that fit in a segment.
+#define SACK_BLOCKS_MAX 4
 
 #define NUM_RETRANSMISSIONS 6 // Documented in tcp(4)
 
+// Retransmission timeouts in microseconds per RFC 6298. Documented in tcp(4).
+#define RTO_INITIAL 1000000
+#define RTO_MIN 200000
+#define RTO_MAX 60000000
+
+// The number of duplicate acknowledgements that trigger a fast retransmit.
+#define DUPACK_THRESHOLD 3
+
+// The congestion window never grows beyond this many bytes.
+#define CWND_MAX 0x40000000
+
+// The number of buckets in the hash table of connections.
+#define CONNECTIONS_LENGTH 4096
+
+// SYN cookies are valid for one to two periods of this many seconds.
+#define COOKIE_PERIOD 64
+
+// The largest segment given to a network interface that cuts it into segments,
+// which must fit in an IPv4 datagram.
+#define SEGMENTATION_MAX (65535 - 20)
+
+// Consecutive segments received for this many connections are merged into
+// segments with at most this much data.
+#define MERGE_FLOWS 8
+#define MERGE_MAX 65535
+
 namespace Sortix {
 namespace TCP {
 
@@ -107,6 +150,25 @@ enum tcp_state
 	TCP_STATE_TIME_WAIT,
 };
 
+// A range of sequence numbers from start (inclusive) to end (exclusive).
+struct tcp_range
+{
+	tcp_seq start;
+	tcp_seq end;
+};
+
+// The options in a segment.
+struct tcp_options
+{
+	struct tcp_range sack[SACK_BLOCKS_MAX];
+	size_t sack_count;
+	uint16_t mss;
+	uint8_t wscale;
+	bool has_mss;
+	bool has_wscale;
+	bool has_sack_permitted;
+};
+
 enum tcp_special
 {
 	TCP_SPECIAL_NOT,
@@ -121,6 +183,18 @@ static kthread_mutex_t tcp_lock = KTHREAD_MUTEX_INITIALIZER;
 static TCPSocket** bindings_v4;
 static TCPSocket** bindings_v6;
 
+// Connected and listening sockets by their local and remote addresses, hashed
+// with a secret key so remote sockets can't choose colliding addresses.
+static TCPSocket* connections[CONNECTIONS_LENGTH];
+static uint32_t connections_key;
+
+// The secret key authenticating SYN cookies.
+static unsigned char cookie_key[32];
+
+// The segment sizes that can be encoded in the low bits of a SYN cookie.
+static const uint16_t cookie_mss[8] =
+	{ 536, 1024, 1220, 1300, 1380, 1440, 1460, 8960 };
+
 void Init()
 {
 	if ( !(bindings_v4 = new TCPSocket*[65536]) ||
@@ -131,6 +205,8 @@ void Init()
 		bindings_v4[i] = NULL;
 		bindings_v6[i] = NULL;
 	}
+	connections_key = arc4random();
+	arc4random_buf(cookie_key, sizeof(cookie_key));
 }
 
 static inline bool mod32_le(tcp_seq a, tcp_seq b)
@@ -158,6 +234,181 @@ static bool IsSupportedAddressFamily(int af)
 	return af == AF_INET /* TODO: || af == AF_INET6 */;
 }
 
+static void ParseOptions(const unsigned char* options, size_t length,
+                         struct tcp_options* result)
+{
+	memset(result, 0, sizeof(*result));
+	size_t i = 0;
+	while ( i < length )
+	{
+		unsigned char kind = options[i];
+		if ( kind == TCPOPT_EOL )
+			break;
+		if ( kind == TCPOPT_NOP )
+		{
+			i++;
+			continue;
+		}
+		if ( length - i < 2 )
+			break;
+		size_t size = options[i + 1];
+		if ( size < 2 || length - i < size )
+			break;
+		if ( kind == TCPOPT_MAXSEG && size == TCPOLEN_MAXSEG )
+		{
+			result->mss = options[i + 2] << 8 | options[i + 3];
+			if ( result->mss < MSS_MIN )
+				result->mss = MSS_MIN;
+			result->has_mss = true;
+		}
+		else if ( kind == TCPOPT_WINDOW && size == TCPOLEN_WINDOW )
+		{
+			result->wscale = options[i + 2];
+			if ( TCP_MAX_WINSHIFT < result->wscale )
+				result->wscale = TCP_MAX_WINSHIFT;
+			result->has_wscale = true;
+		}
+		else if ( kind == TCPOPT_SACK_PERMITTED &&
+		          size == TCPOLEN_SACK_PERMITTED )
+			result->has_sack_permitted = true;
+		else if ( kind == TCPOPT_SACK && (size - 2) % TCPOLEN_SACK == 0 )
+		{
+			for ( size_t n = 0; n < (size - 2) / TCPOLEN_SACK &&
+			                    n < SACK_BLOCKS_MAX; n++ )
+			{
+				const unsigned char* block = options + i + 2 + n * TCPOLEN_SACK;
+				tcp_seq start, end;
+				memcpy(&start, block, sizeof(start));
+				memcpy(&end, block + sizeof(start), sizeof(end));
+				result->sack[n].start = be32toh(start);
+				result->sack[n].end = be32toh(end);
+				result->sack_count = n + 1;
+			}
+		}
+		i += size;
+	}
+}
+
+// Inserts a range into a sorted array of disjoint ranges, merging it with any
+// ranges it overlaps or touches, using a binary search to find its position.
+static bool InsertRange(struct tcp_range* ranges, size_t* count, size_t max,
+                        tcp_seq start, tcp_seq end)
+{
+	if ( !mod32_lt(start, end) )
+		return true;
+	size_t low = 0;
+	size_t high = *count;
+	while ( low < high )
+	{
+		size_t middle = low + (high - low) / 2;
+		if ( mod32_lt(ranges[middle].end, start) )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	size_t first = low;
+	size_t last = first;
+	while ( last < *count && mod32_le(ranges[last].start, end) )
+	{
+		if ( mod32_lt(ranges[last].start, start) )
+			start = ranges[last].start;
+		if ( mod32_lt(end, ranges[last].end) )
+			end = ranges[last].end;
+		last++;
+	}
+	if ( first == last )
+	{
+		if ( *count == max )
+			return false;
+		memmove(ranges + first + 1, ranges + first,
+		        (*count - first) * sizeof(*ranges));
+		(*count)++;
+	}
+	else if ( first + 1 < last )
+	{
+		memmove(ranges + first + 1, ranges + last,
+		        (*count - last) * sizeof(*ranges));
+		*count -= last - (first + 1);
+	}
+	ranges[first].start = start;
+	ranges[first].end = end;
+	return true;
+}
+
+// Removes everything before a sequence number from a sorted array of ranges.
+static void RemoveRangesBefore(struct tcp_range* ranges, size_t* count,
+                               tcp_seq seq)
+{
+	size_t removed = 0;
+	while ( removed < *count && mod32_le(ranges[removed].end, seq) )
+		removed++;
+	memmove(ranges, ranges + removed, (*count - removed) * sizeof(*ranges));
+	*count -= removed;
+	if ( *count && mod32_lt(ranges[0].start, seq) )
+		ranges[0].start = seq;
+}
+
+// Resizes a ring buffer to a new size that fits the data in it, which is moved
+// to the start of the buffer. The buffer is deallocated if the new size is 0.
+static bool ResizeRing(unsigned char** buffer, size_t* size, size_t* offset,
+                       size_t used, size_t new_size)
+{
+	assert(used <= new_size);
+	unsigned char* new_buffer = NULL;
+	if ( new_size && !(new_buffer = new unsigned char[new_size]) )
+		return errno = ENOBUFS, false;
+	size_t until_end = *size - *offset;
+	size_t first = until_end < used ? until_end : used;
+	size_t second = used - first;
+	if ( first )
+		memcpy(new_buffer, *buffer + *offset, first);
+	if ( second )
+		memcpy(new_buffer + first, *buffer, second);
+	delete[] *buffer;
+	*buffer = new_buffer;
+	*size = new_size;
+	*offset = 0;
+	return true;
+}
+
+// Grows a ring buffer to fit the wanted amount of bytes, doubling its size to
+// amortize the cost, but not beyond the limit.
+static bool GrowRing(unsigned char** buffer, size_t* size, size_t* offset,
+                     size_t used, size_t wanted, size_t limit)
+{
+	if ( wanted <= *size )
+		return true;
+	size_t new_size = *size ? *size : BUFFER_MIN;
+	while ( new_size < wanted )
+		new_size *= 2;
+	if ( limit < new_size )
+		new_size = wanted < limit ? limit : wanted;
+	return ResizeRing(buffer, size, offset, used, new_size);
+}
+
+// Copies data from one ring buffer to another, where both may wrap around.
+static void CopyRing(unsigned char* dst, size_t dst_size, size_t dst_at,
+                     const unsigned char* src, size_t src_size, size_t src_at,
+                     size_t amount)
+{
+	while ( amount )
+	{
+		size_t count = amount;
+		if ( dst_size - dst_at < count )
+			count = dst_size - dst_at;
+		if ( src_size - src_at < count )
+			count = src_size - src_at;
+		memcpy(dst + dst_at, src + src_at, count);
+		dst_at += count;
+		if ( dst_size <= dst_at )
+			dst_at -= dst_size;
+		src_at += count;
+		if ( src_size <= src_at )
+			src_at -= src_size;
+		amount -= count;
+	}
+}
+
 static size_t AddressFamilySize(int af)
 {
 	switch ( af )
@@ -168,6 +419,109 @@ static size_t AddressFamilySize(int af)
 	return 0;
 }
 
+static bool IsSameAddress(const union tcp_sockaddr* a,
+                          const union tcp_sockaddr* b)
+{
+	if ( a->family != b->family )
+		return false;
+	if ( a->family == AF_INET )
+		return a->in.sin_addr.s_addr == b->in.sin_addr.s_addr &&
+		       a->in.sin_port == b->in.sin_port;
+	else if ( a->family == AF_INET6 )
+		return !memcmp(&a->in6.sin6_addr, &b->in6.sin6_addr,
+		               sizeof(struct in6_addr)) &&
+		       a->in6.sin6_port == b->in6.sin6_port;
+	return false;
+}
+
+static uint32_t HashMix(uint32_t hash, uint32_t value)
+{
+	hash = (hash ^ value) * 0x9E3779B1;
+	return hash ^ hash >> 15;
+}
+
+static uint32_t HashAddress(uint32_t hash, const union tcp_sockaddr* addr)
+{
+	if ( addr->family == AF_INET )
+	{
+		hash = HashMix(hash, addr->in.sin_addr.s_addr);
+		hash = HashMix(hash, addr->in.sin_port);
+	}
+	else if ( addr->family == AF_INET6 )
+	{
+		for ( size_t i = 0; i < sizeof(struct in6_addr); i += 4 )
+		{
+			uint32_t word;
+			memcpy(&word, (const unsigned char*) &addr->in6.sin6_addr + i,
+			       sizeof(word));
+			hash = HashMix(hash, word);
+		}
+		hash = HashMix(hash, addr->in6.sin6_port);
+	}
+	return hash;
+}
+
+static size_t ConnectionHash(const union tcp_sockaddr* local,
+                             const union tcp_sockaddr* remote)
+{
+	uint32_t hash = connections_key;
+	hash = HashAddress(hash, local);
+	hash = HashAddress(hash, remote);
+	return hash % CONNECTIONS_LENGTH;
+}
+
+static uint32_t CookiePeriod()
+{
+	return Time::Get(CLOCK_MONOTONIC).tv_sec / COOKIE_PERIOD;
+}
+
+static void CookieAddress(SHA2_CTX* ctx, const union tcp_sockaddr* addr)
+{
+	if ( addr->family == AF_INET )
+	{
+		SHA256Update(ctx, (const uint8_t*) &addr->in.sin_addr,
+		             sizeof(addr->in.sin_addr));
+		SHA256Update(ctx, (const uint8_t*) &addr->in.sin_port,
+		             sizeof(addr->in.sin_port));
+	}
+	else if ( addr->family == AF_INET6 )
+	{
+		SHA256Update(ctx, (const uint8_t*) &addr->in6.sin6_addr,
+		             sizeof(addr->in6.sin6_addr));
+		SHA256Update(ctx, (const uint8_t*) &addr->in6.sin6_port,
+		             sizeof(addr->in6.sin6_port));
+	}
+}
+
+// A SYN cookie is an initial sequence number that authenticates the connection
+// with a secret key, so the connection can be established when the remote
+// acknowledges it, without remembering the half-open connection. The low three
+// bits are the index of the segment size, which is authenticated as well.
+static tcp_seq SynCookie(const union tcp_sockaddr* local,
+                         const union tcp_sockaddr* remote,
+                         tcp_seq irs,
+                         uint32_t period,
+                         tcp_seq mss_index)
+{
+	SHA2_CTX ctx;
+	SHA256Init(&ctx);
+	SHA256Update(&ctx, cookie_key, sizeof(cookie_key));
+	CookieAddress(&ctx, local);
+	CookieAddress(&ctx, remote);
+	SHA256Update(&ctx, (const uint8_t*) &irs, sizeof(irs));
+	SHA256Update(&ctx, (const uint8_t*) &period, sizeof(period));
+	SHA256Update(&ctx, (const uint8_t*) &mss_index, sizeof(mss_index));
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256Final(digest, &ctx);
+	tcp_seq cookie;
+	memcpy(&cookie, digest, sizeof(cookie));
+	return (cookie & ~(tcp_seq) 7) | (mss_index & 7);
+}
+
+static void Deliver(Ref<Packet> pkt,
+                    const struct in_addr* src,
+                    const struct in_addr* dst);
+
 // The TCP socket implementation. It is separate from the class TCPSocketNode
 // as that class is reference counted, but this class manages its own lifetime
 // so the socket is properly shut down after all references are closed.
@@ -176,6 +530,10 @@ static size_t AddressFamilySize(int af)
 // bindings array indexed by the port, and then the sockets on that port are
 // doubly linked using prev_socket and next_socket.
 //
+// Connected and listening sockets are also in a doubly linked list starting
+// from the connections hash table bucket of their local and remote addresses,
+// and then doubly linked using prev_connection and next_connection.
+//
 // Half-open sockets are in a doubly linked list starting from connecting_half
 // in the listening socket, and then doubly linked with connecting_prev and
 // connecting_next (with connecting_parent going back to the listening socket).
@@ -190,10 +548,9 @@ static size_t AddressFamilySize(int af)
 // is not pending.
 class TCPSocket
 {
-	friend void HandleIP(Ref<Packet> pkt,
-	                     const struct in_addr* src,
-	                     const struct in_addr* dst,
-	                     bool dst_broadcast);
+	friend void Deliver(Ref<Packet> pkt,
+	                    const struct in_addr* src,
+	                    const struct in_addr* dst);
 
 public:
 	TCPSocket(int af);
@@ -243,12 +600,44 @@ private:
 	                   size_t addrsize);
 	bool CanBind(union tcp_sockaddr new_local);
 	bool BindDefault(const union tcp_sockaddr* new_local_ptr);
-	void UpdateWindow(uint16_t new_window);
+	void LinkConnection();
+	void UnlinkConnection();
+	TCPSocket* NewConnection(const union tcp_sockaddr* pkt_src,
+	                         const union tcp_sockaddr* pkt_dst);
+	void TransmitCookie(const union tcp_sockaddr* pkt_src,
+	                    const union tcp_sockaddr* pkt_dst,
+	                    tcp_seq irs, const struct tcp_options* options);
+	bool AcceptCookie(Ref<Packet> pkt, const struct tcphdr* hdr,
+	                  union tcp_sockaddr* pkt_src,
+	                  union tcp_sockaddr* pkt_dst);
+	void UpdateWindow(tcp_seq new_window);
+	void UpdateReceiveWindow();
+	void AutotuneReceive();
 	void TransmitLoop();
 	bool Transmit();
+	bool TransmitSegment(tcp_seq pos, tcp_seq end, tcp_seq* next);
+	TCPSocket* LocalPeer();
+	void TransmitLocal();
+	tcp_seq TransmitLimit();
+	bool CanTransmitSmall(tcp_seq end);
+	void MeasureRoundTrip();
+	void InitializeWindow();
+	void OnNewAck(tcp_seq acked);
+	void OnDuplicateAck();
+	void OnRetransmitTimeout();
+	tcp_seq FlightSize();
+	void UpdateScoreboard(const struct tcp_options* options);
+	bool NextHole(tcp_seq from, tcp_seq* start, tcp_seq* end);
+	bool NextRetransmission(tcp_seq* start, tcp_seq* end);
+	size_t ReassemblyLength();
+	void ReceiveOutOfOrder(tcp_seq seq, const Packet* pkt, size_t position,
+	                       size_t length, bool fin);
+	bool Reassemble();
 	void ScheduleTransmit();
 	void SetDeadline();
 	void SetTimer();
+	void OnBufferDrained();
+	void ReleaseBuffers();
 	void Close();
 	void Destroy();
 	void Disconnect();
@@ -265,6 +654,12 @@ public:
 	// The next socket bound on the same port in the address family.
 	TCPSocket* next_socket;
 
+	// The previous socket in the same connections hash table bucket.
+	TCPSocket* prev_connection;
+
+	// The next socket in the same connections hash table bucket.
+	TCPSocket* next_connection;
+
 	// The first half-connected socket in our listening queue.
 	TCPSocket* connecting_half;
 
@@ -301,6 +696,9 @@ public:
 	// Whether the socket is receiving datagrams.
 	bool remoted;
 
+	// Whether the socket is in the connections hash table.
+	bool hashed;
+
 	// Whether SO_REUSEADDR is set.
 	bool reuseaddr;
 
@@ -314,25 +712,66 @@ private:
 	// The poll channel to publish poll bit changes on.
 	PollChannel poll_channel;
 
-	// The queue of incoming packets whose sequence numbers are too high to
-	// process right now, sorted by increasing sequence number.
-	Ref<Packet> receive_queue; // TODO: Not a good way to keep track of this.
+	// The ranges of data received out of order after recv_nxt, which have
+	// been stored in the incoming ring buffer after the in-order data.
+	struct tcp_range reassembly[REASSEMBLY_MAX];
+
+	// The ranges after send_una that the remote socket has selectively
+	// acknowledged (RFC 2018).
+	struct tcp_range scoreboard[SCOREBOARD_MAX];
 
 	// The deadline for the remote to acknowledge before retransmitting.
 	struct timespec deadline;
 
+	// The deadline for sending data held back by TCP_CORK or MSG_MORE.
+	struct timespec cork_deadline;
+
+	// The deadline for releasing the memory of the empty buffers.
+	struct timespec release_deadline;
+
+	// When a buffer was last emptied.
+	struct timespec buffer_drained;
+
+	// The incoming ring buffer, or NULL if it is empty.
+	unsigned char* incoming;
+
+	// The size of the incoming ring buffer.
+	size_t incoming_size;
+
 	// The offset at which data begins in the incoming ring buffer.
 	size_t incoming_offset;
 
 	// The amount of bytes in the incoming ring buffer.
 	size_t incoming_used;
 
+	// The amount of bytes the incoming ring buffer can grow to (SO_RCVBUF).
+	size_t incoming_limit;
+
+	// The outgoing ring buffer, or NULL if it is empty.
+	unsigned char* outgoing;
+
+	// The size of the outgoing ring buffer.
+	size_t outgoing_size;
+
 	// The offset at which data begins in the outgoing ring buffer.
 	size_t outgoing_offset;
 
 	// The amount of bytes in the outgoing ring buffer.
 	size_t outgoing_used;
 
+	// The amount of bytes the outgoing ring buffer can grow to (SO_SNDBUF).
+	size_t outgoing_limit;
+
+	// The largest segment the user wants to send or receive (TCP_MAXSEG), or
+	// 0 if there is no such limit.
+	size_t mss_limit;
+
+	// The number of ranges in the reassembly array.
+	size_t reassembly_count;
+
+	// The number of ranges in the scoreboard array.
+	size_t scoreboard_count;
+
 	// Send unacknowledged (STD 7, RFC 793).
 	tcp_seq send_una;
 
@@ -358,6 +797,41 @@ private:
 	// Initial send sequence number (STD 7, RFC 793).
 	tcp_seq iss;
 
+	// The highest sequence number transmitted so far (RFC 6582).
+	tcp_seq send_max;
+
+	// The sequence number whose acknowledgement ends the round trip time
+	// measurement in progress (RFC 6298).
+	tcp_seq rtt_seq;
+
+	// The highest sequence number transmitted when fast recovery or the last
+	// retransmission timeout began (RFC 6582).
+	tcp_seq recover;
+
+	// The congestion window in bytes (RFC 5681).
+	tcp_seq cwnd;
+
+	// The slow start threshold in bytes (RFC 5681).
+	tcp_seq ssthresh;
+
+	// The maximum segment size of the route to the remote socket.
+	tcp_seq send_mss;
+
+	// The maximum segment size the remote socket can receive (RFC 1122).
+	tcp_seq peer_mss;
+
+	// The receive sequence number when the receive buffer was last tuned.
+	tcp_seq autotune_seq;
+
+	// The sequence number of the most recent segment received out of order.
+	tcp_seq reassembly_recent;
+
+	// The sequence number of the FIN received out of order, if any.
+	tcp_seq reassembly_fin;
+
+	// The highest sequence number retransmitted in this fast recovery.
+	tcp_seq retransmit_high;
+
 	// Receive next (STD 7, RFC 793).
 	tcp_seq recv_nxt;
 
@@ -388,10 +862,40 @@ private:
 	// The maximum number of sockets in the listening queue.
 	int backlog_max;
 
+	// The period when SYN cookies were last sent, if cookies_sent.
+	uint32_t cookie_period;
+
 	// The number of retransmissions that have occured since the last
 	// acknowledgement from the remote socket.
 	unsigned int retransmissions;
 
+	// The number of duplicate acknowledgements received in a row.
+	unsigned int dupacks;
+
+	// The number of lost segments to retransmit on the next transmission.
+	unsigned int fast_retransmits;
+
+	// The smoothed round trip time in microseconds (RFC 6298).
+	uint32_t srtt;
+
+	// The round trip time variation in microseconds (RFC 6298).
+	uint32_t rttvar;
+
+	// The retransmission timeout in microseconds before backoff (RFC 6298).
+	uint32_t rto;
+
+	// When the segment whose round trip time is being measured was sent.
+	struct timespec rtt_sent;
+
+	// When the receive buffer was last tuned.
+	struct timespec autotune_time;
+
+	// How many bits the remote socket's window is shifted (RFC 7323).
+	uint8_t send_wscale;
+
+	// How many bits our advertised window is shifted (RFC 7323).
+	uint8_t recv_wscale;
+
 	// The current TCP state.
 	enum tcp_state state;
 
@@ -413,14 +917,44 @@ private:
 	// Whether the timer is pending.
 	bool timer_armed;
 
+	// Whether the round trip time of a segment is being measured.
+	bool rtt_timing;
+
+	// Whether the socket is in fast recovery (RFC 6582).
+	bool fast_recovery;
+
+	// Whether a FIN has been received out of order.
+	bool has_reassembly_fin;
+
 	// Whether the socket has been shut down for receive.
 	bool shutdown_receive;
 
-	// The incoming ring buffer.
-	unsigned char incoming[BUFFER_SIZE];
+	// Whether window scaling is offered or has been negotiated (RFC 7323).
+	bool window_scaling;
+
+	// Whether selective acknowledgements are offered or have been negotiated
+	// (RFC 2018).
+	bool sack_permitted;
+
+	// Whether the receive buffer grows automatically to fit the connection.
+	bool autotune_receive;
 
-	// The outgoing ring buffer.
-	unsigned char outgoing[BUFFER_SIZE];
+	// Whether the send buffer grows automatically to fit the connection.
+	bool autotune_send;
+
+	// Whether SYN cookies have been sent because the listening queue was full.
+	bool cookies_sent;
+
+	// Whether small segments are sent right away rather than being coalesced
+	// while data is unacknowledged (TCP_NODELAY).
+	bool nodelay;
+
+	// Whether small segments are held until a full segment can be sent
+	// (TCP_CORK).
+	bool cork;
+
+	// Whether the last send said more data would follow (MSG_MORE).
+	bool more;
 };
 
 // The TCP socket Inode with a reference counted lifetime. The backend class
@@ -468,6 +1002,8 @@ TCPSocket::TCPSocket(int af)
 {
 	prev_socket = NULL;
 	next_socket = NULL;
+	prev_connection = NULL;
+	next_connection = NULL;
 	connecting_half = NULL;
 	connecting_ready = NULL;
 	connecting_prev = NULL;
@@ -480,16 +1016,30 @@ TCPSocket::TCPSocket(int af)
 	ifindex = 0;
 	bound = false;
 	remoted = false;
+	hashed = false;
 	reuseaddr = false;
 	// timer is initialized by its constructor.
 	timer.Attach(Time::GetClock(CLOCK_MONOTONIC));
 	// poll_channel is initialized by its constructor.
-	// receive_queue is initialized by its constructor.
+	memset(reassembly, 0, sizeof(reassembly));
+	memset(scoreboard, 0, sizeof(scoreboard));
+	reassembly_count = 0;
+	scoreboard_count = 0;
 	deadline = timespec_make(-1, 0);
+	cork_deadline = timespec_make(-1, 0);
+	release_deadline = timespec_make(-1, 0);
+	buffer_drained = timespec_make(0, 0);
+	incoming = NULL;
+	incoming_size = 0;
 	incoming_offset = 0;
 	incoming_used = 0;
+	incoming_limit = BUFFER_SIZE;
+	outgoing = NULL;
+	outgoing_size = 0;
 	outgoing_offset = 0;
 	outgoing_used = 0;
+	outgoing_limit = BUFFER_SIZE;
+	mss_limit = 0;
 	send_una = 0;
 	send_nxt = 0;
 	send_wnd = 0;
@@ -498,6 +1048,17 @@ TCPSocket::TCPSocket(int af)
 	send_wl2 = 0;
 	send_pos = 0;
 	iss = 0;
+	send_max = 0;
+	rtt_seq = 0;
+	recover = 0;
+	cwnd = TCP_MSS;
+	ssthresh = CWND_MAX;
+	send_mss = TCP_MSS;
+	peer_mss = TCP_MSS;
+	autotune_seq = 0;
+	reassembly_recent = 0;
+	reassembly_fin = 0;
+	retransmit_high = 0;
 	recv_nxt = 0;
 	recv_wnd = 0;
 	recv_up = 0;
@@ -508,7 +1069,17 @@ TCPSocket::TCPSocket(int af)
 	sockerr = 0;
 	backlog_used = 0;
 	backlog_max = 0;
+	cookie_period = 0;
 	retransmissions = 0;
+	dupacks = 0;
+	fast_retransmits = 0;
+	srtt = 0;
+	rttvar = 0;
+	rto = RTO_INITIAL;
+	rtt_sent = timespec_make(0, 0);
+	autotune_time = timespec_make(0, 0);
+	send_wscale = 0;
+	recv_wscale = 0;
 	state = TCP_STATE_CLOSED;
 	outgoing_syn = TCP_SPECIAL_NOT;
 	outgoing_fin = TCP_SPECIAL_NOT;
@@ -517,9 +1088,18 @@ TCPSocket::TCPSocket(int af)
 	transmit_scheduled = false;
 	is_referenced = false;
 	timer_armed = false;
+	rtt_timing = false;
+	fast_recovery = false;
+	has_reassembly_fin = false;
 	shutdown_receive = false;
-	memset(incoming, 0, sizeof(incoming));
-	memset(outgoing, 0, sizeof(outgoing));
+	window_scaling = false;
+	sack_permitted = false;
+	autotune_receive = true;
+	autotune_send = true;
+	nodelay = false;
+	cork = false;
+	more = false;
+	cookies_sent = false;
 }
 
 TCPSocket::~TCPSocket()
@@ -535,13 +1115,8 @@ TCPSocket::~TCPSocket()
 	assert(!connecting_next);
 	assert(!connecting_parent);
 	assert(!is_referenced);
-	// Avoid stack overflow in receive_queue recursive destructor.
-	while ( receive_queue )
-	{
-		Ref<Packet> packet = receive_queue;
-		receive_queue = packet->next;
-		packet->next.Reset();
-	}
+	delete[] incoming;
+	delete[] outgoing;
 }
 
 void TCPSocket::Unreference()
@@ -607,6 +1182,7 @@ void TCPSocket::Fail(int error)
 
 void TCPSocket::Destroy() // tcp_lock taken
 {
+	UnlinkConnection();
 	if ( bound )
 	{
 		if ( af == AF_INET )
@@ -673,6 +1249,47 @@ void TCPSocket::Destroy() // tcp_lock taken
 	}
 }
 
+void TCPSocket::LinkConnection() // tcp_lock taken
+{
+	UnlinkConnection();
+	size_t index = ConnectionHash(&local, &remote);
+	prev_connection = NULL;
+	next_connection = connections[index];
+	if ( next_connection )
+		next_connection->prev_connection = this;
+	connections[index] = this;
+	hashed = true;
+}
+
+void TCPSocket::UnlinkConnection() // tcp_lock taken
+{
+	if ( !hashed )
+		return;
+	if ( prev_connection )
+		prev_connection->next_connection = next_connection;
+	else
+		connections[ConnectionHash(&local, &remote)] = next_connection;
+	if ( next_connection )
+		next_connection->prev_connection = prev_connection;
+	prev_connection = NULL;
+	next_connection = NULL;
+	hashed = false;
+}
+
+static TCPSocket* LookupConnection(const union tcp_sockaddr* local,
+                                   const union tcp_sockaddr* remote)
+{
+	size_t index = ConnectionHash(local, remote);
+	for ( TCPSocket* iter = connections[index]; iter;
+	      iter = iter->next_connection )
+	{
+		if ( IsSameAddress(&iter->local, local) &&
+		     IsSameAddress(&iter->remote, remote) )
+			return iter;
+	}
+	return NULL;
+}
+
 Ref<Inode> TCPSocket::accept4(ioctx_t* ctx, uint8_t* addr, size_t* addrsize_ptr,
                               int flags)
 {
@@ -956,6 +1573,10 @@ bool TCPSocket::Transmit() // tcp_lock taken
 	if ( state == TCP_STATE_CLOSED )
 		return (errno = sockerr ? sockerr : ENOTCONN), false;
 
+	// Exchange data and acknowledgements directly with a socket on this
+	// machine, and only send segments for whatever remains.
+	TransmitLocal();
+
 	// Move new outgoing data into the transmission window if there is room.
 	tcp_seq window_available = (tcp_seq) (send_una + send_wnd - send_nxt);
 	if ( window_available && outgoing_syn == TCP_SPECIAL_PENDING )
@@ -986,153 +1607,454 @@ bool TCPSocket::Transmit() // tcp_lock taken
 		window_available--;
 	}
 
-	// Transmit packets.
+	// Retransmit the segments the remote socket has indicated were lost,
+	// without resending the rest of the window.
 	bool any = false;
-	while ( mod32_lt(send_pos, send_nxt) ||
-	        (has_syn && mod32_lt(recv_acked, recv_nxt)) ||
-	        recv_wnd != recv_wndlast )
+	while ( fast_retransmits )
 	{
-		any = true;
-		size_t mtu;
-		union tcp_sockaddr sendfrom;
-		if ( af == AF_INET )
+		fast_retransmits--;
+		tcp_seq start, end;
+		if ( !NextRetransmission(&start, &end) )
 		{
-			if ( !IP::GetSourceIP(&local.in.sin_addr, &remote.in.sin_addr,
-				                  &sendfrom.in.sin_addr, ifindex, &mtu) )
-				return false;
+			fast_retransmits = 0;
+			break;
 		}
-		// TODO: IPv6 support.
-		else
-			return errno = EAFNOSUPPORT, false;
-		if ( mtu < sizeof(struct tcphdr) )
-			return errno = EINVAL, false;
-		mtu -= sizeof(struct tcphdr);
-		Ref<Packet> pkt = GetPacket();
-		if ( !pkt )
+		if ( !TransmitSegment(start, end, &retransmit_high) )
 			return false;
-		pkt->length = sizeof(struct tcphdr);
-		unsigned char* out = pkt->from;
-		struct tcphdr hdr;
-		if ( af == AF_INET )
+		any = true;
+	}
+
+	// Transmit packets.
+	while ( true )
+	{
+		tcp_seq end = TransmitLimit();
+		if ( mod32_lt(send_pos, end) &&
+		     (tcp_seq) (end - send_pos) < send_mss &&
+		     !CanTransmitSmall(end) )
+			end = send_pos;
+		if ( !(mod32_lt(send_pos, end) ||
+		       (has_syn && mod32_lt(recv_acked, recv_nxt)) ||
+		       recv_wnd != recv_wndlast) )
+			break;
+		if ( !TransmitSegment(send_pos, end, &send_pos) )
+			return false;
+		any = true;
+	}
+	if ( send_pos == send_nxt )
+		cork_deadline = timespec_make(-1, 0);
+	if ( any )
+	{
+		SetDeadline();
+		SetTimer();
+	}
+	return true;
+}
+
+// The congestion window limits how far the transmission can go beyond the
+// oldest unacknowledged data, even if the remote window is larger.
+tcp_seq TCPSocket::TransmitLimit() // tcp_lock taken
+{
+	tcp_seq limit = (tcp_seq) (send_una + cwnd);
+	return mod32_lt(limit, send_nxt) ? limit : send_nxt;
+}
+
+// Decides whether the data from send_pos until end, which is less than a full
+// segment, should be sent now, or whether it should wait to be coalesced with
+// more data into a larger segment (RFC 1122 4.2.3.4).
+bool TCPSocket::CanTransmitSmall(tcp_seq end) // tcp_lock taken
+{
+	// Retransmissions and segments with SYN or FIN are sent right away.
+	if ( mod32_lt(send_pos, send_max) ||
+	     outgoing_syn == TCP_SPECIAL_WINDOW ||
+	     (end == send_nxt && outgoing_fin == TCP_SPECIAL_WINDOW) )
+		return true;
+	bool idle = send_una == send_max;
+	// Avoid the silly window syndrome if more data is waiting for the window
+	// to open, and only send a small segment if nothing is in flight, as the
+	// window otherwise opens when the acknowledgement arrives.
+	tcp_seq window_data = (tcp_seq) (send_nxt - send_una);
+	if ( outgoing_syn == TCP_SPECIAL_WINDOW )
+		window_data--;
+	if ( outgoing_fin == TCP_SPECIAL_WINDOW )
+		window_data--;
+	if ( end != send_nxt || window_data < outgoing_used )
+		return idle;
+	// Data held back for more data is sent anyway after a while like on Linux,
+	// in case the application never uncorks or sends more data.
+	if ( cork || more )
+	{
+		struct timespec now = Time::Get(CLOCK_MONOTONIC);
+		if ( cork_deadline.tv_sec < 0 )
 		{
-			hdr.th_sport = local.in.sin_port;
-			hdr.th_dport = remote.in.sin_port;
+			struct timespec delay = timespec_make(CORK_DELAY / 1000000,
+			                                      CORK_DELAY % 1000000 * 1000);
+			cork_deadline = timespec_add(now, delay);
+			SetTimer();
+			return false;
 		}
-		else if ( af == AF_INET6 )
+		return timespec_le(cork_deadline, now);
+	}
+	// Nagle's algorithm only allows one small segment to be unacknowledged.
+	return nodelay || idle;
+}
+
+// Returns the other end of the connection if it's a socket on this machine and
+// the handshake is complete on both ends.
+TCPSocket* TCPSocket::LocalPeer() // tcp_lock taken
+{
+	if ( af != AF_INET || !has_syn || outgoing_syn != TCP_SPECIAL_ACKED )
+		return NULL;
+	TCPSocket* peer = LookupConnection(&remote, &local);
+	if ( !peer || !peer->has_syn || peer->outgoing_syn != TCP_SPECIAL_ACKED )
+		return NULL;
+	if ( !IP::IsLocal(&local.in.sin_addr, &remote.in.sin_addr, ifindex) )
+		return NULL;
+	return peer;
+}
+
+// Moves the data straight from the outgoing buffer into the incoming buffer of
+// a socket on this machine, and acknowledges and opens the window for the data
+// received from it, as if segments had been exchanged. Data already in flight
+// as segments is left to the segments, so the sequence numbers stay in step.
+void TCPSocket::TransmitLocal() // tcp_lock taken
+{
+	TCPSocket* peer = LocalPeer();
+	if ( !peer )
+		return;
+
+	// Acknowledge the received data and update the remote window, if the
+	// remote socket has nothing in flight.
+	if ( (state == TCP_STATE_ESTAB ||
+	      state == TCP_STATE_FIN_WAIT_1 ||
+	      state == TCP_STATE_FIN_WAIT_2) && !reassembly_count &&
+	     peer->send_una == recv_nxt && peer->send_pos == recv_nxt &&
+	     peer->send_max == recv_nxt &&
+	     (recv_acked != recv_nxt || recv_wnd != recv_wndlast) )
+	{
+		tcp_seq old_window = peer->send_wnd;
+		peer->UpdateWindow(recv_wnd);
+		peer->send_wl1 = send_pos;
+		peer->send_wl2 = recv_nxt;
+		recv_acked = recv_nxt;
+		recv_wndlast = recv_wnd;
+		// Let the remote socket transmit the data waiting for the window.
+		if ( old_window < recv_wnd && peer->outgoing_used )
+			peer->ScheduleTransmit();
+	}
+
+	// Move the data if none is in flight and the remote socket expects it next,
+	// unless it's held back to be coalesced, which is left to the segments.
+	if ( !(state == TCP_STATE_ESTAB || state == TCP_STATE_CLOSE_WAIT) ||
+	     cork || more || outgoing_fin != TCP_SPECIAL_PENDING ||
+	     send_pos != send_una || send_max != send_una || !outgoing_used )
+		return;
+	if ( !(peer->state == TCP_STATE_ESTAB ||
+	       peer->state == TCP_STATE_FIN_WAIT_1 ||
+	       peer->state == TCP_STATE_FIN_WAIT_2) ||
+	     peer->shutdown_receive || peer->reassembly_count ||
+	     peer->recv_nxt != send_una )
+		return;
+	size_t amount = outgoing_used < peer->recv_wnd ?
+	                outgoing_used : peer->recv_wnd;
+	if ( !amount )
+		return;
+	// Take only what fits if memory is low, and the rest is moved later.
+	size_t wanted = peer->incoming_used + amount;
+	if ( !GrowRing(&peer->incoming, &peer->incoming_size,
+	               &peer->incoming_offset, peer->incoming_used, wanted,
+	               peer->incoming_limit) )
+		amount = peer->incoming_size - peer->incoming_used;
+	if ( !amount )
+		return;
+	size_t newat = peer->incoming_offset + peer->incoming_used;
+	if ( peer->incoming_size <= newat )
+		newat -= peer->incoming_size;
+	assert(outgoing_offset < outgoing_size);
+	CopyRing(peer->incoming, peer->incoming_size, newat,
+	         outgoing, outgoing_size, outgoing_offset, amount);
+	peer->incoming_used += amount;
+	peer->recv_nxt += amount;
+	size_t available = peer->incoming_used < peer->incoming_limit ?
+	                   peer->incoming_limit - peer->incoming_used : 0;
+	if ( available < peer->recv_wnd )
+		peer->recv_wnd = available;
+	peer->AutotuneReceive();
+	peer->recv_acked = peer->recv_nxt;
+	peer->recv_wndlast = peer->recv_wnd;
+	kthread_cond_broadcast(&peer->receive_cond);
+	peer->poll_channel.Signal(peer->PollEventStatus());
+
+	// The data was delivered, so it's acknowledged right away.
+	outgoing_offset += amount;
+	if ( outgoing_size <= outgoing_offset )
+		outgoing_offset -= outgoing_size;
+	outgoing_used -= amount;
+	send_una += amount;
+	send_pos = send_una;
+	send_max = send_una;
+	if ( mod32_lt(send_nxt, send_una) )
+		send_nxt = send_una;
+	UpdateWindow(peer->recv_wnd);
+	send_wl1 = peer->send_pos;
+	send_wl2 = send_una;
+	if ( sack_permitted )
+		RemoveRangesBefore(scoreboard, &scoreboard_count, send_una);
+	retransmissions = 0;
+	if ( !outgoing_used )
+		OnBufferDrained();
+	kthread_cond_broadcast(&transmit_cond);
+	poll_channel.Signal(PollEventStatus());
+}
+
+// Transmits a segment beginning at pos with the data until at most end, and
+// sets next to the sequence number after the segment.
+bool TCPSocket::TransmitSegment(tcp_seq pos, tcp_seq end,
+                                tcp_seq* next) // tcp_lock taken
+{
+	size_t mtu;
+	bool segmentation = false;
+	union tcp_sockaddr sendfrom;
+	if ( af == AF_INET )
+	{
+		if ( !IP::GetSourceIP(&local.in.sin_addr, &remote.in.sin_addr,
+			                  &sendfrom.in.sin_addr, ifindex, &mtu,
+			                  &segmentation) )
+			return false;
+	}
+	// TODO: IPv6 support.
+	else
+		return errno = EAFNOSUPPORT, false;
+	if ( mtu < sizeof(struct tcphdr) + TCP_MAXOLEN )
+		return errno = EINVAL, false;
+	mtu -= sizeof(struct tcphdr);
+	// The largest segment that can be received on this route is advertised,
+	// and the largest segment both the route and the remote accepts is sent.
+	size_t recv_mss = mtu;
+	if ( mss_limit && mss_limit < recv_mss )
+		recv_mss = mss_limit;
+	if ( UINT16_MAX < recv_mss )
+		recv_mss = UINT16_MAX;
+	send_mss = recv_mss < peer_mss ? recv_mss : peer_mss;
+	Ref<Packet> pkt = GetPacket();
+	if ( !pkt )
+		return false;
+	unsigned char* out = pkt->from;
+	struct tcphdr hdr;
+	if ( af == AF_INET )
+	{
+		hdr.th_sport = local.in.sin_port;
+		hdr.th_dport = remote.in.sin_port;
+	}
+	else if ( af == AF_INET6 )
+	{
+		hdr.th_sport = local.in6.sin6_port;
+		hdr.th_dport = remote.in6.sin6_port;
+	}
+	else
+		return errno = EAFNOSUPPORT, false;
+	hdr.th_seq = htobe32(pos);
+	hdr.th_flags = 0;
+	tcp_seq send_nxtpos = pos;
+	assert(mod32_le(send_nxtpos, end));
+	assert(mod32_le(end, send_nxt));
+	if ( outgoing_syn == TCP_SPECIAL_WINDOW && send_nxtpos == send_una &&
+	     mod32_lt(send_nxtpos, end) )
+	{
+		hdr.th_flags |= TH_SYN;
+		send_nxtpos++;
+	}
+	assert(mod32_le(send_nxtpos, end));
+	// RFC 1122 4.2.2.6, RFC 7323 2.2, and RFC 2018 2, negotiate the options
+	// in the SYN.
+	unsigned char options[TCP_MAXOLEN];
+	size_t options_length = 0;
+	if ( hdr.th_flags & TH_SYN )
+	{
+		options[options_length++] = TCPOPT_MAXSEG;
+		options[options_length++] = TCPOLEN_MAXSEG;
+		options[options_length++] = recv_mss >> 8 & 0xFF;
+		options[options_length++] = recv_mss >> 0 & 0xFF;
+		if ( sack_permitted )
 		{
-			hdr.th_sport = local.in6.sin6_port;
-			hdr.th_dport = remote.in6.sin6_port;
-		}
-		else
-			return errno = EAFNOSUPPORT, false;
-		hdr.th_seq = htobe32(send_pos);
-		hdr.th_offset = TCP_OFFSET_ENCODE(sizeof(struct tcphdr) / 4);
-		hdr.th_flags = 0;
-		tcp_seq send_nxtpos = send_pos;
-		assert(mod32_le(send_nxtpos, send_nxt));
-		if ( outgoing_syn == TCP_SPECIAL_WINDOW && send_nxtpos == send_una )
-		{
-			hdr.th_flags |= TH_SYN;
-			send_nxtpos++;
-		}
-		assert(mod32_le(send_nxtpos, send_nxt));
-		if ( has_syn )
-		{
-			// TODO: RFC 1122 4.2.2.6:
-			//       "TCP SHOULD send an MSS (Maximum Segment Size) option in
-			//        every SYN segment when its receive MSS differs from the
-			//        default 536, and MAY send it always."
-			//       "If an MSS option is not received at connection setup, TCP
-			//        MUST assume a default send MSS of 536 (576-40)."
-			hdr.th_flags |= TH_ACK;
-			hdr.th_ack = htobe32(recv_nxt);
+			options[options_length++] = TCPOPT_NOP;
+			options[options_length++] = TCPOPT_NOP;
+			options[options_length++] = TCPOPT_SACK_PERMITTED;
+			options[options_length++] = TCPOLEN_SACK_PERMITTED;
 		}
-		else
-			hdr.th_ack = htobe32(0);
-		hdr.th_win = htobe16(recv_wnd);
-		hdr.th_urp = htobe16(0);
-		hdr.th_sum = htobe16(0);
-		tcp_seq window_data = (tcp_seq)(send_nxt - send_pos);
-		if ( send_pos == send_una && outgoing_syn == TCP_SPECIAL_WINDOW )
-			window_data--;
-		if ( mod32_lt(send_pos, send_nxt) &&
-		     outgoing_fin == TCP_SPECIAL_WINDOW )
-			window_data--;
-		if ( window_data )
-		{
-			size_t amount = mtu < window_data ? mtu : window_data;
-			assert(outgoing_offset <= sizeof(outgoing));
-			tcp_seq window_length = (tcp_seq) (send_nxtpos - send_una);
-			if ( outgoing_syn == TCP_SPECIAL_WINDOW )
-				window_length--;
-			assert(window_length <= sizeof(outgoing));
-			size_t outgoing_end = outgoing_offset + window_length;
-			if ( sizeof(outgoing) <= outgoing_end )
-				outgoing_end -= sizeof(outgoing);
-			assert(outgoing_end < sizeof(outgoing));
-			size_t until_end = sizeof(outgoing) - outgoing_end;
-			size_t first = until_end < amount ? until_end : amount;
-			assert(first <= sizeof(outgoing));
-			assert(first <= sizeof(outgoing) - outgoing_end);
-			size_t second = amount - first;
-			assert(second <= sizeof(outgoing));
-			memcpy(out + sizeof(hdr), outgoing + outgoing_end, first);
-			if ( second )
-				memcpy(out + sizeof(hdr) + first, outgoing, second);
-			pkt->length += amount;
-			send_nxtpos += amount;
+		if ( window_scaling )
+		{
+			options[options_length++] = TCPOPT_NOP;
+			options[options_length++] = TCPOPT_WINDOW;
+			options[options_length++] = TCPOLEN_WINDOW;
+			options[options_length++] = WINDOW_SHIFT;
 		}
-		assert(mod32_le(send_nxtpos, send_nxt));
-		if ( outgoing_fin == TCP_SPECIAL_WINDOW &&
-		     send_nxtpos + 1 == send_nxt )
+	}
+	// RFC 2018 4, report the data received out of order, beginning with the
+	// range containing the most recently received segment.
+	else if ( has_syn && sack_permitted && reassembly_count )
+	{
+		size_t first = 0;
+		for ( size_t i = 0; i < reassembly_count; i++ )
 		{
-			hdr.th_flags |= TH_FIN;
-			send_nxtpos++;
+			if ( mod32_le(reassembly[i].start, reassembly_recent) &&
+			     mod32_lt(reassembly_recent, reassembly[i].end) )
+				first = i;
 		}
-		assert(mod32_le(send_nxtpos, send_nxt));
-		memcpy(out, &hdr, sizeof(hdr));
-		uint16_t checksum = 0;
-		if ( af == AF_INET )
+		size_t blocks = reassembly_count < SACK_BLOCKS_MAX ?
+		                reassembly_count : SACK_BLOCKS_MAX;
+		options[options_length++] = TCPOPT_NOP;
+		options[options_length++] = TCPOPT_NOP;
+		options[options_length++] = TCPOPT_SACK;
+		options[options_length++] = 2 + blocks * TCPOLEN_SACK;
+		for ( size_t n = 0; n < blocks; n++ )
 		{
-			checksum = IP::ipsum_buf(checksum, &sendfrom.in.sin_addr,
-			                         sizeof(struct in_addr));
-			checksum = IP::ipsum_buf(checksum, &remote.in.sin_addr,
-			                         sizeof(struct in_addr));
+			size_t i = n == 0 ? first : n - 1 < first ? n - 1 : n;
+			tcp_seq start = htobe32(reassembly[i].start);
+			tcp_seq end = htobe32(reassembly[i].end);
+			memcpy(options + options_length, &start, sizeof(start));
+			options_length += sizeof(start);
+			memcpy(options + options_length, &end, sizeof(end));
+			options_length += sizeof(end);
 		}
-		else if ( af == AF_INET6 )
+	}
+	assert(options_length % 4 == 0);
+	size_t header_length = sizeof(struct tcphdr) + options_length;
+	hdr.th_offset = TCP_OFFSET_ENCODE(header_length / 4);
+	pkt->length = header_length;
+	if ( has_syn )
+	{
+		hdr.th_flags |= TH_ACK;
+		hdr.th_ack = htobe32(recv_nxt);
+	}
+	else
+		hdr.th_ack = htobe32(0);
+	// The window is never scaled in SYN segments (RFC 7323 2.2).
+	tcp_seq window = recv_wnd;
+	if ( !(hdr.th_flags & TH_SYN) )
+		window >>= recv_wscale;
+	hdr.th_win = htobe16(window < TCP_MAXWIN ? window : TCP_MAXWIN);
+	hdr.th_urp = htobe16(0);
+	hdr.th_sum = htobe16(0);
+	bool fin_in_range = end == send_nxt && outgoing_fin == TCP_SPECIAL_WINDOW;
+	tcp_seq window_data = (tcp_seq)(end - send_nxtpos);
+	if ( mod32_lt(send_nxtpos, end) && fin_in_range )
+		window_data--;
+	if ( window_data )
+	{
+		size_t segment_size = mtu - options_length;
+		if ( send_mss < segment_size )
+			segment_size = send_mss;
+		size_t amount = segment_size < window_data ? segment_size : window_data;
+		// Let the network interface cut many full segments out of one large
+		// segment, while any final small segment is sent by itself as usual.
+		if ( segmentation && !(hdr.th_flags & TH_SYN) &&
+		     2 * segment_size <= window_data )
 		{
-			checksum = IP::ipsum_buf(checksum, &sendfrom.in6.sin6_addr,
-			                         sizeof(struct in6_addr));
-			checksum = IP::ipsum_buf(checksum, &remote.in6.sin6_addr,
-			                         sizeof(struct in6_addr));
+			size_t limit = SEGMENTATION_MAX - header_length;
+			amount = window_data < limit ? window_data : limit;
+			amount -= amount % segment_size;
+			pkt->segment_size = segment_size;
 		}
-		else
-			return errno = EAFNOSUPPORT, false;
-		checksum = IP::ipsum_word(checksum, IPPROTO_TCP);
-		checksum = IP::ipsum_word(checksum, pkt->length);
-		checksum = IP::ipsum_buf(checksum, out, pkt->length);
-		hdr.th_sum = htobe16(IP::ipsum_finish(checksum));
-		memcpy(out, &hdr, sizeof(hdr));
-		if ( af == AF_INET )
+		assert(outgoing_offset < outgoing_size);
+		tcp_seq window_length = (tcp_seq) (send_nxtpos - send_una);
+		if ( outgoing_syn == TCP_SPECIAL_WINDOW )
+			window_length--;
+		assert(window_length <= outgoing_size);
+		size_t outgoing_end = outgoing_offset + window_length;
+		if ( outgoing_size <= outgoing_end )
+			outgoing_end -= outgoing_size;
+		assert(outgoing_end < outgoing_size);
+		// Large segments continue in additional packets.
+		Packet* tail = pkt.Get();
+		for ( size_t done = 0; done < amount; )
 		{
-			if ( !IP::Send(pkt, &sendfrom.in.sin_addr, &remote.in.sin_addr,
-				           IPPROTO_TCP, ifindex, false) )
-				return false;
+			if ( tail->length == tail->pmap.size )
+			{
+				Ref<Packet> fragment = GetPacket();
+				if ( !fragment )
+					return false;
+				tail->fragment = fragment;
+				tail = fragment.Get();
+			}
+			size_t count = tail->pmap.size - tail->length;
+			if ( amount - done < count )
+				count = amount - done;
+			size_t at = outgoing_end + done;
+			if ( outgoing_size <= at )
+				at -= outgoing_size;
+			size_t until_end = outgoing_size - at;
+			size_t first = until_end < count ? until_end : count;
+			size_t second = count - first;
+			assert(second <= outgoing_size);
+			memcpy(tail->from + tail->length, outgoing + at, first);
+			if ( second )
+				memcpy(tail->from + tail->length + first, outgoing, second);
+			tail->length += count;
+			done += count;
 		}
-		// TODO: IPv6 support.
-		else
-			return errno = EAFNOSUPPORT, false;
-		if ( has_syn )
-			recv_acked = recv_nxt;
-		recv_wndlast = recv_wnd;
-		assert(mod32_le(send_nxtpos, send_nxt));
-		send_pos = send_nxtpos;
+		send_nxtpos += amount;
 	}
-	if ( any )
+	assert(mod32_le(send_nxtpos, end));
+	if ( fin_in_range && send_nxtpos + 1 == send_nxt )
 	{
-		SetDeadline();
-		SetTimer();
+		hdr.th_flags |= TH_FIN;
+		send_nxtpos++;
+	}
+	assert(mod32_le(send_nxtpos, send_nxt));
+	memcpy(out, &hdr, sizeof(hdr));
+	memcpy(out + sizeof(hdr), options, options_length);
+	uint16_t checksum = 0;
+	if ( af == AF_INET )
+	{
+		checksum = IP::ipsum_buf(checksum, &sendfrom.in.sin_addr,
+		                         sizeof(struct in_addr));
+		checksum = IP::ipsum_buf(checksum, &remote.in.sin_addr,
+		                         sizeof(struct in_addr));
+	}
+	else if ( af == AF_INET6 )
+	{
+		checksum = IP::ipsum_buf(checksum, &sendfrom.in6.sin6_addr,
+		                         sizeof(struct in6_addr));
+		checksum = IP::ipsum_buf(checksum, &remote.in6.sin6_addr,
+		                         sizeof(struct in6_addr));
+	}
+	else
+		return errno = EAFNOSUPPORT, false;
+	checksum = IP::ipsum_word(checksum, IPPROTO_TCP);
+	if ( !pkt->segment_size )
+		checksum = IP::ipsum_word(checksum, pkt->length);
+	// Let the network interface checksum the segment itself if possible.
+	hdr.th_sum = htobe16(checksum);
+	memcpy(out, &hdr, sizeof(hdr));
+	pkt->checksum_flags = PACKET_CHECKSUM_PARTIAL;
+	pkt->checksum_start = 0;
+	pkt->checksum_offset = offsetof(struct tcphdr, th_sum);
+	if ( af == AF_INET )
+	{
+		if ( !IP::Send(pkt, &sendfrom.in.sin_addr, &remote.in.sin_addr,
+			           IPPROTO_TCP, ifindex, false) )
+			return false;
+	}
+	// TODO: IPv6 support.
+	else
+		return errno = EAFNOSUPPORT, false;
+	if ( has_syn )
+		recv_acked = recv_nxt;
+	recv_wndlast = recv_wnd;
+	// Measure the round trip time of new data, but never of retransmitted data
+	// as it's ambiguous which transmission is acknowledged (Karn's algorithm).
+	if ( mod32_le(send_max, pos) && pos != send_nxtpos )
+	{
+		if ( !rtt_timing )
+		{
+			rtt_timing = true;
+			rtt_seq = send_nxtpos;
+			rtt_sent = Time::Get(CLOCK_MONOTONIC);
+		}
 	}
+	if ( mod32_lt(send_max, send_nxtpos) )
+		send_max = send_nxtpos;
+	*next = send_nxtpos;
 	return true;
 }
 
@@ -1140,6 +2062,12 @@ void TCPSocket::OnTimer()
 {
 	ScopedLock lock(&tcp_lock);
 	timer_armed = false;
+	if ( 0 <= release_deadline.tv_sec &&
+	     timespec_le(release_deadline, Time::Get(CLOCK_MONOTONIC)) )
+	{
+		release_deadline = timespec_make(-1, 0);
+		ReleaseBuffers();
+	}
 	if ( 0 <= deadline.tv_sec &&
 	     timespec_le(deadline, Time::Get(CLOCK_MONOTONIC)) )
 	{
@@ -1148,47 +2076,294 @@ void TCPSocket::OnTimer()
 			 (state == TCP_STATE_FIN_WAIT_2 && !is_referenced) )
 			Close();
 		else if ( mod32_lt(send_una, send_pos) )
-		{
-			retransmissions++;
-			send_pos = send_una;
-		}
+			OnRetransmitTimeout();
 	}
 	transmit_scheduled = false;
 	TransmitLoop();
-	if ( 0 <= deadline.tv_sec )
+	if ( 0 <= deadline.tv_sec || 0 <= cork_deadline.tv_sec ||
+	     0 <= release_deadline.tv_sec )
 		SetTimer();
 	if ( can_destroy() )
 		delete this;
 }
 
-void TCPSocket::ScheduleTransmit() // tcp_lock locked
+void TCPSocket::ScheduleTransmit() // tcp_lock locked
+{
+	if ( state == TCP_STATE_CLOSED || state == TCP_STATE_LISTEN )
+		return;
+	if ( transmit_scheduled && timer_armed )
+		return;
+	transmit_scheduled = true;
+	SetTimer();
+
+}
+
+void TCPSocket::SetDeadline() // tcp_lock locked
+{
+	if ( 0 <= deadline.tv_sec )
+		return;
+	if ( state == TCP_STATE_TIME_WAIT ||
+	     (state == TCP_STATE_FIN_WAIT_2 && !is_referenced) )
+	{
+		struct timespec now = Time::Get(CLOCK_MONOTONIC);
+		struct timespec msl2 = timespec_make(60, 0); // Documented in tcp(4).
+		deadline = timespec_add(now, msl2);
+	}
+	else if ( mod32_le(send_una, send_pos) )
+	{
+		// Back off exponentially per RFC 6298 5.5.
+		uint32_t timeout = rto;
+		for ( unsigned int i = 0; i < retransmissions && timeout < RTO_MAX; i++ )
+			timeout *= 2;
+		if ( RTO_MAX < timeout )
+			timeout = RTO_MAX;
+		struct timespec now = Time::Get(CLOCK_MONOTONIC);
+		struct timespec delay = timespec_make(timeout / 1000000,
+		                                      timeout % 1000000 * 1000);
+		deadline = timespec_add(now, delay);
+	}
+}
+
+tcp_seq TCPSocket::FlightSize() // tcp_lock locked
+{
+	return (tcp_seq) (send_max - send_una);
+}
+
+void TCPSocket::OnRetransmitTimeout() // tcp_lock locked
+{
+	retransmissions++;
+	// Go back and retransmit everything unacknowledged, one segment at first,
+	// as the network was apparently congested (RFC 5681 3.1).
+	send_pos = send_una;
+	if ( retransmissions == 1 )
+	{
+		tcp_seq half = FlightSize() / 2;
+		ssthresh = half < 2 * send_mss ? 2 * send_mss : half;
+	}
+	cwnd = send_mss;
+	dupacks = 0;
+	fast_recovery = false;
+	fast_retransmits = 0;
+	recover = send_max;
+	rtt_timing = false;
+	// The remote socket may discard data it selectively acknowledged.
+	scoreboard_count = 0;
+}
+
+void TCPSocket::MeasureRoundTrip() // tcp_lock locked
+{
+	if ( !rtt_timing || mod32_lt(send_una, rtt_seq) )
+		return;
+	rtt_timing = false;
+	struct timespec now = Time::Get(CLOCK_MONOTONIC);
+	struct timespec duration = timespec_sub(now, rtt_sent);
+	uint32_t sample = RTO_MAX;
+	if ( duration.tv_sec < RTO_MAX / 1000000 )
+		sample = duration.tv_sec * 1000000 + duration.tv_nsec / 1000;
+	// RFC 6298 2.2 and 2.3.
+	if ( !srtt )
+	{
+		srtt = sample ? sample : 1;
+		rttvar = sample / 2;
+	}
+	else
+	{
+		uint32_t delta = srtt < sample ? sample - srtt : srtt - sample;
+		rttvar = rttvar - rttvar / 4 + delta / 4;
+		srtt = srtt - srtt / 8 + sample / 8;
+		if ( !srtt )
+			srtt = 1;
+	}
+	// The clock granularity is negligible compared to the minimum timeout.
+	rto = srtt + 4 * rttvar;
+	if ( rto < RTO_MIN )
+		rto = RTO_MIN;
+	if ( RTO_MAX < rto )
+		rto = RTO_MAX;
+}
+
+void TCPSocket::InitializeWindow() // tcp_lock locked
+{
+	// Start measuring how much is received per round trip.
+	autotune_seq = recv_nxt;
+	autotune_time = Time::Get(CLOCK_MONOTONIC);
+	// RFC 5681 3.1, and only one segment if the handshake was retransmitted.
+	if ( retransmissions )
+		cwnd = send_mss;
+	else if ( 2190 < send_mss )
+		cwnd = 2 * send_mss;
+	else if ( 1095 < send_mss )
+		cwnd = 3 * send_mss;
+	else
+		cwnd = 4 * send_mss;
+}
+
+void TCPSocket::OnNewAck(tcp_seq acked) // tcp_lock locked
+{
+	dupacks = 0;
+	if ( fast_recovery )
+	{
+		// Leave fast recovery once everything transmitted before the loss was
+		// detected has been acknowledged (RFC 6582 3.2 step 3).
+		if ( mod32_le(recover, send_una) )
+		{
+			tcp_seq flight = FlightSize();
+			if ( flight < send_mss )
+				flight = send_mss;
+			cwnd = flight + send_mss < ssthresh ? flight + send_mss : ssthresh;
+			fast_recovery = false;
+			return;
+		}
+		// Retransmit the next lost segment on a partial acknowledgement and
+		// deflate the congestion window by the data acknowledged (RFC 6582 3.2
+		// step 4).
+		fast_retransmits++;
+		cwnd = acked < cwnd ? cwnd - acked : 0;
+		if ( send_mss <= acked )
+			cwnd += send_mss;
+		if ( cwnd < send_mss )
+			cwnd = send_mss;
+		return;
+	}
+	// Slow start until the threshold, then congestion avoidance (RFC 5681 3.1).
+	if ( cwnd < ssthresh )
+		cwnd += acked < send_mss ? acked : send_mss;
+	else
+	{
+		tcp_seq increase = send_mss * send_mss / cwnd;
+		cwnd += increase ? increase : 1;
+	}
+	if ( CWND_MAX < cwnd )
+		cwnd = CWND_MAX;
+}
+
+void TCPSocket::OnDuplicateAck() // tcp_lock locked
+{
+	dupacks++;
+	if ( fast_recovery )
+	{
+		// Each duplicate acknowledgement means a segment left the network, so
+		// retransmit another segment that was selectively acknowledged to be
+		// lost (RFC 6675), or otherwise inflate the window to transmit another
+		// (RFC 5681 3.2 step 4).
+		tcp_seq start, end;
+		if ( NextHole(retransmit_high, &start, &end) )
+			fast_retransmits++;
+		else if ( cwnd < CWND_MAX )
+			cwnd += send_mss;
+		return;
+	}
+	if ( dupacks != DUPACK_THRESHOLD )
+		return;
+	// Only a loss of data transmitted after the previous recovery began is
+	// a new congestion event (RFC 6582 3.2 step 2).
+	if ( !mod32_lt(recover, send_una) )
+		return;
+	// Fast retransmit and enter fast recovery (RFC 5681 3.2 steps 2 and 3).
+	tcp_seq half = FlightSize() / 2;
+	ssthresh = half < 2 * send_mss ? 2 * send_mss : half;
+	cwnd = ssthresh + DUPACK_THRESHOLD * send_mss;
+	recover = send_max;
+	fast_recovery = true;
+	retransmit_high = send_una;
+	fast_retransmits = 1;
+	rtt_timing = false;
+}
+
+void TCPSocket::UpdateScoreboard(const struct tcp_options* options)
+{
+	// Ignore blocks that aren't about data in flight, such as reports of
+	// duplicate segments (RFC 2883).
+	for ( size_t i = 0; i < options->sack_count; i++ )
+	{
+		tcp_seq start = options->sack[i].start;
+		tcp_seq end = options->sack[i].end;
+		if ( !mod32_lt(start, end) || !mod32_lt(send_una, end) ||
+		     mod32_lt(send_max, end) )
+			continue;
+		if ( mod32_lt(start, send_una) )
+			start = send_una;
+		InsertRange(scoreboard, &scoreboard_count, SCOREBOARD_MAX, start, end);
+	}
+	RemoveRangesBefore(scoreboard, &scoreboard_count, send_una);
+}
+
+// Finds the first range at or after from that hasn't been selectively
+// acknowledged, but data after it has, so it's presumably lost.
+bool TCPSocket::NextHole(tcp_seq from, tcp_seq* start, tcp_seq* end)
+{
+	if ( mod32_lt(from, send_una) )
+		from = send_una;
+	for ( size_t i = 0; i < scoreboard_count; i++ )
+	{
+		if ( mod32_le(scoreboard[i].end, from) )
+			continue;
+		if ( mod32_le(scoreboard[i].start, from) )
+		{
+			from = scoreboard[i].end;
+			continue;
+		}
+		*start = from;
+		*end = scoreboard[i].start;
+		return true;
+	}
+	return false;
+}
+
+bool TCPSocket::NextRetransmission(tcp_seq* start, tcp_seq* end)
+{
+	tcp_seq from = mod32_lt(retransmit_high, send_una) ? send_una
+	                                                    : retransmit_high;
+	if ( NextHole(from, start, end) )
+		return true;
+	// Otherwise the oldest unacknowledged segment is presumed lost, unless it
+	// has already been retransmitted.
+	if ( from != send_una || !mod32_lt(send_una, send_pos) )
+		return false;
+	*start = send_una;
+	*end = send_pos;
+	return true;
+}
+
+// Keeps the empty buffers for a while, rather than reallocating and growing
+// them again each time more data arrives, and releases them once the
+// connection has been idle.
+void TCPSocket::OnBufferDrained() // tcp_lock locked
 {
-	if ( state == TCP_STATE_CLOSED || state == TCP_STATE_LISTEN )
-		return;
-	if ( transmit_scheduled && timer_armed )
+	buffer_drained = Time::Get(CLOCK_MONOTONIC);
+	if ( 0 <= release_deadline.tv_sec )
 		return;
-	transmit_scheduled = true;
+	struct timespec delay = timespec_make(BUFFER_IDLE_DELAY / 1000000,
+	                                      BUFFER_IDLE_DELAY % 1000000 * 1000);
+	release_deadline = timespec_add(buffer_drained, delay);
 	SetTimer();
-
 }
 
-void TCPSocket::SetDeadline() // tcp_lock locked
+void TCPSocket::ReleaseBuffers() // tcp_lock locked
 {
-	if ( 0 <= deadline.tv_sec )
-		return;
-	if ( state == TCP_STATE_TIME_WAIT ||
-	     (state == TCP_STATE_FIN_WAIT_2 && !is_referenced) )
-	{
-		struct timespec now = Time::Get(CLOCK_MONOTONIC);
-		struct timespec msl2 = timespec_make(60, 0); // Documented in tcp(4).
-		deadline = timespec_add(now, msl2);
-	}
-	else if ( mod32_le(send_una, send_pos) )
+	// Wait longer if a buffer was emptied since the deadline was set.
+	struct timespec delay = timespec_make(BUFFER_IDLE_DELAY / 1000000,
+	                                      BUFFER_IDLE_DELAY % 1000000 * 1000);
+	struct timespec idle = timespec_add(buffer_drained, delay);
+	if ( timespec_lt(Time::Get(CLOCK_MONOTONIC), idle) )
 	{
-		struct timespec now = Time::Get(CLOCK_MONOTONIC);
-		struct timespec delay = timespec_make(1 + 1 * retransmissions, 0);
-		deadline = timespec_add(now, delay);
+		release_deadline = idle;
+		return;
 	}
+	if ( outgoing && !outgoing_used )
+		ResizeRing(&outgoing, &outgoing_size, &outgoing_offset, 0, 0);
+	if ( incoming && !incoming_used && !reassembly_count )
+		ResizeRing(&incoming, &incoming_size, &incoming_offset, 0, 0);
+}
+
+// Returns the earliest of two deadlines, where a negative deadline is unset.
+static struct timespec EarliestDeadline(struct timespec a, struct timespec b)
+{
+	if ( a.tv_sec < 0 )
+		return b;
+	if ( b.tv_sec < 0 )
+		return a;
+	return timespec_lt(a, b) ? a : b;
 }
 
 void TCPSocket::SetTimer() // tcp_lock locked
@@ -1202,7 +2377,16 @@ void TCPSocket::SetTimer() // tcp_lock locked
 	if ( state == TCP_STATE_CLOSED )
 		return;
 	bool destruction_is_wanted = want_destruction();
-	if ( transmit_scheduled || destruction_is_wanted || 0 <= deadline.tv_sec )
+	// The held back data is already allowed to be sent once the cork deadline
+	// has passed, and only waits for the window to open, which the timer can't
+	// help with.
+	struct timespec cork_timeout = cork_deadline;
+	if ( 0 <= cork_timeout.tv_sec &&
+	     timespec_le(cork_timeout, Time::Get(CLOCK_MONOTONIC)) )
+		cork_timeout = timespec_make(-1, 0);
+	struct timespec when = EarliestDeadline(deadline, cork_timeout);
+	when = EarliestDeadline(when, release_deadline);
+	if ( transmit_scheduled || destruction_is_wanted || 0 <= when.tv_sec )
 	{
 		int flags = TIMER_FUNC_MAY_DEALLOCATE_TIMER;
 		struct itimerspec timeout;
@@ -1210,9 +2394,9 @@ void TCPSocket::SetTimer() // tcp_lock locked
 		// Slightly delay transmission to batch together a better reply.
 		if ( transmit_scheduled )
 			timeout.it_value = timespec_make(0, 1);
-		else if ( 0 <= deadline.tv_sec )
+		else if ( 0 <= when.tv_sec )
 		{
-			timeout.it_value = deadline;
+			timeout.it_value = when;
 			flags |= TIMER_ABSOLUTE;
 		}
 		timer.Set(&timeout, NULL, flags, TCPSocket__OnTimer, this);
@@ -1220,12 +2404,193 @@ void TCPSocket::SetTimer() // tcp_lock locked
 	}
 }
 
+// Creates a socket for a new connection to the listening socket.
+TCPSocket* TCPSocket::NewConnection(const union tcp_sockaddr* pkt_src,
+                                    const union tcp_sockaddr* pkt_dst)
+{
+	TCPSocket* socket = new TCPSocket(af);
+	if ( !socket )
+		return NULL;
+	socket->remote = *pkt_src;
+	socket->local = *pkt_dst;
+	socket->remoted = true;
+	socket->bound = true;
+	socket->reuseaddr = reuseaddr;
+	if ( af == AF_INET )
+	{
+		uint16_t port = be16toh(socket->local.in.sin_port);
+		socket->prev_socket = NULL;
+		socket->next_socket = bindings_v4[port];
+		if ( socket->next_socket )
+			socket->next_socket->prev_socket = socket;
+		bindings_v4[port] = socket;
+	}
+	else if ( af == AF_INET6 )
+	{
+		uint16_t port = be16toh(socket->local.in6.sin6_port);
+		socket->prev_socket = NULL;
+		socket->next_socket = bindings_v6[port];
+		if ( socket->next_socket )
+			socket->next_socket->prev_socket = socket;
+		bindings_v6[port] = socket;
+	}
+	socket->LinkConnection();
+	socket->incoming_limit = incoming_limit;
+	socket->outgoing_limit = outgoing_limit;
+	socket->autotune_receive = autotune_receive;
+	socket->autotune_send = autotune_send;
+	socket->mss_limit = mss_limit;
+	socket->nodelay = nodelay;
+	socket->cork = cork;
+	return socket;
+}
+
+// Answers a SYN with a SYN cookie as the initial sequence number, offering
+// only the Maximum Segment Size option, as the cookie can't remember more.
+void TCPSocket::TransmitCookie(const union tcp_sockaddr* pkt_src,
+                               const union tcp_sockaddr* pkt_dst,
+                               tcp_seq irs,
+                               const struct tcp_options* options)
+{
+	size_t mtu;
+	union tcp_sockaddr sendfrom;
+	if ( af == AF_INET )
+	{
+		if ( !IP::GetSourceIP(&pkt_dst->in.sin_addr, &pkt_src->in.sin_addr,
+		                      &sendfrom.in.sin_addr, ifindex, &mtu) )
+			return;
+	}
+	// TODO: IPv6 support.
+	else
+		return;
+	if ( mtu < sizeof(struct tcphdr) + TCP_MAXOLEN )
+		return;
+	mtu -= sizeof(struct tcphdr);
+	size_t recv_mss = mtu;
+	if ( mss_limit && mss_limit < recv_mss )
+		recv_mss = mss_limit;
+	if ( UINT16_MAX < recv_mss )
+		recv_mss = UINT16_MAX;
+	uint16_t peer_mss = options->has_mss ? options->mss : TCP_MSS;
+	tcp_seq mss_index = 0;
+	while ( mss_index + 1 < 8 && cookie_mss[mss_index + 1] <= peer_mss )
+		mss_index++;
+	uint32_t period = CookiePeriod();
+	tcp_seq cookie = SynCookie(pkt_dst, pkt_src, irs, period, mss_index);
+	cookie_period = period;
+	cookies_sent = true;
+	Ref<Packet> pkt = GetPacket();
+	if ( !pkt )
+		return;
+	unsigned char* out = pkt->from;
+	unsigned char opts[4];
+	opts[0] = TCPOPT_MAXSEG;
+	opts[1] = TCPOLEN_MAXSEG;
+	opts[2] = recv_mss >> 8 & 0xFF;
+	opts[3] = recv_mss >> 0 & 0xFF;
+	struct tcphdr hdr;
+	hdr.th_sport = pkt_dst->in.sin_port;
+	hdr.th_dport = pkt_src->in.sin_port;
+	hdr.th_seq = htobe32(cookie);
+	hdr.th_ack = htobe32(irs + 1);
+	hdr.th_offset = TCP_OFFSET_ENCODE((sizeof(hdr) + sizeof(opts)) / 4);
+	hdr.th_flags = TH_SYN | TH_ACK;
+	size_t window = incoming_limit < TCP_MAXWIN ? incoming_limit : TCP_MAXWIN;
+	hdr.th_win = htobe16(window);
+	hdr.th_urp = htobe16(0);
+	hdr.th_sum = htobe16(0);
+	pkt->length = sizeof(hdr) + sizeof(opts);
+	memcpy(out, &hdr, sizeof(hdr));
+	memcpy(out + sizeof(hdr), opts, sizeof(opts));
+	uint16_t checksum = 0;
+	checksum = IP::ipsum_buf(checksum, &sendfrom.in.sin_addr,
+	                         sizeof(struct in_addr));
+	checksum = IP::ipsum_buf(checksum, &pkt_src->in.sin_addr,
+	                         sizeof(struct in_addr));
+	checksum = IP::ipsum_word(checksum, IPPROTO_TCP);
+	checksum = IP::ipsum_word(checksum, pkt->length);
+	checksum = IP::ipsum_buf(checksum, out, pkt->length);
+	hdr.th_sum = htobe16(IP::ipsum_finish(checksum));
+	memcpy(out, &hdr, sizeof(hdr));
+	IP::Send(pkt, &sendfrom.in.sin_addr, &pkt_src->in.sin_addr, IPPROTO_TCP,
+	         ifindex, false);
+}
+
+// Establishes the connection if the ACK acknowledges a valid SYN cookie.
+bool TCPSocket::AcceptCookie(Ref<Packet> pkt,
+                             const struct tcphdr* hdr,
+                             union tcp_sockaddr* pkt_src,
+                             union tcp_sockaddr* pkt_dst)
+{
+	if ( !cookies_sent || (hdr->th_flags & TH_RST) )
+		return false;
+	uint32_t period = CookiePeriod();
+	if ( 1 < period - cookie_period )
+		return false;
+	assert(pkt_src);
+	assert(pkt_dst);
+	tcp_seq cookie = hdr->th_ack - 1;
+	tcp_seq irs = hdr->th_seq - 1;
+	tcp_seq mss_index = cookie & 7;
+	if ( cookie != SynCookie(pkt_dst, pkt_src, irs, period, mss_index) &&
+	     cookie != SynCookie(pkt_dst, pkt_src, irs, period - 1, mss_index) )
+		return false;
+	// The connection is genuine, so make room for it in the listening queue by
+	// dropping the oldest half-open connection, which is likely bogus.
+	if ( backlog_max <= backlog_used )
+	{
+		TCPSocket* oldest = connecting_half;
+		while ( oldest && oldest->connecting_next )
+			oldest = oldest->connecting_next;
+		if ( !oldest )
+			return false;
+		oldest->Fail(ECONNRESET);
+		if ( oldest->can_destroy() )
+			delete oldest;
+	}
+	TCPSocket* socket = NewConnection(pkt_src, pkt_dst);
+	if ( !socket )
+		return false;
+	socket->iss = cookie;
+	socket->send_una = hdr->th_ack;
+	socket->send_nxt = hdr->th_ack;
+	socket->send_pos = hdr->th_ack;
+	socket->send_max = hdr->th_ack;
+	socket->recover = hdr->th_ack;
+	socket->outgoing_syn = TCP_SPECIAL_ACKED;
+	socket->peer_mss = cookie_mss[mss_index];
+	socket->send_mss = socket->peer_mss;
+	socket->irs = irs;
+	socket->recv_nxt = hdr->th_seq;
+	socket->recv_acked = hdr->th_seq;
+	socket->has_syn = true;
+	socket->state = TCP_STATE_ESTAB;
+	socket->UpdateReceiveWindow();
+	socket->UpdateWindow(hdr->th_win);
+	socket->send_wl1 = hdr->th_seq;
+	socket->send_wl2 = hdr->th_ack;
+	socket->InitializeWindow();
+	socket->connecting_parent = this;
+	socket->connecting_prev = NULL;
+	socket->connecting_next = connecting_ready;
+	if ( socket->connecting_next )
+		socket->connecting_next->connecting_prev = socket;
+	connecting_ready = socket;
+	backlog_used++;
+	kthread_cond_broadcast(&receive_cond);
+	poll_channel.Signal(PollEventStatus());
+	// Receive any data that came along with the acknowledgement.
+	socket->ReceivePacket(pkt, pkt_src, pkt_dst);
+	return true;
+}
+
 void TCPSocket::ProcessPacket(Ref<Packet> pkt,
                               union tcp_sockaddr* pkt_src,
                               union tcp_sockaddr* pkt_dst) // tcp_lock locked
 {
+	// The data may continue in fragments if segments were merged on receipt.
 	const unsigned char* in = pkt->from + pkt->offset;
-	size_t inlen = pkt->length - pkt->offset;
+	size_t inlen = GetPacketLength(pkt.Get());
 	struct tcphdr hdr;
 	memcpy(&hdr, in, sizeof(hdr));
 	hdr.th_sport = be16toh(hdr.th_sport);
@@ -1235,8 +2600,12 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	hdr.th_win = be16toh(hdr.th_win);
 	hdr.th_urp = be16toh(hdr.th_urp);
 	size_t offset = TCP_OFFSET_DECODE(hdr.th_offset) * 4;
-	in += offset;
+	struct tcp_options options;
+	ParseOptions(in + sizeof(hdr), offset - sizeof(hdr), &options);
+	size_t position = offset;
 	inlen -= offset;
+	// The amount of data in the segment before it is trimmed to the window.
+	size_t segment_length = inlen;
 	if ( state == TCP_STATE_CLOSED ) // STD 7, RFC 793, page 65.
 	{
 		if ( hdr.th_flags & TH_RST )
@@ -1250,6 +2619,9 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 			return;
 		if ( hdr.th_flags & TH_ACK )
 		{
+			if ( !(hdr.th_flags & TH_SYN) &&
+			     AcceptCookie(pkt, &hdr, pkt_src, pkt_dst) )
+				return;
 			// TODO: Send <SEQ=SEG.ACK><CTL=RST>.
 			return;
 		}
@@ -1257,44 +2629,37 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 			return;
 		if ( !hdr.th_win )
 			return;
-		if ( backlog_max <= backlog_used )
-			return;
-		// TODO: Use SYN cache to mitigate SYN flood attack.
-		TCPSocket* socket = new TCPSocket(af);
-		if ( !socket )
-			return;
 		assert(pkt_src);
 		assert(pkt_dst);
-		socket->remote = *pkt_src;
-		socket->local = *pkt_dst;
-		socket->remoted = true;
-		socket->bound = true;
-		socket->reuseaddr = reuseaddr;
-		if ( af == AF_INET )
-		{
-			uint16_t port = be16toh(socket->local.in.sin_port);
-			socket->prev_socket = NULL;
-			socket->next_socket = bindings_v4[port];
-			if ( socket->next_socket )
-				socket->next_socket->prev_socket = socket;
-			bindings_v4[port] = socket;
-		}
-		else if ( af == AF_INET6 )
+		// Answer with a SYN cookie instead of remembering another half-open
+		// connection if the listening queue is full, so a SYN flood can't
+		// keep genuine connections from being established.
+		if ( backlog_max <= backlog_used )
 		{
-			uint16_t port = be16toh(socket->local.in6.sin6_port);
-			socket->prev_socket = NULL;
-			socket->next_socket = bindings_v6[port];
-			if ( socket->next_socket )
-				socket->next_socket->prev_socket = socket;
-			bindings_v6[port] = socket;
+			TransmitCookie(pkt_src, pkt_dst, hdr.th_seq, &options);
+			return;
 		}
+		TCPSocket* socket = NewConnection(pkt_src, pkt_dst);
+		if ( !socket )
+			return;
 		socket->iss = arc4random();
 		socket->send_una = socket->iss;
 		socket->send_nxt = socket->iss;
 		socket->send_wnd = 1;
 		socket->send_pos = socket->iss;
+		socket->send_max = socket->iss;
+		socket->recover = socket->iss;
 		socket->outgoing_syn = TCP_SPECIAL_PENDING;
-		socket->recv_wnd = TCP_MAXWIN;
+		if ( options.has_mss )
+			socket->peer_mss = options.mss;
+		socket->sack_permitted = options.has_sack_permitted;
+		if ( options.has_wscale )
+		{
+			socket->window_scaling = true;
+			socket->send_wscale = options.wscale;
+			socket->recv_wscale = WINDOW_SHIFT;
+		}
+		socket->UpdateReceiveWindow();
 		socket->recv_acked = hdr.th_seq;
 		socket->recv_nxt = hdr.th_seq + 1;
 		socket->irs = hdr.th_seq;
@@ -1337,6 +2702,16 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		recv_nxt = hdr.th_seq + 1;
 		irs = hdr.th_seq;
 		has_syn = true;
+		if ( options.has_mss )
+			peer_mss = options.mss;
+		if ( window_scaling && options.has_wscale )
+		{
+			send_wscale = options.wscale;
+			recv_wscale = WINDOW_SHIFT;
+		}
+		else
+			window_scaling = false;
+		sack_permitted = sack_permitted && options.has_sack_permitted;
 		// RFC 1122 4.2.2.20 (c), page 94.
 		UpdateWindow(hdr.th_win);
 		send_wl1 = hdr.th_seq;
@@ -1345,6 +2720,8 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		if ( hdr.th_flags & TH_ACK )
 		{
 			send_una = hdr.th_ack;
+			MeasureRoundTrip();
+			InitializeWindow();
 			retransmissions = 0;
 			deadline = timespec_make(-1, 0);
 			SetDeadline();
@@ -1353,6 +2730,7 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 			{
 				outgoing_syn = TCP_SPECIAL_ACKED;
 				state = TCP_STATE_ESTAB;
+				UpdateReceiveWindow();
 				kthread_cond_broadcast(&receive_cond); // Wake up connect.
 				poll_channel.Signal(PollEventStatus());
 				return;
@@ -1393,7 +2771,6 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	}
 	// STD 7, RFC 793, page 70. Process segments in the right order and trim the
 	// segment to the receive window.
-	uint16_t real_seq = hdr.th_seq;
 	if ( mod32_lt(hdr.th_seq, recv_nxt) && (hdr.th_flags & TH_SYN) )
 	{
 		hdr.th_flags &= ~TH_SYN;
@@ -1405,7 +2782,7 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		if ( inlen < skip )
 			skip = inlen;
 		hdr.th_seq += skip;
-		in += skip;
+		position += skip;
 		inlen -= skip;
 	}
 	if ( mod32_lt(hdr.th_seq, recv_nxt) && (hdr.th_flags & TH_FIN) )
@@ -1417,35 +2794,13 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		return;
 	if ( mod32_gt(hdr.th_seq, recv_nxt) ) // Can't process yet.
 	{
-		// Insert the segment in the receive queue.
-		Ref<Packet> prev;
-		Ref<Packet> iter = receive_queue;
-		// TODO: For n packets in the worst order, this scales O(n^2).
-		// TODO: This wastes a packet per byte in the worst case.
-		while ( iter )
-		{
-			const unsigned char* iter_in = iter->from + iter->offset;
-			const unsigned char* iter_in_seq =
-				iter_in + offsetof(struct tcphdr, th_seq);
-			tcp_seq iter_seq;
-			memcpy(&iter_seq, iter_in_seq, sizeof(iter_seq));
-			iter_seq = be32toh(iter_seq);
-			if ( mod32_le(real_seq, iter_seq) )
-				break;
-			// TODO: Handle duplicate and overlapping segments.
-			prev = iter;
-			iter = iter->next;
-		}
-		if ( prev )
-		{
-			pkt->next = prev->next;
-			prev->next = pkt;
-		}
-		else
-		{
-			pkt->next = receive_queue;
-			receive_queue = pkt;
-		}
+		// Send a duplicate acknowledgement right away so the remote can
+		// retransmit the missing segment quickly (RFC 5681 4.2).
+		recv_acked = recv_nxt - 1;
+		// Keep the data until the missing data before it is received.
+		if ( !(hdr.th_flags & (TH_RST | TH_SYN)) )
+			ReceiveOutOfOrder(hdr.th_seq, pkt.Get(), position, inlen,
+			                  hdr.th_flags & TH_FIN);
 		return;
 	}
 	if ( recv_wnd < inlen )
@@ -1475,12 +2830,14 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	if ( state == TCP_STATE_SYN_RECV )
 	{
 		// RFC 1122 4.2.2.20 (f), page 94.
-		UpdateWindow(hdr.th_win);
+		UpdateWindow((tcp_seq) hdr.th_win << send_wscale);
 		send_wl1 = hdr.th_seq;
 		send_wl2 = hdr.th_ack;
 		if ( mod32_le(send_una, hdr.th_ack) && mod32_le(hdr.th_ack, send_nxt) )
 		{
 			state = TCP_STATE_ESTAB;
+			InitializeWindow();
+			UpdateReceiveWindow();
 			kthread_cond_broadcast(&receive_cond); // Wake up connect.
 			if ( connecting_parent )
 			{
@@ -1535,13 +2892,15 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	if ( window_data && acked )
 	{
 		size_t amount = window_data < acked ? window_data : acked;
-		assert(outgoing_offset < sizeof(outgoing));
+		assert(outgoing_offset < outgoing_size);
 		outgoing_offset += amount;
-		if ( sizeof(outgoing) <= outgoing_offset )
-			outgoing_offset -= sizeof(outgoing);
-		assert(outgoing_offset < sizeof(outgoing));
+		if ( outgoing_size <= outgoing_offset )
+			outgoing_offset -= outgoing_size;
+		assert(outgoing_offset < outgoing_size);
 		assert(amount <= outgoing_used);
 		outgoing_used -= amount;
+		if ( !outgoing_used )
+			OnBufferDrained();
 		kthread_cond_broadcast(&transmit_cond);
 		poll_channel.Signal(PollEventStatus());
 		acked -= amount;
@@ -1555,17 +2914,34 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		send_una++;
 		fin_was_acked = true;
 	}
+	if ( sack_permitted )
+		UpdateScoreboard(&options);
 	if ( send_una != old_send_una )
 	{
-		// TODO: Possibly recalculate the average time to contact remote.
 		retransmissions = 0;
+		if ( mod32_lt(send_pos, send_una) )
+			send_pos = send_una;
+		if ( mod32_lt(send_max, send_una) )
+			send_max = send_una;
+		MeasureRoundTrip();
+		OnNewAck((tcp_seq) (send_una - old_send_una));
+		// Restart the retransmission timer (RFC 6298 5.3).
+		deadline = timespec_make(-1, 0);
+		if ( mod32_lt(send_una, send_pos) )
+			SetDeadline();
 		SetTimer();
 	}
+	// RFC 5681 2, a duplicate acknowledgement.
+	if ( send_una == old_send_una && hdr.th_ack == send_una &&
+	     mod32_lt(send_una, send_max) && !segment_length &&
+	     !(hdr.th_flags & (TH_SYN | TH_FIN)) &&
+	     (tcp_seq) hdr.th_win << send_wscale == send_wnd )
+		OnDuplicateAck();
 	// STD 7, RFC 793, page 72.
 	if ( mod32_lt(send_wl1, hdr.th_seq) ||
 	     (send_wl1 == hdr.th_seq && mod32_le(send_wl2, hdr.th_ack)) )
 	{
-		UpdateWindow(hdr.th_win);
+		UpdateWindow((tcp_seq) hdr.th_win << send_wscale);
 		send_wl1 = hdr.th_seq;
 		send_wl2 = hdr.th_ack;
 	}
@@ -1609,43 +2985,48 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	     state == TCP_STATE_FIN_WAIT_1 ||
 	     state == TCP_STATE_FIN_WAIT_2 )
 	{
-		assert(incoming_offset < sizeof(incoming));
-		assert(incoming_used <= sizeof(incoming));
-		size_t available = sizeof(incoming) - incoming_used;
+		size_t available = incoming_used < incoming_limit ?
+		                   incoming_limit - incoming_used : 0;
 		size_t amount = available < inlen ? available : inlen;
-		assert(amount <= sizeof(incoming));
-		assert(amount <= available);
-		size_t newat = incoming_offset + incoming_used;
-		if ( sizeof(incoming) <= newat )
-			newat -= sizeof(incoming);
-		assert(newat < sizeof(incoming));
-		size_t until_end = sizeof(incoming) - newat;
-		assert(until_end <= sizeof(incoming));
-		size_t first = until_end < amount ? until_end : amount;
-		assert(first <= amount);
-		assert(first <= sizeof(incoming));
-		size_t second = amount - first;
-		assert(second <= amount);
-		assert(second <= sizeof(incoming));
-		assert(first + second == amount);
-		assert(first + second <= sizeof(incoming));
-		assert(first + second <= available);
-		if ( !shutdown_receive )
-		{
-			memcpy(incoming + newat, in, first);
+		// Grow the buffer as needed, or only take what fits if memory is low,
+		// and the remote will retransmit the rest.
+		size_t keep = incoming_used + ReassemblyLength();
+		size_t wanted = incoming_used + amount;
+		if ( amount && !shutdown_receive &&
+		     !GrowRing(&incoming, &incoming_size, &incoming_offset, keep,
+		               keep < wanted ? wanted : keep, incoming_limit) )
+			amount = incoming_size - incoming_used;
+		if ( !shutdown_receive && amount )
+		{
+			assert(incoming_offset < incoming_size);
+			assert(incoming_used + amount <= incoming_size);
+			size_t newat = incoming_offset + incoming_used;
+			if ( incoming_size <= newat )
+				newat -= incoming_size;
+			assert(newat < incoming_size);
+			size_t until_end = incoming_size - newat;
+			size_t first = until_end < amount ? until_end : amount;
+			size_t second = amount - first;
+			assert(first + second == amount);
+			CopyPacketData(incoming + newat, pkt.Get(), position, first);
 			if ( second )
-				memcpy(incoming, in + first, second);
+				CopyPacketData(incoming, pkt.Get(), position + first, second);
 			incoming_used += amount;
 		}
-		available = sizeof(incoming) - incoming_used;
+		recv_nxt = hdr.th_seq + amount;
+		// Continue with the data received out of order that is now in order.
+		if ( amount == inlen && !(hdr.th_flags & TH_FIN) && Reassemble() )
+			hdr.th_flags |= TH_FIN;
+		available = incoming_used < incoming_limit ?
+		            incoming_limit - incoming_used : 0;
 		if ( available < recv_wnd )
 			recv_wnd = available;
-		recv_nxt = hdr.th_seq + amount;
 		if ( amount == inlen && (hdr.th_flags & TH_FIN) )
 		{
 			recv_nxt++;
 			has_fin = true;
 		}
+		AutotuneReceive();
 		if ( incoming_used || has_fin )
 		{
 			kthread_cond_broadcast(&receive_cond);
@@ -1689,26 +3070,91 @@ void TCPSocket::ReceivePacket(Ref<Packet> pktnew,
 {
 	if ( pktnew )
 		ProcessPacket(pktnew, pkt_src, pkt_dst);
-	while ( receive_queue )
-	{
-		Ref<Packet> pkt = receive_queue;
-		const unsigned char* in = pkt->from + pkt->offset;
-		const unsigned char* in_seq = in + offsetof(struct tcphdr, th_seq);
-		tcp_seq seq;
-		memcpy(&seq, in_seq, sizeof(seq));
-		seq = be32toh(seq);
-		if ( mod32_gt(seq, recv_nxt) )
-			break;
-		receive_queue = pkt->next;
-		pkt->next.Reset();
-		if ( seq == recv_nxt )
-			ProcessPacket(pkt, pkt_src, pkt_dst);
-	}
 	// Delay transmit to answer more efficiently based on upcoming packets.
 	ScheduleTransmit();
 }
 
-void TCPSocket::UpdateWindow(uint16_t new_window)
+size_t TCPSocket::ReassemblyLength()
+{
+	// The data received out of order is stored in the incoming ring buffer
+	// after the data received in order, at its offset from recv_nxt.
+	if ( !reassembly_count )
+		return 0;
+	return (tcp_seq) (reassembly[reassembly_count - 1].end - recv_nxt);
+}
+
+void TCPSocket::ReceiveOutOfOrder(tcp_seq seq,
+                                  const Packet* pkt,
+                                  size_t position,
+                                  size_t length,
+                                  bool fin)
+{
+	if ( !(state == TCP_STATE_ESTAB ||
+	       state == TCP_STATE_FIN_WAIT_1 ||
+	       state == TCP_STATE_FIN_WAIT_2 ||
+	       state == TCP_STATE_SYN_RECV) || shutdown_receive )
+		return;
+	tcp_seq offset = seq - recv_nxt;
+	if ( recv_wnd <= offset )
+		return;
+	if ( recv_wnd - offset < length )
+	{
+		length = recv_wnd - offset;
+		fin = false;
+	}
+	if ( !length && !fin )
+		return;
+	size_t keep = incoming_used + ReassemblyLength();
+	size_t wanted = incoming_used + offset + length;
+	if ( !GrowRing(&incoming, &incoming_size, &incoming_offset, keep,
+	               keep < wanted ? wanted : keep, incoming_limit) )
+		return;
+	// Drop the data if the scoreboard is full, and the remote will retransmit.
+	if ( !InsertRange(reassembly, &reassembly_count, REASSEMBLY_MAX,
+	                  seq, seq + length) )
+		return;
+	if ( length )
+	{
+		size_t at = incoming_offset + incoming_used + offset;
+		while ( incoming_size <= at )
+			at -= incoming_size;
+		size_t until_end = incoming_size - at;
+		size_t first = until_end < length ? until_end : length;
+		size_t second = length - first;
+		CopyPacketData(incoming + at, pkt, position, first);
+		if ( second )
+			CopyPacketData(incoming, pkt, position + first, second);
+		reassembly_recent = seq;
+	}
+	if ( fin )
+	{
+		has_reassembly_fin = true;
+		reassembly_fin = seq + length;
+	}
+}
+
+bool TCPSocket::Reassemble()
+{
+	while ( reassembly_count && mod32_le(reassembly[0].start, recv_nxt) )
+	{
+		if ( mod32_lt(recv_nxt, reassembly[0].end) )
+		{
+			tcp_seq amount = reassembly[0].end - recv_nxt;
+			if ( !shutdown_receive )
+				incoming_used += amount;
+			recv_nxt = reassembly[0].end;
+		}
+		RemoveRangesBefore(reassembly, &reassembly_count, recv_nxt);
+	}
+	if ( has_reassembly_fin && reassembly_fin == recv_nxt )
+	{
+		has_reassembly_fin = false;
+		return true;
+	}
+	return false;
+}
+
+void TCPSocket::UpdateWindow(tcp_seq new_window)
 {
 	tcp_seq pending = (tcp_seq) (send_nxt - send_una);
 	if ( new_window < pending )
@@ -1716,6 +3162,38 @@ void TCPSocket::UpdateWindow(uint16_t new_window)
 	send_wnd = new_window;
 }
 
+void TCPSocket::UpdateReceiveWindow()
+{
+	size_t available = incoming_used < incoming_limit ?
+	                   incoming_limit - incoming_used : 0;
+	tcp_seq max_window = (tcp_seq) TCP_MAXWIN << recv_wscale;
+	recv_wnd = available < max_window ? available : max_window;
+}
+
+void TCPSocket::AutotuneReceive()
+{
+	// Measure how much is received per round trip and double the buffer if
+	// the window was mostly used, as the window is then limiting the speed.
+	if ( !autotune_receive || !srtt || BUFFER_MAX <= incoming_limit )
+		return;
+	struct timespec now = Time::Get(CLOCK_MONOTONIC);
+	struct timespec duration = timespec_sub(now, autotune_time);
+	uint64_t elapsed = (uint64_t) duration.tv_sec * 1000000 +
+	                   duration.tv_nsec / 1000;
+	if ( elapsed < srtt )
+		return;
+	uint64_t received = (tcp_seq) (recv_nxt - autotune_seq);
+	autotune_seq = recv_nxt;
+	autotune_time = now;
+	uint64_t received_per_rtt = received * srtt / elapsed;
+	if ( received_per_rtt < incoming_limit / 4 * 3 )
+		return;
+	incoming_limit *= 2;
+	if ( BUFFER_MAX < incoming_limit )
+		incoming_limit = BUFFER_MAX;
+	UpdateReceiveWindow();
+}
+
 int TCPSocket::connect(ioctx_t* ctx, const uint8_t* addr, size_t addrsize)
 {
 	ScopedLock lock(&tcp_lock);
@@ -1770,12 +3248,17 @@ int TCPSocket::connect(ioctx_t* ctx, const uint8_t* addr, size_t addrsize)
 		return errno = EAFNOSUPPORT, -1;
 	memcpy(&remote, &new_remote, sizeof(new_remote));
 	remoted = true;
+	LinkConnection();
 	iss = arc4random();
-	recv_wnd = TCP_MAXWIN;
+	window_scaling = true;
+	sack_permitted = true;
+	UpdateReceiveWindow();
 	send_una = iss;
 	send_nxt = iss;
 	send_wnd = 1;
 	send_pos = iss;
+	send_max = iss;
+	recover = iss;
 	outgoing_syn = TCP_SPECIAL_PENDING;
 	state = TCP_STATE_SYN_SENT;
 	TransmitLoop();
@@ -1828,6 +3311,7 @@ int TCPSocket::listen(ioctx_t* /*ctx*/, int backlog)
 	else
 		return errno = EAFNOSUPPORT, -1;
 	remoted = true;
+	LinkConnection();
 	state = TCP_STATE_LISTEN;
 	return 0;
 }
@@ -1928,10 +3412,10 @@ ssize_t TCPSocket::recv_unlocked(ioctx_t* ctx,
 			return sofar;
 		uint8_t* data = buf + sofar;
 		size_t left = count - sofar;
-		assert(incoming_used <= sizeof(incoming));
+		assert(incoming_used <= incoming_size);
 		size_t amount = incoming_used < left ? incoming_used : left;
-		assert(incoming_offset < sizeof(incoming));
-		size_t until_end = sizeof(incoming) - incoming_offset;
+		assert(incoming_offset < incoming_size);
+		size_t until_end = incoming_size - incoming_offset;
 		size_t first = until_end < amount ? until_end : amount;
 		size_t second = amount - first;
 		if ( !ctx->copy_to_dest(data, incoming + incoming_offset, first) )
@@ -1942,15 +3426,13 @@ ssize_t TCPSocket::recv_unlocked(ioctx_t* ctx,
 		if ( flags & MSG_PEEK )
 			return sofar;
 		incoming_offset += amount;
-		if ( sizeof(incoming) <= incoming_offset )
-			incoming_offset -= sizeof(incoming);
-		assert(incoming_offset < sizeof(incoming));
+		if ( incoming_size <= incoming_offset )
+			incoming_offset -= incoming_size;
+		assert(incoming_offset < incoming_size);
 		incoming_used -= amount;
-		recv_wnd = sizeof(incoming) - incoming_used;
-		if ( UINT16_MAX < recv_wnd )
-			recv_wnd = UINT16_MAX;
-		if ( TCP_MAXWIN < recv_wnd )
-			recv_wnd = TCP_MAXWIN;
+		if ( !incoming_used && !reassembly_count )
+			OnBufferDrained();
+		UpdateReceiveWindow();
 	}
 	return sofar;
 }
@@ -2012,8 +3494,8 @@ ssize_t TCPSocket::send_unlocked(ioctx_t* ctx,
                                  size_t count,
                                  int flags) // tcp_lock taken
 {
-	// TODO: MSG_MORE (and implement TCP_CORK), MSG_OOB, MSG_DONTROUTE.
-	if ( flags & ~(MSG_NOSIGNAL) )
+	// TODO: MSG_OOB, MSG_DONTROUTE.
+	if ( flags & ~(MSG_NOSIGNAL | MSG_MORE) )
 		return errno = EINVAL, -1;
 	if ( sockerr )
 		return errno = sockerr, -1;
@@ -2025,7 +3507,20 @@ ssize_t TCPSocket::send_unlocked(ioctx_t* ctx,
 	size_t sofar = 0;
 	while ( sofar < count )
 	{
-		while ( outgoing_used == sizeof(outgoing) ||
+		// Grow the buffer if the connection could send more per round trip
+		// than the buffer allows, as the buffer should fit twice the window.
+		if ( outgoing_limit <= outgoing_used && autotune_send &&
+		     outgoing_limit < BUFFER_MAX )
+		{
+			tcp_seq window = cwnd < send_wnd ? cwnd : send_wnd;
+			if ( outgoing_limit / 2 <= window )
+			{
+				outgoing_limit *= 2;
+				if ( BUFFER_MAX < outgoing_limit )
+					outgoing_limit = BUFFER_MAX;
+			}
+		}
+		while ( outgoing_limit <= outgoing_used ||
 		        (state != TCP_STATE_ESTAB && state != TCP_STATE_CLOSE_WAIT) )
 		{
 			if ( sofar )
@@ -2045,15 +3540,21 @@ ssize_t TCPSocket::send_unlocked(ioctx_t* ctx,
 		}
 		const uint8_t* data = buf + sofar;
 		size_t left = count - sofar;
-		assert(outgoing_offset < sizeof(outgoing));
-		assert(outgoing_used <= sizeof(outgoing));
-		size_t available = sizeof(outgoing) - outgoing_used;
+		size_t available = outgoing_limit - outgoing_used;
 		size_t amount = available < left ? available : left;
+		if ( !GrowRing(&outgoing, &outgoing_size, &outgoing_offset,
+		               outgoing_used, outgoing_used + amount, outgoing_limit) )
+		{
+			amount = outgoing_size - outgoing_used;
+			if ( !amount )
+				return sofar ? sofar : -1;
+		}
+		assert(outgoing_offset < outgoing_size);
 		size_t newat = outgoing_offset + outgoing_used;
-		if ( sizeof(outgoing) <= newat )
-			newat -= sizeof(outgoing);
-		assert(newat < sizeof(outgoing));
-		size_t until_end = sizeof(outgoing) - newat;
+		if ( outgoing_size <= newat )
+			newat -= outgoing_size;
+		assert(newat < outgoing_size);
+		size_t until_end = outgoing_size - newat;
 		size_t first = until_end < amount ? until_end : amount;
 		size_t second = amount - first;
 		if ( !ctx->copy_from_src(outgoing + newat, data, first) )
@@ -2061,12 +3562,11 @@ ssize_t TCPSocket::send_unlocked(ioctx_t* ctx,
 		if ( second && !ctx->copy_from_src(outgoing, data + first, second) )
 			return sofar ? sofar : -1;
 		outgoing_used += amount;
-		assert(outgoing_used <= sizeof(outgoing));
+		assert(outgoing_used <= outgoing_size);
 		sofar += amount;
-		// TODO: If there's a sent packet that hasn't been acknowledged, and
-		//       there isn't a full packet yet, then just buffer and don't
-		//       transmit yet.
-		// TODO: TCP_NODELAY, TCP_NOPUSH, MSG_MORE.
+		// Hold back the data if more is coming, which is transmitted as the
+		// send returns.
+		more = flags & MSG_MORE;
 		// TODO: Set PUSH appropriately.
 	}
 	return sofar;
@@ -2092,7 +3592,7 @@ short TCPSocket::PollEventStatus()
 	if ( incoming_used || has_fin || shutdown_receive )
 		status |= POLLIN | POLLRDNORM;
 	if ( (state == TCP_STATE_ESTAB || state == TCP_STATE_CLOSE_WAIT) &&
-	     outgoing_used < sizeof(outgoing) )
+	     outgoing_used < outgoing_limit )
 		status |= POLLOUT | POLLWRNORM;
 	if ( state == TCP_STATE_CLOSE_WAIT ||
 	     state == TCP_STATE_LAST_ACK ||
@@ -2147,10 +3647,11 @@ int TCPSocket::getsockopt(ioctx_t* ctx, int level, int option_name,
 	{
 		switch ( option_name )
 		{
-		// TODO: TCP_NODELAY
-		// TODO: TCP_MAXSEG
-		// TODO: TCP_NOPUSH
-		// TODO: TCP_CORK
+		case TCP_NODELAY: result = nodelay; break;
+		case TCP_MAXSEG:
+			result = mss_limit && mss_limit < send_mss ? mss_limit : send_mss;
+			break;
+		case TCP_CORK: result = cork; break;
 		default: return errno = ENOPROTOOPT, -1;
 		}
 	}
@@ -2163,9 +3664,9 @@ int TCPSocket::getsockopt(ioctx_t* ctx, int level, int option_name,
 		case SO_DOMAIN: result = af; break;
 		case SO_ERROR: result = sockerr; break;
 		case SO_PROTOCOL: result = IPPROTO_TCP; break;
-		case SO_RCVBUF: result = sizeof(incoming); break;
+		case SO_RCVBUF: result = incoming_limit; break;
 		case SO_REUSEADDR: result = reuseaddr; break;
-		case SO_SNDBUF: result = sizeof(outgoing); break;
+		case SO_SNDBUF: result = outgoing_limit; break;
 		case SO_TYPE: result = SOCK_STREAM; break;
 		// TODO: SO_ACCEPTCONN
 		// TODO: SO_LINGER
@@ -2227,10 +3728,22 @@ int TCPSocket::setsockopt(ioctx_t* ctx, int level, int option_name,
 	{
 		switch ( option_name )
 		{
-		case TCP_NODELAY: break; // TODO: Transmit if turned on?
-		case TCP_MAXSEG: break; // TODO: Implement this.
-		case TCP_NOPUSH: break; // TODO: Implement this.
-		// TODO: TCP_CORK
+		case TCP_NODELAY:
+			nodelay = value;
+			// Send the data held back for coalescing.
+			if ( nodelay )
+				ScheduleTransmit();
+			break;
+		case TCP_MAXSEG:
+			if ( value < MSS_MIN || UINT16_MAX < value )
+				return errno = EINVAL, -1;
+			mss_limit = value;
+			break;
+		case TCP_CORK:
+			cork = value;
+			if ( !cork )
+				ScheduleTransmit();
+			break;
 		default:
 			return errno = ENOPROTOOPT, -1;
 		}
@@ -2251,8 +3764,34 @@ int TCPSocket::setsockopt(ioctx_t* ctx, int level, int option_name,
 		case SO_KEEPALIVE: break; // TODO: Implement this.
 		case SO_REUSEADDR: reuseaddr = value; break;
 		case SO_LINGER: break; // TODO: Implement this.
-		case SO_RCVBUF: break; // TODO: Implement this.
-		case SO_SNDBUF: break; // TODO: Implement this.
+		case SO_RCVBUF:
+		{
+			if ( value < BUFFER_MIN )
+				value = BUFFER_MIN;
+			if ( BUFFER_MAX < value )
+				value = BUFFER_MAX;
+			incoming_limit = value;
+			autotune_receive = false;
+			// Open the window if it grew, but don't shrink the window already
+			// advertised to the remote.
+			tcp_seq old_recv_wnd = recv_wnd;
+			UpdateReceiveWindow();
+			if ( recv_wnd < old_recv_wnd )
+				recv_wnd = old_recv_wnd;
+			else if ( old_recv_wnd < recv_wnd )
+				ScheduleTransmit();
+			break;
+		}
+		case SO_SNDBUF:
+			if ( value < BUFFER_MIN )
+				value = BUFFER_MIN;
+			if ( BUFFER_MAX < value )
+				value = BUFFER_MAX;
+			outgoing_limit = value;
+			autotune_send = false;
+			kthread_cond_broadcast(&transmit_cond);
+			poll_channel.Signal(PollEventStatus());
+			break;
 		// TODO: SO_BROADCAST
 		// TODO: SO_DONTROUTE
 		// TODO: SO_LINGER
@@ -2482,79 +4021,70 @@ int TCPSocketNode::sockatmark(ioctx_t* ctx)
 	return socket->sockatmark(ctx);
 }
 
-void HandleIP(Ref<Packet> pkt,
-              const struct in_addr* src,
-              const struct in_addr* dst,
-              bool dst_broadcast)
+// Consecutive segments received for the same connection are merged into one
+// segment until the network interface has handled all the packets it received
+// at once, so the connection processes them all at once.
+struct merge_flow
 {
-	if ( src->s_addr == htobe32(INADDR_ANY) )
-		return;
-	if ( dst_broadcast )
-		return;
-	const unsigned char* in = pkt->from + pkt->offset;
-	size_t inlen = pkt->length - pkt->offset;
+	Ref<Packet> head;
+	Packet* tail;
+	struct in_addr src;
+	struct in_addr dst;
+	uint16_t sport;
+	uint16_t dport;
+	tcp_seq next_seq;
+	tcp_seq ack;
+	uint16_t win;
+	size_t length;
+};
+
+static kthread_mutex_t merge_lock = KTHREAD_MUTEX_INITIALIZER;
+static struct merge_flow merge_flows[MERGE_FLOWS];
+static size_t merge_evict;
+
+// Delivers a segment to its connection, which may continue with segments that
+// were merged into it.
+static void Deliver(Ref<Packet> pkt,
+                    const struct in_addr* src,
+                    const struct in_addr* dst)
+{
+	size_t inlen = GetPacketLength(pkt.Get());
 	struct tcphdr hdr;
-	if ( inlen < sizeof(hdr) )
-		return;
-	if ( UINT16_MAX < inlen )
-		return;
-	memcpy(&hdr, in, sizeof(hdr));
+	memcpy(&hdr, pkt->from + pkt->offset, sizeof(hdr));
 	hdr.th_sport = be16toh(hdr.th_sport);
 	hdr.th_dport = be16toh(hdr.th_dport);
-	hdr.th_sum = be16toh(hdr.th_sum);
-	uint16_t sum = 0;
-	sum = IP::ipsum_buf(sum, src, sizeof(struct in_addr));
-	sum = IP::ipsum_buf(sum, dst, sizeof(struct in_addr));
-	sum = IP::ipsum_word(sum, IPPROTO_TCP);
-	sum = IP::ipsum_word(sum, inlen);
-	sum = IP::ipsum_buf(sum, in, inlen);
-	if ( sum != 0 && sum != 0xFFFF )
-		return;
-	if ( TCP_OFFSET_DECODE(hdr.th_offset) < sizeof(hdr) / 4 ||
-	     inlen < (size_t) TCP_OFFSET_DECODE(hdr.th_offset) * 4 )
-		return;
-	// Port 0 is not valid.
-	if ( hdr.th_sport == 0 || hdr.th_dport == 0 )
-		return;
-	// TODO: TCP options. Respect TCPOPT_MAXSEG.
-	TCPSocket* socket = NULL;
-	TCPSocket* socket_listener = NULL;
-	TCPSocket* any_socket_listener = NULL;
+	union tcp_sockaddr pkt_src;
+	memset(&pkt_src, 0, sizeof(pkt_src));
+	pkt_src.in.sin_family = AF_INET;
+	pkt_src.in.sin_addr = *src;
+	pkt_src.in.sin_port = htobe16(hdr.th_sport);
+	union tcp_sockaddr pkt_dst;
+	memset(&pkt_dst, 0, sizeof(pkt_dst));
+	pkt_dst.in.sin_family = AF_INET;
+	pkt_dst.in.sin_addr = *dst;
+	pkt_dst.in.sin_port = htobe16(hdr.th_dport);
+	union tcp_sockaddr any_local;
+	memset(&any_local, 0, sizeof(any_local));
+	any_local.in.sin_family = AF_INET;
+	any_local.in.sin_addr.s_addr = htobe32(INADDR_ANY);
+	any_local.in.sin_port = htobe16(hdr.th_dport);
+	union tcp_sockaddr any_remote;
+	memset(&any_remote, 0, sizeof(any_remote));
+	any_remote.in.sin_family = AF_INET;
+	any_remote.in.sin_addr.s_addr = htobe32(INADDR_ANY);
+	any_remote.in.sin_port = htobe16(0);
 	ScopedLock lock(&tcp_lock);
-	for ( TCPSocket* iter = bindings_v4[hdr.th_dport];
-	      !socket && iter;
-	      iter = iter->next_socket )
-	{
-		// TODO: If a TCP socket is bound, and then connected to, what happens?
-		//       What if the TCP socket then connects to the other side?
-		if ( !iter->remoted )
-			continue;
-		// The datagram was sent to the socket's local address.
-		if ( !memcmp(&iter->local.in.sin_addr, dst, sizeof(*dst)) )
-		{
-			// The first priority is to receive on a socket with the correct
-			// local address and the correct remote address.
-			if ( !memcmp(&iter->remote.in.sin_addr, src, sizeof(*src)) &&
-				 be16toh(iter->remote.in.sin_port) == hdr.th_sport )
-				socket = iter;
-			// The second priority is to receive on a socket with the correct
-			// local address and listening for connections from any address.
-			else if ( iter->remote.in.sin_addr.s_addr == htobe32(INADDR_ANY) )
-				socket_listener = iter;
-		}
-		// The socket is bound to the any address.
-		if ( iter->local.in.sin_addr.s_addr == htobe32(INADDR_ANY) )
-		{
-			// The third priority is to receive on a socket bound to the any
-			// address and listening for connections from any address.
-			 if ( iter->remote.in.sin_addr.s_addr == htobe32(INADDR_ANY) )
-				any_socket_listener = iter;
-		}
-	}
+	// The first priority is to receive on a socket with the correct local
+	// address and the correct remote address.
+	TCPSocket* socket = LookupConnection(&pkt_dst, &pkt_src);
+	// The second priority is to receive on a socket with the correct local
+	// address and listening for connections from any address.
 	if ( !socket )
-		socket = socket_listener;
+		socket = LookupConnection(&pkt_dst, &any_remote);
+	// The third priority is to receive on a socket bound to the any address and
+	// listening for connections from any address.
 	if ( !socket )
-		socket = any_socket_listener;
+		socket = LookupConnection(&any_local, &any_remote);
 	// If the socket is bound to a network interface, require the packet to
 	// have been received on that network interface.
 	unsigned int ifindex = pkt->netif->ifinfo.linkid;
@@ -2620,20 +4150,169 @@ void HandleIP(Ref<Packet> pkt,
 			return;
 		return;
 	}
-	union tcp_sockaddr pkt_src;
-	pkt_src.in.sin_family = AF_INET;
-	pkt_src.in.sin_addr = *src;
-	pkt_src.in.sin_port = htobe16(hdr.th_sport);
-	union tcp_sockaddr pkt_dst;
-	pkt_dst.in.sin_family = AF_INET;
-	pkt_dst.in.sin_addr = *dst;
-	pkt_dst.in.sin_port = htobe16(hdr.th_dport);
 	// Receive the packet on the socket.
 	socket->ReceivePacket(pkt, &pkt_src, &pkt_dst);
 	// Delete the socket if needed or schedule a transmit if needed.
 	if ( socket->can_destroy() )
 		delete socket;
 }
+void HandleIP(Ref<Packet> pkt,
+              const struct in_addr* src,
+              const struct in_addr* dst,
+              bool dst_broadcast)
+{
+	if ( src->s_addr == htobe32(INADDR_ANY) )
+		return;
+	if ( dst_broadcast )
+		return;
+	// Segments delivered locally may continue in fragments, but the header is
+	// always in the first packet.
+	const unsigned char* in = pkt->from + pkt->offset;
+	size_t inlen = GetPacketLength(pkt.Get());
+	struct tcphdr hdr;
+	if ( pkt->length - pkt->offset < sizeof(hdr) )
+		return;
+	if ( UINT16_MAX < inlen )
+		return;
+	memcpy(&hdr, in, sizeof(hdr));
+	hdr.th_sport = be16toh(hdr.th_sport);
+	hdr.th_dport = be16toh(hdr.th_dport);
+	hdr.th_sum = be16toh(hdr.th_sum);
+	if ( !(pkt->checksum_flags & PACKET_CHECKSUM_VERIFIED) )
+	{
+		// Only segments that never left this machine are in fragments.
+		if ( pkt->fragment )
+			return;
+		uint16_t sum = 0;
+		sum = IP::ipsum_buf(sum, src, sizeof(struct in_addr));
+		sum = IP::ipsum_buf(sum, dst, sizeof(struct in_addr));
+		sum = IP::ipsum_word(sum, IPPROTO_TCP);
+		sum = IP::ipsum_word(sum, inlen);
+		sum = IP::ipsum_buf(sum, in, inlen);
+		if ( sum != 0 && sum != 0xFFFF )
+			return;
+	}
+	if ( TCP_OFFSET_DECODE(hdr.th_offset) < sizeof(hdr) / 4 ||
+	     pkt->length - pkt->offset <
+	     (size_t) TCP_OFFSET_DECODE(hdr.th_offset) * 4 )
+		return;
+	// Port 0 is not valid.
+	if ( hdr.th_sport == 0 || hdr.th_dport == 0 )
+		return;
+	size_t header_length = TCP_OFFSET_DECODE(hdr.th_offset) * 4;
+	size_t data_length = inlen - header_length;
+	tcp_seq seq = be32toh(hdr.th_seq);
+	tcp_seq ack = be32toh(hdr.th_ack);
+	uint16_t win = be16toh(hdr.th_win);
+	// Only segments with data and no options or special flags are merged, as
+	// the connection handles them the same way when received one at a time.
+	bool mergeable = header_length == sizeof(hdr) && data_length &&
+	                 (hdr.th_flags & ~TH_PUSH) == TH_ACK && !pkt->fragment;
+	bool held = false;
+	Ref<Packet> earlier;
+	struct in_addr earlier_src;
+	struct in_addr earlier_dst;
+	kthread_mutex_lock(&merge_lock);
+	struct merge_flow* flow = NULL;
+	for ( size_t i = 0; !flow && i < MERGE_FLOWS; i++ )
+	{
+		struct merge_flow* candidate = &merge_flows[i];
+		if ( candidate->head &&
+		     candidate->sport == hdr.th_sport &&
+		     candidate->dport == hdr.th_dport &&
+		     candidate->src.s_addr == src->s_addr &&
+		     candidate->dst.s_addr == dst->s_addr )
+			flow = candidate;
+	}
+	if ( flow && mergeable && flow->next_seq == seq && flow->ack == ack &&
+	     flow->win == win && data_length <= MERGE_MAX - flow->length )
+	{
+		// The data continues in the packet after the header.
+		pkt->offset += header_length;
+		flow->tail->fragment = pkt;
+		flow->tail = pkt.Get();
+		flow->next_seq += data_length;
+		flow->length += data_length;
+		held = true;
+		// Process the data right away if the remote pushed it.
+		if ( hdr.th_flags & TH_PUSH )
+		{
+			earlier = flow->head;
+			earlier_src = flow->src;
+			earlier_dst = flow->dst;
+			flow->head.Reset();
+			flow->tail = NULL;
+		}
+	}
+	else
+	{
+		// Process the segments received earlier on the connection first.
+		if ( flow )
+		{
+			earlier = flow->head;
+			earlier_src = flow->src;
+			earlier_dst = flow->dst;
+			flow->head.Reset();
+			flow->tail = NULL;
+		}
+		if ( mergeable && !(hdr.th_flags & TH_PUSH) )
+		{
+			for ( size_t i = 0; !flow && i < MERGE_FLOWS; i++ )
+				if ( !merge_flows[i].head )
+					flow = &merge_flows[i];
+			// Process the segments of another connection if all are in use.
+			if ( !flow )
+			{
+				flow = &merge_flows[merge_evict++ % MERGE_FLOWS];
+				earlier = flow->head;
+				earlier_src = flow->src;
+				earlier_dst = flow->dst;
+			}
+			flow->head = pkt;
+			flow->tail = pkt.Get();
+			flow->src = *src;
+			flow->dst = *dst;
+			flow->sport = hdr.th_sport;
+			flow->dport = hdr.th_dport;
+			flow->next_seq = seq + data_length;
+			flow->ack = ack;
+			flow->win = win;
+			flow->length = data_length;
+			held = true;
+		}
+	}
+	kthread_mutex_unlock(&merge_lock);
+	if ( earlier )
+		Deliver(earlier, &earlier_src, &earlier_dst);
+	if ( !held )
+		Deliver(pkt, src, dst);
+}
+
+void Flush()
+{
+	while ( true )
+	{
+		Ref<Packet> pkt;
+		struct in_addr src;
+		struct in_addr dst;
+		kthread_mutex_lock(&merge_lock);
+		for ( size_t i = 0; !pkt && i < MERGE_FLOWS; i++ )
+		{
+			struct merge_flow* flow = &merge_flows[i];
+			if ( !flow->head )
+				continue;
+			pkt = flow->head;
+			src = flow->src;
+			dst = flow->dst;
+			flow->head.Reset();
+			flow->tail = NULL;
+		}
+		kthread_mutex_unlock(&merge_lock);
+		if ( !pkt )
+			break;
+		Deliver(pkt, &src, &dst);
+	}
+}
 
 Ref<Inode> Socket(int af)
 {
@@ -33,6 +33,7 @@ void HandleIP(Ref<Packet> pkt,
               const struct in_addr* src,
               const struct in_addr* dst,
               bool dst_broadcast);
+void Flush();
 Ref<Inode> Socket(int af);
 
 } // namespace TCP
@@ -851,12 +851,12 @@ ssize_t UDPSocket::sendmsg_internal(ioctx_t* ctx,
 		return errno = EAFNOSUPPORT, -1;
 	checksum = IP::ipsum_word(checksum, IPPROTO_UDP);
 	checksum = IP::ipsum_word(checksum, pkt->length);
-	checksum = IP::ipsum_buf(checksum, out, pkt->length);
-	checksum = IP::ipsum_finish(checksum);
-	if ( checksum == 0x0000 )
-		checksum = 0xFFFF;
+	// Let the network interface checksum the datagram itself if possible.
 	hdr.uh_sum = htobe16(checksum);
 	memcpy(out, &hdr, sizeof(hdr));
+	pkt->checksum_flags = PACKET_CHECKSUM_PARTIAL;
+	pkt->checksum_start = 0;
+	pkt->checksum_offset = offsetof(struct udphdr, uh_sum);
 	(void) flags;
 	if ( af == AF_INET )
 	{
@@ -1187,7 +1187,7 @@ void HandleIP(Ref<Packet> pkt,
 	hdr.uh_dport = be16toh(hdr.uh_dport);
 	hdr.uh_ulen = be16toh(hdr.uh_ulen);
 	hdr.uh_sum = be16toh(hdr.uh_sum);
-	if ( hdr.uh_sum )
+	if ( hdr.uh_sum && !(pkt->checksum_flags & PACKET_CHECKSUM_VERIFIED) )
 	{
 		uint16_t sum = 0;
 		sum = IP::ipsum_buf(sum, src, sizeof(struct in_addr));
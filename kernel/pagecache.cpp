@@ -0,0 +1,496 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * pagecache.cpp
+ * Cache of file pages shared between file mappings.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <timespec.h>
+
+#include <sortix/mman.h>
+
+#include <sortix/kernel/addralloc.h>
+#include <sortix/kernel/ioctx.h>
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/kthread.h>
+#include <sortix/kernel/memorymanagement.h>
+#include <sortix/kernel/pagecache.h>
+
+namespace Sortix {
+namespace PageCache {
+
+// The cached pages are shared copy-on-write with the processes mapping them,
+// and the cache owns one of the references to each page. The least recently
+// used page is dropped from the cache when it's full, which frees it unless a
+// process still has it mapped.
+//
+// The modification time has too coarse granularity to notice a file being
+// rewritten, so every write and truncation through the kernel advances the
+// generation of the file. Files share generation counters if they hash the
+// same, which only causes needless misses. Pages from older generations are
+// never found again and eventually fall out of the cache.
+struct cached_page
+{
+	struct cached_page* hash_next;
+	struct cached_page* lru_prev;
+	struct cached_page* lru_next;
+	struct page_cache_key key;
+	addr_t page;
+};
+
+static const size_t HASH_LENGTH = 1024;
+static struct cached_page* hash_table[HASH_LENGTH];
+static struct cached_page* lru_first;
+static struct cached_page* lru_last;
+static size_t cached_count;
+static size_t cached_limit;
+static uintmax_t generations[HASH_LENGTH];
+static kthread_mutex_t cache_lock = KTHREAD_MUTEX_INITIALIZER;
+
+// The pages of shared file mappings are the same in every shared mapping of
+// the file, and the table owns a reference to each of them until the file is
+// no longer mapped shared. Data written to the file is copied into its shared
+// pages, and the processes write the pages they change back to the file.
+struct shared_page
+{
+	struct shared_page* hash_next;
+	struct shared_page* file_next;
+	dev_t dev;
+	ino_t ino;
+	off_t offset;
+	addr_t page;
+};
+
+static struct shared_page* shared_table[HASH_LENGTH];
+
+// Files that are running programs, are open for writing, or are mapped shared,
+// counting the segments mapping them and the descriptors writing to them.
+struct file_access
+{
+	struct file_access* next;
+	struct shared_page* shared_pages;
+	dev_t dev;
+	ino_t ino;
+	size_t denials;
+	size_t writers;
+	size_t shared;
+};
+
+static struct file_access* access_table[HASH_LENGTH];
+
+// The shared pages are written to through a page sized window of the kernel
+// address space, which is reserved when a file is first mapped shared. The
+// window lock is taken before the cache lock.
+static addralloc_t shared_window;
+static kthread_mutex_t shared_window_lock = KTHREAD_MUTEX_INITIALIZER;
+
+static size_t FileHash(dev_t dev, ino_t ino)
+{
+	return ((uintmax_t) dev * 31 + (uintmax_t) ino) % HASH_LENGTH;
+}
+
+static size_t SharedHash(dev_t dev, ino_t ino, off_t offset)
+{
+	uintmax_t hash = (uintmax_t) dev * 31 + (uintmax_t) ino;
+	hash = hash * 31 + (uintmax_t) offset / Page::Size();
+	return hash % HASH_LENGTH;
+}
+
+static size_t Hash(const struct page_cache_key* key)
+{
+	uintmax_t hash = (uintmax_t) key->dev * 31 + (uintmax_t) key->ino;
+	hash = hash * 31 + (uintmax_t) key->offset / Page::Size();
+	return hash % HASH_LENGTH;
+}
+
+static bool IsSameKey(const struct page_cache_key* a,
+                      const struct page_cache_key* b)
+{
+	return a->dev == b->dev &&
+	       a->ino == b->ino &&
+	       timespec_eq(a->mtime, b->mtime) &&
+	       a->generation == b->generation &&
+	       a->offset == b->offset &&
+	       a->size == b->size;
+}
+
+static struct cached_page* Find(const struct page_cache_key* key)
+{
+	for ( struct cached_page* iter = hash_table[Hash(key)]; iter;
+	      iter = iter->hash_next )
+	{
+		if ( IsSameKey(&iter->key, key) )
+			return iter;
+	}
+	return NULL;
+}
+
+static void Unlink(struct cached_page* cached)
+{
+	if ( cached->lru_prev )
+		cached->lru_prev->lru_next = cached->lru_next;
+	else
+		lru_first = cached->lru_next;
+	if ( cached->lru_next )
+		cached->lru_next->lru_prev = cached->lru_prev;
+	else
+		lru_last = cached->lru_prev;
+	cached->lru_prev = NULL;
+	cached->lru_next = NULL;
+}
+
+static void LinkFirst(struct cached_page* cached)
+{
+	cached->lru_prev = NULL;
+	cached->lru_next = lru_first;
+	if ( lru_first )
+		lru_first->lru_prev = cached;
+	else
+		lru_last = cached;
+	lru_first = cached;
+}
+
+static void Evict(struct cached_page* cached)
+{
+	Unlink(cached);
+	for ( struct cached_page** link = &hash_table[Hash(&cached->key)]; *link;
+	      link = &(*link)->hash_next )
+	{
+		if ( *link != cached )
+			continue;
+		*link = cached->hash_next;
+		break;
+	}
+	Page::Put(cached->page, PAGE_USAGE_USER_SPACE);
+	cached_count--;
+	delete cached;
+}
+
+uintmax_t Generation(dev_t dev, ino_t ino)
+{
+	ScopedLock lock(&cache_lock);
+	return generations[FileHash(dev, ino)];
+}
+
+void Invalidate(dev_t dev, ino_t ino)
+{
+	ScopedLock lock(&cache_lock);
+	generations[FileHash(dev, ino)]++;
+}
+
+bool Lookup(const struct page_cache_key* key, addr_t* page)
+{
+	ScopedLock lock(&cache_lock);
+	struct cached_page* cached = Find(key);
+	if ( !cached || !Page::AddReference(cached->page) )
+		return false;
+	Unlink(cached);
+	LinkFirst(cached);
+	*page = cached->page;
+	return true;
+}
+
+bool Insert(const struct page_cache_key* key, addr_t page)
+{
+	ScopedLock lock(&cache_lock);
+	if ( !cached_limit )
+	{
+		// Use at most a small part of the memory for cached pages, whether or
+		// not they're still mapped. Evicting a page that's still mapped only
+		// drops the cache's reference to it.
+		size_t total;
+		Memory::Statistics(NULL, &total, NULL);
+		cached_limit = total / Page::Size() / 32;
+		if ( !cached_limit )
+			cached_limit = 1;
+	}
+	if ( key->generation != generations[FileHash(key->dev, key->ino)] )
+		return false;
+	if ( Find(key) )
+		return false;
+	struct cached_page* cached = new struct cached_page;
+	if ( !cached )
+		return false;
+	if ( !Page::AddReference(page) )
+	{
+		delete cached;
+		return false;
+	}
+	while ( cached_limit <= cached_count )
+		Evict(lru_last);
+	cached->key = *key;
+	cached->page = page;
+	size_t index = Hash(key);
+	cached->hash_next = hash_table[index];
+	hash_table[index] = cached;
+	LinkFirst(cached);
+	cached_count++;
+	return true;
+}
+
+static struct file_access** FindAccess(dev_t dev, ino_t ino)
+{
+	struct file_access** link = &access_table[FileHash(dev, ino)];
+	while ( *link && ((*link)->dev != dev || (*link)->ino != ino) )
+		link = &(*link)->next;
+	return link;
+}
+
+static struct file_access* GetAccess(dev_t dev, ino_t ino)
+{
+	struct file_access** link = FindAccess(dev, ino);
+	if ( *link )
+		return *link;
+	struct file_access* access = new struct file_access;
+	if ( !access )
+		return NULL;
+	access->next = NULL;
+	access->shared_pages = NULL;
+	access->dev = dev;
+	access->ino = ino;
+	access->denials = 0;
+	access->writers = 0;
+	access->shared = 0;
+	return *link = access;
+}
+
+static void PutAccess(dev_t dev, ino_t ino)
+{
+	struct file_access** link = FindAccess(dev, ino);
+	struct file_access* access = *link;
+	if ( access->denials || access->writers || access->shared )
+		return;
+	*link = access->next;
+	delete access;
+}
+
+bool DenyWrite(dev_t dev, ino_t ino)
+{
+	ScopedLock lock(&cache_lock);
+	struct file_access* access = GetAccess(dev, ino);
+	if ( !access )
+		return false;
+	if ( access->writers )
+		return errno = ETXTBSY, false;
+	access->denials++;
+	return true;
+}
+
+void AllowWrite(dev_t dev, ino_t ino)
+{
+	ScopedLock lock(&cache_lock);
+	struct file_access* access = *FindAccess(dev, ino);
+	assert(access && access->denials);
+	access->denials--;
+	PutAccess(dev, ino);
+}
+
+bool AddWriter(dev_t dev, ino_t ino)
+{
+	ScopedLock lock(&cache_lock);
+	struct file_access* access = GetAccess(dev, ino);
+	if ( !access )
+		return false;
+	if ( access->denials )
+		return errno = ETXTBSY, false;
+	access->writers++;
+	return true;
+}
+
+void RemoveWriter(dev_t dev, ino_t ino)
+{
+	ScopedLock lock(&cache_lock);
+	struct file_access* access = *FindAccess(dev, ino);
+	assert(access && access->writers);
+	access->writers--;
+	PutAccess(dev, ino);
+}
+
+static struct shared_page** FindShared(dev_t dev, ino_t ino, off_t offset)
+{
+	struct shared_page** link = &shared_table[SharedHash(dev, ino, offset)];
+	while ( *link && ((*link)->dev != dev || (*link)->ino != ino ||
+	                  (*link)->offset != offset) )
+		link = &(*link)->hash_next;
+	return link;
+}
+
+// Returns whether the file has shared pages that writes must be copied into.
+static bool HasSharedPages(dev_t dev, ino_t ino)
+{
+	ScopedLock lock(&cache_lock);
+	struct file_access* access = *FindAccess(dev, ino);
+	return access && access->shared_pages;
+}
+
+bool AddSharedMapping(dev_t dev, ino_t ino)
+{
+	ScopedLock lock(&cache_lock);
+	if ( !shared_window.size &&
+	     !AllocateKernelAddress(&shared_window, Page::Size()) )
+		return errno = ENOMEM, false;
+	struct file_access* access = GetAccess(dev, ino);
+	if ( !access )
+		return false;
+	access->shared++;
+	return true;
+}
+
+void RemoveSharedMapping(dev_t dev, ino_t ino)
+{
+	ScopedLock lock(&cache_lock);
+	struct file_access* access = *FindAccess(dev, ino);
+	assert(access && access->shared);
+	if ( !--access->shared )
+	{
+		while ( struct shared_page* shared = access->shared_pages )
+		{
+			access->shared_pages = shared->file_next;
+			*FindShared(dev, ino, shared->offset) = shared->hash_next;
+			Page::Put(shared->page, PAGE_USAGE_USER_SPACE);
+			delete shared;
+		}
+	}
+	PutAccess(dev, ino);
+}
+
+bool LookupShared(dev_t dev, ino_t ino, off_t offset, addr_t* page)
+{
+	ScopedLock lock(&cache_lock);
+	struct shared_page* shared = *FindShared(dev, ino, offset);
+	if ( !shared || !Page::AddReference(shared->page) )
+		return false;
+	*page = shared->page;
+	return true;
+}
+
+bool InsertShared(dev_t dev, ino_t ino, off_t offset, uintmax_t generation,
+                  addr_t page)
+{
+	ScopedLock lock(&cache_lock);
+	if ( generation != generations[FileHash(dev, ino)] )
+		return errno = EAGAIN, false;
+	struct shared_page** link = FindShared(dev, ino, offset);
+	if ( *link )
+		return errno = EEXIST, false;
+	struct file_access* access = *FindAccess(dev, ino);
+	assert(access && access->shared);
+	struct shared_page* shared = new struct shared_page;
+	if ( !shared )
+		return errno = ENOMEM, false;
+	if ( !Page::AddReference(page) )
+	{
+		delete shared;
+		return errno = ENOMEM, false;
+	}
+	shared->hash_next = NULL;
+	shared->file_next = access->shared_pages;
+	shared->dev = dev;
+	shared->ino = ino;
+	shared->offset = offset;
+	shared->page = page;
+	access->shared_pages = shared;
+	*link = shared;
+	return true;
+}
+
+void WriteShared(dev_t dev, ino_t ino, ioctx_t* ctx, const struct iovec* iov,
+                 int iovcnt, off_t offset, size_t amount)
+{
+	if ( !amount || !HasSharedPages(dev, ino) )
+		return;
+	// The data is copied straight from the writer, whose buffer may need to
+	// be faulted in, which is why the cache lock isn't held.
+	ScopedLock lock(&shared_window_lock);
+	uint8_t* window = (uint8_t*) shared_window.from;
+	int iov_index = 0;
+	size_t iov_offset = 0;
+	for ( size_t done = 0; done < amount; )
+	{
+		off_t position = offset + (off_t) done;
+		size_t page_skip = (size_t) (position % Page::Size());
+		size_t count = Page::Size() - page_skip;
+		if ( amount - done < count )
+			count = amount - done;
+		addr_t page;
+		bool found = LookupShared(dev, ino, position - page_skip, &page);
+		if ( found && !Memory::Map(page, shared_window.from,
+		                           PROT_KREAD | PROT_KWRITE) )
+		{
+			Page::Put(page, PAGE_USAGE_USER_SPACE);
+			found = false;
+		}
+		if ( found )
+			Memory::InvalidatePage(shared_window.from);
+		for ( size_t copied = 0; copied < count; )
+		{
+			while ( iov_index < iovcnt && iov[iov_index].iov_len <= iov_offset )
+				iov_index++, iov_offset = 0;
+			assert(iov_index < iovcnt);
+			size_t piece = iov[iov_index].iov_len - iov_offset;
+			if ( count - copied < piece )
+				piece = count - copied;
+			const uint8_t* src = (const uint8_t*) iov[iov_index].iov_base;
+			if ( found )
+				ctx->copy_from_src(window + page_skip + copied,
+				                   src + iov_offset, piece);
+			copied += piece;
+			iov_offset += piece;
+		}
+		if ( found )
+		{
+			Memory::Unmap(shared_window.from);
+			Memory::InvalidatePage(shared_window.from);
+			Page::Put(page, PAGE_USAGE_USER_SPACE);
+		}
+		done += count;
+	}
+}
+
+void TruncateShared(dev_t dev, ino_t ino, off_t length)
+{
+	ScopedLock lock1(&shared_window_lock);
+	ScopedLock lock2(&cache_lock);
+	struct file_access* access = *FindAccess(dev, ino);
+	if ( !access )
+		return;
+	for ( struct shared_page* shared = access->shared_pages; shared;
+	      shared = shared->file_next )
+	{
+		if ( shared->offset + (off_t) Page::Size() <= length )
+			continue;
+		size_t skip = 0;
+		if ( shared->offset < length )
+			skip = (size_t) (length - shared->offset);
+		if ( !Memory::Map(shared->page, shared_window.from,
+		                  PROT_KREAD | PROT_KWRITE) )
+			continue;
+		Memory::InvalidatePage(shared_window.from);
+		memset((uint8_t*) shared_window.from + skip, 0, Page::Size() - skip);
+		Memory::Unmap(shared_window.from);
+		Memory::InvalidatePage(shared_window.from);
+	}
+}
+
+} // namespace PageCache
+} // namespace Sortix
@@ -57,6 +57,7 @@
 #include <sortix/kernel/ptable.h>
 #include <sortix/kernel/refcount.h>
 #include <sortix/kernel/scheduler.h>
+#include <sortix/kernel/segment.h>
 #include <sortix/kernel/sortedlist.h>
 #include <sortix/kernel/string.h>
 #include <sortix/kernel/syscall.h>
@@ -79,6 +80,7 @@ Process::Process()
 {
 	program_image_path = NULL;
 	addrspace = 0;
+	addrspace_borrowed = false;
 	pid = 0;
 
 	nice_lock = KTHREAD_MUTEX_INITIALIZER;
@@ -137,6 +139,8 @@ Process::Process()
 	init_next = NULL;
 	init_first = NULL;
 	zombie_cond = KTHREAD_COND_INITIALIZER;
+	vfork_cond = KTHREAD_COND_INITIALIZER;
+	vfork_thread = NULL;
 	is_zombie = false;
 	no_zombify = false;
 	limbo = false;
@@ -351,9 +355,15 @@ void Process::LastPrayer()
 	if ( mtable ) mtable.Reset();
 
 	// Destroy the address space and safely switch to the replacement
-	// address space before things get dangerous.
-	Memory::DestroyAddressSpace(prevaddrspace);
+	// address space before things get dangerous. A borrowed address space is
+	// still in use by the parent process, which can now continue.
+	if ( addrspace_borrowed )
+		Memory::SwitchAddressSpace(prevaddrspace);
+	else
+		Memory::DestroyAddressSpace(prevaddrspace);
 	addrspace = 0;
+	addrspace_borrowed = false;
+	ResumeVforkThread();
 
 	ScopedLock family_lock(&process_family_lock);
 
@@ -435,10 +445,20 @@ void Process::ResetAddressSpace()
 
 	assert(Memory::GetAddressSpace() == addrspace);
 
+	// The memory of a borrowed address space belongs to the parent process,
+	// so only the references held by this process are dropped.
 	for ( size_t i = 0; i < segments_used; i++ )
-		Memory::UnmapRange(segments[i].addr, segments[i].size, PAGE_USAGE_USER_SPACE);
+	{
+		if ( !addrspace_borrowed )
+		{
+			Memory::WriteBackMemory(&segments[i], segments[i].addr, segments[i].size);
+			Memory::UnmapRange(segments[i].addr, segments[i].size, PAGE_USAGE_USER_SPACE);
+		}
+		UnrefSegmentBacking(&segments[i]);
+	}
 
-	Memory::Flush();
+	if ( !addrspace_borrowed )
+		Memory::Flush();
 
 	segments_used = segments_length = 0;
 	free(segments);
@@ -717,7 +737,7 @@ Ref<Descriptor> Process::GetDescriptor(int fd)
 	return dtable->Get(fd);
 }
 
-Process* Process::Fork()
+Process* Process::Fork(bool borrow_addrspace)
 {
 	assert(CurrentProcess() == this);
 
@@ -740,8 +760,16 @@ Process* Process::Fork()
 		memcpy(clone_segments, segments, segments_size);
 	}
 
-	// Fork address-space here and copy memory.
-	clone->addrspace = Memory::Fork();
+	// Fork the address-space here, sharing the memory copy-on-write, unless
+	// the child borrows the address space until it executes or exits. The
+	// child still needs its own segment list to resolve page faults.
+	if ( borrow_addrspace )
+	{
+		clone->addrspace = addrspace;
+		clone->addrspace_borrowed = true;
+	}
+	else
+		clone->addrspace = Memory::Fork();
 	if ( !clone->addrspace )
 	{
 		free(clone_segments);
@@ -754,6 +782,8 @@ Process* Process::Fork()
 	clone->segments = clone_segments;
 	clone->segments_used = segments_used;
 	clone->segments_length = segments_used;
+	for ( size_t i = 0; i < segments_used; i++ )
+		ReferSegmentBacking(&clone_segments[i]);
 	lock_segment.Reset();
 
 	kthread_mutex_lock(&process_family_lock);
@@ -896,6 +926,13 @@ bool Process::ResetForExecute()
 	if ( !ExitOtherThreads() )
 		return false;
 
+	// Give the program its own address space if the address space is borrowed
+	// from the parent process, which can then continue. This is done before
+	// anything else is reset, as it's the last step that can fail.
+	addr_t new_addrspace = 0;
+	if ( addrspace_borrowed && !(new_addrspace = Memory::CreateAddressSpace()) )
+		return false;
+
 	DeleteTimers();
 
 	for ( int i = 0; i < SIG_MAX_NUM; i++ )
@@ -915,9 +952,27 @@ bool Process::ResetForExecute()
 
 	ResetAddressSpace();
 
+	if ( addrspace_borrowed )
+	{
+		Memory::SwitchAddressSpace(new_addrspace);
+		addrspace = new_addrspace;
+		addrspace_borrowed = false;
+		ResumeVforkThread();
+	}
+
 	return true;
 }
 
+void Process::ResumeVforkThread()
+{
+	ScopedLock lock(&process_family_lock);
+	if ( !vfork_thread )
+		return;
+	vfork_thread->vfork_waiting = false;
+	kthread_cond_broadcast(&vfork_thread->process->vfork_cond);
+	vfork_thread = NULL;
+}
+
 bool Process::MapSegment(struct segment* result, void* hint, size_t size,
                          int flags, int prot)
 {
@@ -1281,6 +1336,7 @@ static size_t shebang_count_arguments(char* line)
 //       can be shared somehow, you need to keep this comment in sync as well
 //       as the logic in these files:
 //         * kernel/process.cpp
+//         * libc/spawn/posix_spawn.c
 //         * libc/unistd/execvpe.c
 //         * utils/which.c
 // NOTE: See comments in execvpe() for algorithmic commentary.
@@ -1653,7 +1709,8 @@ pid_t sys_tfork(int flags, struct tfork* user_regs)
 	if ( Signal::IsPending() )
 		return errno = EINTR, -1;
 
-	bool making_process = flags == SFFORK;
+	bool making_vfork = flags == SFVFORK;
+	bool making_process = flags == SFFORK || making_vfork;
 	bool making_thread = (flags & (SFPROC | SFPID | SFFD | SFMEM | SFCWD | SFROOT)) == SFPROC;
 
 	// TODO: Properly support tfork(2).
@@ -1683,7 +1740,7 @@ pid_t sys_tfork(int flags, struct tfork* user_regs)
 	Process* child_process;
 	if ( making_thread )
 		child_process = parent_process;
-	else if ( !(child_process = parent_process->Fork()) )
+	else if ( !(child_process = parent_process->Fork(making_vfork)) )
 		return delete[] newkernelstack, -1;
 
 	struct thread_registers cpuregs;
@@ -1771,9 +1828,24 @@ pid_t sys_tfork(int flags, struct tfork* user_regs)
 		thread->signal_single = curthread->signal_single;
 	}
 
+	// The parent thread is suspended while the child uses its address space,
+	// which can't be interrupted, as the memory must not change meanwhile.
+	pid_t child_pid = child_process->pid;
+	if ( making_vfork )
+	{
+		ScopedLock lock(&process_family_lock);
+		curthread->vfork_waiting = true;
+		child_process->vfork_thread = curthread;
+		StartKernelThread(thread);
+		while ( curthread->vfork_waiting )
+			kthread_cond_wait(&parent_process->vfork_cond,
+			                  &process_family_lock);
+		return child_pid;
+	}
+
 	StartKernelThread(thread);
 
-	return child_process->pid;
+	return child_pid;
 }
 
 pid_t sys_getpid(void)
@@ -27,8 +27,10 @@
 #include <sortix/mman.h>
 
 #include <sortix/kernel/decl.h>
+#include <sortix/kernel/descriptor.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/memorymanagement.h>
+#include <sortix/kernel/pagecache.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/segment.h>
 #include <sortix/kernel/yielder.h>
@@ -226,6 +228,14 @@ bool PlaceSegment(struct segment* solution, Process* process, void* addr_ptr,
 			solution->addr = addr;
 			solution->size = size;
 			solution->prot = 0;
+			solution->backing = NULL;
+			solution->backing_offset = 0;
+			solution->backing_size = 0;
+			solution->backing_mtime = timespec_nul();
+			solution->backing_file_size = 0;
+			solution->backing_generation = 0;
+			solution->backing_shared = false;
+			solution->backing_deny_write = false;
 			return true;
 		}
 		struct segment attempt;
@@ -233,6 +243,14 @@ bool PlaceSegment(struct segment* solution, Process* process, void* addr_ptr,
 		attempt.addr = gap.addr;
 		attempt.size = size;
 		attempt.prot = 0;
+		attempt.backing = NULL;
+		attempt.backing_offset = 0;
+		attempt.backing_size = 0;
+		attempt.backing_mtime = timespec_nul();
+		attempt.backing_file_size = 0;
+		attempt.backing_generation = 0;
+		attempt.backing_shared = false;
+		attempt.backing_deny_write = false;
 		distance = addr < attempt.addr ? attempt.addr - addr : addr - attempt.addr;
 		if ( !found_any|| distance < best_distance )
 			found_any = true, best_distance = distance, best = attempt;
@@ -247,4 +265,60 @@ bool PlaceSegment(struct segment* solution, Process* process, void* addr_ptr,
 	return *solution = best, found_any;
 }
 
+void ReferSegmentBacking(struct segment* segment)
+{
+	if ( !segment->backing )
+		return;
+	segment->backing->Refer_Renamed();
+	// The file is already denied writes or mapped shared on behalf of the
+	// segment this segment was made from, the program being loaded, or the
+	// mapping being made, so this can't fail.
+	if ( segment->backing_deny_write )
+	{
+		bool denied = PageCache::DenyWrite(segment->backing->dev,
+		                                   segment->backing->ino);
+		assert(denied);
+		(void) denied;
+	}
+	if ( segment->backing_shared )
+	{
+		bool shared = PageCache::AddSharedMapping(segment->backing->dev,
+		                                          segment->backing->ino);
+		assert(shared);
+		(void) shared;
+	}
+}
+
+void UnrefSegmentBacking(struct segment* segment)
+{
+	if ( segment->backing && segment->backing_deny_write )
+		PageCache::AllowWrite(segment->backing->dev, segment->backing->ino);
+	if ( segment->backing && segment->backing_shared )
+		PageCache::RemoveSharedMapping(segment->backing->dev,
+		                               segment->backing->ino);
+	if ( segment->backing )
+		segment->backing->Unref_Renamed();
+	segment->backing = NULL;
+	segment->backing_shared = false;
+	segment->backing_deny_write = false;
+}
+
+// Shrink the segment to the subrange [addr, addr + size) of itself, keeping the
+// pages in that range backed by the same parts of the backing file.
+void TrimSegment(struct segment* segment, uintptr_t addr, size_t size)
+{
+	assert(segment->addr <= addr);
+	assert(addr + size <= segment->addr + segment->size);
+	size_t delta = addr - segment->addr;
+	segment->addr = addr;
+	segment->size = size;
+	if ( !segment->backing )
+		return;
+	segment->backing_offset += delta;
+	segment->backing_size = delta < segment->backing_size ?
+	                        segment->backing_size - delta : 0;
+	if ( size < segment->backing_size )
+		segment->backing_size = size;
+}
+
 } // namespace Sortix
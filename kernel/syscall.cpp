@@ -218,6 +218,8 @@ void* syscall_list[SYSCALL_MAX_NUM + 1] =
 	[SYSCALL_SETGROUPS] = (void*) sys_setgroups,
 	[SYSCALL_SOCKATMARK] = (void*) sys_sockatmark,
 	[SYSCALL_GETDENTS] = (void*) sys_getdents,
+	[SYSCALL_MADVISE] = (void*) sys_madvise,
+	[SYSCALL_MSYNC] = (void*) sys_msync,
 	[SYSCALL_MAX_NUM] = (void*) sys_bad_syscall,
 };
 } /* extern "C" */
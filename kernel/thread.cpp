@@ -87,6 +87,7 @@ Thread::Thread()
 	kutex_address = 0;
 	futex_woken = false;
 	kutex_woken = false;
+	vfork_waiting = false;
 	futex_prev_waiting = NULL;
 	futex_next_waiting = NULL;
 	kutex_prev_waiting = NULL;
@@ -17,8 +17,11 @@
  * Nodes in the virtual filesystem.
  */
 
+#include <sys/uio.h>
+
 #include <assert.h>
 #include <errno.h>
+#include <fsmarshall-msg.h>
 
 #include <sortix/fcntl.h>
 #include <sortix/mount.h>
@@ -31,6 +34,7 @@
 #include <sortix/kernel/inode.h>
 #include <sortix/kernel/vnode.h>
 #include <sortix/kernel/mtable.h>
+#include <sortix/kernel/pagecache.h>
 #include <sortix/kernel/process.h>
 
 #include "fs/user.h"
@@ -98,6 +102,11 @@ Ref<Vnode> Vnode::open(ioctx_t* ctx, const char* filename, int flags, mode_t mod
 	Ref<Inode> retinode = inode->open(ctx, filename, flags, mode);
 	if ( !retinode )
 		return Ref<Vnode>(NULL);
+	if ( (flags & O_TRUNC) && S_ISREG(retinode->type) )
+	{
+		PageCache::Invalidate(retinode->dev, retinode->ino);
+		PageCache::TruncateShared(retinode->dev, retinode->ino, 0);
+	}
 	if ( retinode->type & S_IFFACTORY &&
 	     !(retinode->type & S_IFFACTORY_NOSTAT && flags & O_IS_STAT) )
 	{
@@ -138,8 +147,8 @@ Ref<Vnode> Vnode::fsm_mount(ioctx_t* ctx,
                             const struct stat* rootst_ptr,
                             int flags)
 {
-	if ( flags & ~(0) )
-		return Ref<Vnode>(NULL);
+	if ( flags & ~(FSM_MOUNT_MULTIPLEX) )
+		return errno = EINVAL, Ref<Vnode>(NULL);
 
 	if ( !strcmp(filename, ".") || !strcmp(filename, "..") )
 		return errno = EINVAL, Ref<Vnode>(NULL);
@@ -154,7 +163,7 @@ Ref<Vnode> Vnode::fsm_mount(ioctx_t* ctx,
 
 	Ref<Inode> root_inode;
 	Ref<Inode> server_inode;
-	if ( !UserFS::Bootstrap(&root_inode, &server_inode, &rootst) )
+	if ( !UserFS::Bootstrap(&root_inode, &server_inode, &rootst, flags) )
 		return Ref<Vnode>(NULL);
 
 	Ref<Vnode> server_vnode(new Vnode(server_inode, Ref<Vnode>(NULL), 0, 0));
@@ -251,6 +260,14 @@ int Vnode::chown(ioctx_t* ctx, uid_t owner, gid_t group)
 	return inode->chown(ctx, owner, group);
 }
 
+// Pages of regular files read before they were changed must no longer be
+// shared with new mappings of the file.
+void Vnode::Changed()
+{
+	if ( S_ISREG(type) )
+		PageCache::Invalidate(dev, ino);
+}
+
 long Vnode::pathconf(ioctx_t* ctx, int name)
 {
 	return inode->pathconf(ctx, name);
@@ -258,7 +275,11 @@ long Vnode::pathconf(ioctx_t* ctx, int name)
 
 int Vnode::truncate(ioctx_t* ctx, off_t length)
 {
-	return inode->truncate(ctx, length);
+	int result = inode->truncate(ctx, length);
+	Changed();
+	if ( S_ISREG(type) && 0 <= result )
+		PageCache::TruncateShared(dev, ino, length);
+	return result;
 }
 
 off_t Vnode::lseek(ioctx_t* ctx, off_t offset, int whence)
@@ -289,23 +310,40 @@ ssize_t Vnode::preadv(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 
 ssize_t Vnode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
 {
-	return inode->write(ctx, buf, count);
+	ssize_t result = inode->write(ctx, buf, count);
+	Changed();
+	return result;
 }
 
 ssize_t Vnode::writev(ioctx_t* ctx, const struct iovec* iov, int iovcnt)
 {
-	return inode->writev(ctx, iov, iovcnt);
+	ssize_t result = inode->writev(ctx, iov, iovcnt);
+	Changed();
+	return result;
 }
 
 ssize_t Vnode::pwrite(ioctx_t* ctx, const uint8_t* buf, size_t count, off_t off)
 {
-	return inode->pwrite(ctx, buf, count, off);
+	ssize_t result = inode->pwrite(ctx, buf, count, off);
+	Changed();
+	if ( S_ISREG(type) && 0 < result )
+	{
+		struct iovec iov;
+		iov.iov_base = (void*) buf;
+		iov.iov_len = result;
+		PageCache::WriteShared(dev, ino, ctx, &iov, 1, off, result);
+	}
+	return result;
 }
 
 ssize_t Vnode::pwritev(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
                        off_t off)
 {
-	return inode->pwritev(ctx, iov, iovcnt, off);
+	ssize_t result = inode->pwritev(ctx, iov, iovcnt, off);
+	Changed();
+	if ( S_ISREG(type) && 0 < result )
+		PageCache::WriteShared(dev, ino, ctx, iov, iovcnt, off, result);
+	return result;
 }
 
 int Vnode::utimens(ioctx_t* ctx, const struct timespec* times)
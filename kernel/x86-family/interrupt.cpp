@@ -23,9 +23,12 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <sortix/mman.h>
+
 #include <sortix/kernel/cpu.h>
 #include <sortix/kernel/interrupt.h>
 #include <sortix/kernel/kernel.h>
+#include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/random.h>
 #include <sortix/kernel/scheduler.h>
@@ -293,14 +296,33 @@ void UserCrashHandler(struct interrupt_context* intctx)
 	// Execute this crash handler with preemption on.
 	Interrupt::Enable();
 
+	// Accesses to pages not loaded yet from the backing file and writes to
+	// pages shared copy-on-write aren't crashes. Accesses to pages that can't
+	// be loaded from the backing file are bus errors.
+	int signum = SIGSEGV;
+	if ( intctx->int_no == 14 /* Page fault */ )
+	{
+		const uintptr_t PAGE_FAULT_WRITE = 1 << 1;
+		const uintptr_t PAGE_FAULT_INSTRUCTION = 1 << 4;
+		int access = PROT_READ;
+		if ( intctx->err_code & PAGE_FAULT_WRITE )
+			access = PROT_WRITE;
+		else if ( intctx->err_code & PAGE_FAULT_INSTRUCTION )
+			access = PROT_EXEC;
+		if ( Memory::HandlePageFault(CurrentProcess(), intctx->cr2, access) )
+			return;
+		if ( errno == EIO )
+			signum = SIGBUS;
+	}
+
 	// TODO: Also send signals for other types of user-space crashes.
 	if ( intctx->int_no == 14 /* Page fault */ )
 	{
-		struct sigaction* act = &CurrentProcess()->signal_actions[SIGSEGV];
+		struct sigaction* act = &CurrentProcess()->signal_actions[signum];
 		kthread_mutex_lock(&CurrentProcess()->signal_lock);
 		bool handled = act->sa_handler != SIG_DFL && act->sa_handler != SIG_IGN;
 		if ( handled )
-			CurrentThread()->DeliverSignalUnlocked(SIGSEGV);
+			CurrentThread()->DeliverSignalUnlocked(signum);
 		kthread_mutex_unlock(&CurrentProcess()->signal_lock);
 		if ( handled )
 		{
@@ -318,7 +340,7 @@ void UserCrashHandler(struct interrupt_context* intctx)
 
 	// Exit the process with the right error code.
 	// TODO: Send a SIGINT, SIGBUS, or whatever instead.
-	CurrentProcess()->ExitThroughSignal(SIGSEGV);
+	CurrentProcess()->ExitThroughSignal(signum);
 
 	// Deliver signals to this thread so it can exit correctly.
 	assert(Interrupt::IsEnabled());
@@ -49,11 +49,13 @@ namespace Sortix {
 namespace Page {
 
 void InitPushRegion(addr_t position, size_t length);
+void InitFrames();
 size_t pagesnotonstack = 0;
 size_t stackused = 0;
 size_t stackreserved = 0;
 size_t stacklength = 4096 / sizeof(addr_t);
 size_t totalmem = 0;
+size_t frames_end = 0;
 size_t page_usage_counts[PAGE_USAGE_NUM_KINDS];
 kthread_mutex_t pagelock = KTHREAD_MUTEX_INITIALIZER;
 
@@ -255,6 +257,10 @@ static void OnMemoryRegion(struct boot_info* boot_info,
 
 	// Count the amount of usable RAM.
 	Page::totalmem += length;
+	// The frame number is used rather than the address, which might not fit.
+	size_t end_frame = base / Page::Size() + length / Page::Size();
+	if ( Page::frames_end < end_frame )
+		Page::frames_end = end_frame;
 
 	// Give all the physical memory to the physical memory allocator, but make
 	// sure not to give it things we already use.
@@ -410,6 +416,17 @@ static void PostInitMultiboot2(struct boot_info* boot_info)
 	boot_info->cmdline = cmdline_tag ? cmdline_tag->string : "";
 }
 
+// Kernel addresses can only be freed in reverse order of allocation, so pages
+// are copied through a single window reserved once during boot.
+static addralloc_t copy_window;
+static kthread_mutex_t copy_window_lock = KTHREAD_MUTEX_INITIALIZER;
+
+// The kernel address space doesn't have any user-space memory, so new empty
+// address spaces are made by forking it, which is serialized as forking uses
+// the fork window of the address space.
+static addr_t kernel_addrspace;
+static kthread_mutex_t kernel_addrspace_lock = KTHREAD_MUTEX_INITIALIZER;
+
 // Initialize memory allocation using the boot information.
 void Init(struct boot_info* boot_info)
 {
@@ -474,6 +491,15 @@ void Init(struct boot_info* boot_info)
 	Unmap(mb2_pages + 4096);
 	Page::Put(mb2_pages + 0, PAGE_USAGE_WASNT_ALLOCATED);
 	Page::Put(mb2_pages + 4096, PAGE_USAGE_WASNT_ALLOCATED);
+
+	// Allocate the metadata of the physical frames.
+	Page::InitFrames();
+
+	// Reserve the window used to copy pages shared copy-on-write.
+	if ( !AllocateKernelAddress(&copy_window, Page::Size()) )
+		Panic("Failed to allocate the copy-on-write window");
+
+	kernel_addrspace = GetAddressSpace();
 }
 
 void Statistics(size_t* used, size_t* total, size_t* purposes)
@@ -677,8 +703,100 @@ void PutUnlocked(addr_t page, enum page_usage usage)
 	PageUsageRegisterFree(page, usage);
 }
 
+// Physical frames shared copy-on-write between address spaces and caches have
+// their number of references besides the owner's in the frame metadata, which
+// is indexed by the frame number. A frame without other references is freed
+// when it is put. Frames being accessed by devices are pinned, which counts as
+// a reference so the frame outlives its mappings until the transfer is done.
+struct frame
+{
+	uint32_t references;
+	uint32_t pins;
+};
+
+static struct frame* frames;
+static size_t frames_count;
+
+void InitFrames()
+{
+	frames_count = frames_end;
+	size_t size = AlignUp(frames_count * sizeof(struct frame));
+	addralloc_t alloc;
+	if ( !AllocateKernelAddress(&alloc, size) )
+		Panic("Failed to allocate the physical frame metadata");
+	if ( !Memory::MapRange(alloc.from, size, PROT_KREAD | PROT_KWRITE,
+	                       PAGE_USAGE_PHYSICAL) )
+		Panic("Out of memory allocating the physical frame metadata");
+	Memory::Flush();
+	frames = (struct frame*) alloc.from;
+	memset(frames, 0, size);
+}
+
+bool AddReference(addr_t page)
+{
+	assert(page == AlignDown(page));
+	size_t index = page / Size();
+	if ( frames_count <= index )
+		return false;
+	__atomic_fetch_add(&frames[index].references, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+// Returns true if another reference to the page remains after dropping one,
+// or false if the caller held the last reference and should free the page.
+static bool DropReference(addr_t page)
+{
+	size_t index = page / Size();
+	if ( frames_count <= index )
+		return false;
+	uint32_t* references = &frames[index].references;
+	uint32_t count = __atomic_load_n(references, __ATOMIC_ACQUIRE);
+	while ( count )
+	{
+		if ( __atomic_compare_exchange_n(references, &count, count - 1, false,
+		                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+			return true;
+	}
+	return false;
+}
+
+bool IsShared(addr_t page)
+{
+	size_t index = page / Size();
+	return index < frames_count &&
+	       __atomic_load_n(&frames[index].references, __ATOMIC_ACQUIRE);
+}
+
+bool Pin(addr_t page)
+{
+	assert(page == AlignDown(page));
+	size_t index = page / Size();
+	if ( frames_count <= index )
+		return false;
+	__atomic_fetch_add(&frames[index].references, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&frames[index].pins, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+void Unpin(addr_t page)
+{
+	size_t index = page / Size();
+	assert(index < frames_count);
+	__atomic_fetch_sub(&frames[index].pins, 1, __ATOMIC_RELEASE);
+	Put(page, PAGE_USAGE_USER_SPACE);
+}
+
+bool IsPinned(addr_t page)
+{
+	size_t index = page / Size();
+	return index < frames_count &&
+	       __atomic_load_n(&frames[index].pins, __ATOMIC_ACQUIRE);
+}
+
 void Put(addr_t page, enum page_usage usage)
 {
+	if ( usage == PAGE_USAGE_USER_SPACE && DropReference(page) )
+		return;
 	ScopedLock lock(&pagelock);
 	PutUnlocked(page, usage);
 }
@@ -745,6 +863,22 @@ int ProvidedProtection(int prot)
 	return PMLFlagsToProtection(ProtectionToPMLFlags(prot));
 }
 
+// Locate the page table entry for the virtual page, or return NULL if the page
+// tables leading up to it aren't present.
+static addr_t* LookUpEntry(addr_t mapto)
+{
+	const size_t MASK = (1<<TRANSBITS)-1;
+	size_t offset = 0;
+	for ( size_t i = TOPPMLLEVEL; i > 1; i-- )
+	{
+		size_t childid = mapto >> (12 + (i-1) * TRANSBITS) & MASK;
+		if ( !((PMLS[i] + offset)->entry[childid] & PML_PRESENT) )
+			return NULL;
+		offset = offset * ENTRIES + childid;
+	}
+	return &(PMLS[1] + offset)->entry[mapto >> 12 & MASK];
+}
+
 bool LookUp(addr_t mapto, addr_t* physical, int* protection)
 {
 	// Translate the virtual address into PML indexes.
@@ -845,6 +979,10 @@ bool UnmapRange(addr_t where, size_t bytes, enum page_usage usage)
 {
 	for ( addr_t page = where; page < where + bytes; page += 4096UL )
 	{
+		// Pages in demand paged segments may not have been faulted in yet.
+		addr_t* entry = LookUpEntry(page);
+		if ( !entry || !(*entry & PML_PRESENT) )
+			continue;
 		addr_t physicalpage = Unmap(page);
 		if ( physicalpage )
 			Page::Put(physicalpage, usage);
@@ -905,12 +1043,26 @@ bool Map(addr_t physical, addr_t mapto, int prot)
 	return MapInternal(physical, mapto, prot);
 }
 
+// Change the protection of a page, but keep copy-on-write pages read-only so
+// the first write still faults and makes a private copy, and keep whether the
+// page is shared and has been written to.
+static void Reprotect(addr_t phys, addr_t mapto, int protection)
+{
+	addr_t* entry = LookUpEntry(mapto);
+	bool cow = entry && (*entry & PML_COW);
+	addr_t keep = entry ? *entry & (PML_SHARED | PML_DIRTY) : 0;
+	Map(phys, mapto, protection);
+	*entry |= keep;
+	if ( cow )
+		*entry = (*entry & ~PML_WRITABLE) | PML_COW;
+}
+
 void PageProtect(addr_t mapto, int protection)
 {
 	addr_t phys;
 	if ( !LookUp(mapto, &phys, NULL) )
 		return;
-	Map(phys, mapto, protection);
+	Reprotect(phys, mapto, protection);
 }
 
 void PageProtectAdd(addr_t mapto, int protection)
@@ -920,7 +1072,7 @@ void PageProtectAdd(addr_t mapto, int protection)
 	if ( !LookUp(mapto, &phys, &prot) )
 		return;
 	prot |= protection;
-	Map(phys, mapto, prot);
+	Reprotect(phys, mapto, prot);
 }
 
 void PageProtectSub(addr_t mapto, int protection)
@@ -930,7 +1082,79 @@ void PageProtectSub(addr_t mapto, int protection)
 	if ( !LookUp(mapto, &phys, &prot) )
 		return;
 	prot &= ~protection;
-	Map(phys, mapto, prot);
+	Reprotect(phys, mapto, prot);
+}
+
+// Map a page shared with other address spaces or caches, such that the first
+// write makes a private copy of it.
+bool MapCopyOnWrite(addr_t physical, addr_t mapto, int prot)
+{
+	if ( !Map(physical, mapto, prot) )
+		return false;
+	addr_t* entry = LookUpEntry(mapto);
+	*entry = (*entry & ~PML_WRITABLE) | PML_COW;
+	return true;
+}
+
+// Map a page shared with other address spaces, such that writes are seen by
+// every address space mapping it, even after forking.
+bool MapShared(addr_t physical, addr_t mapto, int prot)
+{
+	return MapInternal(physical, mapto, prot, PML_SHARED);
+}
+
+// Returns whether the page has been written to since it was mapped or since
+// the last call, and forgets that it has been.
+bool ClearDirty(addr_t mapto)
+{
+	addr_t* entry = LookUpEntry(Page::AlignDown(mapto));
+	if ( !entry || !(*entry & PML_PRESENT) || !(*entry & PML_DIRTY) )
+		return false;
+	*entry &= ~PML_DIRTY;
+	InvalidatePage(Page::AlignDown(mapto));
+	return true;
+}
+
+bool IsCopyOnWrite(addr_t mapto)
+{
+	addr_t* entry = LookUpEntry(Page::AlignDown(mapto));
+	return entry && (*entry & PML_PRESENT) && (*entry & PML_COW);
+}
+
+// Give the current address space a private writable copy of a page shared
+// copy-on-write, or just make it writable if nobody else references it
+// anymore. The caller must have verified the page is meant to be writable.
+bool BreakCopyOnWrite(addr_t mapto)
+{
+	mapto = Page::AlignDown(mapto);
+	addr_t* entry = LookUpEntry(mapto);
+	if ( !entry || !(*entry & PML_PRESENT) || !(*entry & PML_COW) )
+		return true;
+	addr_t phys = *entry & PML_ADDRESS;
+	addr_t flags = (*entry & PML_FLAGS & ~PML_COW) | PML_WRITABLE;
+	if ( !Page::IsShared(phys) )
+	{
+		*entry = phys | flags;
+		InvalidatePage(mapto);
+		return true;
+	}
+	addr_t copy = Page::Get(PAGE_USAGE_USER_SPACE);
+	if ( !copy )
+		return false;
+	ScopedLock lock(&copy_window_lock);
+	if ( !Map(copy, copy_window.from, PROT_KREAD | PROT_KWRITE) )
+	{
+		Page::Put(copy, PAGE_USAGE_USER_SPACE);
+		return false;
+	}
+	InvalidatePage(copy_window.from);
+	memcpy((void*) copy_window.from, (const void*) mapto, Page::Size());
+	Unmap(copy_window.from);
+	InvalidatePage(copy_window.from);
+	*entry = copy | flags;
+	InvalidatePage(mapto);
+	Page::Put(phys, PAGE_USAGE_USER_SPACE);
+	return true;
 }
 
 addr_t Unmap(addr_t mapto)
@@ -1001,8 +1225,6 @@ void ForkCleanup(size_t i, size_t level)
 	}
 }
 
-// TODO: Copying every frame is endlessly useless in many uses. It'd be
-// nice to upgrade this to a copy-on-write algorithm.
 bool Fork(size_t level, size_t pmloffset)
 {
 	PML* destpml = FORKPML + level;
@@ -1017,6 +1239,30 @@ bool Fork(size_t level, size_t pmloffset)
 			continue;
 		}
 
+		// Pages of shared mappings stay shared and writable in both address
+		// spaces.
+		if ( level == 1 && (entry & PML_SHARED) &&
+		     Page::AddReference(entry & PML_ADDRESS) )
+		{
+			destpml->entry[i] = entry;
+			continue;
+		}
+
+		// Share user-space pages read-only between the address spaces and
+		// copy them only when either side writes to them. Fall back on
+		// copying the page right away if the reference can't be recorded.
+		// Pinned pages are copied right away, as a device might be writing
+		// to them on behalf of this address space.
+		if ( level == 1 && (entry & PML_USERSPACE) &&
+		     !Page::IsPinned(entry & PML_ADDRESS) &&
+		     Page::AddReference(entry & PML_ADDRESS) )
+		{
+			entry = (entry & ~PML_WRITABLE) | PML_COW;
+			(PMLS[level] + pmloffset)->entry[i] = entry;
+			destpml->entry[i] = entry;
+			continue;
+		}
+
 		enum page_usage usage = 1 < level ? PAGE_USAGE_PAGING_OVERHEAD
 		                                  : PAGE_USAGE_USER_SPACE;
 		addr_t phys = Page::Get(usage);
@@ -1079,9 +1325,13 @@ addr_t Fork()
 	if ( !Fork(dir, TOPPMLLEVEL, 0) )
 	{
 		Page::Put(dir, PAGE_USAGE_PAGING_OVERHEAD);
+		Flush();
 		return 0;
 	}
 
+	// The pages of the current address space may have become copy-on-write.
+	Flush();
+
 	// Now, the new top pml needs to have its fractal memory fixed.
 	const addr_t flags = PML_PRESENT | PML_WRITABLE;
 	addr_t mapto;
@@ -1101,5 +1351,15 @@ addr_t Fork()
 	return dir;
 }
 
+// Create an address space without any user-space memory.
+addr_t CreateAddressSpace()
+{
+	ScopedLock lock(&kernel_addrspace_lock);
+	addr_t previous = SwitchAddressSpace(kernel_addrspace);
+	addr_t result = Fork();
+	SwitchAddressSpace(previous);
+	return result;
+}
+
 } // namespace Memory
 } // namespace Sortix
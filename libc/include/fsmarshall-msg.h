@@ -40,11 +40,16 @@ extern "C" {
 #define FSM_MOUNT_CLOFORK (1 << 1)
 #define FSM_MOUNT_NOFOLLOW (1 << 2)
 #define FSM_MOUNT_NONBLOCK (1 << 3)
+/* The kernel keeps a channel open and sends further requests on it, possibly
+   before the previous requests are answered. The responses carry the msgid of
+   their request and their msgsize covers all the data following the header. */
+#define FSM_MOUNT_MULTIPLEX (1 << 4)
 
 struct fsm_msg_header
 {
 	size_t msgtype;
 	size_t msgsize;
+	size_t msgid;
 	uid_t uid;
 	gid_t gid;
 };
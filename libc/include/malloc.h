@@ -40,7 +40,12 @@
 extern "C" {
 #endif
 
+/* Options for mallopt. */
+#define M_TRIM_THRESHOLD (-1)
+#define M_THREAD_CACHE (-100) /* Sortix extension. */
+
 int heap_get_paranoia(void);
+int mallopt(int, int);
 /* TODO: Operations to verify pointers and consistency check the heap. */
 
 /* NOTE: The following declarations are heap internals and are *NOT* part of the
@@ -84,6 +89,21 @@ int heap_get_paranoia(void);
 #endif
 #endif
 
+/* Threads keep caches of small free chunks in user-space, so most allocations
+   and deallocations don't need the heap lock. */
+#if !defined(__is_sortix_libk) && !defined(HEAP_GUARD_DEBUG)
+#define HEAP_THREAD_CACHE
+#endif
+
+/* Large unused areas of the heap are returned to the kernel in user-space,
+   either by unmapping parts of the heap that become entirely unused, by
+   shrinking the current part when a large unused chunk ends it, or otherwise by
+   discarding the whole pages inside large unused chunks. */
+#if !defined(__is_sortix_libk) && !defined(HEAP_GUARD_DEBUG)
+#define HEAP_TRIM
+#define HEAP_TRIM_THRESHOLD_DEFAULT (128 * 1024)
+#endif
+
 #if defined(HEAP_GUARD_DEBUG)
 struct heap_alloc
 {
@@ -202,8 +222,35 @@ static_assert(sizeof(struct heap_part_post) * 8 == 6 * __WORDSIZE,
 static_assert(alignof(struct heap_part_post) * 8 == __WORDSIZE,
              "alignof(struct heap_part_post) * 8 == __WORDSIZE");
 
+#if defined(HEAP_THREAD_CACHE)
+/* The chunk sizes are multiples of this unit, and each chunk size up to a limit
+   has its own class in the thread cache. The smallest chunk isn't cached as it
+   has no room for the link to the next cached chunk. */
+#define HEAP_CACHE_UNIT (4 * sizeof(size_t))
+#define HEAP_CACHE_CLASSES 32
+#define HEAP_CACHE_CLASS_BYTES 8192
+#define HEAP_CACHE_BATCH_MAX 32
+
+/* This structure describes the chunks cached by a thread. The cached chunks
+   are used as far as the heap is concerned, and the first word of their data
+   links to the next chunk in the class. */
+struct heap_thread_cache
+{
+	struct heap_chunk* class_first[HEAP_CACHE_CLASSES + 1];
+	size_t class_count[HEAP_CACHE_CLASSES + 1];
+};
+#endif
+
 /* Global secret variables used internally by the heap. */
 extern struct heap_state __heap_state;
+#if defined(HEAP_THREAD_CACHE)
+extern __thread struct heap_thread_cache __heap_thread_cache;
+/* Accessed with relaxed atomics as mallopt may change it at any time. */
+extern bool __heap_thread_cache_enabled;
+#endif
+#if defined(HEAP_TRIM)
+extern size_t __heap_trim_threshold;
+#endif
 
 /* Internal heap functions. */
 bool __heap_expand_current_part(size_t);
@@ -212,6 +259,14 @@ void __heap_unlock(void);
 #if !defined(HEAP_NO_ASSERT)
 void __heap_verify(void);
 #endif
+#if defined(HEAP_THREAD_CACHE)
+struct heap_chunk* __heap_thread_cache_refill(size_t);
+void __heap_thread_cache_drain(size_t);
+void __heap_thread_cache_flush(void);
+#endif
+#if defined(HEAP_TRIM)
+void __heap_trim(struct heap_chunk*);
+#endif
 
 #if !defined(HEAP_NO_ASSERT)
 /* Utility function to verify addresses are well-aligned. */
@@ -648,6 +703,142 @@ struct heap_chunk* heap_chunk_combine_neighbors(struct heap_chunk* chunk)
 	return chunk;
 }
 
+/* Allocates a chunk of at least the given size from the heap, optionally
+   expanding the heap if no free chunk is large enough. */
+__attribute__((unused)) static inline
+struct heap_chunk* heap_allocate_chunk(size_t chunk_size, bool expand)
+{
+	/* Decide which bins are large enough for our allocation. */
+	size_t smallest_desirable_bin = heap_bin_for_allocation(chunk_size);
+	size_t smallest_desirable_bin_size = heap_size_of_bin(smallest_desirable_bin);
+	size_t desirable_bins = ~0UL << smallest_desirable_bin;
+
+	/* Determine whether there are any bins that we can use. */
+	size_t usable_bins = desirable_bins & __heap_state.bin_filled_bitmap;
+
+	/* If there are no usable bins, attempt to expand the current part of the
+	   heap or create a new part. */
+	if ( !usable_bins && expand &&
+	     __heap_expand_current_part(smallest_desirable_bin_size) )
+		usable_bins = desirable_bins & __heap_state.bin_filled_bitmap;
+
+	/* If we failed to expand the current part or make a new one - then we are
+	   officially out of memory until someone deallocates something. */
+	if ( !usable_bins )
+		return NULL;
+
+	/* Pick the smallest of the usable bins. */
+	size_t bin_index = heap_bsf(usable_bins);
+
+	/* Pick the first element of this bins linked list. This is our
+	   allocation. */
+	struct heap_chunk* result_chunk = __heap_state.bin[bin_index];
+	assert(result_chunk);
+	assert(HEAP_IS_POINTER_ALIGNED(result_chunk, result_chunk->chunk_size));
+
+	assert(chunk_size <= result_chunk->chunk_size);
+
+	/* Mark our chosen chunk as used and remove it from its bin. */
+	heap_remove_chunk(result_chunk);
+
+	/* If our chunk is larger than what we really needed and it is possible to
+	   split the chunk into two, then we should split off a part of it and
+	   return it to the heap for further allocation. */
+	if ( heap_can_split_chunk(result_chunk, chunk_size) )
+		heap_split_chunk(result_chunk, chunk_size);
+
+	return result_chunk;
+}
+
+/* Returns the memory of an unused chunk to the kernel if it's large enough and
+   ends its part. */
+__attribute__((unused)) static inline
+void heap_trim_chunk(struct heap_chunk* chunk)
+{
+#if defined(HEAP_TRIM)
+	if ( __heap_trim_threshold <= chunk->chunk_size )
+		__heap_trim(chunk);
+#else
+	(void) chunk;
+#endif
+}
+
+/* Returns a used chunk to the heap. */
+__attribute__((unused)) static inline
+void heap_free_chunk(struct heap_chunk* chunk)
+{
+	/* Return the chunk to the heap. */
+	heap_insert_chunk(chunk);
+
+	/* Combine the chunk with its left and right neighbors if they are
+	   unused. */
+	chunk = heap_chunk_combine_neighbors(chunk);
+
+	heap_trim_chunk(chunk);
+}
+
+#if defined(HEAP_THREAD_CACHE)
+/* Returns whether chunks of this size are kept in the thread cache. */
+__attribute__((unused)) static inline
+bool heap_cache_has_class(size_t chunk_size)
+{
+	return HEAP_CACHE_UNIT < chunk_size &&
+	       chunk_size <= HEAP_CACHE_CLASSES * HEAP_CACHE_UNIT;
+}
+
+/* Returns the thread cache class of chunks of this size. */
+__attribute__((unused)) static inline
+size_t heap_cache_class(size_t chunk_size)
+{
+	assert(heap_cache_has_class(chunk_size));
+	assert(chunk_size % HEAP_CACHE_UNIT == 0);
+
+	return chunk_size / HEAP_CACHE_UNIT;
+}
+
+/* Returns how many chunks the thread cache keeps of a class at most. */
+__attribute__((unused)) static inline
+size_t heap_cache_class_limit(size_t cache_class)
+{
+	size_t limit = HEAP_CACHE_CLASS_BYTES / (cache_class * HEAP_CACHE_UNIT);
+	return limit < 8 ? 8 : limit;
+}
+
+/* Returns how many chunks are moved at once between the heap and the thread
+   cache. */
+__attribute__((unused)) static inline
+size_t heap_cache_class_batch(size_t cache_class)
+{
+	size_t batch = heap_cache_class_limit(cache_class) / 2;
+	return HEAP_CACHE_BATCH_MAX < batch ? HEAP_CACHE_BATCH_MAX : batch;
+}
+
+/* Adds a chunk to the thread cache. */
+__attribute__((unused)) static inline
+void heap_cache_push(size_t cache_class, struct heap_chunk* chunk)
+{
+	struct heap_thread_cache* cache = &__heap_thread_cache;
+	*(struct heap_chunk**) heap_chunk_to_data(chunk) =
+		cache->class_first[cache_class];
+	cache->class_first[cache_class] = chunk;
+	cache->class_count[cache_class]++;
+}
+
+/* Removes a chunk from the thread cache, if any. */
+__attribute__((unused)) static inline
+struct heap_chunk* heap_cache_pop(size_t cache_class)
+{
+	struct heap_thread_cache* cache = &__heap_thread_cache;
+	struct heap_chunk* chunk = cache->class_first[cache_class];
+	if ( !chunk )
+		return NULL;
+	cache->class_first[cache_class] =
+		*(struct heap_chunk**) heap_chunk_to_data(chunk);
+	cache->class_count[cache_class]--;
+	return chunk;
+}
+#endif
+
 #endif
 
 #ifdef __cplusplus
@@ -36,6 +36,9 @@
 #define IF_TYPE_ETHERNET 2
 
 #define IF_FEATURE_ETHERNET_CRC_OFFLOAD (1 << 0)
+#define IF_FEATURE_CHECKSUM_OFFLOAD (1 << 1)
+#define IF_FEATURE_SCATTER_GATHER (1 << 2)
+#define IF_FEATURE_TCP_SEGMENTATION_OFFLOAD (1 << 3)
 
 struct if_info
 {
@@ -55,6 +58,16 @@ struct if_status
 	size_t mtu;
 };
 
+struct if_stats
+{
+	uint64_t rx_packets;
+	uint64_t tx_packets;
+	uint64_t interrupts;
+	uint64_t polls;
+	uint64_t polls_exhausted;
+	unsigned int interrupt_rate;
+};
+
 struct if_config_ether
 {
 	struct ether_addr address;
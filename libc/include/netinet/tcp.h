@@ -76,6 +76,17 @@ struct tcphdr
 #define TCPOPT_MAXSEG 2 /* Maximum Segment Size. */
 #define TCPOLEN_MAXSEG 4 /* Length of Maximum Segment Size. */
 
+#define TCPOPT_WINDOW 3 /* Window Scale. */
+#define TCPOLEN_WINDOW 3 /* Length of Window Scale. */
+
+#define TCP_MAX_WINSHIFT 14 /* Maximum Window Scale shift. */
+
+#define TCPOPT_SACK_PERMITTED 4 /* Selective Acknowledgement Permitted. */
+#define TCPOLEN_SACK_PERMITTED 2 /* Length of Selective Acknowledgement Permitted. */
+
+#define TCPOPT_SACK 5 /* Selective Acknowledgement. */
+#define TCPOLEN_SACK 8 /* Length of each Selective Acknowledgement block. */
+
 /* Maximum header size: 16 * 4 bytes */
 #define TCP_MAXHLEN 64
 
@@ -89,5 +100,6 @@ struct tcphdr
 #define TCP_NODELAY 1
 #define TCP_MAXSEG 2
 #define TCP_NOPUSH 3
+#define TCP_CORK TCP_NOPUSH
 
 #endif
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * spawn.h
+ * Process spawning.
+ */
+
+#ifndef _INCLUDE_SPAWN_H
+#define _INCLUDE_SPAWN_H
+
+#include <sys/cdefs.h>
+
+#include <sys/__/types.h>
+
+#include <sortix/sigset.h>
+
+#if defined(__is_sortix_libc)
+#include <stdbool.h>
+#endif
+
+#ifndef __mode_t_defined
+#define __mode_t_defined
+typedef __mode_t mode_t;
+#endif
+
+#ifndef __pid_t_defined
+#define __pid_t_defined
+typedef __pid_t pid_t;
+#endif
+
+#ifndef __size_t_defined
+#define __size_t_defined
+#define __need_size_t
+#include <stddef.h>
+#endif
+
+#define POSIX_SPAWN_RESETIDS (1 << 0)
+#define POSIX_SPAWN_SETPGROUP (1 << 1)
+#define POSIX_SPAWN_SETSIGDEF (1 << 2)
+#define POSIX_SPAWN_SETSIGMASK (1 << 3)
+#define POSIX_SPAWN_SETSID (1 << 7)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+#if defined(__is_sortix_libc)
+	short flags;
+	pid_t pgroup;
+	sigset_t sigdefault;
+	sigset_t sigmask;
+#else
+	short __flags;
+	pid_t __pgroup;
+	sigset_t __sigdefault;
+	sigset_t __sigmask;
+#endif
+} posix_spawnattr_t;
+
+struct __posix_spawn_file_action;
+
+typedef struct
+{
+#if defined(__is_sortix_libc)
+	struct __posix_spawn_file_action* actions;
+	size_t actions_used;
+	size_t actions_length;
+#else
+	struct __posix_spawn_file_action* __actions;
+	size_t __actions_used;
+	size_t __actions_length;
+#endif
+} posix_spawn_file_actions_t;
+
+#if defined(__is_sortix_libc)
+enum __posix_spawn_file_action_type
+{
+	__POSIX_SPAWN_FILE_ACTION_OPEN,
+	__POSIX_SPAWN_FILE_ACTION_CLOSE,
+	__POSIX_SPAWN_FILE_ACTION_DUP2,
+	__POSIX_SPAWN_FILE_ACTION_CHDIR,
+	__POSIX_SPAWN_FILE_ACTION_FCHDIR,
+};
+
+struct __posix_spawn_file_action
+{
+	enum __posix_spawn_file_action_type type;
+	int fd;
+	int newfd;
+	int oflag;
+	mode_t mode;
+	char* path;
+};
+#endif
+
+int posix_spawn(pid_t* __restrict, const char* __restrict,
+                const posix_spawn_file_actions_t*,
+                const posix_spawnattr_t* __restrict,
+                char* const[__restrict], char* const[__restrict]);
+int posix_spawn_file_actions_addchdir(posix_spawn_file_actions_t* __restrict,
+                                      const char* __restrict);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t*, int);
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t*, int, int);
+int posix_spawn_file_actions_addfchdir(posix_spawn_file_actions_t*, int);
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t* __restrict,
+                                     int, const char* __restrict, int, mode_t);
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t*);
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t*);
+int posix_spawnattr_destroy(posix_spawnattr_t*);
+int posix_spawnattr_getflags(const posix_spawnattr_t* __restrict,
+                             short* __restrict);
+int posix_spawnattr_getpgroup(const posix_spawnattr_t* __restrict,
+                              pid_t* __restrict);
+int posix_spawnattr_getsigdefault(const posix_spawnattr_t* __restrict,
+                                  sigset_t* __restrict);
+int posix_spawnattr_getsigmask(const posix_spawnattr_t* __restrict,
+                               sigset_t* __restrict);
+int posix_spawnattr_init(posix_spawnattr_t*);
+int posix_spawnattr_setflags(posix_spawnattr_t*, short);
+int posix_spawnattr_setpgroup(posix_spawnattr_t*, pid_t);
+int posix_spawnattr_setsigdefault(posix_spawnattr_t* __restrict,
+                                  const sigset_t* __restrict);
+int posix_spawnattr_setsigmask(posix_spawnattr_t* __restrict,
+                               const sigset_t* __restrict);
+int posix_spawnp(pid_t* __restrict, const char* __restrict,
+                 const posix_spawn_file_actions_t*,
+                 const posix_spawnattr_t* __restrict,
+                 char* const[__restrict], char* const[__restrict]);
+
+#if defined(__is_sortix_libc)
+int __posix_spawn(pid_t* __restrict, const char* __restrict,
+                  const posix_spawn_file_actions_t*,
+                  const posix_spawnattr_t* __restrict,
+                  char* const[__restrict], char* const[__restrict], bool);
+int __posix_spawn_file_actions_add(posix_spawn_file_actions_t*,
+                                   const struct __posix_spawn_file_action*);
+#endif
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
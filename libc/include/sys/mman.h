@@ -46,8 +46,10 @@ typedef __off_t off_t;
 #include <stddef.h>
 #endif
 
+int madvise(void*, size_t, int);
 void* mmap(void*, size_t, int, int, int, off_t);
 int mprotect(void*, size_t, int);
+int msync(void*, size_t, int);
 int munmap(void*, size_t);
 
 #ifdef __cplusplus
@@ -156,6 +156,9 @@ struct linger
 #endif
 #define MSG_CMSG_CLOEXEC (1<<9)
 #define MSG_CMSG_CLOFORK (1<<10)
+#if __USE_SORTIX
+#define MSG_MORE (1<<11)
+#endif
 
 #define AF_UNSPEC 0
 #define AF_INET 1
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * malloc/__heap_thread_cache_drain.c
+ * Returns a batch of chunks in the thread cache to the heap.
+ */
+
+#include <malloc.h>
+
+#if defined(HEAP_NO_ASSERT)
+#define __heap_verify() ((void) 0)
+#undef assert
+#define assert(x) do { ((void) 0); } while ( 0 )
+#endif
+
+void __heap_thread_cache_drain(size_t cache_class)
+{
+	size_t batch = heap_cache_class_batch(cache_class);
+
+	__heap_lock();
+	__heap_verify();
+
+	struct heap_chunk* chunk;
+	for ( size_t i = 0; i < batch && (chunk = heap_cache_pop(cache_class)); i++ )
+		heap_free_chunk(chunk);
+
+	__heap_verify();
+	__heap_unlock();
+}
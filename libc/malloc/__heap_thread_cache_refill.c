@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * malloc/__heap_thread_cache_refill.c
+ * Refills the thread cache with a batch of chunks from the heap.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+
+#if defined(HEAP_NO_ASSERT)
+#define __heap_verify() ((void) 0)
+#undef assert
+#define assert(x) do { ((void) 0); } while ( 0 )
+#endif
+
+struct heap_chunk* __heap_thread_cache_refill(size_t chunk_size)
+{
+	size_t cache_class = heap_cache_class(chunk_size);
+	size_t batch = heap_cache_class_batch(cache_class);
+
+	__heap_lock();
+	__heap_verify();
+
+	struct heap_chunk* result = heap_allocate_chunk(chunk_size, true);
+
+	// Only expand the heap for the chunk actually requested, the rest of the
+	// batch is just opportunistic.
+	int errno_saved = errno;
+	for ( size_t i = 1; result && i < batch; i++ )
+	{
+		struct heap_chunk* chunk = heap_allocate_chunk(chunk_size, false);
+		if ( !chunk )
+			break;
+		// The chunk is larger if it couldn't be split, in which case it doesn't
+		// belong to the class and the heap has run dry anyway.
+		if ( chunk->chunk_size != chunk_size )
+		{
+			heap_free_chunk(chunk);
+			break;
+		}
+		heap_cache_push(cache_class, chunk);
+	}
+	errno = errno_saved;
+
+	__heap_verify();
+	__heap_unlock();
+
+	return result;
+}
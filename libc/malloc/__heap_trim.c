@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * malloc/__heap_trim.c
+ * Returns the memory of a large unused chunk at the end of a part to the kernel.
+ */
+
+#include <sys/mman.h>
+
+#include <malloc.h>
+#include <stdint.h>
+#include <unistd.h>
+
+size_t __heap_trim_threshold = HEAP_TRIM_THRESHOLD_DEFAULT;
+
+// Unused chunks in the middle of the heap can't be unmapped, so their whole
+// pages are discarded instead. The size of the chunk when discarded is recorded
+// after its header, keyed by its address so stale data isn't mistaken for a
+// record, and the chunk isn't discarded again until it has grown by the
+// threshold, so freeing small chunks next to it stays cheap.
+struct heap_discard
+{
+	uintptr_t discard_key;
+	size_t discard_size;
+};
+
+static void heap_discard_chunk(struct heap_chunk* chunk)
+{
+	size_t page_size = getpagesize();
+	struct heap_discard* record = (struct heap_discard*) (chunk + 1);
+	uintptr_t from = (uintptr_t) (record + 1);
+	from = -(-from & ~(page_size - 1));
+	uintptr_t to = (uintptr_t) heap_chunk_to_post(chunk) & ~(page_size - 1);
+	if ( to <= from )
+		return;
+	uintptr_t key = ~(uintptr_t) chunk;
+	if ( record->discard_key == key &&
+	     record->discard_size <= chunk->chunk_size &&
+	     chunk->chunk_size - record->discard_size < __heap_trim_threshold )
+		return;
+	madvise((void*) from, to - from, MADV_DONTNEED);
+	record->discard_key = key;
+	record->discard_size = chunk->chunk_size;
+}
+
+void __heap_trim(struct heap_chunk* chunk)
+{
+	assert(!heap_chunk_is_used(chunk));
+
+	if ( heap_chunk_right(chunk) )
+	{
+		heap_discard_chunk(chunk);
+		return;
+	}
+
+	struct heap_part_post* post = (struct heap_part_post*)
+		((uint8_t*) chunk + chunk->chunk_size);
+	assert(post->part_magic == HEAP_PART_MAGIC);
+	struct heap_part* part = heap_post_to_part(post);
+
+	// Unmap the part entirely if the chunk is all there is to it, except for
+	// the current part, which would likely just be recreated right away.
+	if ( !heap_chunk_left(chunk) && part != __heap_state.current_part )
+	{
+		heap_remove_chunk(chunk);
+		struct heap_part* part_prev = post->part_prev;
+		struct heap_part* part_next = part->part_next;
+		// The current part is the first in the list, so there is always a
+		// previous part.
+		assert(part_prev);
+		part_prev->part_next = part_next;
+		if ( part_next )
+			heap_part_to_post(part_next)->part_prev = part_prev;
+		munmap(part, part->part_size);
+		return;
+	}
+
+	// Otherwise shrink the current part like the top of a traditional heap,
+	// which is where the heap grows. Half the threshold is kept unused so
+	// alternately allocating and freeing at the end of the heap doesn't map
+	// and unmap memory every time, and the part isn't trimmed again until the
+	// chunk grows by as much. Other parts can't shrink as the heap grows into
+	// their ends, so their pages are discarded instead.
+	if ( part != __heap_state.current_part )
+	{
+		heap_discard_chunk(chunk);
+		return;
+	}
+	size_t page_size = getpagesize();
+	size_t keep = __heap_trim_threshold / 2;
+	if ( keep < page_size )
+		keep = page_size;
+	if ( chunk->chunk_size <= keep )
+		return;
+	size_t release = (chunk->chunk_size - keep) & ~(page_size - 1);
+	if ( !release )
+		return;
+	struct heap_part* part_prev = post->part_prev;
+	size_t chunk_size = chunk->chunk_size - release;
+	heap_remove_chunk(chunk);
+	part->part_size -= release;
+	struct heap_part_post* new_post = heap_part_to_post(part);
+	new_post->part_magic = HEAP_PART_MAGIC;
+	new_post->part_prev = part_prev;
+	new_post->part_size = part->part_size;
+	new_post->unused[0] = 0;
+	new_post->unused[1] = 0;
+	new_post->unused[2] = 0;
+	heap_insert_chunk(heap_chunk_format((uint8_t*) chunk, chunk_size));
+	munmap(heap_part_end(part), release);
+}
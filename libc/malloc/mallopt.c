@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * malloc/mallopt.c
+ * Adjusts the behavior of the memory allocator.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+
+int mallopt(int param, int value)
+{
+	switch ( param )
+	{
+	case M_TRIM_THRESHOLD:
+		__heap_lock();
+		// A negative threshold disables returning memory to the kernel.
+		__heap_trim_threshold = value < 0 ? SIZE_MAX : (size_t) value;
+		__heap_unlock();
+		return 1;
+#if defined(HEAP_THREAD_CACHE)
+	case M_THREAD_CACHE:
+		// Chunks already in the thread caches stay there, but new allocations
+		// and deallocations go straight to the heap while disabled.
+		__atomic_store_n(&__heap_thread_cache_enabled, value != 0,
+		                 __ATOMIC_RELAXED);
+		return 1;
+#endif
+	default:
+		return errno = EINVAL, 0;
+	}
+}
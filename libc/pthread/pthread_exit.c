@@ -19,6 +19,7 @@
 
 #include <sys/mman.h>
 
+#include <malloc.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -51,6 +52,11 @@ void pthread_exit(void* return_value)
 	thread->keys_length = 0;
 	pthread_mutex_unlock(&__pthread_keys_lock);
 
+#if defined(HEAP_THREAD_CACHE)
+	// Give the chunks cached by this thread back to the heap.
+	__heap_thread_cache_flush();
+#endif
+
 	pthread_mutex_lock(&thread->detach_lock);
 	thread->exit_result = return_value;
 	int exit_flags = 0;
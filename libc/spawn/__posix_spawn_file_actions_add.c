@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * spawn/__posix_spawn_file_actions_add.c
+ * Append a process spawning file action.
+ */
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+
+int __posix_spawn_file_actions_add(posix_spawn_file_actions_t* file_actions,
+                                   const struct __posix_spawn_file_action* action)
+{
+	if ( file_actions->actions_used == file_actions->actions_length )
+	{
+		size_t old_length = file_actions->actions_length;
+		size_t new_length = old_length ? 2 * old_length : 4;
+		struct __posix_spawn_file_action* new_actions =
+			reallocarray(file_actions->actions, new_length,
+			             sizeof(struct __posix_spawn_file_action));
+		if ( !new_actions )
+			return errno;
+		file_actions->actions = new_actions;
+		file_actions->actions_length = new_length;
+	}
+	struct __posix_spawn_file_action* copy =
+		&file_actions->actions[file_actions->actions_used];
+	memcpy(copy, action, sizeof(*copy));
+	if ( action->path && !(copy->path = strdup(action->path)) )
+		return errno;
+	file_actions->actions_used++;
+	return 0;
+}
@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * spawn/posix_spawn.c
+ * Spawn a process.
+ */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// The child runs on its own stack in the memory of the parent until it has
+// executed the program, so it must not allocate memory. The parent prepares the
+// buffers needed to search for the program and run it with the shell.
+struct spawn_args
+{
+	const char* path;
+	const posix_spawn_file_actions_t* file_actions;
+	const posix_spawnattr_t* attr;
+	char* const* argv;
+	char* const* envp;
+	bool search;
+	sigset_t oldset;
+	char* path_buffer;
+	char* shell_path_buffer;
+	char** shell_argv;
+	int error;
+};
+
+static const size_t SPAWN_STACK_SIZE = 64 * 1024;
+
+static bool spawn_file_action(const struct __posix_spawn_file_action* action)
+{
+	switch ( action->type )
+	{
+	case __POSIX_SPAWN_FILE_ACTION_OPEN:
+	{
+		int fd = open(action->path, action->oflag, action->mode);
+		if ( fd < 0 )
+			return false;
+		if ( fd != action->fd )
+		{
+			if ( dup2(fd, action->fd) < 0 )
+				return false;
+			close(fd);
+		}
+		return true;
+	}
+	case __POSIX_SPAWN_FILE_ACTION_CLOSE:
+		return close(action->fd) == 0 || errno == EBADF;
+	case __POSIX_SPAWN_FILE_ACTION_DUP2:
+		// Unlike dup2, the descriptor inherits across exec even if it is the
+		// same descriptor.
+		if ( action->fd == action->newfd )
+		{
+			int flags = fcntl(action->fd, F_GETFD);
+			return 0 <= flags &&
+			       0 <= fcntl(action->fd, F_SETFD, flags & ~FD_CLOEXEC);
+		}
+		return 0 <= dup2(action->fd, action->newfd);
+	case __POSIX_SPAWN_FILE_ACTION_CHDIR:
+		return chdir(action->path) == 0;
+	case __POSIX_SPAWN_FILE_ACTION_FCHDIR:
+		return fchdir(action->fd) == 0;
+	}
+	return errno = EINVAL, false;
+}
+
+static const char* spawn_lookup_path(char* const* envp)
+{
+	for ( size_t i = 0; envp && envp[i]; i++ )
+		if ( !strncmp(envp[i], "PATH=", strlen("PATH=")) )
+			return envp[i] + strlen("PATH=");
+	return NULL;
+}
+
+static void spawn_search(struct spawn_args* args, const char* filename,
+                         char* const* argv, char* buffer);
+
+// Execute the file, or run it with the shell if it isn't a known format.
+static void spawn_attempt(struct spawn_args* args, const char* filename,
+                          const char* original, char* const* argv)
+{
+	execve(filename, argv, args->envp);
+
+	if ( errno != ENOEXEC )
+		return;
+
+	// Prevent attempting to run the shell using itself in an endless loop if it
+	// happens to be an unknown format or a shell script itself.
+	if ( !strcmp(original, "sh") )
+	{
+		errno = ENOEXEC;
+		return;
+	}
+
+	size_t argc = 0;
+	while ( argv[argc] )
+		argc++;
+
+	char** shell_argv = args->shell_argv;
+	shell_argv[0] = (char*) "sh";
+	shell_argv[1] = (char*) filename;
+	for ( size_t i = 1; i < argc; i++ )
+		shell_argv[1 + i] = argv[i];
+	shell_argv[1 + argc] = (char*) NULL;
+
+	spawn_search(args, "sh", shell_argv, args->shell_path_buffer);
+
+	errno = ENOEXEC;
+}
+
+// NOTE: The PATH-searching logic is repeated multiple places. Until this logic
+//       can be shared somehow, you need to keep this comment in sync as well
+//       as the logic in these files:
+//         * kernel/process.cpp
+//         * libc/spawn/posix_spawn.c
+//         * libc/unistd/execvpe.c
+//         * utils/which.c
+// NOTE: See comments in execvpe() for algorithmic commentary.
+
+static void spawn_search(struct spawn_args* args, const char* filename,
+                         char* const* argv, char* buffer)
+{
+	if ( !filename[0] )
+	{
+		errno = ENOENT;
+		return;
+	}
+
+	const char* path = spawn_lookup_path(args->envp);
+	bool search_path = !strchr(filename, '/') && path;
+	bool any_tries = false;
+	bool any_eacces = false;
+
+	while ( search_path && *path )
+	{
+		size_t len = strcspn(path, ":");
+		if ( !len )
+		{
+			path++;
+			continue;
+		}
+
+		any_tries = true;
+
+		memcpy(buffer, path, len);
+		if ( (path += len)[0] == ':' )
+			path++;
+		while ( len && buffer[len - 1] == '/' )
+			len--;
+		buffer[len] = '/';
+		strcpy(buffer + len + 1, filename);
+
+		spawn_attempt(args, buffer, filename, argv);
+
+		if ( errno == ENOENT )
+			continue;
+
+		if ( errno == ELOOP ||
+		     errno == EISDIR ||
+		     errno == ENAMETOOLONG ||
+		     errno == ENOTDIR )
+			continue;
+
+		if ( errno == EACCES )
+		{
+			any_eacces = true;
+			continue;
+		}
+
+		break;
+	}
+
+	if ( !any_tries )
+		spawn_attempt(args, filename, filename, argv);
+
+	if ( any_eacces )
+		errno = EACCES;
+}
+
+// Prepare the child and execute the program, or return on failure.
+static void spawn_child(struct spawn_args* args)
+{
+	const posix_spawnattr_t* attr = args->attr;
+	short flags = attr ? attr->flags : 0;
+	if ( (flags & POSIX_SPAWN_SETSID) && setsid() < 0 )
+		return;
+	if ( (flags & POSIX_SPAWN_SETPGROUP) && setpgid(0, attr->pgroup) < 0 )
+		return;
+	if ( (flags & POSIX_SPAWN_RESETIDS) &&
+	     (setegid(getgid()) < 0 || seteuid(getuid()) < 0) )
+		return;
+	// Signal handlers of the parent must not run in the child before exec, so
+	// reset them all to the default action while signals are still blocked.
+	for ( int signum = 1; signum < __SIG_MAX_NUM; signum++ )
+	{
+		struct sigaction sa;
+		if ( sigaction(signum, NULL, &sa) < 0 )
+			continue;
+		bool reset = sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN;
+		if ( (flags & POSIX_SPAWN_SETSIGDEF) &&
+		     sigismember(&attr->sigdefault, signum) == 1 )
+			reset = true;
+		if ( !reset )
+			continue;
+		sa.sa_handler = SIG_DFL;
+		sa.sa_flags = 0;
+		sigemptyset(&sa.sa_mask);
+		sigaction(signum, &sa, NULL);
+	}
+	const posix_spawn_file_actions_t* file_actions = args->file_actions;
+	for ( size_t i = 0; file_actions && i < file_actions->actions_used; i++ )
+		if ( !spawn_file_action(&file_actions->actions[i]) )
+			return;
+	const sigset_t* mask = flags & POSIX_SPAWN_SETSIGMASK ?
+	                       &attr->sigmask : &args->oldset;
+	sigprocmask(SIG_SETMASK, mask, NULL);
+	if ( args->search )
+		spawn_search(args, args->path, args->argv, args->path_buffer);
+	else
+		execve(args->path, args->argv, args->envp);
+}
+
+// The parent is suspended until the child has executed the program or exited,
+// so the child reports why it failed through the shared memory.
+static void spawn_entry(struct spawn_args* args)
+{
+	spawn_child(args);
+	args->error = errno ? errno : ENOEXEC;
+	_exit(127);
+}
+
+#if defined(__i386__)
+static void spawn_setup_registers(struct tfork* regs, struct spawn_args* args,
+                                  void* stack, size_t stack_size)
+{
+	regs->eip = (uintptr_t) spawn_entry;
+	regs->gsbase = (unsigned long) pthread_self();
+	unsigned long* sp = (unsigned long*) ((uint8_t*) stack + stack_size);
+	*--sp = 0; // Alignment.
+	*--sp = 0; // Alignment.
+	*--sp = 0; // Alignment.
+	*--sp = (unsigned long) args;
+	*--sp = 0; // eip=0
+	regs->esp = (uintptr_t) sp;
+	regs->ebp = 0;
+}
+#elif defined(__x86_64__)
+static void spawn_setup_registers(struct tfork* regs, struct spawn_args* args,
+                                  void* stack, size_t stack_size)
+{
+	regs->rip = (uintptr_t) spawn_entry;
+	regs->rdi = (uintptr_t) args;
+	regs->fsbase = (unsigned long) pthread_self();
+	unsigned long* sp = (unsigned long*) ((uint8_t*) stack + stack_size);
+	*--sp = 0; // rip=0
+	regs->rsp = (uintptr_t) sp;
+	regs->rbp = 0;
+}
+#else
+#error "You need to implement spawn_setup_registers for your platform"
+#endif
+
+int __posix_spawn(pid_t* restrict pid_ptr,
+                  const char* restrict path,
+                  const posix_spawn_file_actions_t* file_actions,
+                  const posix_spawnattr_t* restrict attr,
+                  char* const argv[restrict],
+                  char* const envp[restrict],
+                  bool search)
+{
+	struct spawn_args args;
+	memset(&args, 0, sizeof(args));
+	args.path = path;
+	args.file_actions = file_actions;
+	args.attr = attr;
+	args.argv = argv;
+	args.envp = envp;
+	args.search = search;
+
+	// Allocate the stack of the child along with the buffers for searching for
+	// the program and the arguments for running it with the shell.
+	size_t size = SPAWN_STACK_SIZE;
+	size_t path_buffer_size = 0;
+	size_t shell_path_buffer_size = 0;
+	size_t shell_argv_size = 0;
+	if ( search )
+	{
+		const char* search_path = spawn_lookup_path(envp);
+		size_t path_length = search_path ? strlen(search_path) : 0;
+		path_buffer_size = path_length + 1 + strlen(path) + 1;
+		shell_path_buffer_size = path_length + 1 + strlen("sh") + 1;
+		size_t argc = 0;
+		while ( argv[argc] )
+			argc++;
+		if ( (SIZE_MAX - size) / sizeof(char*) - 2 < argc )
+			return ENOMEM;
+		shell_argv_size = (argc + 2) * sizeof(char*);
+		size += shell_argv_size;
+		if ( SIZE_MAX - size < path_buffer_size + shell_path_buffer_size )
+			return ENOMEM;
+		size += path_buffer_size + shell_path_buffer_size;
+	}
+	uint8_t* memory = (uint8_t*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+	                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( memory == MAP_FAILED )
+		return errno;
+	if ( search )
+	{
+		uint8_t* buffers = memory + SPAWN_STACK_SIZE;
+		args.shell_argv = (char**) buffers;
+		args.path_buffer = (char*) (buffers + shell_argv_size);
+		args.shell_path_buffer = args.path_buffer + path_buffer_size;
+	}
+
+	// The child starts with every signal blocked, so no signal handler runs
+	// in the child while it shares the memory of the parent.
+	struct tfork regs;
+	memset(&regs, 0, sizeof(regs));
+	sigset_t allset;
+	sigfillset(&allset);
+	sigprocmask(SIG_SETMASK, &allset, &args.oldset);
+	memcpy(&regs.sigmask, &allset, sizeof(regs.sigmask));
+	regs.altstack.ss_flags = SS_DISABLE;
+	spawn_setup_registers(&regs, &args, memory, SPAWN_STACK_SIZE);
+	pid_t child = tfork(SFVFORK, &regs);
+	int errnum = child < 0 ? errno : args.error;
+	sigprocmask(SIG_SETMASK, &args.oldset, NULL);
+	munmap(memory, size);
+	if ( child < 0 )
+		return errnum;
+	if ( errnum )
+	{
+		while ( waitpid(child, NULL, 0) < 0 && errno == EINTR )
+			continue;
+		return errnum;
+	}
+	if ( pid_ptr )
+		*pid_ptr = child;
+	return 0;
+}
+
+int posix_spawn(pid_t* restrict pid,
+                const char* restrict path,
+                const posix_spawn_file_actions_t* file_actions,
+                const posix_spawnattr_t* restrict attr,
+                char* const argv[restrict],
+                char* const envp[restrict])
+{
+	return __posix_spawn(pid, path, file_actions, attr, argv, envp, false);
+}
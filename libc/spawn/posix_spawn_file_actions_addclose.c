@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * spawn/posix_spawn_file_actions_addclose.c
+ * Add a close action to process spawning file actions.
+ */
+
+#include <errno.h>
+#include <spawn.h>
+#include <stddef.h>
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t* file_actions,
+                                      int fd)
+{
+	if ( fd < 0 )
+		return EBADF;
+	struct __posix_spawn_file_action action;
+	action.type = __POSIX_SPAWN_FILE_ACTION_CLOSE;
+	action.fd = fd;
+	action.newfd = -1;
+	action.oflag = 0;
+	action.mode = 0;
+	action.path = NULL;
+	return __posix_spawn_file_actions_add(file_actions, &action);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * spawn/posix_spawn_file_actions_addopen.c
+ * Add an open action to process spawning file actions.
+ */
+
+#include <errno.h>
+#include <spawn.h>
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t* restrict
+                                     file_actions,
+                                     int fd,
+                                     const char* restrict path,
+                                     int oflag,
+                                     mode_t mode)
+{
+	if ( fd < 0 )
+		return EBADF;
+	struct __posix_spawn_file_action action;
+	action.type = __POSIX_SPAWN_FILE_ACTION_OPEN;
+	action.fd = fd;
+	action.newfd = -1;
+	action.oflag = oflag;
+	action.mode = mode;
+	action.path = (char*) path;
+	return __posix_spawn_file_actions_add(file_actions, &action);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * spawn/posix_spawn_file_actions_destroy.c
+ * Destroy process spawning file actions.
+ */
+
+#include <spawn.h>
+#include <stdlib.h>
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t* file_actions)
+{
+	for ( size_t i = 0; i < file_actions->actions_used; i++ )
+		free(file_actions->actions[i].path);
+	free(file_actions->actions);
+	file_actions->actions = NULL;
+	file_actions->actions_used = 0;
+	file_actions->actions_length = 0;
+	return 0;
+}
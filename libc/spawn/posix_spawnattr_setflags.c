@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * spawn/posix_spawnattr_setflags.c
+ * Set process spawning flags.
+ */
+
+#include <errno.h>
+#include <spawn.h>
+
+int posix_spawnattr_setflags(posix_spawnattr_t* attr, short flags)
+{
+	const short supported = POSIX_SPAWN_RESETIDS | POSIX_SPAWN_SETPGROUP |
+	                        POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK |
+	                        POSIX_SPAWN_SETSID;
+	if ( flags & ~supported )
+		return EINVAL;
+	attr->flags = flags;
+	return 0;
+}
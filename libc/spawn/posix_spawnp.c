@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * spawn/posix_spawnp.c
+ * Spawn a process, searching PATH for the program.
+ */
+
+#include <spawn.h>
+#include <stdbool.h>
+
+int posix_spawnp(pid_t* restrict pid,
+                 const char* restrict file,
+                 const posix_spawn_file_actions_t* file_actions,
+                 const posix_spawnattr_t* restrict attr,
+                 char* const argv[restrict],
+                 char* const envp[restrict])
+{
+	return __posix_spawn(pid, file, file_actions, attr, argv, envp, true);
+}
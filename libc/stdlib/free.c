@@ -33,17 +33,30 @@ void free(void* addr)
 	if ( !addr )
 		return;
 
-	__heap_lock();
-	__heap_verify();
-
 	// Retrieve the chunk that contains this allocation.
 	struct heap_chunk* chunk = heap_data_to_chunk((uint8_t*) addr);
 
-	// Return the chunk to the heap.
-	heap_insert_chunk(chunk);
+#if defined(HEAP_THREAD_CACHE)
+	// Small chunks are kept in the thread cache without locking, and the
+	// cache is drained in batches to the heap when it becomes full.
+	assert(chunk->chunk_magic == HEAP_CHUNK_MAGIC);
+	if ( __atomic_load_n(&__heap_thread_cache_enabled, __ATOMIC_RELAXED) &&
+	     heap_cache_has_class(chunk->chunk_size) )
+	{
+		size_t cache_class = heap_cache_class(chunk->chunk_size);
+		if ( heap_cache_class_limit(cache_class) <=
+		     __heap_thread_cache.class_count[cache_class] )
+			__heap_thread_cache_drain(cache_class);
+		heap_cache_push(cache_class, chunk);
+		return;
+	}
+#endif
 
-	// Combine the chunk with its left and right neighbors if they are unused.
-	heap_chunk_combine_neighbors(chunk);
+	__heap_lock();
+	__heap_verify();
+
+	// Return the chunk to the heap.
+	heap_free_chunk(chunk);
 
 	__heap_verify();
 	__heap_unlock();
@@ -45,53 +45,31 @@ void* malloc(size_t original_size)
 	if ( !heap_size_has_bin(chunk_size) )
 		return errno = ENOMEM, (void*) NULL;
 
-	// Decide which bins are large enough for our allocation.
-	size_t smallest_desirable_bin = heap_bin_for_allocation(chunk_size);
-	size_t smallest_desirable_bin_size = heap_size_of_bin(smallest_desirable_bin);
-	size_t desirable_bins = ~0UL << smallest_desirable_bin;
-
-	__heap_lock();
-	__heap_verify();
-
-	// Determine whether there are any bins that we can use.
-	size_t usable_bins = desirable_bins & __heap_state.bin_filled_bitmap;
-
-	// If there are no usable bins, attempt to expand the current part of the
-	// heap or create a new part.
-	if ( !usable_bins && __heap_expand_current_part(smallest_desirable_bin_size) )
-		usable_bins = desirable_bins & __heap_state.bin_filled_bitmap;
-
-	// If we failed to expand the current part or make a new one - then we are
-	// officially out of memory until someone deallocates something.
-	if ( !usable_bins )
+#if defined(HEAP_THREAD_CACHE)
+	// Small allocations are served from the thread cache without locking,
+	// which is refilled in batches from the heap.
+	if ( __atomic_load_n(&__heap_thread_cache_enabled, __ATOMIC_RELAXED) &&
+	     heap_cache_has_class(chunk_size) )
 	{
-		__heap_verify();
-		__heap_unlock();
-		return (void*) NULL;
+		struct heap_chunk* cached_chunk;
+		if ( !(cached_chunk = heap_cache_pop(heap_cache_class(chunk_size))) &&
+		     !(cached_chunk = __heap_thread_cache_refill(chunk_size)) )
+			return (void*) NULL;
+		return heap_chunk_to_data(cached_chunk);
 	}
+#endif
 
-	// Pick the smallest of the usable bins.
-	size_t bin_index = heap_bsf(usable_bins);
-
-	// Pick the first element of this bins linked list. This is our allocation.
-	struct heap_chunk* result_chunk = __heap_state.bin[bin_index];
-	assert(result_chunk);
-	assert(HEAP_IS_POINTER_ALIGNED(result_chunk, result_chunk->chunk_size));
-
-	assert(chunk_size <= result_chunk->chunk_size);
-
-	// Mark our chosen chunk as used and remove it from its bin.
-	heap_remove_chunk(result_chunk);
+	__heap_lock();
+	__heap_verify();
 
-	// If our chunk is larger than what we really needed and it is possible to
-	// split the chunk into two, then we should split off a part of it and
-	// return it to the heap for further allocation.
-	if ( heap_can_split_chunk(result_chunk, chunk_size) )
-		heap_split_chunk(result_chunk, chunk_size);
+	struct heap_chunk* result_chunk = heap_allocate_chunk(chunk_size, true);
 
 	__heap_verify();
 	__heap_unlock();
 
+	if ( !result_chunk )
+		return (void*) NULL;
+
 	// Return the inner data associated with the chunk to the caller.
 	return heap_chunk_to_data(result_chunk);
 }
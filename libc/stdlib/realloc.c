@@ -73,7 +73,13 @@ void* realloc(void* ptr, size_t requested_size)
 	{
 		assert(requested_chunk_size <= chunk->chunk_size);
 		if ( heap_can_split_chunk(chunk, requested_chunk_size) )
+		{
 			heap_split_chunk(chunk, requested_chunk_size);
+			// The surplus must be combined with the right neighbor if it is
+			// unused, as no two neighboring chunks can be unused.
+			struct heap_chunk* surplus = heap_chunk_right(chunk);
+			heap_trim_chunk(heap_chunk_combine_neighbors(surplus));
+		}
 		__heap_verify();
 		__heap_unlock();
 		return heap_chunk_to_data(chunk);
@@ -90,6 +90,7 @@ int execvpe_attempt(const char* filename,
 //       can be shared somehow, you need to keep this comment in sync as well
 //       as the logic in these files:
 //         * kernel/process.cpp
+//         * libc/spawn/posix_spawn.c
 //         * libc/unistd/execvpe.c
 //         * utils/which.c
 
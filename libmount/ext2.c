@@ -34,7 +34,7 @@
 // These must be kept up to date with ext/extfs.cpp.
 #define EXT2_FEATURE_COMPAT_SUPPORTED 0
 #define EXT2_FEATURE_INCOMPAT_SUPPORTED \
-        (EXT2_FEATURE_INCOMPAT_FILETYPE)
+        (EXT2_FEATURE_INCOMPAT_FILETYPE | EXT4_FEATURE_INCOMPAT_EXTENTS)
 #define EXT2_FEATURE_RO_COMPAT_SUPPORTED \
         (EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
 
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * bench-loopback.c
+ * Compares the throughput and latency of TCP over loopback and Unix sockets.
+ */
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <timespec.h>
+#include <unistd.h>
+
+static size_t block_size = 65536;
+static size_t total_size = 256 * 1024 * 1024;
+static size_t round_trips = 10000;
+
+static void tcp_pair(int fds[2])
+{
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	if ( server < 0 )
+		err(1, "socket");
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(0);
+	if ( bind(server, (const struct sockaddr*) &addr, sizeof(addr)) < 0 )
+		err(1, "bind");
+	socklen_t addr_size = sizeof(addr);
+	if ( getsockname(server, (struct sockaddr*) &addr, &addr_size) < 0 )
+		err(1, "getsockname");
+	if ( listen(server, 1) < 0 )
+		err(1, "listen");
+	if ( (fds[0] = socket(AF_INET, SOCK_STREAM, 0)) < 0 )
+		err(1, "socket");
+	if ( connect(fds[0], (const struct sockaddr*) &addr, sizeof(addr)) < 0 )
+		err(1, "connect");
+	if ( (fds[1] = accept(server, NULL, NULL)) < 0 )
+		err(1, "accept");
+	close(server);
+}
+
+static void unix_pair(int fds[2])
+{
+	if ( socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0 )
+		err(1, "socketpair");
+}
+
+static uintmax_t elapsed_usecs(struct timespec begun)
+{
+	struct timespec ended;
+	clock_gettime(CLOCK_MONOTONIC, &ended);
+	struct timespec elapsed = timespec_sub(ended, begun);
+	uintmax_t usecs = (uintmax_t) elapsed.tv_sec * 1000000 +
+	                  (uintmax_t) elapsed.tv_nsec / 1000;
+	return usecs ? usecs : 1;
+}
+
+static void read_exactly(int fd, unsigned char* buffer, size_t size)
+{
+	for ( size_t sofar = 0; sofar < size; )
+	{
+		ssize_t amount = read(fd, buffer + sofar, size - sofar);
+		if ( amount < 0 )
+			err(1, "read");
+		if ( amount == 0 )
+			errx(1, "read: Unexpected end of file");
+		sofar += amount;
+	}
+}
+
+static void write_exactly(int fd, const unsigned char* buffer, size_t size)
+{
+	for ( size_t sofar = 0; sofar < size; )
+	{
+		ssize_t amount = write(fd, buffer + sofar, size - sofar);
+		if ( amount < 0 )
+			err(1, "write");
+		sofar += amount;
+	}
+}
+
+static void bench(const char* name, void (*make_pair)(int[2]))
+{
+	int fds[2];
+	make_pair(fds);
+	unsigned char* buffer = malloc(block_size);
+	if ( !buffer )
+		err(1, "malloc");
+	memset(buffer, 'x', block_size);
+
+	// Stream data in one direction as fast as possible.
+	struct timespec begun;
+	clock_gettime(CLOCK_MONOTONIC, &begun);
+	pid_t child = fork();
+	if ( child < 0 )
+		err(1, "fork");
+	if ( !child )
+	{
+		close(fds[1]);
+		for ( size_t done = 0; done < total_size; done += block_size )
+			write_exactly(fds[0], buffer, block_size);
+		_exit(0);
+	}
+	size_t received = 0;
+	while ( received < total_size )
+	{
+		ssize_t amount = read(fds[1], buffer, block_size);
+		if ( amount < 0 )
+			err(1, "read");
+		if ( amount == 0 )
+			errx(1, "read: Unexpected end of file");
+		received += amount;
+	}
+	uintmax_t stream_usecs = elapsed_usecs(begun);
+	waitpid(child, NULL, 0);
+
+	// Bounce a single byte back and forth.
+	clock_gettime(CLOCK_MONOTONIC, &begun);
+	if ( (child = fork()) < 0 )
+		err(1, "fork");
+	if ( !child )
+	{
+		for ( size_t i = 0; i < round_trips; i++ )
+		{
+			read_exactly(fds[0], buffer, 1);
+			write_exactly(fds[0], buffer, 1);
+		}
+		_exit(0);
+	}
+	for ( size_t i = 0; i < round_trips; i++ )
+	{
+		write_exactly(fds[1], buffer, 1);
+		read_exactly(fds[1], buffer, 1);
+	}
+	uintmax_t bounce_usecs = elapsed_usecs(begun);
+	waitpid(child, NULL, 0);
+
+	uintmax_t mib_per_second =
+		(uintmax_t) total_size * 1000000 / stream_usecs / (1024 * 1024);
+	uintmax_t round_trips_per_second =
+		(uintmax_t) round_trips * 1000000 / bounce_usecs;
+	printf("%-7s %12ju %16ju\n", name, mib_per_second, round_trips_per_second);
+	fflush(stdout);
+
+	free(buffer);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while ( (opt = getopt(argc, argv, "b:n:r:")) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'b': block_size = strtoul(optarg, NULL, 10); break;
+		case 'n': total_size = strtoul(optarg, NULL, 10) * 1024 * 1024; break;
+		case 'r': round_trips = strtoul(optarg, NULL, 10); break;
+		default: return 1;
+		}
+	}
+	if ( optind < argc )
+		errx(1, "extra operand: %s", argv[optind]);
+	if ( !block_size || !total_size || !round_trips )
+		errx(1, "invalid arguments");
+	total_size -= total_size % block_size;
+	if ( !total_size )
+		errx(1, "invalid arguments");
+
+	printf("%-7s %12s %16s\n", "socket", "MiB/s", "round trips/s");
+	bench("tcp", tcp_pair);
+	bench("unix", unix_pair);
+	return 0;
+}
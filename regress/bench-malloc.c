@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * bench-malloc.c
+ * Measures how many allocations per second threads can make concurrently.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <timespec.h>
+#include <unistd.h>
+
+#define SLOTS 256
+
+struct worker
+{
+	pthread_t thread;
+	uintmax_t allocations;
+	unsigned int seed;
+};
+
+static size_t max_size = 256;
+static volatile bool stop;
+
+static void* work(void* ctx)
+{
+	struct worker* worker = (struct worker*) ctx;
+	void* slots[SLOTS] = { NULL };
+	uintmax_t allocations = 0;
+	unsigned int seed = worker->seed;
+	while ( !stop )
+	{
+		// Keep a changing working set of live allocations of varying sizes,
+		// like a real program would, rather than freeing right away.
+		for ( size_t i = 0; i < SLOTS; i++ )
+		{
+			seed = seed * 1103515245 + 12345;
+			size_t slot = (seed >> 8) % SLOTS;
+			size_t size = 1 + (seed >> 16) % max_size;
+			free(slots[slot]);
+			if ( !(slots[slot] = malloc(size)) )
+				err(1, "malloc");
+			*(volatile char*) slots[slot] = 0;
+			allocations++;
+		}
+	}
+	for ( size_t i = 0; i < SLOTS; i++ )
+		free(slots[i]);
+	worker->allocations = allocations;
+	return NULL;
+}
+
+static uintmax_t measure(struct worker* workers, size_t count,
+                         unsigned int duration)
+{
+	stop = false;
+	struct timespec begun;
+	clock_gettime(CLOCK_MONOTONIC, &begun);
+	for ( size_t i = 0; i < count; i++ )
+	{
+		workers[i].seed = i + 1;
+		if ( (errno = pthread_create(&workers[i].thread, NULL, work,
+		                             &workers[i])) )
+			err(1, "pthread_create");
+	}
+	sleep(duration);
+	stop = true;
+	uintmax_t total = 0;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].allocations;
+	}
+	struct timespec ended;
+	clock_gettime(CLOCK_MONOTONIC, &ended);
+	struct timespec elapsed = timespec_sub(ended, begun);
+	uintmax_t usecs = (uintmax_t) elapsed.tv_sec * 1000000 +
+	                  (uintmax_t) elapsed.tv_nsec / 1000;
+	if ( !usecs )
+		usecs = 1;
+	return total * 1000000 / usecs;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int duration = 1;
+	size_t max_threads = 16;
+	int opt;
+	while ( (opt = getopt(argc, argv, "d:s:t:")) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'd': duration = strtoul(optarg, NULL, 10); break;
+		case 's': max_size = strtoul(optarg, NULL, 10); break;
+		case 't': max_threads = strtoul(optarg, NULL, 10); break;
+		default: return 1;
+		}
+	}
+	if ( optind < argc )
+		errx(1, "extra operand: %s", argv[optind]);
+	if ( !duration || !max_size || !max_threads )
+		errx(1, "invalid arguments");
+
+	struct worker* workers = calloc(max_threads, sizeof(struct worker));
+	if ( !workers )
+		err(1, "malloc");
+
+	// The baseline is the allocator without the thread caches, where every
+	// allocation and deallocation takes the heap lock.
+	printf("%7s %16s %16s %16s %8s\n", "threads", "allocs/s",
+	       "allocs/s/thread", "baseline/s", "speedup");
+	size_t count = 1;
+	while ( true )
+	{
+		if ( !mallopt(M_THREAD_CACHE, 1) )
+			err(1, "mallopt: M_THREAD_CACHE");
+		uintmax_t per_second = measure(workers, count, duration);
+		if ( !mallopt(M_THREAD_CACHE, 0) )
+			err(1, "mallopt: M_THREAD_CACHE");
+		uintmax_t baseline = measure(workers, count, duration);
+		if ( !baseline )
+			baseline = 1;
+		uintmax_t speedup = per_second * 10 / baseline;
+		printf("%7zu %16ju %16ju %16ju %5ju.%jux\n", count, per_second,
+		       per_second / count, baseline, speedup / 10, speedup % 10);
+		fflush(stdout);
+		if ( count == max_threads )
+			break;
+		count = count <= max_threads / 2 ? count * 2 : max_threads;
+	}
+
+	free(workers);
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-madvise.c
+ * Tests whether discarded pages read as zero afterwards.
+ */
+
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <malloc.h>
+#include <memusage.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define PAGES 4
+#define HEAP_PAGES 1024
+
+static size_t userspace_memory(void)
+{
+	size_t statistic = MEMUSAGE_PURPOSE_USERSPACE;
+	size_t value;
+	test_assert(memusage(&statistic, &value, 1) == 0);
+	return value;
+}
+
+int main(void)
+{
+	size_t page_size = getpagesize();
+	size_t size = PAGES * page_size;
+	unsigned char* map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	test_assert(map != MAP_FAILED);
+	memset(map, 'X', size);
+
+	// Discarded anonymous pages must be zero when accessed again, both by the
+	// process and by the kernel, and the other pages must remain.
+	test_assert(madvise(map + page_size, 2 * page_size, MADV_DONTNEED) == 0);
+	for ( size_t i = 0; i < page_size; i++ )
+		test_assertx(map[i] == 'X');
+	for ( size_t i = page_size; i < 2 * page_size; i++ )
+		test_assertx(map[i] == 0);
+	int pipes[2];
+	test_assert(pipe(pipes) == 0);
+	test_assert(write(pipes[1], map + 2 * page_size, 16) == 16);
+	unsigned char copied[16];
+	test_assert(read(pipes[0], copied, 16) == 16);
+	for ( size_t i = 0; i < 16; i++ )
+		test_assertx(copied[i] == 0);
+	for ( size_t i = 3 * page_size; i < size; i++ )
+		test_assertx(map[i] == 'X');
+
+	// The pages must be usable again after being discarded.
+	map[page_size] = 'Y';
+	test_assertx(map[page_size] == 'Y');
+
+	// Advice is rejected for unknown advice and memory that isn't mapped.
+	test_assert(madvise(map, page_size, -1) < 0 && errno == EINVAL);
+	test_assert(munmap(map + page_size, page_size) == 0);
+	test_assert(madvise(map, size, MADV_DONTNEED) < 0 && errno == ENOMEM);
+	test_assertx(map[0] == 'X');
+
+	// The heap returns large unused chunks to the kernel, also when they are
+	// kept in place by a chunk after them, and can use them again.
+	size_t heap_size = HEAP_PAGES * page_size;
+	unsigned char* buffer = malloc(heap_size);
+	test_assert(buffer);
+	unsigned char* after = malloc(16);
+	test_assert(after);
+	memset(buffer, 'Z', heap_size);
+	size_t before_free = userspace_memory();
+	free(buffer);
+	size_t after_free = userspace_memory();
+	test_assertx(after_free < before_free);
+	test_assertx(heap_size / 2 <= before_free - after_free);
+	buffer = malloc(heap_size);
+	test_assert(buffer);
+	memset(buffer, 'Z', heap_size);
+	for ( size_t i = 0; i < heap_size; i += page_size )
+		test_assertx(buffer[i] == 'Z');
+	free(buffer);
+	free(after);
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-mmap-file.c
+ * Tests whether private file mappings are loaded correctly on demand.
+ */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define PAGES 4
+
+static unsigned char expected(size_t offset)
+{
+	return (unsigned char) (offset * 7 + offset / 4096);
+}
+
+int main(void)
+{
+	size_t page_size = getpagesize();
+	size_t file_size = (PAGES - 1) * page_size + page_size / 2;
+	char path[] = "/tmp/test-mmap-file.XXXXXX";
+	int fd = mkstemp(path);
+	test_assert(0 <= fd);
+	test_assert(unlink(path) == 0);
+	unsigned char* buffer = malloc(file_size);
+	test_assert(buffer);
+	for ( size_t i = 0; i < file_size; i++ )
+		buffer[i] = expected(i);
+	test_assert(write(fd, buffer, file_size) == (ssize_t) file_size);
+
+	size_t map_size = PAGES * page_size;
+	unsigned char* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+	                          MAP_PRIVATE, fd, 0);
+	test_assert(map != MAP_FAILED);
+
+	// The kernel must load pages not yet accessed when copying from them.
+	int pipes[2];
+	test_assert(pipe(pipes) == 0);
+	test_assert(write(pipes[1], map + page_size, 16) == 16);
+	unsigned char copied[16];
+	test_assert(read(pipes[0], copied, 16) == 16);
+	for ( size_t i = 0; i < 16; i++ )
+		test_assertx(copied[i] == expected(page_size + i));
+
+	// The kernel must load pages not yet accessed when copying to them.
+	unsigned char replacement[16];
+	memset(replacement, 'X', sizeof(replacement));
+	test_assert(write(pipes[1], replacement, 16) == 16);
+	test_assert(read(pipes[0], map + 2 * page_size, 16) == 16);
+	test_assertx(!memcmp(map + 2 * page_size, replacement, 16));
+	test_assertx(map[2 * page_size + 16] == expected(2 * page_size + 16));
+
+	// The contents must match the file, and the end must be zero filled.
+	for ( size_t i = 16; i < file_size; i++ )
+		if ( i < 2 * page_size || 2 * page_size + 16 <= i )
+			test_assertx(map[i] == expected(i));
+	for ( size_t i = file_size; i < map_size; i++ )
+		test_assertx(map[i] == 0);
+
+	// Writes to a private mapping must not reach the file.
+	map[0] = ~expected(0);
+	unsigned char first;
+	test_assert(pread(fd, &first, 1, 0) == 1);
+	test_assertx(first == expected(0));
+
+	// Split the mapping and make sure the remainder still loads correctly.
+	unsigned char* other = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	test_assert(other != MAP_FAILED);
+	test_assert(munmap(other + page_size, page_size) == 0);
+	test_assertx(other[2 * page_size + 1] == expected(2 * page_size + 1));
+
+	// Forked children must see the parent's view of the mapping, including
+	// pages that haven't been loaded yet.
+	pid_t child = fork();
+	test_assert(0 <= child);
+	if ( child == 0 )
+	{
+		if ( map[0] != (unsigned char) ~expected(0) )
+			_exit(1);
+		if ( other[3 * page_size] != expected(3 * page_size) )
+			_exit(1);
+		map[1] = 0;
+		_exit(0);
+	}
+	int status;
+	test_assert(waitpid(child, &status, 0) == child);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	test_assertx(map[1] == expected(1));
+
+	// Pages that weren't loaded before the file was rewritten are loaded with
+	// the current contents, while the pages already loaded keep the old
+	// contents.
+	unsigned char* stale = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	test_assert(stale != MAP_FAILED);
+	test_assertx(stale[0] == expected(0));
+	memset(buffer, 'Y', page_size);
+	test_assert(pwrite(fd, buffer, page_size, page_size) ==
+	            (ssize_t) page_size);
+	test_assert(ftruncate(fd, file_size + 1) == 0);
+	test_assertx(stale[0] == expected(0));
+	test_assertx(stale[page_size] == 'Y');
+	test_assertx(stale[file_size] == 0);
+
+	// Pages past the end of the file can't be loaded.
+	test_assert(ftruncate(fd, page_size + page_size / 2) == 0);
+	test_assertx(stale[page_size + page_size / 2 - 1] == 'Y');
+	test_assertx(write(pipes[1], stale + 2 * page_size, 16) < 0);
+	test_assertx(errno == EIO);
+	child = fork();
+	test_assert(0 <= child);
+	if ( child == 0 )
+	{
+		volatile unsigned char* byte = stale + 2 * page_size;
+		(void) *byte;
+		_exit(0);
+	}
+	test_assert(waitpid(child, &status, 0) == child);
+	test_assertx(WIFSIGNALED(status) && WTERMSIG(status) == SIGBUS);
+
+	test_assert(munmap(map, map_size) == 0);
+	test_assert(munmap(other, map_size) == 0);
+	test_assert(munmap(stale, map_size) == 0);
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-mmap-shared.c
+ * Tests whether shared file mappings are written back to the file.
+ */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define PAGES 2
+
+int main(void)
+{
+	size_t page_size = getpagesize();
+	size_t file_size = PAGES * page_size;
+	char path[] = "/tmp/test-mmap-shared.XXXXXX";
+	int fd = mkstemp(path);
+	test_assert(0 <= fd);
+	int rdonly = open(path, O_RDONLY);
+	test_assert(0 <= rdonly);
+	test_assert(unlink(path) == 0);
+	test_assert(ftruncate(fd, file_size) == 0);
+
+	unsigned char* map = mmap(NULL, file_size, PROT_READ | PROT_WRITE,
+	                          MAP_SHARED, fd, 0);
+	test_assert(map != MAP_FAILED);
+	unsigned char* other = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+	test_assert(other != MAP_FAILED);
+
+	// Writes through the mapping must be seen by the other mappings and reach
+	// the file after msync.
+	map[0] = 'A';
+	test_assertx(other[0] == 'A');
+	test_assert(msync(map, page_size, MS_SYNC) == 0);
+	unsigned char byte;
+	test_assert(pread(fd, &byte, 1, 0) == 1);
+	test_assertx(byte == 'A');
+
+	// Writes to the file must be seen by the mappings.
+	test_assert(pwrite(fd, "B", 1, page_size) == 1);
+	test_assertx(map[page_size] == 'B');
+	test_assert(pwrite(fd, "C", 1, page_size) == 1);
+	test_assertx(other[page_size] == 'C');
+
+	// Forked children must share the mapping with the parent.
+	pid_t child = fork();
+	test_assert(0 <= child);
+	if ( child == 0 )
+	{
+		map[1] = 'D';
+		_exit(0);
+	}
+	int status;
+	test_assert(waitpid(child, &status, 0) == child);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	test_assertx(map[1] == 'D');
+	test_assert(pread(fd, &byte, 1, 1) == 1);
+	test_assertx(byte == 'D');
+
+	// Unmapping must write the changes back.
+	map[2] = 'E';
+	test_assert(munmap(map, file_size) == 0);
+	test_assert(pread(fd, &byte, 1, 2) == 1);
+	test_assertx(byte == 'E');
+	test_assertx(other[2] == 'E');
+
+	// Shared mappings of files not open for writing can't be writable.
+	test_assertx(mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                  rdonly, 0) == MAP_FAILED);
+	test_assertx(errno == EACCES);
+	unsigned char* readonly = mmap(NULL, file_size, PROT_READ, MAP_SHARED,
+	                               rdonly, 0);
+	test_assert(readonly != MAP_FAILED);
+	test_assertx(readonly[2] == 'E');
+	test_assertx(mprotect(readonly, file_size, PROT_READ | PROT_WRITE) < 0);
+	test_assertx(errno == EACCES);
+
+	test_assert(munmap(readonly, file_size) == 0);
+	test_assert(munmap(other, file_size) == 0);
+	close(rdonly);
+	close(fd);
+
+	return 0;
+}
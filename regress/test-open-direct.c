@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-open-direct.c
+ * Tests whether O_DIRECT is kept on descriptors and transfers data intact.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define PAGES 4
+
+// Compare reads from a block device with and without O_DIRECT, which lets the
+// disk transfer the aligned whole blocks straight into the buffer, while the
+// misaligned parts still go through the driver's bounce buffer. The disk is
+// only read, as it might hold a filesystem in use.
+static void test_block_device(size_t size)
+{
+	DIR* dir = opendir("/dev");
+	if ( !dir )
+		return;
+	int fd = -1;
+	int direct_fd = -1;
+	struct dirent* entry;
+	while ( fd < 0 && (entry = readdir(dir)) )
+	{
+		fd = openat(dirfd(dir), entry->d_name, O_RDONLY);
+		if ( fd < 0 )
+			continue;
+		struct stat st;
+		if ( fstat(fd, &st) < 0 || !S_ISBLK(st.st_mode) ||
+		     (off_t) (2 * size) > st.st_size ||
+		     (direct_fd = openat(dirfd(dir), entry->d_name,
+		                         O_RDONLY | O_DIRECT)) < 0 )
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	closedir(dir);
+	if ( fd < 0 )
+		return;
+
+	unsigned char* map = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+	                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	test_assert(map != MAP_FAILED);
+	unsigned char* expected = map;
+	unsigned char* buffer = map + size;
+	test_assert(pread(fd, expected, size, 0) == (ssize_t) size);
+	test_assert(pread(direct_fd, buffer, size, 0) == (ssize_t) size);
+	test_assertx(!memcmp(buffer, expected, size));
+	memset(buffer, 0, size);
+	test_assert(pread(direct_fd, buffer + 1, 3000, 0) == 3000);
+	test_assertx(!memcmp(buffer + 1, expected, 3000));
+	memset(buffer, 0, size);
+	test_assert(pread(direct_fd, buffer, size - 512 - 3, 512) ==
+	            (ssize_t) (size - 512 - 3));
+	test_assertx(!memcmp(buffer, expected + 512, size - 512 - 3));
+	memset(buffer, 0, size);
+	test_assert(pread(direct_fd, buffer, 1000, 3) == 1000);
+	test_assertx(!memcmp(buffer, expected + 3, 1000));
+
+	close(direct_fd);
+	close(fd);
+	munmap(map, 2 * size);
+}
+
+int main(void)
+{
+	size_t page_size = getpagesize();
+	size_t size = PAGES * page_size;
+	char path[] = "/tmp/test-open-direct.XXXXXX";
+	int fd = mkstemp(path);
+	test_assert(0 <= fd);
+	close(fd);
+
+	// The flag is kept on the descriptor and can be changed later.
+	fd = open(path, O_RDWR | O_DIRECT);
+	test_assert(0 <= fd);
+	test_assert(unlink(path) == 0);
+	int flags = fcntl(fd, F_GETFL);
+	test_assert(0 <= flags);
+	test_assertx(flags & O_DIRECT);
+	test_assert(fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0);
+	test_assertx(!(fcntl(fd, F_GETFL) & O_DIRECT));
+	test_assert(fcntl(fd, F_SETFL, flags) == 0);
+	test_assertx(fcntl(fd, F_GETFL) & O_DIRECT);
+
+	// Page aligned and misaligned transfers must both be intact.
+	unsigned char* map = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+	                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	test_assert(map != MAP_FAILED);
+	for ( size_t i = 0; i < size; i++ )
+		map[i] = (unsigned char) (i * 7 + i / 509);
+	test_assert(pwrite(fd, map, size, 0) == (ssize_t) size);
+	test_assert(pwrite(fd, map + 1, 1000, size) == 1000);
+	unsigned char* copy = map + size;
+	test_assert(pread(fd, copy, size, 0) == (ssize_t) size);
+	test_assertx(!memcmp(copy, map, size));
+	test_assert(pread(fd, copy + 3, 1000, size) == 1000);
+	test_assertx(!memcmp(copy + 3, map + 1, 1000));
+
+	close(fd);
+	munmap(map, 2 * size);
+
+	test_block_device(size);
+
+	return 0;
+}
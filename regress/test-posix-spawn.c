@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-posix-spawn.c
+ * Tests whether posix_spawn runs programs and applies file actions.
+ */
+
+#include <sys/wait.h>
+
+#include <spawn.h>
+#include <unistd.h>
+
+#include "test.h"
+
+extern char** environ;
+
+int main(void)
+{
+	pid_t pid;
+	int status;
+
+	char* false_argv[] = { (char*) "false", NULL };
+	test_assertp(posix_spawnp(&pid, "false", NULL, NULL, false_argv, environ));
+	test_assert(waitpid(pid, &status, 0) == pid);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+
+	char* missing_argv[] = { (char*) "missing", NULL };
+	test_assertx(posix_spawn(&pid, "/nonexistent/missing", NULL, NULL,
+	                         missing_argv, environ) == ENOENT);
+
+	int fds[2];
+	test_assert(pipe(fds) == 0);
+	posix_spawn_file_actions_t file_actions;
+	test_assertp(posix_spawn_file_actions_init(&file_actions));
+	test_assertp(posix_spawn_file_actions_adddup2(&file_actions, fds[1], 1));
+	test_assertp(posix_spawn_file_actions_addclose(&file_actions, fds[0]));
+	test_assertp(posix_spawn_file_actions_addclose(&file_actions, fds[1]));
+	char* echo_argv[] = { (char*) "echo", (char*) "spawned", NULL };
+	test_assertp(posix_spawnp(&pid, "echo", &file_actions, NULL, echo_argv,
+	                          environ));
+	test_assertp(posix_spawn_file_actions_destroy(&file_actions));
+	close(fds[1]);
+	char output[32];
+	size_t output_used = 0;
+	ssize_t amount;
+	while ( 0 < (amount = read(fds[0], output + output_used,
+	                           sizeof(output) - 1 - output_used)) )
+		output_used += amount;
+	test_assert(0 <= amount);
+	output[output_used] = '\0';
+	close(fds[0]);
+	test_assert(waitpid(pid, &status, 0) == pid);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	test_assertx(!strcmp(output, "spawned\n"));
+
+	return 0;
+}
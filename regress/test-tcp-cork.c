@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-tcp-cork.c
+ * Tests whether TCP sockets coalesce small writes and deliver them correctly.
+ */
+
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "test.h"
+
+static int get_option(int fd, int name)
+{
+	int value;
+	socklen_t size = sizeof(value);
+	test_assert(getsockopt(fd, IPPROTO_TCP, name, &value, &size) == 0);
+	return value;
+}
+
+static void set_option(int fd, int name, int value)
+{
+	test_assert(setsockopt(fd, IPPROTO_TCP, name, &value,
+	                       sizeof(value)) == 0);
+}
+
+static void receive_exactly(int fd, const char* expected, size_t size)
+{
+	char buffer[64];
+	test_assertx(size <= sizeof(buffer));
+	size_t sofar = 0;
+	while ( sofar < size )
+	{
+		ssize_t amount = recv(fd, buffer + sofar, size - sofar, 0);
+		test_assert(0 < amount);
+		sofar += amount;
+	}
+	test_assertx(!memcmp(buffer, expected, size));
+}
+
+static void receive_nothing(int fd)
+{
+	// Give the data a chance to arrive if it was wrongly sent.
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	test_assert(poll(&pfd, 1, 100) == 0);
+	char c;
+	test_assert(recv(fd, &c, 1, MSG_DONTWAIT) < 0);
+	test_assertx(errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int main(void)
+{
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	test_assert(0 <= server);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(0);
+	test_assert(bind(server, (const struct sockaddr*) &addr,
+	                 sizeof(addr)) == 0);
+	socklen_t addr_size = sizeof(addr);
+	test_assert(getsockname(server, (struct sockaddr*) &addr,
+	                        &addr_size) == 0);
+	test_assert(listen(server, 1) == 0);
+
+	int client = socket(AF_INET, SOCK_STREAM, 0);
+	test_assert(0 <= client);
+	test_assertx(get_option(client, TCP_NODELAY) == 0);
+	test_assertx(get_option(client, TCP_CORK) == 0);
+	test_assert(connect(client, (const struct sockaddr*) &addr,
+	                    sizeof(addr)) == 0);
+	int peer = accept(server, NULL, NULL);
+	test_assert(0 <= peer);
+
+	// Small writes must arrive in order while being coalesced.
+	for ( size_t i = 0; i < 8; i++ )
+		test_assert(send(client, "ab", 2, 0) == 2);
+	receive_exactly(peer, "abababababababab", 16);
+
+	// Data held back by MSG_MORE must be sent with the next send.
+	test_assert(send(client, "head", 4, MSG_MORE) == 4);
+	receive_nothing(peer);
+	test_assert(send(client, "tail", 4, 0) == 4);
+	receive_exactly(peer, "headtail", 8);
+
+	// Data held back by TCP_CORK must be sent when uncorked.
+	set_option(client, TCP_CORK, 1);
+	test_assertx(get_option(client, TCP_CORK) == 1);
+	test_assert(send(client, "corked", 6, 0) == 6);
+	receive_nothing(peer);
+	set_option(client, TCP_CORK, 0);
+	receive_exactly(peer, "corked", 6);
+
+	set_option(client, TCP_NODELAY, 1);
+	test_assertx(get_option(client, TCP_NODELAY) == 1);
+	for ( size_t i = 0; i < 4; i++ )
+	{
+		test_assert(send(client, "x", 1, 0) == 1);
+		receive_exactly(peer, "x", 1);
+	}
+
+	// The data held back by TCP_CORK must be sent when shut down.
+	set_option(client, TCP_CORK, 1);
+	test_assert(send(client, "last", 4, 0) == 4);
+	receive_nothing(peer);
+	test_assert(shutdown(client, SHUT_WR) == 0);
+	receive_exactly(peer, "last", 4);
+	char c;
+	test_assert(recv(peer, &c, 1, 0) == 0);
+
+	close(peer);
+	close(client);
+	close(server);
+
+	return 0;
+}
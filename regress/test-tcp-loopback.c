@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-tcp-loopback.c
+ * Tests whether large amounts of data are delivered intact over loopback.
+ */
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define TOTAL (4 * 1024 * 1024)
+
+static unsigned char pattern(size_t offset)
+{
+	return (unsigned char) (offset * 7 + offset / 251);
+}
+
+int main(void)
+{
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	test_assert(0 <= server);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(0);
+	test_assert(bind(server, (const struct sockaddr*) &addr,
+	                 sizeof(addr)) == 0);
+	socklen_t addr_size = sizeof(addr);
+	test_assert(getsockname(server, (struct sockaddr*) &addr,
+	                        &addr_size) == 0);
+	test_assert(listen(server, 1) == 0);
+
+	int client = socket(AF_INET, SOCK_STREAM, 0);
+	test_assert(0 <= client);
+	test_assert(connect(client, (const struct sockaddr*) &addr,
+	                    sizeof(addr)) == 0);
+	int peer = accept(server, NULL, NULL);
+	test_assert(0 <= peer);
+	close(server);
+
+	// Send writes of varying sizes so segments of all sizes are made.
+	pid_t child = fork();
+	test_assert(0 <= child);
+	if ( !child )
+	{
+		close(peer);
+		unsigned char buffer[65536 + 1000];
+		size_t offset = 0;
+		for ( size_t i = 0; offset < TOTAL; i++ )
+		{
+			size_t size = (i * 4099) % sizeof(buffer) + 1;
+			if ( TOTAL - offset < size )
+				size = TOTAL - offset;
+			for ( size_t n = 0; n < size; n++ )
+				buffer[n] = pattern(offset + n);
+			for ( size_t sofar = 0; sofar < size; )
+			{
+				ssize_t amount = send(client, buffer + sofar, size - sofar, 0);
+				test_assert(0 < amount);
+				sofar += amount;
+			}
+			offset += size;
+		}
+		test_assert(shutdown(client, SHUT_WR) == 0);
+		_exit(0);
+	}
+	close(client);
+
+	unsigned char buffer[32768];
+	size_t offset = 0;
+	while ( true )
+	{
+		ssize_t amount = recv(peer, buffer, sizeof(buffer), 0);
+		test_assert(0 <= amount);
+		if ( amount == 0 )
+			break;
+		test_assertx(offset + amount <= TOTAL);
+		for ( ssize_t n = 0; n < amount; n++ )
+			test_assertx(buffer[n] == pattern(offset + n));
+		offset += amount;
+	}
+	test_assertx(offset == TOTAL);
+	int status;
+	test_assert(waitpid(child, &status, 0) == child);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	close(peer);
+
+	return 0;
+}
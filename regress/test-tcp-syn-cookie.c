@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-tcp-syn-cookie.c
+ * Tests whether TCP connections are established when the listen queue is full.
+ */
+
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define CLIENTS 4
+
+int main(void)
+{
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	test_assert(0 <= server);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(0);
+	test_assert(bind(server, (const struct sockaddr*) &addr,
+	                 sizeof(addr)) == 0);
+	socklen_t addr_size = sizeof(addr);
+	test_assert(getsockname(server, (struct sockaddr*) &addr,
+	                        &addr_size) == 0);
+	test_assert(listen(server, 1) == 0);
+
+	// Connections beyond the first don't fit in the listen queue and must be
+	// answered with SYN cookies.
+	int clients[CLIENTS];
+	for ( size_t i = 0; i < CLIENTS; i++ )
+	{
+		clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+		test_assert(0 <= clients[i]);
+		test_assert(connect(clients[i], (const struct sockaddr*) &addr,
+		                    sizeof(addr)) == 0);
+		char c = 'a' + i;
+		test_assert(send(clients[i], &c, 1, 0) == 1);
+	}
+
+	// Every connection must be accepted once there is room in the listen
+	// queue, as the data is retransmitted along with the acknowledgement.
+	bool seen[CLIENTS] = { false };
+	for ( size_t i = 0; i < CLIENTS; i++ )
+	{
+		int peer = accept(server, NULL, NULL);
+		test_assert(0 <= peer);
+		char c;
+		test_assert(recv(peer, &c, 1, 0) == 1);
+		test_assertx('a' <= c && c < 'a' + CLIENTS);
+		test_assertx(!seen[c - 'a']);
+		seen[c - 'a'] = true;
+		close(peer);
+	}
+
+	for ( size_t i = 0; i < CLIENTS; i++ )
+		close(clients[i]);
+	close(server);
+
+	return 0;
+}
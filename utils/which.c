@@ -33,6 +33,7 @@
 //       can be shared somehow, you need to keep this comment in sync as well
 //       as the logic in these files:
 //         * kernel/process.cpp
+//         * libc/spawn/posix_spawn.c
 //         * libc/unistd/execvpe.c
 //         * utils/which.c
 // NOTE: See comments in execvpe() for algorithmic commentary.